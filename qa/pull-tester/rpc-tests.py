@@ -65,6 +65,9 @@ BASE_SCRIPTS= [
     'proxy_test.py',
     'signrawtransactions.py',
     'nodehandling.py',
+    'addressindex.py',
+    'socketevents.py',
+    'utxo_snapshot.py',
     'decodescript.py',
     'blockchain.py',
     'disablewallet.py',
@@ -83,6 +86,7 @@ BASE_SCRIPTS= [
     'rpcnamedargs.py',
     'listsinceblock.py',
     'p2p-leaktests.py',
+    'wallet-shutdown.py',
 ]
 
 ZMQ_SCRIPTS = [
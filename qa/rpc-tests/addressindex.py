@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the address index and its RPC and REST interfaces.
+
+- getaddressutxos and getaddresshistory follow blocks being connected and disconnected.
+- /rest/address/utxos and /rest/address/history return the same data.
+- The index is in step with the chain after a clean restart and after the node is killed.
+- A node without -addressindex refuses the calls.
+"""
+
+import http.client
+import json
+import urllib.parse
+from decimal import Decimal
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+from test_framework.mininode import CTransaction, CTxIn, CTxOut, COutPoint, COIN
+from test_framework.script import CScript, OP_TRUE, OP_DROP, hash160, OP_HASH160, OP_EQUAL
+from test_framework.address import script_to_p2sh
+
+# Anyone can spend the outputs of these P2SH scripts
+REDEEM_SCRIPT = CScript([OP_TRUE])
+DEST_REDEEM_SCRIPT = CScript([OP_DROP, OP_TRUE])
+ADDRESS = script_to_p2sh(REDEEM_SCRIPT)
+DEST_SCRIPT_HEX = bytes_to_hex_str(CScript([OP_HASH160, hash160(DEST_REDEEM_SCRIPT), OP_EQUAL]))
+
+def http_get_json(url, path):
+    conn = http.client.HTTPConnection(url.hostname, url.port)
+    conn.request('GET', path)
+    response = conn.getresponse()
+    assert_equal(response.status, 200)
+    return json.loads(response.read().decode('utf-8'), parse_float=Decimal)
+
+class AddressIndexTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [['-addressindex', '-rest'], []]
+
+    def setup_network(self):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, self.extra_args)
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+
+    def spend(self, utxo, value):
+        tx = CTransaction()
+        tx.vin.append(CTxIn(COutPoint(int(utxo['txid'], 16), utxo['vout']), CScript([REDEEM_SCRIPT])))
+        tx.vout.append(CTxOut(int(value * COIN), hex_str_to_bytes(DEST_SCRIPT_HEX)))
+        return self.nodes[1].sendrawtransaction(bytes_to_hex_str(tx.serialize()))
+
+    def check_consistent(self, node):
+        utxos = node.getaddressutxos(ADDRESS)
+        assert_equal(len(utxos), node.getblockcount() - len(node.getaddresshistory(DEST_SCRIPT_HEX)))
+        for utxo in utxos:
+            txout = node.gettxout(utxo['txid'], utxo['vout'])
+            assert_equal(txout['value'], utxo['amount'])
+            assert_equal(txout['confirmations'], utxo['confirmations'])
+
+    def run_test(self):
+        node = self.nodes[0]
+        url = urllib.parse.urlparse(node.url)
+
+        self.log.info("Index coinbase outputs")
+        node.generatetoaddress(101, ADDRESS)
+        utxos = node.getaddressutxos(ADDRESS)
+        assert_equal(len(utxos), 101)
+        first = [u for u in utxos if u['height'] == 1][0]
+        assert(first['coinbase'])
+        assert_equal(first['confirmations'], 101)
+        assert_equal(first['amount'], Decimal('50'))
+        history = node.getaddresshistory(ADDRESS)
+        assert_equal(len(history), 101)
+        assert_equal([h['height'] for h in history], list(range(1, 102)))
+        assert(all(not h['spending'] for h in history))
+        assert_equal(len(node.getaddresshistory(ADDRESS, 10, 19)), 10)
+        assert_raises_jsonrpc(-8, "Invalid height range", node.getaddresshistory, ADDRESS, 20, 10)
+
+        self.log.info("Index a spend")
+        sync_blocks(self.nodes)
+        txid = self.spend(first, Decimal('49.999'))
+        sync_mempools(self.nodes)
+        spend_hash = node.generatetoaddress(1, ADDRESS)[0]
+        dest = node.getaddressutxos(DEST_SCRIPT_HEX)
+        assert_equal(len(dest), 1)
+        assert_equal(dest[0]['txid'], txid)
+        assert_equal(dest[0]['amount'], Decimal('49.999'))
+        assert(not dest[0]['coinbase'])
+        utxos = node.getaddressutxos(ADDRESS)
+        assert_equal(len(utxos), 101)
+        assert(all(u['txid'] != first['txid'] for u in utxos))
+        spent = node.getaddresshistory(ADDRESS, 102)
+        assert_equal(len(spent), 2)
+        spending = [h for h in spent if h['spending']][0]
+        assert_equal(spending['txid'], txid)
+        assert_equal(spending['amount'], Decimal('-50'))
+        assert_equal(spending['blockhash'], spend_hash)
+
+        self.log.info("Query through REST")
+        rest_utxos = http_get_json(url, '/rest/address/utxos/' + ADDRESS + '.json')
+        assert_equal(rest_utxos['chainHeight'], 102)
+        assert_equal(rest_utxos['chaintipHash'], spend_hash)
+        assert_equal(rest_utxos['utxos'], node.getaddressutxos(ADDRESS))
+        assert_equal(http_get_json(url, '/rest/address/history/' + DEST_SCRIPT_HEX + '.json'), node.getaddresshistory(DEST_SCRIPT_HEX))
+
+        self.log.info("Roll back on disconnect")
+        node.invalidateblock(spend_hash)
+        assert_equal(node.getaddressutxos(DEST_SCRIPT_HEX), [])
+        assert_equal(len(node.getaddressutxos(ADDRESS)), 101)
+        assert_equal(len(node.getaddresshistory(ADDRESS)), 101)
+        node.reconsiderblock(spend_hash)
+        assert_equal(len(node.getaddressutxos(DEST_SCRIPT_HEX)), 1)
+        self.check_consistent(node)
+
+        self.log.info("Keep the index across restarts")
+        stop_node(node, 0)
+        self.nodes[0] = node = start_node(0, self.options.tmpdir, self.extra_args[0])
+        self.check_consistent(node)
+        assert_equal(len(node.getaddressutxos(DEST_SCRIPT_HEX)), 1)
+
+        # Killing the node loses the index changes since the last block index
+        # write along with the blocks themselves; they are indexed again when
+        # the blocks are synced from the peer
+        connect_nodes_bi(self.nodes, 0, 1)
+        node.generatetoaddress(20, ADDRESS)
+        sync_blocks(self.nodes)
+        bitcoind_processes[0].kill()
+        bitcoind_processes[0].wait(timeout=BITCOIND_PROC_WAIT_TIMEOUT)
+        del bitcoind_processes[0]
+        self.nodes[0] = node = start_node(0, self.options.tmpdir, self.extra_args[0])
+        connect_nodes_bi(self.nodes, 0, 1)
+        sync_blocks(self.nodes)
+        self.check_consistent(node)
+        assert_equal(len(node.getaddresshistory(ADDRESS)), node.getblockcount() + 1)
+
+        self.log.info("Refuse the calls without -addressindex")
+        assert_raises_jsonrpc(-1, "-addressindex", self.nodes[1].getaddressutxos, ADDRESS)
+        assert_raises_jsonrpc(-1, "-addressindex", self.nodes[1].getaddresshistory, ADDRESS)
+
+if __name__ == '__main__':
+    AddressIndexTest().main()
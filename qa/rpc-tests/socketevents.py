@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the socket event backends selected with -socketevents.
+
+- Nodes using epoll relay blocks to each other and to a node using select.
+- A disconnected peer is forgotten and can connect again.
+- A restarted peer is served again, possibly on a reused socket number.
+- An unknown mode is refused at startup.
+"""
+
+import platform
+import time
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+ADDRESS = 'mjTkW3DjgyZck4KbiRusZsqTgaYTxdSz6z'
+
+class SocketEventsTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 3
+        self.epoll = platform.system() == 'Linux'
+        mode = 'epoll' if self.epoll else 'select'
+        self.extra_args = [['-socketevents=' + mode], ['-socketevents=' + mode], ['-socketevents=select']]
+
+    def setup_network(self):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, self.extra_args)
+        connect_nodes_bi(self.nodes, 0, 1)
+        connect_nodes_bi(self.nodes, 1, 2)
+        connect_nodes_bi(self.nodes, 0, 2)
+        self.is_network_split = False
+
+    def peer_addr(self, i):
+        return '127.0.0.1:' + str(p2p_port(i))
+
+    def run_test(self):
+        if not self.epoll:
+            self.log.info("epoll is not available on this platform, testing select only")
+
+        self.log.info("Relay blocks between the backends")
+        self.nodes[0].generatetoaddress(150, ADDRESS)
+        sync_blocks(self.nodes)
+        self.nodes[2].generatetoaddress(50, ADDRESS)
+        sync_blocks(self.nodes)
+        assert_equal(self.nodes[1].getblockcount(), 200)
+        for node in self.nodes:
+            peers = node.getpeerinfo()
+            assert_equal(len(peers), 4)
+            for peer in peers:
+                assert(peer['bytesrecv'] > 0)
+                assert(peer['bytessent'] > 0)
+
+        self.log.info("Disconnect and reconnect a peer")
+        self.nodes[0].disconnectnode(self.peer_addr(1))
+        wait_until(lambda: all(peer['addr'] != self.peer_addr(1) for peer in self.nodes[0].getpeerinfo()), timeout=10)
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.nodes[1].generatetoaddress(10, ADDRESS)
+        sync_blocks(self.nodes)
+
+        self.log.info("Restart a peer")
+        stop_node(self.nodes[1], 1)
+        self.nodes[0].generatetoaddress(10, ADDRESS)
+        sync_blocks([self.nodes[0], self.nodes[2]])
+        self.nodes[1] = start_node(1, self.options.tmpdir, self.extra_args[1])
+        connect_nodes_bi(self.nodes, 0, 1)
+        connect_nodes_bi(self.nodes, 1, 2)
+        sync_blocks(self.nodes)
+        self.nodes[1].generatetoaddress(10, ADDRESS)
+        sync_blocks(self.nodes)
+        assert_equal(self.nodes[2].getblockcount(), 230)
+
+        self.log.info("Refuse an unknown mode")
+        stop_node(self.nodes[2], 2)
+        assert_start_raises_init_error(2, self.options.tmpdir, ['-socketevents=poll'], "Invalid -socketevents ('poll') specified")
+        self.nodes[2] = start_node(2, self.options.tmpdir, self.extra_args[2])
+
+def wait_until(predicate, *, timeout):
+    deadline = time.time() + timeout
+    while not predicate():
+        assert(time.time() < deadline)
+        time.sleep(0.1)
+
+if __name__ == '__main__':
+    SocketEventsTest().main()
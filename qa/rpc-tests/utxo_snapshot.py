@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test starting from a UTXO snapshot and validating it in the background.
+
+- A node started with -loadsnapshot downloads the blocks below the snapshot base,
+  validates them, and advertises NODE_NETWORK once the snapshot is confirmed.
+- The result survives a restart.
+- A snapshot that does not match the chain shuts the node down, and it refuses
+  to start again without -reindex.
+"""
+
+import os
+import shutil
+import struct
+import time
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+ADDRESS = "mneYUmWYsuk7kySiURxCi3AGxrAqZxLgPZ"
+NODE_NETWORK = 1
+# Offset of nChainTx in the snapshot header: magic, version, message start, base hash
+NCHAINTX_OFFSET = 5 + 2 + 4 + 32
+
+class UTXOSnapshotTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 3
+
+    def setup_network(self):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir)
+        self.is_network_split = False
+
+    def local_services(self, node):
+        return int(node.getnetworkinfo()['localservices'], 16)
+
+    def wait_for_shutdown(self, i, timeout=60):
+        deadline = time.time() + timeout
+        while bitcoind_processes[i].poll() is None:
+            assert time.time() < deadline, "node%d did not shut down" % i
+            time.sleep(0.2)
+        del bitcoind_processes[i]
+
+    def run_test(self):
+        self.nodes[0].generatetoaddress(150, ADDRESS)
+        snapshot = self.nodes[0].dumptxoutset("snapshot.dat")
+        assert_equal(snapshot['base_height'], 150)
+        self.nodes[0].generatetoaddress(10, ADDRESS)
+
+        self.log.info("Load the snapshot and validate it in the background")
+        stop_node(self.nodes[1], 1)
+        self.nodes[1] = start_node(1, self.options.tmpdir, ["-loadsnapshot=" + snapshot['path'], "-assumeutxo=" + snapshot['hash_serialized']])
+        assert_equal(self.nodes[1].getblockcount(), 150)
+        assert_equal(self.local_services(self.nodes[1]) & NODE_NETWORK, 0)
+        connect_nodes_bi(self.nodes, 0, 1)
+        sync_blocks(self.nodes[0:2])
+        deadline = time.time() + 60
+        while not self.local_services(self.nodes[1]) & NODE_NETWORK:
+            assert time.time() < deadline, "snapshot was not validated"
+            time.sleep(0.5)
+        # Blocks below the base are available now
+        assert_equal(self.nodes[1].getblock(self.nodes[1].getblockhash(1))['height'], 1)
+        assert_equal(self.nodes[1].gettxoutsetinfo()['hash_serialized'], self.nodes[0].gettxoutsetinfo()['hash_serialized'])
+        assert not os.path.exists(os.path.join(self.options.tmpdir, "node1", "regtest", "chainstate_snapshot"))
+
+        self.log.info("The validated snapshot stays validated across a restart")
+        stop_node(self.nodes[1], 1)
+        self.nodes[1] = start_node(1, self.options.tmpdir)
+        assert_equal(self.local_services(self.nodes[1]) & NODE_NETWORK, NODE_NETWORK)
+        assert_equal(self.nodes[1].getblockcount(), 160)
+
+        self.log.info("A snapshot that does not match the chain is rejected")
+        bad_path = os.path.join(self.options.tmpdir, "bad_snapshot.dat")
+        shutil.copyfile(snapshot['path'], bad_path)
+        with open(bad_path, 'r+b') as f:
+            f.seek(NCHAINTX_OFFSET)
+            nchaintx = struct.unpack("<Q", f.read(8))[0]
+            f.seek(NCHAINTX_OFFSET)
+            f.write(struct.pack("<Q", nchaintx + 1))
+        stop_node(self.nodes[2], 2)
+        self.nodes[2] = start_node(2, self.options.tmpdir, ["-loadsnapshot=" + bad_path, "-assumeutxo=" + snapshot['hash_serialized']])
+        connect_nodes(self.nodes[2], 0)
+        self.wait_for_shutdown(2)
+        assert_start_raises_init_error(2, self.options.tmpdir, [], "UTXO snapshot this chainstate was loaded from is invalid")
+        self.nodes[2] = start_node(2, self.options.tmpdir, ["-reindex"])
+        connect_nodes(self.nodes[2], 0)
+        sync_blocks([self.nodes[0], self.nodes[2]])
+        assert_equal(self.local_services(self.nodes[2]) & NODE_NETWORK, NODE_NETWORK)
+
+if __name__ == '__main__':
+    UTXOSnapshotTest().main()
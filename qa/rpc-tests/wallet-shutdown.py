@@ -0,0 +1,47 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test that the wallet is up to date with the chain after a clean shutdown.
+
+Wallet notifications are delivered from the scheduler thread. The best block
+written by the final chainstate flush must still reach the wallet before its
+database is closed, so that the next start does not have to rescan.
+"""
+
+import os
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+class WalletShutdownTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir)
+        self.is_network_split = False
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.generate(101)
+        txid = node.sendtoaddress(node.getnewaddress(), 1)
+        node.generate(1)
+        tip = node.getbestblockhash()
+
+        self.log.info("Restart the node and check the wallet did not need a rescan")
+        stop_node(node, 0)
+        debug_log = os.path.join(self.options.tmpdir, "node0", "regtest", "debug.log")
+        log_size = os.path.getsize(debug_log)
+        self.nodes[0] = start_node(0, self.options.tmpdir)
+        assert_equal(self.nodes[0].getbestblockhash(), tip)
+        with open(debug_log, encoding='utf-8') as f:
+            f.seek(log_size)
+            assert("Rescanning last" not in f.read())
+        assert_equal(self.nodes[0].gettransaction(txid)["confirmations"], 1)
+
+if __name__ == '__main__':
+    WalletShutdownTest().main()
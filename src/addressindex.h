@@ -0,0 +1,120 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "crypto/sha256.h"
+#include "script/script.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <tuple>
+
+/** The key under which -addressindex stores everything paying to a scriptPubKey */
+inline uint256 GetScriptHash(const CScript& script)
+{
+    uint256 hash;
+    CSHA256().Write(script.data(), script.size()).Finalize(hash.begin());
+    return hash;
+}
+
+/**
+ * One entry in the history of a script: an output paying to it, or an input
+ * spending such an output. The height is stored big-endian so that a
+ * database scan over one script returns its history in block order.
+ */
+struct CAddressIndexKey {
+    uint256 scriptHash;
+    int nHeight;
+    uint256 txhash;
+    uint32_t nIndex; //!< vout index for outputs, vin index for spends
+    bool fSpending;
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        scriptHash.Serialize(s);
+        ser_writedata32be(s, nHeight);
+        txhash.Serialize(s);
+        ser_writedata32(s, nIndex);
+        ser_writedata8(s, fSpending);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        scriptHash.Unserialize(s);
+        nHeight = ser_readdata32be(s);
+        txhash.Unserialize(s);
+        nIndex = ser_readdata32(s);
+        fSpending = ser_readdata8(s);
+    }
+
+    CAddressIndexKey(const uint256& scriptHashIn, int nHeightIn, const uint256& txhashIn, uint32_t nIndexIn, bool fSpendingIn) :
+        scriptHash(scriptHashIn), nHeight(nHeightIn), txhash(txhashIn), nIndex(nIndexIn), fSpending(fSpendingIn) {}
+
+    CAddressIndexKey() : nHeight(0), nIndex(0), fSpending(false) {}
+
+    friend bool operator<(const CAddressIndexKey& a, const CAddressIndexKey& b) {
+        return std::tie(a.scriptHash, a.nHeight, a.txhash, a.nIndex, a.fSpending) < std::tie(b.scriptHash, b.nHeight, b.txhash, b.nIndex, b.fSpending);
+    }
+};
+
+/** An unspent output paying to a script, keyed so that one script's outputs are adjacent */
+struct CAddressUnspentKey {
+    uint256 scriptHash;
+    uint256 txhash;
+    uint32_t n;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(scriptHash);
+        READWRITE(txhash);
+        READWRITE(n);
+    }
+
+    CAddressUnspentKey(const uint256& scriptHashIn, const uint256& txhashIn, uint32_t nIn) :
+        scriptHash(scriptHashIn), txhash(txhashIn), n(nIn) {}
+
+    CAddressUnspentKey() : n(0) {}
+
+    friend bool operator<(const CAddressUnspentKey& a, const CAddressUnspentKey& b) {
+        return std::tie(a.scriptHash, a.txhash, a.n) < std::tie(b.scriptHash, b.txhash, b.n);
+    }
+};
+
+struct CAddressUnspentValue {
+    CAmount nValue;
+    CScript script;
+    int nHeight;
+    bool fCoinBase;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nValue);
+        READWRITE(*(CScriptBase*)(&script));
+        READWRITE(nHeight);
+        READWRITE(fCoinBase);
+    }
+
+    CAddressUnspentValue(CAmount nValueIn, const CScript& scriptIn, int nHeightIn, bool fCoinBaseIn) :
+        nValue(nValueIn), script(scriptIn), nHeight(nHeightIn), fCoinBase(fCoinBaseIn) {}
+
+    CAddressUnspentValue() { SetNull(); }
+
+    //! A null value in an index update erases the entry
+    void SetNull() {
+        nValue = -1;
+        script.clear();
+        nHeight = 0;
+        fCoinBase = false;
+    }
+
+    bool IsNull() const { return nValue == -1; }
+};
+
+#endif // BITCOIN_ADDRESSINDEX_H
@@ -5,10 +5,13 @@
 #include "bench.h"
 #include "coins.h"
 #include "policy/policy.h"
+#include "random.h"
 #include "wallet/crypter.h"
 
 #include <vector>
 
+#include <boost/unordered_map.hpp>
+
 // FIXME: Dedup with SetupDummyInputs in test/transaction_tests.cpp.
 //
 // Helper: create two dummy transactions, each with
@@ -35,14 +38,14 @@ SetupDummyInputs(CBasicKeyStore& keystoreRet, CCoinsViewCache& coinsRet)
     dummyTransactions[0].vout[0].scriptPubKey << ToByteVector(key[0].GetPubKey()) << OP_CHECKSIG;
     dummyTransactions[0].vout[1].nValue = 50 * CENT;
     dummyTransactions[0].vout[1].scriptPubKey << ToByteVector(key[1].GetPubKey()) << OP_CHECKSIG;
-    coinsRet.ModifyCoins(dummyTransactions[0].GetHash())->FromTx(dummyTransactions[0], 0);
+    AddCoins(coinsRet, dummyTransactions[0], 0);
 
     dummyTransactions[1].vout.resize(2);
     dummyTransactions[1].vout[0].nValue = 21 * CENT;
     dummyTransactions[1].vout[0].scriptPubKey = GetScriptForDestination(key[2].GetPubKey().GetID());
     dummyTransactions[1].vout[1].nValue = 22 * CENT;
     dummyTransactions[1].vout[1].scriptPubKey = GetScriptForDestination(key[3].GetPubKey().GetID());
-    coinsRet.ModifyCoins(dummyTransactions[1].GetHash())->FromTx(dummyTransactions[1], 0);
+    AddCoins(coinsRet, dummyTransactions[1], 0);
 
     return dummyTransactions;
 }
@@ -85,3 +88,87 @@ static void CCoinsCaching(benchmark::State& state)
 }
 
 BENCHMARK(CCoinsCaching);
+
+static const size_t N_BENCH_COINS = 50000;
+
+static std::vector<COutPoint> BenchOutpoints()
+{
+    std::vector<COutPoint> outpoints;
+    outpoints.reserve(N_BENCH_COINS);
+    for (size_t i = 0; i < N_BENCH_COINS / 2; i++) {
+        uint256 txid = GetRandHash();
+        outpoints.push_back(COutPoint(txid, 0));
+        outpoints.push_back(COutPoint(txid, 1));
+    }
+    return outpoints;
+}
+
+// Insert, look up and erase many entries in a coins map, as connecting blocks
+// does with the UTXO cache. Run against the current CCoinsMap and against the
+// boost::unordered_map it replaced.
+template <typename Map>
+static void CoinsMapInsertFindErase(benchmark::State& state)
+{
+    const std::vector<COutPoint> outpoints = BenchOutpoints();
+    CScript script = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    while (state.KeepRunning()) {
+        Map map;
+        for (const COutPoint& outpoint : outpoints) {
+            map.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(Coin(CTxOut(CENT, script), 1, false)));
+        }
+        for (const COutPoint& outpoint : outpoints) {
+            assert(map.find(outpoint) != map.end());
+        }
+        for (const COutPoint& outpoint : outpoints) {
+            COutPoint missing(outpoint.hash, 2);
+            assert(map.find(missing) == map.end());
+        }
+        for (typename Map::iterator it = map.begin(); it != map.end(); ) {
+            typename Map::iterator itOld = it++;
+            map.erase(itOld);
+        }
+    }
+}
+
+static void CoinsMapOpenHash(benchmark::State& state)
+{
+    CoinsMapInsertFindErase<CCoinsMap>(state);
+}
+
+static void CoinsMapBoostUnordered(benchmark::State& state)
+{
+    CoinsMapInsertFindErase<boost::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> >(state);
+}
+
+// Add, access and spend coins through a CCoinsViewCache layered on another
+// cache, and flush the result, as ConnectBlock does with the view on pcoinsTip.
+static void CCoinsViewCacheAddSpendFlush(benchmark::State& state)
+{
+    const std::vector<COutPoint> outpoints = BenchOutpoints();
+    CScript script = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    while (state.KeepRunning()) {
+        CCoinsView coinsDummy;
+        CCoinsViewCache base(&coinsDummy);
+        for (size_t i = 0; i < outpoints.size(); i += 2) {
+            base.AddCoin(outpoints[i], Coin(CTxOut(CENT, script), 1, false), false);
+        }
+
+        CCoinsViewCache view(&base);
+        for (size_t i = 0; i < outpoints.size(); i++) {
+            if (i % 2 == 0) {
+                assert(!view.AccessCoin(outpoints[i]).IsSpent());
+                view.SpendCoin(outpoints[i]);
+            } else {
+                view.AddCoin(outpoints[i], Coin(CTxOut(CENT, script), 2, false), false);
+            }
+        }
+        view.Flush();
+        assert(base.GetCacheSize() == outpoints.size() / 2);
+    }
+}
+
+BENCHMARK(CoinsMapOpenHash);
+BENCHMARK(CoinsMapBoostUnordered);
+BENCHMARK(CCoinsViewCacheAddSpendFlush);
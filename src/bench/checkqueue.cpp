@@ -99,5 +99,65 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.interrupt_all();
     tg.join_all();
 }
+
+// The benchmarks below compare the work-stealing CCheckQueue against the
+// single-mutex CSingleLockCheckQueue at fixed thread counts, using checks
+// that each do a small, fixed amount of work (roughly the order of a cached
+// signature lookup) so that scaling with the number of threads is visible.
+struct FakeJobLightWork {
+    uint32_t seed {1};
+    bool operator()()
+    {
+        uint32_t x = seed;
+        for (int i = 0; i < 256; i++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+        }
+        return x != 0;
+    }
+    void swap(FakeJobLightWork& x) { std::swap(seed, x.seed); };
+};
+
+template <typename Queue>
+static void CCheckQueueThreads(benchmark::State& state, int nThreads)
+{
+    Queue queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    // The master thread takes part in verification too.
+    for (auto x = 0; x < nThreads - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<FakeJobLightWork, Queue> control(&queue);
+        for (size_t b = 0; b < BATCHES; ++b) {
+            std::vector<FakeJobLightWork> vChecks(BATCH_SIZE);
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+#define CHECKQUEUE_THREADS_BENCHMARK(n) \
+    static void CCheckQueueWorkStealing_##n##Threads(benchmark::State& state) \
+    { \
+        CCheckQueueThreads<CCheckQueue<FakeJobLightWork>>(state, n); \
+    } \
+    static void CCheckQueueSingleLock_##n##Threads(benchmark::State& state) \
+    { \
+        CCheckQueueThreads<CSingleLockCheckQueue<FakeJobLightWork>>(state, n); \
+    } \
+    BENCHMARK(CCheckQueueWorkStealing_##n##Threads); \
+    BENCHMARK(CCheckQueueSingleLock_##n##Threads);
+
+CHECKQUEUE_THREADS_BENCHMARK(1)
+CHECKQUEUE_THREADS_BENCHMARK(2)
+CHECKQUEUE_THREADS_BENCHMARK(4)
+CHECKQUEUE_THREADS_BENCHMARK(8)
+CHECKQUEUE_THREADS_BENCHMARK(16)
+CHECKQUEUE_THREADS_BENCHMARK(32)
+
 BENCHMARK(CCheckQueueSpeed);
 BENCHMARK(CCheckQueueSpeedPrevectorJob);
@@ -41,6 +41,25 @@ static void SHA256(benchmark::State& state)
         CSHA256().Write(in.data(), in.size()).Finalize(hash);
 }
 
+static void SHA256Backend(benchmark::State& state, sha256_implementation::UseImplementation use, const std::string& name)
+{
+    // Skip backends this CPU or build does not support, rather than timing the fallback.
+    if (SHA256AutoDetect(use).compare(0, name.size(), name) != 0) {
+        SHA256AutoDetect();
+        return;
+    }
+    uint8_t hash[CSHA256::OUTPUT_SIZE];
+    std::vector<uint8_t> in(BUFFER_SIZE,0);
+    while (state.KeepRunning())
+        CSHA256().Write(in.data(), in.size()).Finalize(hash);
+    SHA256AutoDetect();
+}
+
+static void SHA256_standard(benchmark::State& state) { SHA256Backend(state, sha256_implementation::STANDARD, "standard"); }
+static void SHA256_sse4(benchmark::State& state) { SHA256Backend(state, sha256_implementation::USE_SSE4, "sse4"); }
+static void SHA256_avx2(benchmark::State& state) { SHA256Backend(state, sha256_implementation::USE_AVX2, "avx2"); }
+static void SHA256_shani(benchmark::State& state) { SHA256Backend(state, sha256_implementation::USE_SHANI, "shani"); }
+
 static void SHA256_32b(benchmark::State& state)
 {
     std::vector<uint8_t> in(32,0);
@@ -51,6 +70,14 @@ static void SHA256_32b(benchmark::State& state)
     }
 }
 
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning()) {
+        SHA256D64(in.data(), in.data(), 1024);
+    }
+}
+
 static void SHA512(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
@@ -74,5 +101,11 @@ BENCHMARK(SHA1);
 BENCHMARK(SHA256);
 BENCHMARK(SHA512);
 
+BENCHMARK(SHA256_standard);
+BENCHMARK(SHA256_sse4);
+BENCHMARK(SHA256_avx2);
+BENCHMARK(SHA256_shani);
+
 BENCHMARK(SHA256_32b);
+BENCHMARK(SHA256D64_1024);
 BENCHMARK(SipHash_32b);
@@ -5,6 +5,7 @@
 #include "bench.h"
 #include "policy/policy.h"
 #include "txmempool.h"
+#include "validation.h"
 
 #include <list>
 #include <vector>
@@ -112,3 +113,40 @@ static void MempoolEviction(benchmark::State& state)
 }
 
 BENCHMARK(MempoolEviction);
+
+// Walk the ancestors of every entry in a mempool made of long chains of
+// dependent transactions, which is what CalculateMemPoolAncestors spends its
+// time on during block assembly and when removing confirmed transactions.
+static void MempoolAncestors(benchmark::State& state)
+{
+    const int nChains = 100;
+    const int nChainLength = DEFAULT_ANCESTOR_LIMIT;
+
+    CTxMemPool pool;
+    std::vector<uint256> vHashes;
+    for (int i = 0; i < nChains; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << i;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = 10 * COIN;
+        for (int j = 0; j < nChainLength; j++) {
+            AddTx(tx, 1000LL, pool);
+            vHashes.push_back(tx.GetHash());
+            tx.vin[0].prevout = COutPoint(tx.GetHash(), 0);
+        }
+    }
+
+    const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    while (state.KeepRunning()) {
+        for (const uint256& hash : vHashes) {
+            CTxMemPool::setEntries setAncestors;
+            LOCK(pool.cs);
+            pool.CalculateMemPoolAncestors(*pool.mapTx.find(hash), setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        }
+    }
+}
+
+BENCHMARK(MempoolAncestors);
@@ -30,6 +30,12 @@ struct CCheckpointData {
     MapCheckpoints mapCheckpoints;
 };
 
+/**
+ * Trusted UTXO snapshots: base block hash -> hash_serialized of the UTXO set at that block.
+ * Empty on every network until entries have been through review; -assumeutxo supplies the hash meanwhile.
+ */
+typedef std::map<uint256, uint256> MapAssumeUTXO;
+
 struct ChainTxData {
     int64_t nTime;
     int64_t nTxCount;
@@ -75,6 +81,7 @@ public:
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
     const ChainTxData& TxData() const { return chainTxData; }
+    const MapAssumeUTXO& AssumeUTXO() const { return mapAssumeUTXO; }
 protected:
     CChainParams() {}
 
@@ -92,6 +99,7 @@ protected:
     bool fMineBlocksOnDemand;
     CCheckpointData checkpointData;
     ChainTxData chainTxData;
+    MapAssumeUTXO mapAssumeUTXO;
 };
 
 /**
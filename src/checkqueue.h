@@ -6,6 +6,10 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -13,10 +17,120 @@
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
 
+/**
+ * Lock-free double-ended queue of pointers (Chase-Lev).
+ *
+ * A single owner thread pushes and pops at the bottom, any other thread may
+ * steal from the top. The buffer grows on demand; replaced buffers are kept
+ * alive until destruction because a concurrent thief may still be reading
+ * from them. Their total size is bounded by the size of the live buffer.
+ */
 template <typename T>
-class CCheckQueueControl;
+class CWorkStealingDeque
+{
+private:
+    struct Buffer {
+        const int64_t nSize;
+        std::unique_ptr<std::atomic<T*>[]> items;
 
-/** 
+        explicit Buffer(int64_t nSizeIn) : nSize(nSizeIn), items(new std::atomic<T*>[nSizeIn]) {}
+        T* Get(int64_t i) const { return items[i & (nSize - 1)].load(std::memory_order_relaxed); }
+        void Put(int64_t i, T* x) { items[i & (nSize - 1)].store(x, std::memory_order_relaxed); }
+    };
+
+    std::atomic<int64_t> top;
+    std::atomic<int64_t> bottom;
+    std::atomic<Buffer*> buffer;
+    //! Every buffer ever allocated; only touched by the owner.
+    std::vector<std::unique_ptr<Buffer>> vBuffers;
+
+public:
+    enum StealResult {
+        STEAL_OK,
+        STEAL_EMPTY,
+        STEAL_ABORT, //!< Lost a race against another thread; items may remain.
+    };
+
+    explicit CWorkStealingDeque(int64_t nInitialSize = 64) : top(0), bottom(0)
+    {
+        vBuffers.emplace_back(new Buffer(nInitialSize));
+        buffer.store(vBuffers.back().get(), std::memory_order_relaxed);
+    }
+
+    CWorkStealingDeque(const CWorkStealingDeque&) = delete;
+    CWorkStealingDeque& operator=(const CWorkStealingDeque&) = delete;
+
+    //! Approximate number of queued items.
+    int64_t Size() const
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+    //! Owner only.
+    void Push(T* x)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Buffer* a = buffer.load(std::memory_order_relaxed);
+        if (b - t > a->nSize - 1) {
+            vBuffers.emplace_back(new Buffer(a->nSize * 2));
+            Buffer* grown = vBuffers.back().get();
+            for (int64_t i = t; i < b; i++) {
+                grown->Put(i, a->Get(i));
+            }
+            buffer.store(grown, std::memory_order_release);
+            a = grown;
+        }
+        a->Put(b, x);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    //! Owner only. Returns nullptr when empty.
+    T* Pop()
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Buffer* a = buffer.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        T* x = nullptr;
+        if (t <= b) {
+            x = a->Get(b);
+            if (t == b) {
+                // Last item: race against thieves for it.
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    x = nullptr;
+                }
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        } else {
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return x;
+    }
+
+    //! Any thread.
+    StealResult Steal(T*& x)
+    {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return STEAL_EMPTY;
+        }
+        Buffer* a = buffer.load(std::memory_order_acquire);
+        x = a->Get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return STEAL_ABORT;
+        }
+        return STEAL_OK;
+    }
+};
+
+/**
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
@@ -25,10 +139,232 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every participant owns a CWorkStealingDeque. The master pushes onto its
+  * own deque; an idle worker steals a batch from a random victim into its own
+  * deque and works through it, where it can in turn be stolen by others. The
+  * mutex and condition variables are only used to put idle threads to sleep
+  * and wake them up, never on the path of an individual check.
   */
 template <typename T>
 class CCheckQueue
 {
+private:
+    //! Maximum number of participants with their own deque (slot 0 is the master).
+    static const int MAX_SLOTS = 128;
+
+    //! Number of fruitless sweeps over all deques before an idle thread sleeps.
+    static const int IDLE_SPINS = 64;
+
+    //! Per-participant deques; slot 0 belongs to whichever thread holds ControlMutex.
+    std::unique_ptr<CWorkStealingDeque<T>[]> vDeques;
+
+    //! Number of registered worker threads.
+    std::atomic<int> nWorkers;
+
+    //! The checks handed over by Add(); they stay in place until Wait() returns.
+    std::deque<std::vector<T>> vBatches;
+
+    /**
+     * Number of verifications that haven't completed yet. A check only
+     * counts as completed once it has been run and destroyed.
+     */
+    std::atomic<unsigned int> nTodo;
+
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
+
+    //! Bumped whenever new work becomes available, so sleepers can detect it.
+    std::atomic<uint64_t> nEpoch;
+
+    //! Number of threads that are (about to be) blocked on a condition variable.
+    std::atomic<int> nSleeping;
+
+    //! Protects sleeping and waking; never held while running checks.
+    boost::mutex mutex;
+
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+
+    //! Master thread blocks on this when waiting for the last checks to finish
+    boost::condition_variable condMaster;
+
+    //! The maximum number of elements to be stolen in one batch
+    unsigned int nBatchSize;
+
+    void NotifyWork()
+    {
+        nEpoch.fetch_add(1, std::memory_order_seq_cst);
+        if (nSleeping.load(std::memory_order_seq_cst) > 0) {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            condWorker.notify_all();
+        }
+    }
+
+    //! Run one check, release it and account for it.
+    void Execute(T* check)
+    {
+        if (fAllOk.load(std::memory_order_relaxed) && !(*check)()) {
+            fAllOk.store(false, std::memory_order_relaxed);
+        }
+        {
+            T tmp;
+            check->swap(tmp);
+        }
+        if (nTodo.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            // We processed the last element; inform the master it can exit and return the result
+            boost::lock_guard<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+        }
+    }
+
+    /**
+     * Steal work from the other participants. Returns one check to run right
+     * away; any further stolen checks are pushed onto own. fContended is set
+     * when a steal lost a race, meaning work may still be available.
+     */
+    T* StealWork(int nSelf, CWorkStealingDeque<T>* own, uint32_t& rng, bool& fContended)
+    {
+        const int nSlots = std::min(nWorkers.load(std::memory_order_acquire) + 1, MAX_SLOTS);
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        const int nStart = rng % nSlots;
+        for (int i = 0; i < nSlots; i++) {
+            const int nVictim = (nStart + i) % nSlots;
+            if (nVictim == nSelf)
+                continue;
+            CWorkStealingDeque<T>& victim = vDeques[nVictim];
+            T* first = nullptr;
+            typename CWorkStealingDeque<T>::StealResult res = victim.Steal(first);
+            if (res == CWorkStealingDeque<T>::STEAL_ABORT)
+                fContended = true;
+            if (res != CWorkStealingDeque<T>::STEAL_OK)
+                continue;
+            if (own) {
+                // Aim for increasingly smaller batches so all participants
+                // finish approximately simultaneously.
+                int64_t nMore = std::min<int64_t>(nBatchSize, victim.Size() / (nSlots + 1));
+                int64_t nStolen = 0;
+                T* x = nullptr;
+                while (nStolen < nMore && victim.Steal(x) == CWorkStealingDeque<T>::STEAL_OK) {
+                    own->Push(x);
+                    nStolen++;
+                }
+                if (nStolen)
+                    NotifyWork();
+            }
+            return first;
+        }
+        return nullptr;
+    }
+
+    void Sleep(bool fMaster, uint64_t nSeenEpoch)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nSleeping.fetch_add(1, std::memory_order_seq_cst);
+        try {
+            if (fMaster) {
+                // Whatever is left is being run by workers.
+                while (nTodo.load(std::memory_order_seq_cst) != 0)
+                    condMaster.wait(lock);
+            } else {
+                while (nEpoch.load(std::memory_order_seq_cst) == nSeenEpoch)
+                    condWorker.wait(lock);
+            }
+        } catch (...) {
+            // Thread interruption
+            nSleeping.fetch_sub(1, std::memory_order_seq_cst);
+            throw;
+        }
+        nSleeping.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    /** Internal function that does bulk of the verification work. */
+    bool Loop(bool fMaster = false)
+    {
+        const int nSelf = fMaster ? 0 : nWorkers.fetch_add(1, std::memory_order_acq_rel) + 1;
+        // Threads beyond MAX_SLOTS still help, one stolen check at a time.
+        CWorkStealingDeque<T>* own = nSelf < MAX_SLOTS ? &vDeques[nSelf] : nullptr;
+        uint32_t rng = 0x9E3779B9u * (nSelf + 1);
+        int nIdleSpins = 0;
+        while (true) {
+            const uint64_t nSeenEpoch = nEpoch.load(std::memory_order_seq_cst);
+            T* check = own ? own->Pop() : nullptr;
+            bool fContended = false;
+            if (!check)
+                check = StealWork(nSelf, own, rng, fContended);
+            if (check) {
+                Execute(check);
+                nIdleSpins = 0;
+                continue;
+            }
+            if (fMaster && nTodo.load(std::memory_order_acquire) == 0)
+                break;
+            if (fContended || ++nIdleSpins < IDLE_SPINS) {
+                std::this_thread::yield();
+                continue;
+            }
+            nIdleSpins = 0;
+            Sleep(fMaster, nSeenEpoch);
+        }
+        // Every check has been run and destroyed; drop the emptied storage.
+        vBatches.clear();
+        bool fRet = fAllOk.load(std::memory_order_acquire);
+        // reset the status for new work later
+        fAllOk.store(true, std::memory_order_relaxed);
+        return fRet;
+    }
+
+public:
+    //! Mutex to ensure only one concurrent CCheckQueueControl
+    boost::mutex ControlMutex;
+
+    //! Create a new check queue
+    CCheckQueue(unsigned int nBatchSizeIn) : vDeques(new CWorkStealingDeque<T>[MAX_SLOTS]), nWorkers(0), nTodo(0), fAllOk(true), nEpoch(0), nSleeping(0), nBatchSize(nBatchSizeIn) {}
+
+    //! Worker thread
+    void Thread()
+    {
+        Loop();
+    }
+
+    //! Wait until execution finishes, and return whether all evaluations were successful.
+    bool Wait()
+    {
+        return Loop(true);
+    }
+
+    //! Add a batch of checks to the queue
+    void Add(std::vector<T>& vChecks)
+    {
+        if (vChecks.empty())
+            return;
+        // Take over the caller's vector instead of swapping checks one by one.
+        vBatches.emplace_back();
+        vBatches.back().swap(vChecks);
+        std::vector<T>& batch = vBatches.back();
+        nTodo.fetch_add(batch.size(), std::memory_order_relaxed);
+        for (T& check : batch)
+            vDeques[0].Push(&check);
+        NotifyWork();
+    }
+
+    ~CCheckQueue()
+    {
+    }
+
+};
+
+/**
+ * Verification queue with the same interface as CCheckQueue, where all
+ * checks go through one shared LIFO vector protected by a single mutex.
+ * This was CCheckQueue's implementation before it switched to work-stealing
+ * deques; it is kept as a baseline for benchmarks.
+ */
+template <typename T>
+class CSingleLockCheckQueue
+{
 private:
     //! Mutex to protect the inner state
     boost::mutex mutex;
@@ -131,7 +467,7 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CSingleLockCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
@@ -160,7 +496,7 @@ public:
             condWorker.notify_all();
     }
 
-    ~CCheckQueue()
+    ~CSingleLockCheckQueue()
     {
     }
 
@@ -170,18 +506,30 @@ public:
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
-template <typename T>
+template <typename T, typename Q = CCheckQueue<T>>
 class CCheckQueueControl
 {
 private:
-    CCheckQueue<T> * const pqueue;
+    Q * const pqueue;
     bool fDone;
 
+    static Q* TryControl(Q * const pqueueIn)
+    {
+        if (pqueueIn != NULL) {
+            EnterCritical("pqueue->ControlMutex", __FILE__, __LINE__, (void*)(&pqueueIn->ControlMutex), true);
+            if (!pqueueIn->ControlMutex.try_lock()) {
+                LeaveCritical();
+                return NULL;
+            }
+        }
+        return pqueueIn;
+    }
+
 public:
     CCheckQueueControl() = delete;
     CCheckQueueControl(const CCheckQueueControl&) = delete;
     CCheckQueueControl& operator=(const CCheckQueueControl&) = delete;
-    explicit CCheckQueueControl(CCheckQueue<T> * const pqueueIn) : pqueue(pqueueIn), fDone(false)
+    explicit CCheckQueueControl(Q * const pqueueIn) : pqueue(pqueueIn), fDone(false)
     {
         // passed queue is supposed to be unused, or NULL
         if (pqueue != NULL) {
@@ -189,6 +537,19 @@ public:
         }
     }
 
+    /**
+     * Take control of the queue only if nobody else has it. If somebody does,
+     * this behaves as if it was passed NULL; use HasQueue() to tell.
+     */
+    CCheckQueueControl(Q * const pqueueIn, bool fTry) : pqueue(fTry ? TryControl(pqueueIn) : pqueueIn), fDone(false)
+    {
+        if (pqueue != NULL && !fTry) {
+            ENTER_CRITICAL_SECTION(pqueue->ControlMutex);
+        }
+    }
+
+    bool HasQueue() const { return pqueue != NULL; }
+
     bool Wait()
     {
         if (pqueue == NULL)
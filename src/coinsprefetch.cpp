@@ -0,0 +1,132 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinsprefetch.h"
+
+#include "util.h"
+
+#include <functional>
+
+CCoinsViewPrefetch::CCoinsViewPrefetch(CCoinsView* viewIn, int nThreads)
+    : CCoinsViewBacked(viewIn), m_generation(0), m_writing(false), m_busy(0), m_stop(false)
+{
+    for (int i = 0; i < nThreads; i++) {
+        m_threads.emplace_back(&TraceThread<std::function<void()> >, "coinsprefetch", std::function<void()>(std::bind(&CCoinsViewPrefetch::ThreadPrefetch, this)));
+    }
+}
+
+CCoinsViewPrefetch::~CCoinsViewPrefetch()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv_work.notify_all();
+    for (std::thread& thread : m_threads)
+        thread.join();
+}
+
+void CCoinsViewPrefetch::ThreadPrefetch()
+{
+    std::vector<COutPoint> batch;
+    std::vector<std::pair<COutPoint, Coin> > loaded;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_cv_work.wait(lock, [this]{ return m_stop || (!m_queue.empty() && !m_writing); });
+        if (m_stop)
+            return;
+
+        size_t n = std::min(m_queue.size(), size_t(WORKER_BATCH_SIZE));
+        batch.assign(m_queue.begin(), m_queue.begin() + n);
+        m_queue.erase(m_queue.begin(), m_queue.begin() + n);
+        const uint64_t generation = m_generation;
+        m_busy++;
+        lock.unlock();
+
+        loaded.clear();
+        for (const COutPoint& outpoint : batch) {
+            Coin coin;
+            if (base->GetCoin(outpoint, coin))
+                loaded.emplace_back(outpoint, std::move(coin));
+        }
+
+        lock.lock();
+        // Whatever was read while the base was being written may be stale
+        if (generation == m_generation) {
+            for (std::pair<COutPoint, Coin>& entry : loaded)
+                m_staged.emplace(entry.first, std::move(entry.second));
+        }
+        m_busy--;
+        if (m_busy == 0 && m_queue.empty())
+            m_cv_idle.notify_all();
+    }
+}
+
+bool CCoinsViewPrefetch::GetCoin(const COutPoint& outpoint, Coin& coin) const
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::map<COutPoint, Coin>::iterator it = m_staged.find(outpoint);
+        if (it != m_staged.end()) {
+            coin = std::move(it->second);
+            m_staged.erase(it);
+            return true;
+        }
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewPrefetch::HaveCoin(const COutPoint& outpoint) const
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_staged.count(outpoint))
+            return true;
+    }
+    return base->HaveCoin(outpoint);
+}
+
+bool CCoinsViewPrefetch::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_generation++;
+        m_writing = true;
+        m_staged.clear();
+    }
+    bool fOk = base->BatchWrite(mapCoins, hashBlock, fErase);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_writing = false;
+    }
+    m_cv_work.notify_all();
+    return fOk;
+}
+
+void CCoinsViewPrefetch::Prefetch(const std::vector<COutPoint>& outpoints)
+{
+    if (m_threads.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const COutPoint& outpoint : outpoints) {
+            if (m_queue.size() + m_staged.size() >= MAX_STAGED_COINS)
+                break;
+            m_queue.push_back(outpoint);
+        }
+    }
+    m_cv_work.notify_all();
+}
+
+void CCoinsViewPrefetch::WaitForIdle()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv_idle.wait(lock, [this]{ return m_threads.empty() || m_stop || (m_queue.empty() && m_busy == 0); });
+}
+
+size_t CCoinsViewPrefetch::GetStagedCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_staged.size();
+}
@@ -0,0 +1,77 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSPREFETCH_H
+#define BITCOIN_COINSPREFETCH_H
+
+#include "coins.h"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Default for -prefetchthreads, the number of threads loading coins ahead of block validation */
+static const int DEFAULT_PREFETCH_THREADS = 4;
+/** Maximum number of prefetch threads */
+static const int MAX_PREFETCH_THREADS = 16;
+
+/**
+ * CCoinsView that sits between the coins cache and the database and loads
+ * the coins spent by incoming blocks ahead of time.
+ *
+ * Prefetch() queues outpoints, and a pool of worker threads reads them from
+ * the base view in parallel into a staging area. GetCoin serves staged coins
+ * (handing each over once, as the cache above keeps it from then on) and
+ * falls back to the base view for everything else. The base view must
+ * support concurrent reads, as CCoinsViewDB does.
+ *
+ * Staged coins are only ever copies of what the base contains, so writes
+ * through BatchWrite discard the staging area, together with any read that
+ * overlaps the write. Prefetching is best effort: requests are dropped when
+ * the staging area is full.
+ */
+class CCoinsViewPrefetch : public CCoinsViewBacked
+{
+private:
+    /** Upper bound on staged plus queued coins */
+    static const size_t MAX_STAGED_COINS = 1 << 17;
+    /** Number of outpoints a worker takes off the queue at once */
+    static const size_t WORKER_BATCH_SIZE = 64;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv_work;
+    std::condition_variable m_cv_idle;
+    std::vector<std::thread> m_threads;
+    std::deque<COutPoint> m_queue;
+    mutable std::map<COutPoint, Coin> m_staged;
+    /** Bumped by every write, so that reads overlapping one are discarded */
+    uint64_t m_generation;
+    bool m_writing;
+    int m_busy;
+    bool m_stop;
+
+    void ThreadPrefetch();
+
+public:
+    CCoinsViewPrefetch(CCoinsView* viewIn, int nThreads);
+    ~CCoinsViewPrefetch();
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
+    bool HaveCoin(const COutPoint& outpoint) const;
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase);
+
+    /** Queue outpoints to be loaded from the base view. */
+    void Prefetch(const std::vector<COutPoint>& outpoints);
+
+    /** Block until all queued outpoints have been loaded. */
+    void WaitForIdle();
+
+    /** Number of coins loaded and not yet handed out. */
+    size_t GetStagedCount() const;
+};
+
+#endif // BITCOIN_COINSPREFETCH_H
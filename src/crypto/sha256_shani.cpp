@@ -0,0 +1,127 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// SHA-256 transform using the Intel SHA extensions (SHA-NI), which perform
+// two rounds and the message schedule updates in dedicated instructions.
+
+#ifdef ENABLE_SHANI
+
+#include <stdint.h>
+#include <stddef.h>
+#include <immintrin.h>
+
+namespace sha256_shani {
+namespace {
+
+alignas(16) const uint32_t K[64] = {
+    0x428a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul, 0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+    0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul, 0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf174ul,
+    0xe49b69c1ul, 0xefbe4786ul, 0x0fc19dc6ul, 0x240ca1ccul, 0x2de92c6ful, 0x4a7484aaul, 0x5cb0a9dcul, 0x76f988daul,
+    0x983e5152ul, 0xa831c66dul, 0xb00327c8ul, 0xbf597fc7ul, 0xc6e00bf3ul, 0xd5a79147ul, 0x06ca6351ul, 0x14292967ul,
+    0x27b70a85ul, 0x2e1b2138ul, 0x4d2c6dfcul, 0x53380d13ul, 0x650a7354ul, 0x766a0abbul, 0x81c2c92eul, 0x92722c85ul,
+    0xa2bfe8a1ul, 0xa81a664bul, 0xc24b8b70ul, 0xc76c51a3ul, 0xd192e819ul, 0xd6990624ul, 0xf40e3585ul, 0x106aa070ul,
+    0x19a4c116ul, 0x1e376c08ul, 0x2748774cul, 0x34b0bcb5ul, 0x391c0cb3ul, 0x4ed8aa4aul, 0x5b9cca4ful, 0x682e6ff3ul,
+    0x748f82eeul, 0x78a5636ful, 0x84c87814ul, 0x8cc70208ul, 0x90befffaul, 0xa4506cebul, 0xbef9a3f7ul, 0xc67178f2ul,
+};
+
+/** Run four rounds on message words m, with round constants K[i..i+3]. */
+void inline QuadRound(__m128i& state0, __m128i& state1, __m128i m, int i)
+{
+    const __m128i msg = _mm_add_epi32(m, _mm_load_si128((const __m128i*)(K + i)));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+}
+
+/** Finish computing the next message words into m2, given the two most recent groups m0 and m1. */
+void inline ShiftMessageB(__m128i m0, __m128i m1, __m128i& m2)
+{
+    m2 = _mm_sha256msg2_epu32(_mm_add_epi32(m2, _mm_alignr_epi8(m1, m0, 4)), m1);
+}
+
+/** Start computing the message words that follow m1 into m0. */
+void inline ShiftMessageA(__m128i& m0, __m128i m1)
+{
+    m0 = _mm_sha256msg1_epu32(m0, m1);
+}
+
+__m128i inline Load(const unsigned char* in, __m128i mask) { return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), mask); }
+
+} // namespace
+
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i m0, m1, m2, m3, abef_save, cdgh_save;
+
+    // Convert the state from ABCD/EFGH order to the ABEF/CDGH layout used by sha256rnds2.
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)s), 0xb1); // CDAB
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(s + 4)), 0x1b); // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0); // CDGH
+
+    while (blocks--) {
+        abef_save = state0;
+        cdgh_save = state1;
+
+        m0 = Load(chunk, mask);
+        m1 = Load(chunk + 16, mask);
+        m2 = Load(chunk + 32, mask);
+        m3 = Load(chunk + 48, mask);
+
+        QuadRound(state0, state1, m0, 0);
+        QuadRound(state0, state1, m1, 4);
+        ShiftMessageA(m0, m1);
+        QuadRound(state0, state1, m2, 8);
+        ShiftMessageA(m1, m2);
+        QuadRound(state0, state1, m3, 12);
+        ShiftMessageB(m2, m3, m0);
+        ShiftMessageA(m2, m3);
+        QuadRound(state0, state1, m0, 16);
+        ShiftMessageB(m3, m0, m1);
+        ShiftMessageA(m3, m0);
+        QuadRound(state0, state1, m1, 20);
+        ShiftMessageB(m0, m1, m2);
+        ShiftMessageA(m0, m1);
+        QuadRound(state0, state1, m2, 24);
+        ShiftMessageB(m1, m2, m3);
+        ShiftMessageA(m1, m2);
+        QuadRound(state0, state1, m3, 28);
+        ShiftMessageB(m2, m3, m0);
+        ShiftMessageA(m2, m3);
+        QuadRound(state0, state1, m0, 32);
+        ShiftMessageB(m3, m0, m1);
+        ShiftMessageA(m3, m0);
+        QuadRound(state0, state1, m1, 36);
+        ShiftMessageB(m0, m1, m2);
+        ShiftMessageA(m0, m1);
+        QuadRound(state0, state1, m2, 40);
+        ShiftMessageB(m1, m2, m3);
+        ShiftMessageA(m1, m2);
+        QuadRound(state0, state1, m3, 44);
+        ShiftMessageB(m2, m3, m0);
+        ShiftMessageA(m2, m3);
+        QuadRound(state0, state1, m0, 48);
+        ShiftMessageB(m3, m0, m1);
+        ShiftMessageA(m3, m0);
+        QuadRound(state0, state1, m1, 52);
+        ShiftMessageB(m0, m1, m2);
+        QuadRound(state0, state1, m2, 56);
+        ShiftMessageB(m1, m2, m3);
+        QuadRound(state0, state1, m3, 60);
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+        chunk += 64;
+    }
+
+    // Convert back to ABCD/EFGH order.
+    tmp = _mm_shuffle_epi32(state0, 0x1b); // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xb1); // DCHG
+    _mm_storeu_si128((__m128i*)s, _mm_blend_epi16(tmp, state1, 0xf0)); // DCBA
+    _mm_storeu_si128((__m128i*)(s + 4), _mm_alignr_epi8(state1, tmp, 8)); // HGFE
+}
+
+} // namespace sha256_shani
+
+#endif
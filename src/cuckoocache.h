@@ -451,6 +451,23 @@ public:
             }
         return false;
     }
+
+    /** get_live appends every element that is not marked for garbage
+     * collection to out, elements of the older epoch first. Inserting them
+     * in that order into an empty cache of the same size or larger restores
+     * the contents.
+     *
+     * @param out the vector to append the elements to
+     */
+    void get_live(std::vector<Element>& out) const
+    {
+        for (bool epoch : {false, true}) {
+            for (uint32_t i = 0; i < size; ++i) {
+                if (!collection_flags.bit_is_set(i) && epoch_flags[i] == epoch)
+                    out.push_back(table[i]);
+            }
+        }
+    }
 };
 } // namespace CuckooCache
 
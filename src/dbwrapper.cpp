@@ -15,6 +15,10 @@
 #include <memenv.h>
 #include <stdint.h>
 #include <algorithm>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdio.h>
 
 class CBitcoinLevelDBLogger : public leveldb::Logger {
 public:
@@ -73,10 +77,49 @@ public:
     }
 };
 
+/** LevelDB's LRU block cache, counting lookups that hit and miss */
+class CDBBlockCache : public leveldb::Cache
+{
+private:
+    leveldb::Cache* cache;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+
+public:
+    CDBBlockCache(size_t capacity) : cache(leveldb::NewLRUCache(capacity)), hits(0), misses(0) {}
+    ~CDBBlockCache() { delete cache; }
+
+    virtual Handle* Insert(const leveldb::Slice& key, void* value, size_t charge, void (*deleter)(const leveldb::Slice& key, void* value))
+    {
+        return cache->Insert(key, value, charge, deleter);
+    }
+
+    virtual Handle* Lookup(const leveldb::Slice& key)
+    {
+        Handle* handle = cache->Lookup(key);
+        (handle ? hits : misses).fetch_add(1, std::memory_order_relaxed);
+        return handle;
+    }
+
+    virtual void Release(Handle* handle) { cache->Release(handle); }
+    virtual void* Value(Handle* handle) { return cache->Value(handle); }
+    virtual void Erase(const leveldb::Slice& key) { cache->Erase(key); }
+    virtual uint64_t NewId() { return cache->NewId(); }
+    virtual void Prune() { cache->Prune(); }
+    virtual size_t TotalCharge() const { return cache->TotalCharge(); }
+
+    uint64_t GetHits() const { return hits.load(std::memory_order_relaxed); }
+    uint64_t GetMisses() const { return misses.load(std::memory_order_relaxed); }
+};
+
+/** All open databases, for GetAllDBWrapperStats */
+static std::mutex csDBWrappers;
+static std::set<const CDBWrapper*> setDBWrappers;
+
 static leveldb::Options GetOptions(size_t nCacheSize)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
+    options.block_cache = new CDBBlockCache(nCacheSize / 2);
     options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
     options.compression = leveldb::kNoCompression;
@@ -91,6 +134,8 @@ static leveldb::Options GetOptions(size_t nCacheSize)
 }
 
 CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+    : m_name(path.filename().string()), m_reads(0), m_reads_found(0), m_read_bytes(0), m_read_micros(0),
+      m_batches(0), m_batch_bytes(0), m_batch_micros(0), m_max_batch_micros(0), m_slow_batches(0)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
@@ -98,6 +143,7 @@ CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, b
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
     options = GetOptions(nCacheSize);
+    m_block_cache = static_cast<CDBBlockCache*>(options.block_cache);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -133,10 +179,17 @@ CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, b
     }
 
     LogPrintf("Using obfuscation key for %s: %s\n", path.string(), HexStr(obfuscate_key));
+
+    std::lock_guard<std::mutex> lock(csDBWrappers);
+    setDBWrappers.insert(this);
 }
 
 CDBWrapper::~CDBWrapper()
 {
+    {
+        std::lock_guard<std::mutex> lock(csDBWrappers);
+        setDBWrappers.erase(this);
+    }
     delete pdb;
     pdb = NULL;
     delete options.filter_policy;
@@ -145,17 +198,79 @@ CDBWrapper::~CDBWrapper()
     options.info_log = NULL;
     delete options.block_cache;
     options.block_cache = NULL;
+    m_block_cache = NULL;
     delete penv;
     options.env = NULL;
 }
 
 bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync)
 {
+    int64_t nTimeStart = GetTimeMicros();
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
+    int64_t nMicros = GetTimeMicros() - nTimeStart;
     dbwrapper_private::HandleError(status);
+
+    m_batches.fetch_add(1, std::memory_order_relaxed);
+    m_batch_bytes.fetch_add(batch.SizeEstimate(), std::memory_order_relaxed);
+    m_batch_micros.fetch_add(nMicros, std::memory_order_relaxed);
+    int64_t nMax = m_max_batch_micros.load(std::memory_order_relaxed);
+    while (nMicros > nMax && !m_max_batch_micros.compare_exchange_weak(nMax, nMicros, std::memory_order_relaxed)) {}
+    if (nMicros > DBWRAPPER_SLOW_WRITE_MICROS) {
+        // LevelDB delays writes while compaction is behind, so slow writes
+        // are the visible symptom of a compaction stall.
+        m_slow_batches.fetch_add(1, std::memory_order_relaxed);
+        LogPrint("leveldb", "Slow LevelDB write to %s: %u bytes took %.2fms\n", m_name, batch.SizeEstimate(), nMicros * 0.001);
+    }
     return true;
 }
 
+CDBWrapperStats CDBWrapper::GetStats() const
+{
+    CDBWrapperStats stats;
+    stats.name = m_name;
+    stats.nReads = m_reads.load(std::memory_order_relaxed);
+    stats.nReadsFound = m_reads_found.load(std::memory_order_relaxed);
+    stats.nReadBytes = m_read_bytes.load(std::memory_order_relaxed);
+    stats.nReadMicros = m_read_micros.load(std::memory_order_relaxed);
+    stats.nBatches = m_batches.load(std::memory_order_relaxed);
+    stats.nBatchBytes = m_batch_bytes.load(std::memory_order_relaxed);
+    stats.nBatchMicros = m_batch_micros.load(std::memory_order_relaxed);
+    stats.nMaxBatchMicros = m_max_batch_micros.load(std::memory_order_relaxed);
+    stats.nSlowBatches = m_slow_batches.load(std::memory_order_relaxed);
+    stats.nBlockCacheHits = m_block_cache->GetHits();
+    stats.nBlockCacheMisses = m_block_cache->GetMisses();
+    stats.nBlockCacheUsage = m_block_cache->TotalCharge();
+
+    std::string value;
+    stats.nMemoryUsage = 0;
+    if (pdb->GetProperty("leveldb.approximate-memory-usage", &value))
+        stats.nMemoryUsage = atoi64(value);
+
+    // "leveldb.stats" is a table with one row per level that has files or
+    // has seen compactions, following three header lines.
+    stats.dCompactionSeconds = 0;
+    stats.nReadAmplification = 0;
+    if (pdb->GetProperty("leveldb.stats", &value)) {
+        std::istringstream table(value);
+        std::string line;
+        for (int i = 0; i < 3 && std::getline(table, line); i++) {}
+        while (std::getline(table, line)) {
+            CDBWrapperStats::Level level;
+            if (sscanf(line.c_str(), "%d %d %lf %lf %lf %lf", &level.nLevel, &level.nFiles, &level.dSizeMiB,
+                       &level.dCompactionSeconds, &level.dCompactionReadMiB, &level.dCompactionWrittenMiB) != 6)
+                continue;
+            stats.levels.push_back(level);
+            stats.dCompactionSeconds += level.dCompactionSeconds;
+            if (level.nLevel == 0) {
+                stats.nReadAmplification += level.nFiles;
+            } else if (level.nFiles > 0) {
+                stats.nReadAmplification++;
+            }
+        }
+    }
+    return stats;
+}
+
 // Prefixed with null character to avoid collisions with other keys
 //
 // We must use a string constructor which specifies length so that we copy
@@ -183,6 +298,34 @@ bool CDBWrapper::IsEmpty()
     return !(it->Valid());
 }
 
+std::vector<CDBWrapperStats> GetAllDBWrapperStats()
+{
+    std::vector<CDBWrapperStats> vStats;
+    std::lock_guard<std::mutex> lock(csDBWrappers);
+    for (const CDBWrapper* db : setDBWrappers)
+        vStats.push_back(db->GetStats());
+    std::sort(vStats.begin(), vStats.end(), [](const CDBWrapperStats& a, const CDBWrapperStats& b) { return a.name < b.name; });
+    return vStats;
+}
+
+void LogDBWrapperStats()
+{
+    if (!LogAcceptCategory("leveldb"))
+        return;
+    for (const CDBWrapperStats& stats : GetAllDBWrapperStats()) {
+        LogPrintf("LevelDB %s: reads=%u (%.2fms) batches=%u (%.2fMiB, %.2fms, max %.2fms, %u slow) cache hits=%u misses=%u usage=%.2fMiB compaction=%.2fs read amplification=%d\n",
+            stats.name, stats.nReads, stats.nReadMicros * 0.001, stats.nBatches, stats.nBatchBytes / 1048576.0,
+            stats.nBatchMicros * 0.001, stats.nMaxBatchMicros * 0.001, stats.nSlowBatches,
+            stats.nBlockCacheHits, stats.nBlockCacheMisses, stats.nBlockCacheUsage / 1048576.0,
+            stats.dCompactionSeconds, stats.nReadAmplification);
+        for (const CDBWrapperStats::Level& level : stats.levels) {
+            LogPrintf("LevelDB %s: level %d files=%d size=%.2fMiB compaction=%.2fs read=%.2fMiB written=%.2fMiB\n",
+                stats.name, level.nLevel, level.nFiles, level.dSizeMiB, level.dCompactionSeconds,
+                level.dCompactionReadMiB, level.dCompactionWrittenMiB);
+        }
+    }
+}
+
 CDBIterator::~CDBIterator() { delete piter; }
 bool CDBIterator::Valid() { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
@@ -10,8 +10,11 @@
 #include "streams.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "utiltime.h"
 #include "version.h"
 
+#include <atomic>
+
 #include <boost/filesystem/path.hpp>
 
 #include <leveldb/db.h>
@@ -19,6 +22,48 @@
 
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
+//! Batch writes taking longer than this, in microseconds, are counted as stalled
+static const int64_t DBWRAPPER_SLOW_WRITE_MICROS = 100000;
+//! Interval in seconds at which database statistics are logged with -debug=leveldb
+static const int64_t DBWRAPPER_STATS_LOG_INTERVAL = 5 * 60;
+
+/** I/O and compaction statistics of one database, see CDBWrapper::GetStats */
+struct CDBWrapperStats
+{
+    struct Level
+    {
+        int nLevel;
+        int nFiles;
+        double dSizeMiB;
+        double dCompactionSeconds;
+        double dCompactionReadMiB;
+        double dCompactionWrittenMiB;
+    };
+
+    std::string name;
+    //! Point lookups through Read and Exists
+    uint64_t nReads;
+    uint64_t nReadsFound;
+    uint64_t nReadBytes;
+    int64_t nReadMicros;
+    //! Batches written through WriteBatch
+    uint64_t nBatches;
+    uint64_t nBatchBytes;
+    int64_t nBatchMicros;
+    int64_t nMaxBatchMicros;
+    uint64_t nSlowBatches;
+    //! LevelDB's block cache
+    uint64_t nBlockCacheHits;
+    uint64_t nBlockCacheMisses;
+    size_t nBlockCacheUsage;
+    //! Block cache plus memtables
+    size_t nMemoryUsage;
+    //! Levels that hold files or have seen compactions
+    std::vector<Level> levels;
+    double dCompactionSeconds;
+    //! Number of files a lookup of a missing key may have to check: every level-0 file plus one per deeper level
+    int nReadAmplification;
+};
 
 class dbwrapper_error : public std::runtime_error
 {
@@ -27,6 +72,7 @@ public:
 };
 
 class CDBWrapper;
+class CDBBlockCache;
 
 /** These should be considered an implementation detail of the specific database.
  */
@@ -56,11 +102,19 @@ private:
     CDataStream ssKey;
     CDataStream ssValue;
 
+    size_t size_estimate;
+
 public:
     /**
      * @param[in] _parent   CDBWrapper that this batch is to be submitted to
      */
-    CDBBatch(const CDBWrapper &_parent) : parent(_parent), ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION) { };
+    CDBBatch(const CDBWrapper &_parent) : parent(_parent), ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION), size_estimate(0) { };
+
+    void Clear()
+    {
+        batch.Clear();
+        size_estimate = 0;
+    }
 
     template <typename K, typename V>
     void Write(const K& key, const V& value)
@@ -75,6 +129,14 @@ public:
         leveldb::Slice slValue(ssValue.data(), ssValue.size());
 
         batch.Put(slKey, slValue);
+        // LevelDB serializes writes as:
+        // - byte: header
+        // - varint: key length (1 byte up to 127B, 2 bytes up to 16383B, ...)
+        // - byte[]: key
+        // - varint: value length
+        // - byte[]: value
+        // The formula below assumes the key and value are both less than 16k.
+        size_estimate += 3 + (slKey.size() > 127) + slKey.size() + (slValue.size() > 127) + slValue.size();
         ssKey.clear();
         ssValue.clear();
     }
@@ -87,8 +149,16 @@ public:
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         batch.Delete(slKey);
+        // LevelDB serializes erases as:
+        // - byte: header
+        // - varint: key length
+        // - byte[]: key
+        // The formula below assumes the key is less than 16kB.
+        size_estimate += 2 + (slKey.size() > 127) + slKey.size();
         ssKey.clear();
     }
+
+    size_t SizeEstimate() const { return size_estimate; }
 };
 
 class CDBIterator
@@ -160,6 +230,9 @@ private:
     //! database options used
     leveldb::Options options;
 
+    //! options.block_cache, which counts its hits and misses
+    CDBBlockCache* m_block_cache;
+
     //! options used when reading from the database
     leveldb::ReadOptions readoptions;
 
@@ -186,6 +259,28 @@ private:
 
     std::vector<unsigned char> CreateObfuscateKey() const;
 
+    //! name of the database in statistics, the last component of its path
+    std::string m_name;
+
+    //! counters reported by GetStats
+    mutable std::atomic<uint64_t> m_reads;
+    mutable std::atomic<uint64_t> m_reads_found;
+    mutable std::atomic<uint64_t> m_read_bytes;
+    mutable std::atomic<int64_t> m_read_micros;
+    std::atomic<uint64_t> m_batches;
+    std::atomic<uint64_t> m_batch_bytes;
+    std::atomic<int64_t> m_batch_micros;
+    std::atomic<int64_t> m_max_batch_micros;
+    std::atomic<uint64_t> m_slow_batches;
+
+    void RecordRead(bool fFound, size_t nBytes, int64_t nMicros) const
+    {
+        m_reads.fetch_add(1, std::memory_order_relaxed);
+        m_reads_found.fetch_add(fFound, std::memory_order_relaxed);
+        m_read_bytes.fetch_add(nBytes, std::memory_order_relaxed);
+        m_read_micros.fetch_add(nMicros, std::memory_order_relaxed);
+    }
+
 public:
     /**
      * @param[in] path        Location in the filesystem where leveldb data will be stored.
@@ -207,7 +302,9 @@ public:
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         std::string strValue;
+        int64_t nTimeStart = GetTimeMicros();
         leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        RecordRead(status.ok(), strValue.size(), GetTimeMicros() - nTimeStart);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -241,7 +338,9 @@ public:
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         std::string strValue;
+        int64_t nTimeStart = GetTimeMicros();
         leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        RecordRead(status.ok(), strValue.size(), GetTimeMicros() - nTimeStart);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -282,7 +381,36 @@ public:
      * Return true if the database managed by this class contains no entries.
      */
     bool IsEmpty();
+
+    /** Name of the database, as used in statistics. */
+    const std::string& GetName() const { return m_name; }
+
+    /** Collect I/O counters and LevelDB's compaction and cache statistics. */
+    CDBWrapperStats GetStats() const;
+
+    /**
+     * Compact the on-disk representation of the given key range, e.g. after
+     * rewriting a large part of the database.
+     */
+    template<typename K>
+    void CompactRange(const K& key_begin, const K& key_end) const
+    {
+        CDataStream ssKey1(SER_DISK, CLIENT_VERSION), ssKey2(SER_DISK, CLIENT_VERSION);
+        ssKey1.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey2.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey1 << key_begin;
+        ssKey2 << key_end;
+        leveldb::Slice slKey1(ssKey1.data(), ssKey1.size());
+        leveldb::Slice slKey2(ssKey2.data(), ssKey2.size());
+        pdb->CompactRange(&slKey1, &slKey2);
+    }
 };
 
+/** Statistics of all open databases. */
+std::vector<CDBWrapperStats> GetAllDBWrapperStats();
+
+/** Log a summary of the statistics of all open databases to the "leveldb" category. */
+void LogDBWrapperStats();
+
 #endif // BITCOIN_DBWRAPPER_H
 
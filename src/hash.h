@@ -207,4 +207,11 @@ public:
  */
 uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
 
+/** Optimized SipHash-2-4 implementation for a uint256 followed by a 32-bit
+ *  integer, as used for hashing transaction outpoints. It is identical to
+ *  SipHasher(k0, k1) over the 36 bytes of val followed by extra in
+ *  little-endian order.
+ */
+uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra);
+
 #endif // BITCOIN_HASH_H
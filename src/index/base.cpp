@@ -0,0 +1,250 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "index/base.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "init.h"
+#include "primitives/block.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+#include "warnings.h"
+
+#include <functional>
+
+/** How often the sync thread persists its best block while catching up */
+static const int64_t INDEX_LOCATOR_WRITE_INTERVAL = 30;
+
+/** An index that cannot keep up with the chain would silently serve stale data; shut down instead. */
+template<typename... Args>
+static void FatalError(const char* fmt, const Args&... args)
+{
+    std::string strMessage = tfm::format(fmt, args...);
+    SetMiscWarning(strMessage);
+    LogPrintf("*** %s\n", strMessage);
+    FlushDebugLog();
+    uiInterface.ThreadSafeMessageBox(
+        _("Error: A fatal internal error occurred, see debug.log for details"),
+        "", CClientUIInterface::MSG_ERROR);
+    StartShutdown();
+}
+
+BaseIndex::BaseIndex() : m_blocks_connected(0), m_interrupt(false), m_best_block_index(NULL), m_synced(false)
+{
+}
+
+BaseIndex::~BaseIndex()
+{
+    Interrupt();
+    Stop();
+}
+
+bool BaseIndex::Start()
+{
+    CBlockLocator locator;
+    if (!ReadBestBlock(locator))
+        locator.SetNull();
+
+    {
+        LOCK(cs_main);
+        // Unlike FindForkInGlobalIndex, keep a best block that is not (or not
+        // yet, during -reindex-chainstate) part of the active chain, so that
+        // blocks which were already indexed are not written again.
+        for (const uint256& hash : locator.vHave) {
+            BlockMap::const_iterator mi = mapBlockIndex.find(hash);
+            if (mi != mapBlockIndex.end()) {
+                m_best_block_index = mi->second;
+                break;
+            }
+        }
+    }
+    const CBlockIndex* pindexBest = m_best_block_index;
+    LogPrintf("%s: %s resuming from height %d\n", __func__, GetName(), pindexBest ? pindexBest->nHeight : -1);
+
+    RegisterValidationInterface(this);
+    m_thread = std::thread(&TraceThread<std::function<void()> >, GetName(), std::function<void()>(std::bind(&BaseIndex::ThreadSync, this)));
+    return true;
+}
+
+void BaseIndex::Interrupt()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_interrupt = true;
+    }
+    m_cv_work.notify_all();
+    m_cv_progress.notify_all();
+}
+
+void BaseIndex::Stop()
+{
+    Interrupt();
+    UnregisterValidationInterface(this);
+    if (m_thread.joinable()) {
+        m_thread.join();
+        CommitBestBlock();
+    }
+}
+
+void BaseIndex::BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queue.size() >= MAX_QUEUED_BLOCKS)
+            m_queue.pop_front();
+        m_queue.emplace_back(pindex, block);
+        m_blocks_connected++;
+    }
+    m_cv_work.notify_one();
+}
+
+const CBlockIndex* BaseIndex::NextSyncBlock(const CBlockIndex* pindexPrev) const
+{
+    AssertLockHeld(cs_main);
+
+    if (!pindexPrev)
+        return chainActive.Genesis();
+
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    if (!pindexTip)
+        return NULL;
+    if (chainActive.Contains(pindexPrev))
+        return chainActive.Next(pindexPrev);
+
+    // Ahead of the active chain on the same branch, as while the chainstate
+    // is being rebuilt; wait for the chain to catch up.
+    if (pindexPrev->GetAncestor(pindexTip->nHeight) == pindexTip)
+        return NULL;
+
+    // The best block was reorganized away. Entries for the disconnected blocks
+    // are left in place and overwritten as their transactions are reconnected.
+    return chainActive.Next(chainActive.FindFork(pindexPrev));
+}
+
+std::shared_ptr<const CBlock> BaseIndex::TakeQueuedBlock(const CBlockIndex* pindex)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_queue.size(); i++) {
+        if (m_queue[i].first == pindex) {
+            std::shared_ptr<const CBlock> pblock = m_queue[i].second;
+            // Anything queued before this block has either been indexed or was disconnected
+            m_queue.erase(m_queue.begin(), m_queue.begin() + i + 1);
+            return pblock;
+        }
+    }
+    return std::shared_ptr<const CBlock>();
+}
+
+bool BaseIndex::CommitBestBlock()
+{
+    CBlockLocator locator;
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindexBest = m_best_block_index;
+        if (!pindexBest)
+            return true;
+        locator = chainActive.GetLocator(pindexBest);
+    }
+    if (!WriteBestBlock(locator))
+        return error("%s: failed to write %s best block", __func__, GetName());
+    return true;
+}
+
+void BaseIndex::ThreadSync()
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    int64_t nLastLocatorWrite = GetTime();
+    const CBlockIndex* pindexCommitted = m_best_block_index;
+
+    while (true) {
+        uint64_t nBlocksConnected;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_interrupt)
+                return;
+            nBlocksConnected = m_blocks_connected;
+        }
+
+        const CBlockIndex* pindexNext;
+        {
+            LOCK(cs_main);
+            pindexNext = NextSyncBlock(m_best_block_index);
+        }
+
+        if (!pindexNext) {
+            if (!m_synced) {
+                const CBlockIndex* pindexBest = m_best_block_index;
+                LogPrintf("%s is enabled at height %d\n", GetName(), pindexBest ? pindexBest->nHeight : 0);
+                m_synced = true;
+            }
+            if (pindexCommitted != m_best_block_index) {
+                pindexCommitted = m_best_block_index;
+                CommitBestBlock();
+                nLastLocatorWrite = GetTime();
+            }
+
+            // Wait for a block to be connected. Blocks that are already queued
+            // may never be taken, for instance while the index is ahead of a
+            // chainstate being rebuilt, so only a new one counts. The timeout
+            // picks up chain changes that do not connect a block, such as
+            // invalidateblock.
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv_work.wait_for(lock, std::chrono::seconds(5), [this, nBlocksConnected] { return m_interrupt || m_blocks_connected != nBlocksConnected; });
+            continue;
+        }
+
+        std::shared_ptr<const CBlock> pblock = TakeQueuedBlock(pindexNext);
+        if (!pblock) {
+            std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+            if (!ReadBlockFromDisk(*pblockRead, pindexNext, consensusParams)) {
+                m_synced = false;
+                FatalError("%s: Failed to read block %s from disk", __func__, pindexNext->GetBlockHash().ToString());
+                return;
+            }
+            pblock = pblockRead;
+        }
+
+        if (!WriteBlock(*pblock, pindexNext)) {
+            m_synced = false;
+            FatalError("%s: Failed to write block %s to %s", __func__, pindexNext->GetBlockHash().ToString(), GetName());
+            return;
+        }
+        m_best_block_index = pindexNext;
+        m_cv_progress.notify_all();
+
+        if (GetTime() - nLastLocatorWrite >= INDEX_LOCATOR_WRITE_INTERVAL) {
+            pindexCommitted = pindexNext;
+            CommitBestBlock();
+            nLastLocatorWrite = GetTime();
+        }
+    }
+}
+
+bool BaseIndex::BlockUntilSyncedToCurrentChain()
+{
+    if (!m_synced)
+        return false;
+
+    while (true) {
+        // cs_main is taken first, as BlockConnected runs with it held
+        const CBlockIndex* pindexTip;
+        {
+            LOCK(cs_main);
+            pindexTip = chainActive.Tip();
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_interrupt || !m_synced)
+            return false;
+        const CBlockIndex* pindexBest = m_best_block_index;
+        if (pindexBest && pindexBest->GetAncestor(pindexTip->nHeight) == pindexTip)
+            return true;
+        // Also wake up periodically, in case the sync thread stopped on an error,
+        // missed the notification, or the tip changed
+        m_cv_progress.wait_for(lock, std::chrono::milliseconds(100));
+    }
+}
@@ -0,0 +1,92 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_BASE_H
+#define BITCOIN_INDEX_BASE_H
+
+#include "validationinterface.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+class CBlock;
+class CBlockIndex;
+struct CBlockLocator;
+
+/**
+ * Base class for optional indexes that are built from the active chain in
+ * the background. Each index runs its own thread, which walks the active
+ * chain from the index's best block, reading blocks from disk while catching
+ * up and taking them from BlockConnected notifications once in sync. Block
+ * connection never waits for an index; an index that falls behind catches up
+ * on its own. The best block is persisted as a locator, so an interrupted
+ * index resumes where it left off.
+ */
+class BaseIndex : public CValidationInterface
+{
+private:
+    /** Connected blocks kept for the sync thread, so that it does not have to read them back from disk */
+    static const size_t MAX_QUEUED_BLOCKS = 32;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv_work;
+    std::condition_variable m_cv_progress;
+    std::deque<std::pair<const CBlockIndex*, std::shared_ptr<const CBlock> > > m_queue;
+    /** Number of BlockConnected notifications so far, so the sync thread only wakes up for new ones */
+    uint64_t m_blocks_connected;
+    bool m_interrupt;
+
+    /** The last block written to the index; may be on a chain that is no longer active */
+    std::atomic<const CBlockIndex*> m_best_block_index;
+    /** Whether the index has caught up with the active chain; cleared if the sync thread stops on an error, which also shuts the node down */
+    std::atomic<bool> m_synced;
+
+    /** Pick the block to index after pindexPrev, or NULL if the index is up to date. */
+    const CBlockIndex* NextSyncBlock(const CBlockIndex* pindexPrev) const;
+    std::shared_ptr<const CBlock> TakeQueuedBlock(const CBlockIndex* pindex);
+    bool CommitBestBlock();
+    void ThreadSync();
+
+protected:
+    virtual void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex);
+
+    /** Write the entries for a block connected to the active chain. */
+    virtual bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) = 0;
+    /** Read the locator of the last block written, returning false if there is none. */
+    virtual bool ReadBestBlock(CBlockLocator& locator) = 0;
+    virtual bool WriteBestBlock(const CBlockLocator& locator) = 0;
+    /** Name of the index, for the thread name and log messages. */
+    virtual const char* GetName() const = 0;
+
+public:
+    BaseIndex();
+    virtual ~BaseIndex();
+
+    /** Load the best block and start the sync thread. Must be called after the block index is loaded. */
+    bool Start();
+    void Interrupt();
+    /** Interrupt and join the sync thread, then persist the best block. */
+    void Stop();
+
+    /**
+     * Wait until the index has caught up with the chain tip, which is read
+     * again on every pass so that a reorganization cannot leave it waiting
+     * for a block that is no longer active. Returns false at once if the
+     * index has not completed its initial sync, and when interrupted. Must
+     * not be called with cs_main held.
+     */
+    bool BlockUntilSyncedToCurrentChain();
+
+    /** Whether the index has completed its initial sync with the active chain. */
+    bool IsSynced() const { return m_synced; }
+};
+
+#endif // BITCOIN_INDEX_BASE_H
@@ -0,0 +1,148 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "index/blockfilterindex.h"
+
+#include "chain.h"
+#include "dbwrapper.h"
+#include "primitives/block.h"
+#include "undo.h"
+#include "util.h"
+#include "validation.h"
+
+#include <boost/filesystem.hpp>
+
+static const char DB_BEST_BLOCK = 'B';
+static const char DB_FILTER = 's';
+
+std::unique_ptr<BlockFilterIndex> g_blockfilterindex;
+
+namespace {
+
+/** Database entry for the filter of one block */
+struct CFilterEntry
+{
+    uint256 hash;
+    uint256 header;
+    std::vector<unsigned char> filter;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hash);
+        READWRITE(header);
+        READWRITE(filter);
+    }
+};
+
+}
+
+BlockFilterIndex::BlockFilterIndex(BlockFilterType filter_type, size_t nCacheSize, bool fMemory, bool fWipe)
+    : m_filter_type(filter_type)
+{
+    const std::string& strFilterName = BlockFilterTypeName(filter_type);
+    if (strFilterName.empty())
+        throw std::invalid_argument("unknown filter_type");
+    m_name = strFilterName + " block filter index";
+
+    boost::filesystem::path path = GetDataDir() / "indexes" / "blockfilter" / strFilterName;
+    if (!fMemory)
+        boost::filesystem::create_directories(path);
+    m_db.reset(new CDBWrapper(path, nCacheSize, fMemory, fWipe));
+}
+
+BlockFilterIndex::~BlockFilterIndex()
+{
+    // Stop the thread before the database goes away
+    Interrupt();
+    Stop();
+}
+
+bool BlockFilterIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    CBlockUndo blockundo;
+    uint256 prevHeader;
+
+    if (pindex->pprev) {
+        CDiskBlockPos pos;
+        {
+            LOCK(cs_main);
+            pos = pindex->GetUndoPos();
+        }
+        if (!UndoReadFromDisk(blockundo, pos, pindex->pprev->GetBlockHash()))
+            return false;
+
+        CFilterEntry prevEntry;
+        if (!m_db->Read(std::make_pair(DB_FILTER, pindex->pprev->GetBlockHash()), prevEntry))
+            return error("%s: filter of previous block %s not found", __func__, pindex->pprev->GetBlockHash().ToString());
+        prevHeader = prevEntry.header;
+    }
+
+    BlockFilter filter(m_filter_type, block, blockundo);
+
+    CFilterEntry entry;
+    entry.hash = filter.GetHash();
+    entry.header = filter.ComputeHeader(prevHeader);
+    entry.filter = filter.GetEncodedFilter();
+    return m_db->Write(std::make_pair(DB_FILTER, pindex->GetBlockHash()), entry);
+}
+
+bool BlockFilterIndex::ReadBestBlock(CBlockLocator& locator)
+{
+    return m_db->Read(DB_BEST_BLOCK, locator);
+}
+
+bool BlockFilterIndex::WriteBestBlock(const CBlockLocator& locator)
+{
+    return m_db->Write(DB_BEST_BLOCK, locator, true);
+}
+
+bool BlockFilterIndex::LookupFilter(const CBlockIndex* pindex, BlockFilter& filter) const
+{
+    CFilterEntry entry;
+    if (!m_db->Read(std::make_pair(DB_FILTER, pindex->GetBlockHash()), entry))
+        return false;
+    filter = BlockFilter(m_filter_type, pindex->GetBlockHash(), entry.filter);
+    return true;
+}
+
+bool BlockFilterIndex::LookupFilterHeader(const CBlockIndex* pindex, uint256& header) const
+{
+    CFilterEntry entry;
+    if (!m_db->Read(std::make_pair(DB_FILTER, pindex->GetBlockHash()), entry))
+        return false;
+    header = entry.header;
+    return true;
+}
+
+bool BlockFilterIndex::LookupFilterRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<BlockFilter>& filters) const
+{
+    if (nStartHeight < 0 || nStartHeight > pindexStop->nHeight)
+        return false;
+
+    filters.resize(pindexStop->nHeight - nStartHeight + 1);
+    const CBlockIndex* pindex = pindexStop;
+    for (size_t i = filters.size(); i > 0; i--, pindex = pindex->pprev) {
+        if (!LookupFilter(pindex, filters[i - 1]))
+            return false;
+    }
+    return true;
+}
+
+bool BlockFilterIndex::LookupFilterHashRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<uint256>& hashes) const
+{
+    if (nStartHeight < 0 || nStartHeight > pindexStop->nHeight)
+        return false;
+
+    hashes.resize(pindexStop->nHeight - nStartHeight + 1);
+    const CBlockIndex* pindex = pindexStop;
+    for (size_t i = hashes.size(); i > 0; i--, pindex = pindex->pprev) {
+        CFilterEntry entry;
+        if (!m_db->Read(std::make_pair(DB_FILTER, pindex->GetBlockHash()), entry))
+            return false;
+        hashes[i - 1] = entry.hash;
+    }
+    return true;
+}
@@ -0,0 +1,58 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_BLOCKFILTERINDEX_H
+#define BITCOIN_INDEX_BLOCKFILTERINDEX_H
+
+#include "blockfilter.h"
+#include "index/base.h"
+
+#include <memory>
+#include <vector>
+
+class CDBWrapper;
+
+/**
+ * -blockfilterindex: stores the BIP 158 filter of every block in the active
+ * chain, together with its filter hash and filter header, in a database under
+ * indexes/blockfilter/<type>. Filters are computed once when a block is
+ * connected and looked up by block hash, so entries for blocks that were
+ * reorganized away stay valid and are simply not served.
+ */
+class BlockFilterIndex : public BaseIndex
+{
+private:
+    BlockFilterType m_filter_type;
+    std::string m_name;
+    std::unique_ptr<CDBWrapper> m_db;
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex);
+    bool ReadBestBlock(CBlockLocator& locator);
+    bool WriteBestBlock(const CBlockLocator& locator);
+    const char* GetName() const { return m_name.c_str(); }
+
+public:
+    BlockFilterIndex(BlockFilterType filter_type, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    virtual ~BlockFilterIndex();
+
+    BlockFilterType GetFilterType() const { return m_filter_type; }
+
+    /** Get the filter of a single block. Returns false if it has not been indexed. */
+    bool LookupFilter(const CBlockIndex* pindex, BlockFilter& filter) const;
+
+    /** Get the filter header of a single block. Returns false if it has not been indexed. */
+    bool LookupFilterHeader(const CBlockIndex* pindex, uint256& header) const;
+
+    /** Get the filters of the ancestors of pindexStop from nStartHeight up to and including pindexStop. */
+    bool LookupFilterRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<BlockFilter>& filters) const;
+
+    /** Get the filter hashes of the ancestors of pindexStop from nStartHeight up to and including pindexStop. */
+    bool LookupFilterHashRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<uint256>& hashes) const;
+};
+
+/** The basic filter index, NULL unless -blockfilterindex is set */
+extern std::unique_ptr<BlockFilterIndex> g_blockfilterindex;
+
+#endif // BITCOIN_INDEX_BLOCKFILTERINDEX_H
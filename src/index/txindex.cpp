@@ -0,0 +1,65 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "index/txindex.h"
+
+#include "chain.h"
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "txdb.h"
+#include "util.h"
+#include "validation.h"
+
+std::unique_ptr<TxIndex> g_txindex;
+
+TxIndex::~TxIndex()
+{
+    // Stop the thread before the derived object goes away
+    Interrupt();
+    Stop();
+}
+
+bool TxIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    // The genesis coinbase is not spendable and has never been indexed
+    if (pindex->nHeight == 0)
+        return true;
+
+    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    vPos.reserve(block.vtx.size());
+    for (const auto& tx : block.vtx) {
+        vPos.push_back(std::make_pair(tx->GetHash(), pos));
+        pos.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
+    }
+    return pblocktree->WriteTxIndex(vPos);
+}
+
+bool TxIndex::ReadBestBlock(CBlockLocator& locator)
+{
+    if (pblocktree->ReadTxIndexBestBlock(locator))
+        return true;
+
+    // Databases from before the index was built in the background kept it in
+    // step with the chainstate and only recorded that it was enabled.
+    bool fLegacyIndex = false;
+    if (pblocktree->ReadFlag("txindex", fLegacyIndex) && fLegacyIndex) {
+        int nHeight;
+        {
+            LOCK(cs_main);
+            locator = chainActive.GetLocator();
+            nHeight = chainActive.Height();
+        }
+        if (!pblocktree->WriteTxIndexBestBlock(locator) || !pblocktree->WriteFlag("txindex", false))
+            return false;
+        LogPrintf("%s: upgraded transaction index at height %d\n", __func__, nHeight);
+        return true;
+    }
+    return false;
+}
+
+bool TxIndex::WriteBestBlock(const CBlockLocator& locator)
+{
+    return pblocktree->WriteTxIndexBestBlock(locator);
+}
@@ -0,0 +1,32 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_TXINDEX_H
+#define BITCOIN_INDEX_TXINDEX_H
+
+#include "index/base.h"
+
+#include <memory>
+
+/**
+ * -txindex: maps transaction ids to their position in the block files.
+ * Entries are stored in the block tree database, as they always were, with
+ * the index's best block kept alongside them.
+ */
+class TxIndex : public BaseIndex
+{
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex);
+    bool ReadBestBlock(CBlockLocator& locator);
+    bool WriteBestBlock(const CBlockLocator& locator);
+    const char* GetName() const { return "txindex"; }
+
+public:
+    virtual ~TxIndex();
+};
+
+/** The global transaction index, NULL unless -txindex is set */
+extern std::unique_ptr<TxIndex> g_txindex;
+
+#endif // BITCOIN_INDEX_TXINDEX_H
@@ -14,12 +14,18 @@
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "coinsprefetch.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"
+#include "dbwrapper.h"
 #include "httpserver.h"
 #include "httprpc.h"
+#include "index/blockfilterindex.h"
+#include "index/txindex.h"
 #include "key.h"
 #include "validation.h"
+#include "metrics.h"
 #include "miner.h"
 #include "netbase.h"
 #include "net.h"
@@ -125,6 +131,7 @@ static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
 
 std::atomic<bool> fRequestShutdown(false);
 std::atomic<bool> fDumpMempoolLater(false);
+static bool fDumpSigCacheLater = false;
 
 void StartShutdown()
 {
@@ -144,9 +151,9 @@ class CCoinsViewErrorCatcher : public CCoinsViewBacked
 {
 public:
     CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         try {
-            return CCoinsViewBacked::GetCoins(txid, coins);
+            return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch(const std::runtime_error& e) {
             uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
             LogPrintf("Error reading from database: %s\n", e.what());
@@ -162,6 +169,8 @@ public:
 
 static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
+static int nPrefetchThreads = 0;
+static int nSchedulerThreads = DEFAULT_SCHEDULER_THREADS;
 static std::unique_ptr<ECCVerifyHandle> globalVerifyHandle;
 
 void Interrupt(boost::thread_group& threadGroup)
@@ -170,7 +179,13 @@ void Interrupt(boost::thread_group& threadGroup)
     InterruptHTTPRPC();
     InterruptRPC();
     InterruptREST();
+    InterruptMetrics();
     InterruptTorControl();
+    if (g_txindex)
+        g_txindex->Interrupt();
+    if (g_blockfilterindex)
+        g_blockfilterindex->Interrupt();
+    InterruptSnapshotValidation();
     if (g_connman)
         g_connman->Interrupt();
     threadGroup.interrupt_all();
@@ -193,8 +208,11 @@ void Shutdown()
 
     StopHTTPRPC();
     StopREST();
+    StopMetrics();
     StopRPC();
     StopHTTPServer();
+    // The scheduler thread has stopped, deliver what is still queued for wallets and ZMQ
+    FlushBackgroundCallbacks();
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(false);
@@ -208,6 +226,8 @@ void Shutdown()
     UnregisterNodeSignals(GetNodeSignals());
     if (fDumpMempoolLater)
         DumpMempool();
+    if (fDumpSigCacheLater)
+        DumpSignatureCache();
 
     if (fFeeEstimatesInitialized)
     {
@@ -220,6 +240,11 @@ void Shutdown()
         fFeeEstimatesInitialized = false;
     }
 
+    // Stop the index threads before the databases they write to go away
+    g_txindex.reset();
+    g_blockfilterindex.reset();
+    StopSnapshotValidation();
+
     {
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
@@ -227,6 +252,8 @@ void Shutdown()
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
+        delete pcoinsPrefetch;
+        pcoinsPrefetch = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
         delete pcoinsdbview;
@@ -234,6 +261,9 @@ void Shutdown()
         delete pblocktree;
         pblocktree = NULL;
     }
+    // The final flush above tells the wallets about the best chain; deliver
+    // that before the wallet database and ZMQ are shut down
+    FlushBackgroundCallbacks();
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(true);
@@ -255,6 +285,7 @@ void Shutdown()
     }
 #endif
     UnregisterAllValidationInterfaces();
+    UnregisterBackgroundSignalScheduler();
 #ifdef ENABLE_WALLET
     delete pwalletMain;
     pwalletMain = NULL;
@@ -262,6 +293,7 @@ void Shutdown()
     globalVerifyHandle.reset();
     ECC_Stop();
     LogPrintf("%s: done\n", __func__);
+    StopDebugLogWriter();
 }
 
 /**
@@ -319,11 +351,14 @@ std::string HelpMessage(HelpMessageMode mode)
     std::string strUsage = HelpMessageGroup(_("Options:"));
     strUsage += HelpMessageOpt("-?", _("Print this help message and exit"));
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
+    strUsage += HelpMessageOpt("-addressindex", strprintf(_("Maintain an index of outputs and spends by scriptPubKey, used by the getaddressutxos and getaddresshistory rpc calls (default: %u)"), DEFAULT_ADDRESSINDEX));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain an index of BIP 158 basic block filters, used by the getblockfilter rpc call and the REST interface. The index is built in the background (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
     strUsage +=HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: %s, testnet: %s)"), Params(CBaseChainParams::MAIN).GetConsensus().defaultAssumeValid.GetHex(), Params(CBaseChainParams::TESTNET).GetConsensus().defaultAssumeValid.GetHex()));
+    strUsage += HelpMessageOpt("-assumeutxo=<hex>", _("Accept a -loadsnapshot file whose UTXO set hash (hash_serialized in gettxoutsetinfo) matches this value. Only use a hash from a source you trust, such as a node of your own; no snapshot hashes are built into this release"));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), BITCOIN_CONF_FILENAME));
     if (mode == HMM_BITCOIND)
     {
@@ -336,16 +371,22 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-loadsnapshot=<file>", _("Start a new chainstate from a UTXO snapshot written by dumptxoutset; blocks before the snapshot are downloaded and checked against it in the background"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     strUsage += HelpMessageOpt("-blockreconstructionextratxn=<n>", strprintf(_("Extra transactions to keep in memory for compact block reconstructions (default: %u)"), DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-prefetchthreads=<n>", strprintf(_("Number of threads loading the coins spent by incoming blocks ahead of validation (0 to %d, 0 = disable, default: %d)"),
+        MAX_PREFETCH_THREADS, DEFAULT_PREFETCH_THREADS));
+    if (showDebug)
+        strUsage += HelpMessageOpt("-schedulerthreads=<n>", strprintf("Number of threads running background tasks and wallet and ZMQ notifications. With more than one, one of them is kept free of periodic maintenance tasks; with more than two, those may run concurrently (1 to %d, default: %d)",
+            MAX_SCHEDULER_THREADS, DEFAULT_SCHEDULER_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
-    strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by enabling pruning (deleting) of old blocks. This allows the pruneblockchain RPC to be called to delete specific blocks, and enables automatic pruning of old blocks if a target size in MiB is provided. This mode is incompatible with -txindex and -rescan. "
+    strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by enabling pruning (deleting) of old blocks. This allows the pruneblockchain RPC to be called to delete specific blocks, and enables automatic pruning of old blocks if a target size in MiB is provided. This mode is incompatible with -txindex, -addressindex, -blockfilterindex and -rescan. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >%u = automatically prune block files to stay under the specified target size in MiB)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
@@ -353,7 +394,7 @@ std::string HelpMessage(HelpMessageMode mode)
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
-    strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
+    strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call. The index is built in the background (default: %u)"), DEFAULT_TXINDEX));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open"));
@@ -375,12 +416,18 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
+    strUsage += HelpMessageOpt("-peerblockfilters", strprintf(_("Serve BIP 157 compact block filters to peers, requires -blockfilterindex (default: %u)"), DEFAULT_PEERBLOCKFILTERS));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with bloom filters (default: %u)"), DEFAULT_PEERBLOOMFILTERS));
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), Params(CBaseChainParams::MAIN).GetDefaultPort(), Params(CBaseChainParams::TESTNET).GetDefaultPort()));
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-rpcserialversion", strprintf(_("Sets the serialization of raw transaction or block hex returned in non-verbose mode, non-segwit(0) or segwit(1) (default: %d)"), DEFAULT_RPC_SERIALIZE_VERSION));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+#ifdef HAVE_SYS_EPOLL_H
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("Socket events mode, either 'select' or 'epoll' (default: %s)"), DEFAULT_SOCKETEVENTS));
+#else
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("Socket events mode, only 'select' is supported on this platform (default: %s)"), DEFAULT_SOCKETEVENTS));
+#endif
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
@@ -443,6 +490,7 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-logtimemicros", strprintf("Add microsecond precision to debug timestamps (default: %u)", DEFAULT_LOGTIMEMICROS));
+        strUsage += HelpMessageOpt("-logqueuesize=<n>", strprintf("Queue up to <n> KiB of messages for the thread writing debug.log, dropping any beyond that; 0 writes them directly (default: %u)", DEFAULT_LOG_QUEUE_SIZE));
         strUsage += HelpMessageOpt("-mocktime=<n>", "Replace actual time with <n> seconds since epoch (default: 0)");
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
@@ -482,6 +530,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), DEFAULT_REST_ENABLE));
+    strUsage += HelpMessageOpt("-metrics", strprintf(_("Serve metrics in the Prometheus text format at /metrics on the RPC port, without authentication (default: %u)"), DEFAULT_METRICS_ENABLE));
     strUsage += HelpMessageOpt("-rpcbind=<addr>[:port]", _("Bind to given address to listen for JSON-RPC connections. This option is ignored unless -rpcallowip is also passed. Port is optional and overrides -rpcport. Use [host]:port notation for IPv6. This option can be specified multiple times (default: 127.0.0.1 and ::1 i.e., localhost, or if -rpcallowip has been specified, 0.0.0.0 and :: i.e., all addresses)"));
     strUsage += HelpMessageOpt("-rpccookiefile=<loc>", _("Location of the auth cookie (default: data dir)"));
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
@@ -531,6 +580,57 @@ static void BlockNotifyCallback(bool initialSync, const CBlockIndex *pBlockIndex
     boost::thread t(runCommand, strCmd); // thread runs free
 }
 
+static void LogSchedulerStats(const CScheduler& scheduler)
+{
+    if (!LogAcceptCategory("bench"))
+        return;
+    static const char* const names[] = {"high", "normal", "low"};
+    for (int priority = CScheduler::PRIORITY_HIGH; priority < CScheduler::PRIORITY_COUNT; priority++) {
+        CScheduler::Stats stats = scheduler.getStats((CScheduler::Priority)priority);
+        LogPrintf("Scheduler %s priority: %u tasks, delay %.2fms (max %.2fms), run %.2fms\n", names[priority], stats.nTasks,
+            stats.nTasks ? stats.nDelayMicros * 0.001 / stats.nTasks : 0.0, stats.nMaxDelayMicros * 0.001,
+            stats.nTasks ? stats.nRunMicros * 0.001 / stats.nTasks : 0.0);
+    }
+}
+
+/**
+ * Start advertising NODE_COMPACT_FILTERS once the block filter index has
+ * caught up with the chain, so that peers are not told about filters we
+ * cannot serve yet. Checks again every second until then.
+ */
+static void AdvertiseBlockFilters(CScheduler& scheduler)
+{
+    if (!g_blockfilterindex || !g_connman)
+        return;
+    if (!g_blockfilterindex->IsSynced()) {
+        scheduler.scheduleFromNow(boost::bind(&AdvertiseBlockFilters, boost::ref(scheduler)), 1000, CScheduler::PRIORITY_LOW);
+        return;
+    }
+    g_connman->AddLocalServices(NODE_COMPACT_FILTERS);
+    LogPrintf("Block filter index is synced, advertising NODE_COMPACT_FILTERS to new peers\n");
+}
+
+/**
+ * Advertise NODE_NETWORK again once the blocks below the UTXO snapshot base
+ * have been downloaded and validated. Checks again every ten seconds until then.
+ */
+static void AdvertiseSnapshotBlocks(CScheduler& scheduler)
+{
+    if (!g_connman)
+        return;
+    bool fValidated;
+    {
+        LOCK(cs_main);
+        fValidated = fSnapshotValidated;
+    }
+    if (!fValidated) {
+        scheduler.scheduleFromNow(boost::bind(&AdvertiseSnapshotBlocks, boost::ref(scheduler)), 10000, CScheduler::PRIORITY_LOW);
+        return;
+    }
+    g_connman->AddLocalServices(NODE_NETWORK);
+    LogPrintf("UTXO snapshot validated, advertising NODE_NETWORK to new peers\n");
+}
+
 static bool fHaveGenesis = false;
 static boost::mutex cs_GenesisWait;
 static CConditionVariable condvar_GenesisWait;
@@ -706,6 +806,8 @@ bool AppInitServers(boost::thread_group& threadGroup)
         return false;
     if (GetBoolArg("-rest", DEFAULT_REST_ENABLE) && !StartREST())
         return false;
+    if (GetBoolArg("-metrics", DEFAULT_METRICS_ENABLE) && !StartMetrics())
+        return false;
     if (!StartHTTPServer())
         return false;
     return true;
@@ -797,6 +899,7 @@ ServiceFlags nRelevantServices = NODE_NETWORK;
 int nMaxConnections;
 int nUserMaxConnections;
 int nFD;
+SocketEventsMode socketEventsMode = SOCKETEVENTS_SELECT;
 ServiceFlags nLocalServices = NODE_NETWORK;
 
 }
@@ -883,7 +986,12 @@ bool AppInitParameterInteraction()
     if (GetArg("-prune", 0)) {
         if (GetBoolArg("-txindex", DEFAULT_TXINDEX))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX))
+            return InitError(_("Prune mode is incompatible with -addressindex."));
+        if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("Prune mode is incompatible with -blockfilterindex."));
     }
+    fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
 
     // Make sure enough file descriptors are available
     int nBind = std::max(
@@ -892,8 +1000,21 @@ bool AppInitParameterInteraction()
     nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
+    std::string strSocketEvents = GetArg("-socketevents", DEFAULT_SOCKETEVENTS);
+    if (strSocketEvents == "select") {
+        socketEventsMode = SOCKETEVENTS_SELECT;
+#ifdef HAVE_SYS_EPOLL_H
+    } else if (strSocketEvents == "epoll") {
+        socketEventsMode = SOCKETEVENTS_EPOLL;
+#endif
+    } else {
+        return InitError(strprintf(_("Invalid -socketevents ('%s') specified"), strSocketEvents));
+    }
+
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
+    // select() cannot wait on descriptors beyond FD_SETSIZE, epoll has no such limit
+    if (socketEventsMode == SOCKETEVENTS_SELECT)
+        nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
     nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + MAX_ADDNODE_CONNECTIONS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -969,6 +1090,9 @@ bool AppInitParameterInteraction()
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    nPrefetchThreads = std::max(0, std::min((int)GetArg("-prefetchthreads", DEFAULT_PREFETCH_THREADS), MAX_PREFETCH_THREADS));
+    nSchedulerThreads = std::max(1, std::min((int)GetArg("-schedulerthreads", DEFAULT_SCHEDULER_THREADS), MAX_SCHEDULER_THREADS));
+
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
     int64_t nPruneArg = GetArg("-prune", 0);
     if (nPruneArg < 0) {
@@ -1055,6 +1179,12 @@ bool AppInitParameterInteraction()
     if (GetBoolArg("-peerbloomfilters", DEFAULT_PEERBLOOMFILTERS))
         nLocalServices = ServiceFlags(nLocalServices | NODE_BLOOM);
 
+    if (GetBoolArg("-peerblockfilters", DEFAULT_PEERBLOCKFILTERS)) {
+        if (!GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("Cannot set -peerblockfilters without -blockfilterindex."));
+        // NODE_COMPACT_FILTERS is added once the index has synced, see AdvertiseBlockFilters
+    }
+
     if (GetArg("-rpcserialversion", DEFAULT_RPC_SERIALIZE_VERSION) < 0)
         return InitError("rpcserialversion must be non-negative.");
 
@@ -1136,6 +1266,10 @@ bool AppInitSanityChecks()
 {
     // ********************************************************* Step 4: sanity checks
 
+    // Pick the fastest SHA256 implementation this CPU supports
+    std::string sha256_algo = SHA256AutoDetect();
+    LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
+
     // Initialize elliptic curve code
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
@@ -1169,8 +1303,10 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
         ShrinkDebugFile();
     }
 
-    if (fPrintToDebugLog)
+    if (fPrintToDebugLog) {
         OpenDebugLog();
+        StartDebugLogWriter(std::max<int64_t>(GetArg("-logqueuesize", DEFAULT_LOG_QUEUE_SIZE), 0) * 1024);
+    }
 
     if (!fLogTimestamps)
         LogPrintf("Startup time: %s\n", DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()));
@@ -1180,16 +1316,25 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i automatic connections (%i file descriptors available)\n", nMaxConnections, nFD);
 
     InitSignatureCache();
+    LoadSignatureCache();
+    fDumpSigCacheLater = true;
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    LogPrintf("Using %u threads for coins prefetch\n", nPrefetchThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadTxHash);
+        }
     }
 
-    // Start the lightweight task scheduler thread
+    // Start the lightweight task scheduler threads
+    LogPrintf("Using %u threads for the scheduler\n", nSchedulerThreads);
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
-    threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    for (int i = 0; i < nSchedulerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    // Wallet and ZMQ notifications are delivered from it, so that they do not hold up validation
+    RegisterBackgroundSignalScheduler(scheduler);
 
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
@@ -1364,7 +1509,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     pzmqNotificationInterface = CZMQNotificationInterface::Create();
 
     if (pzmqNotificationInterface) {
-        RegisterValidationInterface(pzmqNotificationInterface);
+        RegisterValidationInterface(pzmqNotificationInterface, true);
     }
 #endif
     uint64_t nMaxOutboundLimit = 0; //unlimited unless -maxuploadtarget is set
@@ -1386,17 +1531,37 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greater than nMaxDbcache
     int64_t nBlockTreeDBCache = nTotalCache / 8;
-    nBlockTreeDBCache = std::min(nBlockTreeDBCache, (GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
+    nBlockTreeDBCache = std::min(nBlockTreeDBCache, (GetBoolArg("-txindex", DEFAULT_TXINDEX) || GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
     nTotalCache -= nBlockTreeDBCache;
+    int64_t nFilterIndexCache = 0;
+    if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX)) {
+        nFilterIndexCache = std::min(nTotalCache / 8, nMaxFilterIndexCache << 20);
+        nTotalCache -= nFilterIndexCache;
+    }
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
+    // The blocks below a UTXO snapshot are validated on a second chainstate, which gets a fifth of the coin caches
+    int64_t nSnapshotCoinDBCache = 0;
+    int64_t nSnapshotCoinCacheUsage = 0;
+    if (IsArgSet("-loadsnapshot") || boost::filesystem::exists(GetDataDir() / "chainstate_snapshot")) {
+        nSnapshotCoinDBCache = nCoinDBCache / 5;
+        nCoinDBCache -= nSnapshotCoinDBCache;
+        nSnapshotCoinCacheUsage = nCoinCacheUsage / 5;
+        nCoinCacheUsage -= nSnapshotCoinCacheUsage;
+    }
     int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    if (nFilterIndexCache)
+        LogPrintf("* Using %.1fMiB for block filter index database\n", nFilterIndexCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of unused mempool space)\n", nCoinCacheUsage * (1.0 / 1024 / 1024), nMempoolSizeMax * (1.0 / 1024 / 1024));
+    if (nSnapshotCoinCacheUsage) {
+        LogPrintf("* Using %.1fMiB for UTXO snapshot validation chain state database\n", nSnapshotCoinDBCache * (1.0 / 1024 / 1024));
+        LogPrintf("* Using %.1fMiB for UTXO snapshot validation in-memory UTXO set\n", nSnapshotCoinCacheUsage * (1.0 / 1024 / 1024));
+    }
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1410,14 +1575,28 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinsPrefetch;
+                pcoinsPrefetch = NULL;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
+                // Until it is validated, blocks below a UTXO snapshot may lack the data to rebuild the chainstate from
+                uint256 hashSnapshotBase, hashSnapshotSerialized;
+                uint64_t nSnapshotChainTx;
+                bool fValidatedSnapshot = false;
+                pblocktree->ReadFlag("snapshotvalidated", fValidatedSnapshot);
+                if (fReindexChainState && !fValidatedSnapshot && pblocktree->ReadSnapshotBase(hashSnapshotBase, nSnapshotChainTx, hashSnapshotSerialized))
+                    return InitError(_("-reindex-chainstate is not possible on a chainstate loaded from a UTXO snapshot. Use -reindex to download the full block chain instead."));
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
-                pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                if (nPrefetchThreads > 0) {
+                    pcoinsPrefetch = new CCoinsViewPrefetch(pcoinscatcher, nPrefetchThreads);
+                    pcoinsTip = new CCoinsViewCache(pcoinsPrefetch);
+                } else {
+                    pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                }
 
                 if (fReindex) {
                     pblocktree->WriteReindexing(true);
@@ -1442,9 +1621,9 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
-                // Check for changed -txindex state
-                if (fTxIndex != GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
-                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -txindex");
+                // Check for changed -addressindex state
+                if (fAddressIndex != GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)) {
+                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -addressindex");
                     break;
                 }
 
@@ -1455,6 +1634,36 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                // A UTXO snapshot that was only partially written cannot be used
+                bool fSnapshotLoading = false;
+                pblocktree->ReadFlag("snapshotloading", fSnapshotLoading);
+                if (fSnapshotLoading) {
+                    if (!fReindexChainState) {
+                        strLoadError = _("Loading a UTXO snapshot was interrupted. You need to rebuild the database using -reindex-chainstate");
+                        break;
+                    }
+                    pblocktree->WriteFlag("snapshotloading", false);
+                }
+                bool fSnapshotInvalid = false;
+                pblocktree->ReadFlag("snapshotinvalid", fSnapshotInvalid);
+                if (fSnapshotInvalid) {
+                    strLoadError = _("The UTXO snapshot this chainstate was loaded from is invalid. You need to rebuild the database using -reindex");
+                    break;
+                }
+
+                // If necessary, upgrade from older database format.
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+
+                // The address index is written ahead of the chainstate; this
+                // must happen before anything below disconnects blocks from it
+                if (!ReplayAddressIndex(chainparams)) {
+                    strLoadError = _("Unable to replay the address index. You need to rebuild the database using -reindex-chainstate");
+                    break;
+                }
+
                 if (!fReindex && chainActive.Tip() != NULL) {
                     uiInterface.InitMessage(_("Rewinding blocks..."));
                     if (!RewindBlockIndex(chainparams)) {
@@ -1495,7 +1704,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
             fLoaded = true;
         } while(false);
 
-        if (!fLoaded) {
+        if (!fLoaded && !fRequestShutdown) {
             // first suggest a reindex
             if (!fReset) {
                 bool fRet = uiInterface.ThreadSafeQuestion(
@@ -1525,6 +1734,35 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    if (IsArgSet("-loadsnapshot")) {
+        uiInterface.InitMessage(_("Loading UTXO snapshot..."));
+        std::string strAssumeUTXO = GetArg("-assumeutxo", "");
+        if (!strAssumeUTXO.empty() && (strAssumeUTXO.size() != 64 || !IsHex(strAssumeUTXO)))
+            return InitError(strprintf(_("Invalid -assumeutxo hash '%s'"), strAssumeUTXO));
+        std::string strError;
+        nStart = GetTimeMillis();
+        if (!LoadUTXOSnapshot(chainparams, GetArg("-loadsnapshot", ""), uint256S(strAssumeUTXO), strError))
+            return InitError(strError);
+        LogPrintf(" utxo snapshot %15dms\n", GetTimeMillis() - nStart);
+    }
+
+    // The transaction index catches up with the chain in its own thread
+    if (fTxIndex) {
+        // Until the snapshot is validated, blocks below it may not have been downloaded
+        if (pindexSnapshotBase && !fSnapshotValidated)
+            return InitError(_("-txindex is incompatible with a chainstate loaded from a UTXO snapshot."));
+        g_txindex.reset(new TxIndex());
+        g_txindex->Start();
+    }
+
+    if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX)) {
+        // Filters need the undo data of every block, which is not available below a snapshot
+        if (pindexSnapshotBase)
+            return InitError(_("-blockfilterindex is incompatible with a chainstate loaded from a UTXO snapshot."));
+        g_blockfilterindex.reset(new BlockFilterIndex(BLOCK_FILTER_BASIC, nFilterIndexCache, false, fReindex));
+        g_blockfilterindex->Start();
+    }
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1544,6 +1782,10 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // if pruning, unset the service bit and perform the initial blockstore prune
     // after any wallet rescanning has taken place.
+    if (pindexSnapshotBase && !fSnapshotValidated) {
+        LogPrintf("Unsetting NODE_NETWORK until the blocks before the UTXO snapshot are validated\n");
+        nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
+    }
     if (fPruneMode) {
         LogPrintf("Unsetting NODE_NETWORK on prune mode\n");
         nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
@@ -1553,6 +1795,16 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
         }
     }
 
+    // Blocks below a UTXO snapshot are checked against it as they arrive, on a
+    // second chainstate. If its cache share wasn't set aside above, it comes out
+    // of the in-memory UTXO set.
+    if (pindexSnapshotBase && !fSnapshotValidated && !nSnapshotCoinCacheUsage) {
+        nSnapshotCoinDBCache = nSnapshotCoinCacheUsage = nCoinCacheUsage / 10;
+        nCoinCacheUsage -= nSnapshotCoinDBCache + nSnapshotCoinCacheUsage;
+        LogPrintf("Using %.1fMiB of the in-memory UTXO set for UTXO snapshot validation\n", (nSnapshotCoinDBCache + nSnapshotCoinCacheUsage) * (1.0 / 1024 / 1024));
+    }
+    StartSnapshotValidation(nSnapshotCoinDBCache, nSnapshotCoinCacheUsage);
+
     if ((chainparams.GetConsensus().vDeployments[Consensus::DEPLOYMENT_SEGWIT].nTimeout != 0) ||
        (chainparams.GetConsensus().vDeployments[Consensus::DEPLOYMENT_SEGWIT_AND_2MB_BLOCKS].nTimeout != 0))
          {
@@ -1629,12 +1881,20 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
     connOptions.nMaxOutboundLimit = nMaxOutboundLimit;
+    connOptions.socketEventsMode = socketEventsMode;
 
     if (!connman.Start(scheduler, strNodeError, connOptions))
         return InitError(strNodeError);
 
     // ********************************************************* Step 12: finished
 
+    scheduler.scheduleEvery(LogDBWrapperStats, DBWRAPPER_STATS_LOG_INTERVAL * 1000, CScheduler::PRIORITY_LOW);
+    scheduler.scheduleEvery(boost::bind(&LogSchedulerStats, boost::cref(scheduler)), SCHEDULER_STATS_LOG_INTERVAL * 1000, CScheduler::PRIORITY_LOW);
+    if (GetBoolArg("-peerblockfilters", DEFAULT_PEERBLOCKFILTERS))
+        AdvertiseBlockFilters(scheduler);
+    if (pindexSnapshotBase && !fPruneMode && !(nLocalServices & NODE_NETWORK))
+        AdvertiseSnapshotBlocks(scheduler);
+
     SetRPCWarmupFinished();
     uiInterface.InitMessage(_("Done loading"));
 
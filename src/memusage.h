@@ -6,6 +6,7 @@
 #define BITCOIN_MEMUSAGE_H
 
 #include "indirectmap.h"
+#include "openhashmap.h"
 
 #include <stdlib.h>
 
@@ -131,6 +132,18 @@ static inline size_t IncrementalDynamicUsage(const indirectmap<X, Y>& m)
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X*, Y> >));
 }
 
+// openhashmap allocates its slot array and node pool chunks directly
+
+template<typename X, typename Y, typename Z, typename E>
+static inline size_t DynamicUsage(const openhashmap<X, Y, Z, E>& m)
+{
+    size_t usage = MallocUsage(sizeof(typename openhashmap<X, Y, Z, E>::slot) * m.bucket_count());
+    const std::vector<std::pair<void*, size_t> >& chunks = m.pool().chunks();
+    for (size_t i = 0; i < chunks.size(); i++)
+        usage += MallocUsage(chunks[i].second);
+    return usage + DynamicUsage(chunks);
+}
+
 template<typename X>
 static inline size_t DynamicUsage(const std::unique_ptr<X>& p)
 {
@@ -0,0 +1,218 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "metrics.h"
+
+#include "httpserver.h"
+#include "net.h"
+#include "protocol.h"
+#include "rpc/protocol.h"
+#include "tinyformat.h"
+#include "txmempool.h"
+#include "validation.h"
+
+#include <map>
+#include <mutex>
+
+const std::array<int64_t, CMetricHistogram::NUM_BUCKETS - 1> CMetricHistogram::BUCKET_BOUNDS = {{
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 10000000
+}};
+
+CMetricHistogram::CMetricHistogram() : nCount(0), nSumMicros(0)
+{
+    for (std::atomic<uint64_t>& bucket : buckets)
+        bucket = 0;
+}
+
+void CMetricHistogram::Observe(int64_t nMicros)
+{
+    size_t i = std::lower_bound(BUCKET_BOUNDS.begin(), BUCKET_BOUNDS.end(), nMicros) - BUCKET_BOUNDS.begin();
+    buckets[i].fetch_add(1, std::memory_order_relaxed);
+    nSumMicros.fetch_add(nMicros, std::memory_order_relaxed);
+    nCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CMetricHistogram::Render(std::string& out, const std::string& name, const std::string& labels) const
+{
+    const std::string prefix = labels.empty() ? "" : labels + ",";
+    uint64_t nCumulative = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        nCumulative += buckets[i].load(std::memory_order_relaxed);
+        std::string le = i < BUCKET_BOUNDS.size() ? strprintf("%g", BUCKET_BOUNDS[i] * 0.000001) : "+Inf";
+        out += strprintf("%s_bucket{%sle=\"%s\"} %u\n", name, prefix, le, nCumulative);
+    }
+    const std::string braced = labels.empty() ? "" : "{" + labels + "}";
+    out += strprintf("%s_sum%s %.6f\n", name, braced, nSumMicros.load(std::memory_order_relaxed) * 0.000001);
+    out += strprintf("%s_count%s %u\n", name, braced, nCount.load(std::memory_order_relaxed));
+}
+
+namespace {
+
+const char* const BLOCK_PHASE_NAMES[BLOCK_PHASE_COUNT] = {
+    "read_from_disk",
+    "check",
+    "forks",
+    "connect_txs",
+    "verify",
+    "index",
+    "callbacks",
+    "flush",
+    "chainstate",
+    "post_connect",
+    "total",
+};
+
+CMetricHistogram blockConnectPhases[BLOCK_PHASE_COUNT];
+
+struct MessageBytes
+{
+    std::atomic<uint64_t> nSent;
+    std::atomic<uint64_t> nRecv;
+    MessageBytes() : nSent(0), nRecv(0) {}
+};
+
+const std::string MESSAGE_COMMAND_OTHER = "*other*";
+
+/** One entry per known command, never modified after construction */
+std::map<std::string, MessageBytes>& GetMessageBytes()
+{
+    static std::map<std::string, MessageBytes> mapMessageBytes;
+    static std::once_flag once;
+    std::call_once(once, []() {
+        for (const std::string& msg : getAllNetMessageTypes())
+            mapMessageBytes[msg];
+        mapMessageBytes[MESSAGE_COMMAND_OTHER];
+    });
+    return mapMessageBytes;
+}
+
+struct RPCStats
+{
+    CMetricHistogram duration;
+    std::atomic<uint64_t> nErrors;
+    RPCStats() : nErrors(0) {}
+};
+
+std::mutex cs_rpcStats;
+/** Only grows; entries are never erased, so pointers to them stay valid */
+std::map<std::string, RPCStats> mapRPCStats;
+
+std::atomic<int> nChainHeight(-1);
+std::atomic<size_t> nCoinsCacheUsage(0);
+std::atomic<size_t> nCoinsCacheEntries(0);
+
+void RenderHeader(std::string& out, const std::string& name, const std::string& type, const std::string& help)
+{
+    out += strprintf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+template <typename T>
+void RenderGauge(std::string& out, const std::string& name, const std::string& help, T value)
+{
+    RenderHeader(out, name, "gauge", help);
+    out += strprintf("%s %d\n", name, value);
+}
+
+bool metrics_handler(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (req->GetRequestMethod() != HTTPRequest::GET) {
+        req->WriteReply(HTTP_BAD_METHOD, "Only GET requests allowed");
+        return false;
+    }
+    req->WriteHeader("Content-Type", "text/plain; version=0.0.4");
+    req->WriteReply(HTTP_OK, RenderMetrics());
+    return true;
+}
+
+}
+
+void RecordBlockConnectPhase(BlockConnectPhase phase, int64_t nMicros)
+{
+    blockConnectPhases[phase].Observe(nMicros);
+}
+
+void RecordMessageBytes(bool fSent, const std::string& strCommand, uint64_t nBytes)
+{
+    std::map<std::string, MessageBytes>& mapMessageBytes = GetMessageBytes();
+    std::map<std::string, MessageBytes>::iterator it = mapMessageBytes.find(strCommand);
+    if (it == mapMessageBytes.end())
+        it = mapMessageBytes.find(MESSAGE_COMMAND_OTHER);
+    (fSent ? it->second.nSent : it->second.nRecv).fetch_add(nBytes, std::memory_order_relaxed);
+}
+
+void RecordRPCCall(const std::string& strMethod, int64_t nMicros, bool fError)
+{
+    RPCStats* stats;
+    {
+        std::lock_guard<std::mutex> lock(cs_rpcStats);
+        stats = &mapRPCStats[strMethod];
+    }
+    stats->duration.Observe(nMicros);
+    if (fError)
+        stats->nErrors++;
+}
+
+void SetChainStateMetrics(int nHeight, size_t nUsage, size_t nEntries)
+{
+    nChainHeight = nHeight;
+    nCoinsCacheUsage = nUsage;
+    nCoinsCacheEntries = nEntries;
+}
+
+std::string RenderMetrics()
+{
+    std::string out;
+
+    RenderHeader(out, "bitcoin_block_connect_seconds", "histogram", "Time spent in each phase of connecting a block to the tip");
+    for (int i = 0; i < BLOCK_PHASE_COUNT; i++)
+        blockConnectPhases[i].Render(out, "bitcoin_block_connect_seconds", strprintf("phase=\"%s\"", BLOCK_PHASE_NAMES[i]));
+
+    RenderGauge(out, "bitcoin_chain_height", "Height of the active chain tip", nChainHeight.load());
+    RenderGauge(out, "bitcoin_coins_cache_bytes", "Memory usage of the UTXO cache", nCoinsCacheUsage.load());
+    RenderGauge(out, "bitcoin_coins_cache_entries", "Number of entries in the UTXO cache", nCoinsCacheEntries.load());
+
+    RenderGauge(out, "bitcoin_mempool_transactions", "Number of transactions in the mempool", mempool.size());
+    RenderGauge(out, "bitcoin_mempool_bytes", "Total virtual size of the transactions in the mempool", mempool.GetTotalTxSize());
+    RenderGauge(out, "bitcoin_mempool_usage_bytes", "Memory usage of the mempool", mempool.DynamicMemoryUsage());
+
+    if (g_connman) {
+        RenderGauge(out, "bitcoin_peers", "Number of connected peers", g_connman->GetNodeCount(CConnman::CONNECTIONS_ALL));
+        RenderHeader(out, "bitcoin_net_bytes_total", "counter", "Bytes sent and received on all P2P connections");
+        out += strprintf("bitcoin_net_bytes_total{direction=\"sent\"} %u\n", g_connman->GetTotalBytesSent());
+        out += strprintf("bitcoin_net_bytes_total{direction=\"recv\"} %u\n", g_connman->GetTotalBytesRecv());
+    }
+
+    RenderHeader(out, "bitcoin_net_message_bytes_total", "counter", "Bytes of P2P messages by command, including headers");
+    for (const auto& entry : GetMessageBytes()) {
+        out += strprintf("bitcoin_net_message_bytes_total{command=\"%s\",direction=\"sent\"} %u\n", entry.first, entry.second.nSent.load(std::memory_order_relaxed));
+        out += strprintf("bitcoin_net_message_bytes_total{command=\"%s\",direction=\"recv\"} %u\n", entry.first, entry.second.nRecv.load(std::memory_order_relaxed));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(cs_rpcStats);
+        RenderHeader(out, "bitcoin_rpc_duration_seconds", "histogram", "Duration of RPC calls by method");
+        for (const auto& entry : mapRPCStats)
+            entry.second.duration.Render(out, "bitcoin_rpc_duration_seconds", strprintf("method=\"%s\"", entry.first));
+        RenderHeader(out, "bitcoin_rpc_errors_total", "counter", "RPC calls that returned an error, by method");
+        for (const auto& entry : mapRPCStats)
+            out += strprintf("bitcoin_rpc_errors_total{method=\"%s\"} %u\n", entry.first, entry.second.nErrors.load());
+    }
+
+    return out;
+}
+
+bool StartMetrics()
+{
+    RegisterHTTPHandler("/metrics", true, metrics_handler);
+    return true;
+}
+
+void InterruptMetrics()
+{
+}
+
+void StopMetrics()
+{
+    UnregisterHTTPHandler("/metrics", true);
+}
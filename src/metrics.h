@@ -0,0 +1,80 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_METRICS_H
+#define BITCOIN_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+/** Default for -metrics, serving Prometheus metrics at /metrics on the RPC port */
+static const bool DEFAULT_METRICS_ENABLE = false;
+
+/**
+ * Histogram of durations, with fixed buckets from 100us to 10s. All members
+ * are atomics, so recording is lock free; a scrape may see a recording half
+ * done, which only skews the numbers it reports by one sample.
+ */
+class CMetricHistogram
+{
+public:
+    static const size_t NUM_BUCKETS = 16;
+    /** Upper bounds of the buckets in microseconds, the last one is +Inf */
+    static const std::array<int64_t, NUM_BUCKETS - 1> BUCKET_BOUNDS;
+
+    CMetricHistogram();
+
+    void Observe(int64_t nMicros);
+
+    /** Append the series of this histogram in the text exposition format */
+    void Render(std::string& out, const std::string& name, const std::string& labels) const;
+
+private:
+    std::array<std::atomic<uint64_t>, NUM_BUCKETS> buckets;
+    std::atomic<uint64_t> nCount;
+    std::atomic<int64_t> nSumMicros;
+};
+
+/** Phases of connecting a block, matching the "bench" log category timings */
+enum BlockConnectPhase
+{
+    BLOCK_PHASE_READ_FROM_DISK,
+    BLOCK_PHASE_CHECK,
+    BLOCK_PHASE_FORKS,
+    BLOCK_PHASE_CONNECT_TXS,
+    BLOCK_PHASE_VERIFY,
+    BLOCK_PHASE_INDEX,
+    BLOCK_PHASE_CALLBACKS,
+    BLOCK_PHASE_FLUSH,
+    BLOCK_PHASE_CHAINSTATE,
+    BLOCK_PHASE_POST_CONNECT,
+    BLOCK_PHASE_TOTAL,
+    BLOCK_PHASE_COUNT
+};
+
+/** Record how long a phase of connecting a block took */
+void RecordBlockConnectPhase(BlockConnectPhase phase, int64_t nMicros);
+
+/** Record the bytes of a P2P message; unknown commands are counted as "*other*" */
+void RecordMessageBytes(bool fSent, const std::string& strCommand, uint64_t nBytes);
+
+/** Record the duration of an RPC call */
+void RecordRPCCall(const std::string& strMethod, int64_t nMicros, bool fError);
+
+/** Publish the chain tip height and coins cache size, so that scrapes do not need cs_main */
+void SetChainStateMetrics(int nHeight, size_t nUsage, size_t nEntries);
+
+/** Render all metrics in the Prometheus text exposition format */
+std::string RenderMetrics();
+
+/** Register the /metrics handler with the HTTP server */
+bool StartMetrics();
+/** Interrupt metrics */
+void InterruptMetrics();
+/** Unregister the /metrics handler */
+void StopMetrics();
+
+#endif // BITCOIN_METRICS_H
@@ -151,6 +151,102 @@ static BlockAssembler::Options DefaultOptions(const CChainParams& params)
 
 BlockAssembler::BlockAssembler(const CChainParams& params) : BlockAssembler(params, DefaultOptions(params)) {}
 
+//! Transactions that entered the mempool are kept for at most this many before the candidate is dropped
+static const size_t MAX_CANDIDATE_PENDING_TXS = 100000;
+
+/**
+ * The block candidate: the transactions of the last block template, and the
+ * parameters they were selected with. Guarded by mempool.cs.
+ *
+ * As long as no package had to be left out for lack of space, a full
+ * assembly would select every eligible package, so the candidate can be
+ * brought up to date by appending new transactions whose in-mempool parents
+ * it already contains. Any other change to the mempool that could affect the
+ * selection, such as the removal of a selected transaction, invalidates it.
+ */
+struct CBlockCandidate
+{
+    bool fValid;
+    bool fConnected;
+
+    const CBlockIndex* pindexPrev;
+    int nHeight;
+    int64_t nLockTimeCutoff;
+    bool fIncludeWitness;
+    unsigned int nBlockMaxWeight;
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockMaxSigopsCost;
+    CFeeRate blockMinFeeRate;
+    bool fSkippedForLimits;
+
+    uint64_t nBlockWeight;
+    uint64_t nBlockSize;
+    uint64_t nBlockSigOpsCost;
+    CAmount nFees;
+    CTxMemPool::setEntries inBlock;
+    std::vector<CTxMemPool::txiter> vInBlock;
+
+    //! Transactions that entered the mempool since the candidate was stored
+    std::vector<uint256> vPending;
+    //! The mempool's update counter when the candidate was stored, and the
+    //! number of updates accounted for since: any other update means the
+    //! mempool changed in a way the candidate did not follow.
+    unsigned int nTransactionsUpdated;
+    unsigned int nUpdatesSeen;
+
+    CBlockCandidate() : fValid(false), fConnected(false) {}
+
+    void Invalidate()
+    {
+        fValid = false;
+        inBlock.clear();
+        vInBlock.clear();
+        vPending.clear();
+    }
+
+    bool IsCurrent() const
+    {
+        return fValid && mempool.GetTransactionsUpdated() == nTransactionsUpdated + nUpdatesSeen;
+    }
+};
+
+static CBlockCandidate blockCandidate;
+
+static void BlockCandidateEntryAdded(CTransactionRef tx)
+{
+    if (!blockCandidate.IsCurrent())
+        return blockCandidate.Invalidate();
+    if (blockCandidate.fSkippedForLimits || blockCandidate.vPending.size() >= MAX_CANDIDATE_PENDING_TXS)
+        return blockCandidate.Invalidate();
+    blockCandidate.vPending.push_back(tx->GetHash());
+    blockCandidate.nUpdatesSeen++;
+}
+
+static void BlockCandidateEntryRemoved(CTransactionRef tx, MemPoolRemovalReason reason)
+{
+    if (!blockCandidate.IsCurrent())
+        return blockCandidate.Invalidate();
+    if (reason == MemPoolRemovalReason::BLOCK || blockCandidate.fSkippedForLimits)
+        return blockCandidate.Invalidate();
+    // The entry is still in the mempool while this is notified
+    CTxMemPool::txiter it = mempool.mapTx.find(tx->GetHash());
+    if (it == mempool.mapTx.end() || blockCandidate.inBlock.count(it))
+        return blockCandidate.Invalidate();
+    blockCandidate.nUpdatesSeen++;
+}
+
+bool CanUpdateBlockCandidate()
+{
+    LOCK2(cs_main, mempool.cs);
+    return blockCandidate.IsCurrent() && !blockCandidate.fSkippedForLimits && blockCandidate.pindexPrev == chainActive.Tip();
+}
+
+void InvalidateBlockCandidate()
+{
+    LOCK(mempool.cs);
+    blockCandidate.Invalidate();
+}
+
 void BlockAssembler::resetBlock()
 {
     inBlock.clear();
@@ -164,6 +260,9 @@ void BlockAssembler::resetBlock()
     // These counters do not include coinbase tx
     nBlockTx = 0;
     nFees = 0;
+
+    vInBlock.clear();
+    fSkippedForLimits = false;
 }
 
 std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx)
@@ -206,7 +305,11 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     // transaction (which in most cases can be a no-op).
     fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus()) && fMineWitnessTx;
 
-    addPackageTxs();
+    int64_t nTimeStart = GetTimeMicros();
+    bool fIncremental = addCandidateTxs(pindexPrev);
+    if (!fIncremental)
+        addPackageTxs();
+    int64_t nTimeSelected = GetTimeMicros();
 
     nLastBlockTx = nBlockTx;
     nLastBlockSize = nBlockSize;
@@ -236,12 +339,111 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
 
     CValidationState state;
     if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+        blockCandidate.Invalidate();
         throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
     }
+    int64_t nTimeValidated = GetTimeMicros();
+    LogPrint("bench", "CreateNewBlock() %s selection: %.2fms, validity: %.2fms\n", fIncremental ? "incremental" : "full",
+             0.001 * (nTimeSelected - nTimeStart), 0.001 * (nTimeValidated - nTimeSelected));
+
+    storeCandidate(pindexPrev);
 
     return std::move(pblocktemplate);
 }
 
+bool BlockAssembler::addCandidateTxs(const CBlockIndex* pindexPrev)
+{
+    CBlockCandidate& candidate = blockCandidate;
+    if (!candidate.IsCurrent() || candidate.pindexPrev != pindexPrev || candidate.nHeight != nHeight ||
+        candidate.nLockTimeCutoff != nLockTimeCutoff || candidate.fIncludeWitness != fIncludeWitness ||
+        candidate.nBlockMaxWeight != nBlockMaxWeight || candidate.nBlockMaxSize != nBlockMaxSize ||
+        candidate.nBlockMaxSigopsCost != nBlockMaxSigopsCost || !(candidate.blockMinFeeRate == blockMinFeeRate))
+        return false;
+
+    for (CTxMemPool::txiter it : candidate.vInBlock) {
+        pblock->vtx.emplace_back(it->GetSharedTx());
+        pblocktemplate->vTxFees.push_back(it->GetFee());
+        pblocktemplate->vTxSigOpsCost.push_back(it->GetSigOpCost());
+    }
+    inBlock.swap(candidate.inBlock);
+    vInBlock.swap(candidate.vInBlock);
+    nBlockWeight = candidate.nBlockWeight;
+    nBlockSize = candidate.nBlockSize;
+    nBlockSigOpsCost = candidate.nBlockSigOpsCost;
+    nBlockTx = vInBlock.size();
+    nFees = candidate.nFees;
+    fSkippedForLimits = candidate.fSkippedForLimits;
+    std::vector<uint256> vPending;
+    vPending.swap(candidate.vPending);
+    candidate.Invalidate();
+
+    bool fSameSelection = true;
+    for (const uint256& hash : vPending) {
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it == mempool.mapTx.end() || inBlock.count(it))
+            continue;
+        // Only transactions whose package is just themselves can be
+        // appended; anything else may change which packages are best.
+        for (const CTxMemPoolEntry* parent : mempool.GetMemPoolParents(it)) {
+            if (!inBlock.count(mempool.mapTx.iterator_to(*parent))) {
+                fSameSelection = false;
+                break;
+            }
+        }
+        if (!fSameSelection)
+            break;
+        if (it->GetModifiedFee() < blockMinFeeRate.GetFee(it->GetTxSize()))
+            continue;
+        if (!IsFinalTx(it->GetTx(), nHeight, nLockTimeCutoff) || (!fIncludeWitness && it->GetTx().HasWitness()))
+            continue;
+        // What remains is whether it fits
+        CTxMemPool::setEntries package;
+        package.insert(it);
+        if (!TestPackage(it->GetTxSize(), it->GetSigOpCost()) || !TestPackageTransactions(package)) {
+            fSameSelection = false;
+            break;
+        }
+        AddToBlock(it);
+    }
+
+    if (!fSameSelection) {
+        resetBlock();
+        pblock->vtx.resize(1);
+        pblocktemplate->vTxFees.resize(1);
+        pblocktemplate->vTxSigOpsCost.resize(1);
+    }
+    return fSameSelection;
+}
+
+void BlockAssembler::storeCandidate(const CBlockIndex* pindexPrev)
+{
+    CBlockCandidate& candidate = blockCandidate;
+    if (!candidate.fConnected) {
+        mempool.NotifyEntryAdded.connect(&BlockCandidateEntryAdded);
+        mempool.NotifyEntryRemoved.connect(&BlockCandidateEntryRemoved);
+        candidate.fConnected = true;
+    }
+    candidate.Invalidate();
+    candidate.pindexPrev = pindexPrev;
+    candidate.nHeight = nHeight;
+    candidate.nLockTimeCutoff = nLockTimeCutoff;
+    candidate.fIncludeWitness = fIncludeWitness;
+    candidate.nBlockMaxWeight = nBlockMaxWeight;
+    candidate.nBlockMaxSize = nBlockMaxSize;
+    candidate.nBlockMaxSigopsCost = nBlockMaxSigopsCost;
+    candidate.blockMinFeeRate = blockMinFeeRate;
+    candidate.fSkippedForLimits = fSkippedForLimits;
+    candidate.nBlockWeight = nBlockWeight;
+    candidate.nBlockSize = nBlockSize;
+    candidate.nBlockSigOpsCost = nBlockSigOpsCost;
+    candidate.nFees = nFees;
+    candidate.inBlock.swap(inBlock);
+    candidate.vInBlock.swap(vInBlock);
+    candidate.nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    candidate.nUpdatesSeen = 0;
+    candidate.fValid = true;
+}
+
 void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
 {
     for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
@@ -303,6 +505,7 @@ void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
     nBlockSigOpsCost += iter->GetSigOpCost();
     nFees += iter->GetFee();
     inBlock.insert(iter);
+    vInBlock.push_back(iter);
 
     bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
     if (fPrintPriority) {
@@ -442,6 +645,7 @@ void BlockAssembler::addPackageTxs()
         }
 
         if (!TestPackage(packageSize, packageSigOpsCost)) {
+            fSkippedForLimits = true;
             if (fUsingModified) {
                 // Since we always look at the best entry in mapModifiedTx,
                 // we must erase failed entries so that we can consider the
@@ -462,6 +666,9 @@ void BlockAssembler::addPackageTxs()
 
         // Test if all tx's are Final
         if (!TestPackageTransactions(ancestors)) {
+            // The package may also have been too large for -blockmaxsize
+            if (fNeedSizeAccounting)
+                fSkippedForLimits = true;
             if (fUsingModified) {
                 mapModifiedTx.get<ancestor_score>().erase(modit);
                 failedTx.insert(iter);
@@ -152,6 +152,10 @@ private:
     uint64_t nBlockSigOpsCost;
     CAmount nFees;
     CTxMemPool::setEntries inBlock;
+    // The entries of inBlock, in block order
+    std::vector<CTxMemPool::txiter> vInBlock;
+    // Whether a package was left out because it did not fit
+    bool fSkippedForLimits;
 
     // Chain context for the block
     int nHeight;
@@ -185,6 +189,12 @@ private:
     // Methods for how to add transactions to a block.
     /** Add transactions based on feerate including unconfirmed ancestors */
     void addPackageTxs();
+    /** Take over the transactions of the block candidate and add those that
+      * entered the mempool since. Returns false, leaving the block empty, if
+      * that would not select the same transactions as addPackageTxs. */
+    bool addCandidateTxs(const CBlockIndex* pindexPrev);
+    /** Make the transactions of this block the block candidate */
+    void storeCandidate(const CBlockIndex* pindexPrev);
 
     // helper functions for addPackageTxs()
     /** Remove confirmed (inBlock) entries from given set */
@@ -206,6 +216,16 @@ private:
     void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/**
+ * The transactions selected for the last block template are kept as the
+ * block candidate, and followed as transactions enter the mempool, so that
+ * the next template does not have to be assembled from scratch. This
+ * returns whether the candidate can still be extended that way.
+ */
+bool CanUpdateBlockCandidate();
+/** Drop the block candidate, so that the next template is assembled from scratch. */
+void InvalidateBlockCandidate();
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
@@ -16,6 +16,7 @@
 #include "crypto/common.h"
 #include "crypto/sha256.h"
 #include "hash.h"
+#include "metrics.h"
 #include "primitives/transaction.h"
 #include "netbase.h"
 #include "scheduler.h"
@@ -28,6 +29,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -41,6 +46,9 @@
 // Dump addresses to peers.dat and banlist.dat every 15 minutes (900s)
 #define DUMP_ADDRESSES_INTERVAL 900
 
+// How long the socket handler waits for socket events before polling nodes again (milliseconds)
+#define SOCKET_EVENTS_TIMEOUT 50
+
 // We add a random period time (0 to 1 seconds) to feeler connections to prevent synchronization.
 #define FEELER_SLEEP_WINDOW 1
 
@@ -366,7 +374,7 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (socketEventsMode == SOCKETEVENTS_SELECT && !IsSelectableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -727,6 +735,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
                 i = mapRecvBytesPerMsgCmd.find(NET_MESSAGE_COMMAND_OTHER);
             assert(i != mapRecvBytesPerMsgCmd.end());
             i->second += msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
+            RecordMessageBytes(false, i->first, msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE);
 
             msg.nTime = nTimeMicros;
             complete = true;
@@ -855,9 +864,11 @@ size_t CConnman::SocketSendData(CNode *pnode) const
                 it++;
             } else {
                 // could not send full message; stop sending more
+                pnode->fSocketWritable = false;
                 break;
             }
         } else {
+            pnode->fSocketWritable = false;
             if (nBytes < 0) {
                 // error
                 int nErr = WSAGetLastError();
@@ -1060,7 +1071,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (socketEventsMode == SOCKETEVENTS_SELECT && !IsSelectableSocket(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1105,13 +1116,192 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
 
     {
         LOCK(cs_vNodes);
+        if (!RegisterSocketEvents(pnode))
+            pnode->CloseSocketDisconnect();
         vNodes.push_back(pnode);
     }
 }
 
+bool CConnman::RegisterSocketEvents(CNode* pnode)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (socketEventsMode != SOCKETEVENTS_EPOLL)
+        return true;
+
+    // The registration stays in place for the lifetime of the socket and is
+    // dropped by the kernel when the socket is closed.
+    AssertLockHeld(cs_vNodes);
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket == INVALID_SOCKET)
+        return false;
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.fd = pnode->hSocket;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("epoll_ctl failed for peer=%d: %s\n", pnode->id, NetworkErrorString(WSAGetLastError()));
+        return false;
+    }
+    // A closed socket's number may have been reused, replacing its entry
+    mapEventSockets[pnode->hSocket] = pnode;
+    pnode->hEventSocket = pnode->hSocket;
+    // Data that arrived before the registration is not reported
+    setNodesPendingIO.insert(pnode);
+#endif
+    return true;
+}
+
+void CConnman::UnregisterSocketEvents(CNode* pnode)
+{
+    AssertLockHeld(cs_vNodes);
+    std::map<SOCKET, CNode*>::iterator it = mapEventSockets.find(pnode->hEventSocket);
+    if (it != mapEventSockets.end() && it->second == pnode)
+        mapEventSockets.erase(it);
+    pnode->hEventSocket = INVALID_SOCKET;
+    setNodesPendingIO.erase(pnode);
+}
+
+void CConnman::WaitSocketEventsSelect(std::set<SOCKET>& setRecv, std::set<SOCKET>& setSend, std::set<SOCKET>& setError)
+{
+    std::set<SOCKET> setRecvSelect;
+    std::set<SOCKET> setSendSelect;
+    std::set<SOCKET> setErrorSelect;
+
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        setRecvSelect.insert(hListenSocket.socket);
+    }
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+        {
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is space left in the receive buffer, select() for
+            //   receiving data.
+            // * Hand off all complete messages to the processor, to be handled without
+            //   blocking here.
+
+            bool select_recv = !pnode->fPauseRecv;
+            bool select_send;
+            {
+                LOCK(pnode->cs_vSend);
+                select_send = !pnode->vSendMsg.empty();
+            }
+
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+
+            setErrorSelect.insert(pnode->hSocket);
+            if (select_send) {
+                setSendSelect.insert(pnode->hSocket);
+                continue;
+            }
+            if (select_recv) {
+                setRecvSelect.insert(pnode->hSocket);
+            }
+        }
+    }
+
+    struct timeval timeout = MillisToTimeval(SOCKET_EVENTS_TIMEOUT);
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+
+    BOOST_FOREACH(SOCKET hSocket, setRecvSelect) {
+        FD_SET(hSocket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    BOOST_FOREACH(SOCKET hSocket, setSendSelect) {
+        FD_SET(hSocket, &fdsetSend);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    BOOST_FOREACH(SOCKET hSocket, setErrorSelect) {
+        FD_SET(hSocket, &fdsetError);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    bool have_fds = !setRecvSelect.empty() || !setErrorSelect.empty();
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (interruptNet)
+        return;
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (have_fds)
+        {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            setRecv = setRecvSelect;
+        }
+        interruptNet.sleep_for(std::chrono::milliseconds(SOCKET_EVENTS_TIMEOUT));
+        return;
+    }
+
+    BOOST_FOREACH(SOCKET hSocket, setRecvSelect) {
+        if (FD_ISSET(hSocket, &fdsetRecv))
+            setRecv.insert(hSocket);
+    }
+    BOOST_FOREACH(SOCKET hSocket, setSendSelect) {
+        if (FD_ISSET(hSocket, &fdsetSend))
+            setSend.insert(hSocket);
+    }
+    BOOST_FOREACH(SOCKET hSocket, setErrorSelect) {
+        if (FD_ISSET(hSocket, &fdsetError))
+            setError.insert(hSocket);
+    }
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+void CConnman::WaitSocketEventsEpoll(std::set<SOCKET>& setRecv, std::set<SOCKET>& setSend, std::set<SOCKET>& setError, bool fBlock)
+{
+    // Sockets stay registered between calls, so unlike select() there is no
+    // per-wakeup cost proportional to the number of peers. Events beyond
+    // MAX_EVENTS remain queued in the kernel and are returned by the next call.
+    const int MAX_EVENTS = 256;
+    struct epoll_event events[MAX_EVENTS];
+
+    int nEvents = epoll_wait(epollfd, events, MAX_EVENTS, fBlock ? SOCKET_EVENTS_TIMEOUT : 0);
+    if (interruptNet)
+        return;
+
+    if (nEvents < 0)
+    {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            interruptNet.sleep_for(std::chrono::milliseconds(SOCKET_EVENTS_TIMEOUT));
+        }
+        return;
+    }
+
+    for (int i = 0; i < nEvents; i++) {
+        SOCKET hSocket = events[i].data.fd;
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+            setRecv.insert(hSocket);
+        if (events[i].events & EPOLLOUT)
+            setSend.insert(hSocket);
+        if (events[i].events & (EPOLLERR | EPOLLHUP))
+            setError.insert(hSocket);
+    }
+}
+#endif
+
 void CConnman::ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+    int64_t nLastInactivityCheck = 0;
+    bool fRecvPending = false;
     while (!interruptNet)
     {
         //
@@ -1127,6 +1317,7 @@ void CConnman::ThreadSocketHandler()
                 {
                     // remove from vNodes
                     vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                    UnregisterSocketEvents(pnode);
 
                     // release outbound grant (if any)
                     pnode->grantOutbound.Release();
@@ -1176,108 +1367,62 @@ void CConnman::ThreadSocketHandler()
         }
 
         //
-        // Find which sockets have data to receive
+        // Wait for sockets to become ready
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
-            {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
-                //   receiving data.
-                // * Hand off all complete messages to the processor, to be handled without
-                //   blocking here.
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
-
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        std::set<SOCKET> setRecv;
+        std::set<SOCKET> setSend;
+        std::set<SOCKET> setError;
+#ifdef HAVE_SYS_EPOLL_H
+        if (socketEventsMode == SOCKETEVENTS_EPOLL)
+            WaitSocketEventsEpoll(setRecv, setSend, setError, !fRecvPending);
+        else
+#endif
+            WaitSocketEventsSelect(setRecv, setSend, setError);
         if (interruptNet)
             return;
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
-                return;
-        }
-
         //
         // Accept new connections
         //
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && setRecv.count(hListenSocket.socket))
             {
                 AcceptConnection(hListenSocket);
             }
         }
 
+        // Idle peers produce no events with epoll, so there is no point in
+        // sweeping them for inactivity more than once per second.
+        int64_t nTime = GetSystemTimeInSeconds();
+        bool fCheckInactivity = socketEventsMode == SOCKETEVENTS_SELECT || nTime != nLastInactivityCheck;
+        nLastInactivityCheck = nTime;
+        fRecvPending = false;
+
         //
         // Service each socket
         //
         std::vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
+            if (socketEventsMode == SOCKETEVENTS_EPOLL && !fCheckInactivity) {
+                // Only nodes with events or pending I/O have anything to do
+                std::set<CNode*> setNodes(setNodesPendingIO);
+                for (const std::set<SOCKET>* psetEvents : {&setRecv, &setSend, &setError}) {
+                    for (SOCKET hSocket : *psetEvents) {
+                        std::map<SOCKET, CNode*>::const_iterator it = mapEventSockets.find(hSocket);
+                        if (it != mapEventSockets.end())
+                            setNodes.insert(it->second);
+                    }
+                }
+                vNodesCopy.assign(setNodes.begin(), setNodes.end());
+            } else {
+                vNodesCopy = vNodes;
+            }
             BOOST_FOREACH(CNode* pnode, vNodesCopy)
                 pnode->AddRef();
         }
+        std::vector<CNode*> vNodesPendingIO;
         BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
             if (interruptNet)
@@ -1293,9 +1438,27 @@ void CConnman::ThreadSocketHandler()
                 LOCK(pnode->cs_hSocket);
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+                recvSet = setRecv.count(pnode->hSocket) > 0;
+                sendSet = setSend.count(pnode->hSocket) > 0;
+                errorSet = setError.count(pnode->hSocket) > 0;
+            }
+            if (socketEventsMode == SOCKETEVENTS_EPOLL)
+            {
+                // Edge-triggered readability is only reported once, so remember it
+                // until recv() runs dry. As with select(), drain pending sends and
+                // respect the receive flood limit before reading more.
+                if (recvSet || errorSet)
+                    pnode->fHasRecvData = true;
+                recvSet = errorSet = false;
+                LOCK(pnode->cs_vSend);
+                // EPOLLOUT only comes once the socket turns writable again, so
+                // remember it. Until then there is no point in trying to send;
+                // new messages are sent right away by PushMessage.
+                if (sendSet)
+                    pnode->fSocketWritable = true;
+                sendSet = pnode->fSocketWritable && !pnode->vSendMsg.empty();
+                if (pnode->fHasRecvData && !pnode->fPauseRecv)
+                    recvSet = pnode->vSendMsg.empty();
             }
             if (recvSet || errorSet)
             {
@@ -1312,6 +1475,9 @@ void CConnman::ThreadSocketHandler()
                         }
                         if (nBytes > 0)
                         {
+                            // there may be more queued than fit in pchBuf
+                            if (socketEventsMode == SOCKETEVENTS_EPOLL)
+                                fRecvPending = true;
                             bool notify = false;
                             if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
                                 pnode->CloseSocketDisconnect();
@@ -1344,7 +1510,11 @@ void CConnman::ThreadSocketHandler()
                         {
                             // error
                             int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+                            if (nErr == WSAEWOULDBLOCK)
+                            {
+                                pnode->fHasRecvData = false;
+                            }
+                            else if (nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
                             {
                                 if (!pnode->fDisconnect)
                                     LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
@@ -1366,12 +1536,20 @@ void CConnman::ThreadSocketHandler()
                     RecordBytesSent(nBytes);
                 }
             }
+            if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+                bool fPendingIO = pnode->fHasRecvData;
+                if (!fPendingIO) {
+                    LOCK(pnode->cs_vSend);
+                    fPendingIO = pnode->fSocketWritable && !pnode->vSendMsg.empty();
+                }
+                if (fPendingIO)
+                    vNodesPendingIO.push_back(pnode);
+            }
 
             //
             // Inactivity checking
             //
-            int64_t nTime = GetSystemTimeInSeconds();
-            if (nTime - pnode->nTimeConnected > 60)
+            if (fCheckInactivity && nTime - pnode->nTimeConnected > 60)
             {
                 if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
                 {
@@ -1402,6 +1580,15 @@ void CConnman::ThreadSocketHandler()
         }
         {
             LOCK(cs_vNodes);
+            if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+                // Nodes that were not serviced keep their state
+                BOOST_FOREACH(CNode* pnode, vNodesCopy)
+                    setNodesPendingIO.erase(pnode);
+                BOOST_FOREACH(CNode* pnode, vNodesPendingIO) {
+                    if (pnode->hEventSocket != INVALID_SOCKET)
+                        setNodesPendingIO.insert(pnode);
+                }
+            }
             BOOST_FOREACH(CNode* pnode, vNodesCopy)
                 pnode->Release();
         }
@@ -1939,6 +2126,8 @@ bool CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
     GetNodeSignals().InitializeNode(pnode, *this);
     {
         LOCK(cs_vNodes);
+        if (!RegisterSocketEvents(pnode))
+            pnode->CloseSocketDisconnect();
         vNodes.push_back(pnode);
     }
 
@@ -2185,6 +2374,8 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nBestHeight = 0;
     clientInterface = NULL;
     flagInterruptMsgProc = false;
+    socketEventsMode = SOCKETEVENTS_SELECT;
+    epollfd = -1;
 }
 
 NodeId CConnman::GetNewNodeId()
@@ -2214,6 +2405,27 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
 
     SetBestHeight(connOptions.nBestHeight);
 
+    socketEventsMode = connOptions.socketEventsMode;
+#ifdef HAVE_SYS_EPOLL_H
+    if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd == -1) {
+            strNodeError = strprintf("Failed to create epoll instance: %s", NetworkErrorString(WSAGetLastError()));
+            return false;
+        }
+        // Listening sockets are level-triggered; one connection is accepted per iteration
+        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.fd = hListenSocket.socket;
+            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0) {
+                strNodeError = strprintf("Failed to register listening socket with epoll: %s", NetworkErrorString(WSAGetLastError()));
+                return false;
+            }
+        }
+    }
+#endif
+
     clientInterface = connOptions.uiInterface;
     if (clientInterface) {
         clientInterface->InitMessage(_("Loading P2P addresses..."));
@@ -2293,7 +2505,7 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
     threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
 
     // Dump network addresses
-    scheduler.scheduleEvery(std::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL * 1000);
+    scheduler.scheduleEvery(std::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL * 1000, CScheduler::PRIORITY_LOW);
 
     return true;
 }
@@ -2373,7 +2585,15 @@ void CConnman::Stop()
     }
     vNodes.clear();
     vNodesDisconnected.clear();
+    mapEventSockets.clear();
+    setNodesPendingIO.clear();
     vhListenSocket.clear();
+#ifdef HAVE_SYS_EPOLL_H
+    if (epollfd != -1) {
+        close(epollfd);
+        epollfd = -1;
+    }
+#endif
     delete semOutbound;
     semOutbound = NULL;
     delete semAddnode;
@@ -2605,6 +2825,12 @@ ServiceFlags CConnman::GetLocalServices() const
     return nLocalServices;
 }
 
+void CConnman::AddLocalServices(ServiceFlags nServices)
+{
+    ServiceFlags nExpected = nLocalServices;
+    while (!nLocalServices.compare_exchange_weak(nExpected, ServiceFlags(nExpected | nServices))) {}
+}
+
 void CConnman::SetBestHeight(int height)
 {
     nBestHeight.store(height, std::memory_order_release);
@@ -2677,6 +2903,11 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nextSendTimeFeeFilter = 0;
     fPauseRecv = false;
     fPauseSend = false;
+    // Assume data is waiting, so a readiness edge reported before the node was
+    // added to vNodes cannot get lost.
+    fHasRecvData = true;
+    fSocketWritable = true;
+    hEventSocket = INVALID_SOCKET;
     nProcessQueueSize = 0;
 
     BOOST_FOREACH(const std::string &msg, getAllNetMessageTypes())
@@ -2757,6 +2988,7 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 
         //log total amount of bytes per command
         pnode->mapSendBytesPerMsgCmd[msg.command] += nTotalSize;
+        RecordMessageBytes(true, msg.command, nTotalSize);
         pnode->nSendSize += nTotalSize;
 
         if (pnode->nSendSize > nSendBufferMaxSize)
@@ -26,6 +26,7 @@
 #include <stdint.h>
 #include <thread>
 #include <memory>
+#include <set>
 #include <condition_variable>
 
 #ifndef WIN32
@@ -87,6 +88,19 @@ static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
 
+/** Mechanism the socket handler thread uses to wait for socket readiness */
+enum SocketEventsMode {
+    SOCKETEVENTS_SELECT = 0,
+    SOCKETEVENTS_EPOLL = 1,
+};
+
+/** -socketevents default */
+#ifdef HAVE_SYS_EPOLL_H
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+#else
+static const char* const DEFAULT_SOCKETEVENTS = "select";
+#endif
+
 static const ServiceFlags REQUIRED_SERVICES = NODE_NETWORK;
 
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
@@ -145,6 +159,7 @@ public:
         unsigned int nReceiveFloodSize = 0;
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
+        SocketEventsMode socketEventsMode = SOCKETEVENTS_SELECT;
     };
     CConnman(uint64_t seed0, uint64_t seed1);
     ~CConnman();
@@ -250,6 +265,8 @@ public:
     void AddWhitelistedRange(const CSubNet &subnet);
 
     ServiceFlags GetLocalServices() const;
+    /** Offer additional services to the peers connecting from now on */
+    void AddLocalServices(ServiceFlags nServices);
 
     //!set the max outbound target in bytes
     void SetMaxOutboundTarget(uint64_t limit);
@@ -298,6 +315,12 @@ private:
     void ThreadMessageHandler();
     void AcceptConnection(const ListenSocket& hListenSocket);
     void ThreadSocketHandler();
+    bool RegisterSocketEvents(CNode* pnode);
+    void UnregisterSocketEvents(CNode* pnode);
+    void WaitSocketEventsSelect(std::set<SOCKET>& setRecv, std::set<SOCKET>& setSend, std::set<SOCKET>& setError);
+#ifdef HAVE_SYS_EPOLL_H
+    void WaitSocketEventsEpoll(std::set<SOCKET>& setRecv, std::set<SOCKET>& setSend, std::set<SOCKET>& setError, bool fBlock);
+#endif
     void ThreadDNSAddressSeed();
 
     uint64_t CalculateKeyedNetGroup(const CAddress& ad) const;
@@ -370,7 +393,7 @@ private:
     std::atomic<NodeId> nLastNodeId;
 
     /** Services this instance offers */
-    ServiceFlags nLocalServices;
+    std::atomic<ServiceFlags> nLocalServices;
 
     /** Services this instance cares about */
     ServiceFlags nRelevantServices;
@@ -396,6 +419,19 @@ private:
 
     CThreadInterrupt interruptNet;
 
+    /** Which readiness mechanism ThreadSocketHandler uses, see -socketevents */
+    SocketEventsMode socketEventsMode;
+    /** epoll instance holding one edge-triggered registration per node socket */
+    int epollfd;
+    /** Nodes by the socket they registered with epoll, to dispatch its events; protected by cs_vNodes */
+    std::map<SOCKET, CNode*> mapEventSockets;
+    /**
+     * Nodes with unread data (fHasRecvData) or unsent messages on a writable
+     * socket. epoll does not report them again, so these are serviced on every
+     * wakeup along with the nodes that have events; protected by cs_vNodes.
+     */
+    std::set<CNode*> setNodesPendingIO;
+
     std::thread threadDNSAddressSeed;
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
@@ -618,6 +654,19 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+    // Set by the SocketHandler thread (only with -socketevents=epoll) when the socket
+    // was reported readable and has not been drained yet. Edge-triggered readiness is
+    // not reported again until recv() returns EWOULDBLOCK.
+    bool fHasRecvData;
+    // Whether send() can make progress: cleared when it could not send all that
+    // was queued, set again when the socket is reported writable. Edge-triggered
+    // writability is only reported once the send buffer drains, so until then
+    // the SocketHandler thread (with -socketevents=epoll) leaves the queue alone.
+    // Protected by cs_vSend.
+    bool fSocketWritable;
+    // The socket registered with epoll, remembered so the registration can be
+    // forgotten after hSocket was closed. Protected by CConnman::cs_vNodes.
+    SOCKET hEventSocket;
 protected:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -11,6 +11,7 @@
 #include "chainparams.h"
 #include "consensus/validation.h"
 #include "hash.h"
+#include "index/blockfilterindex.h"
 #include "init.h"
 #include "validation.h"
 #include "merkleblock.h"
@@ -105,6 +106,7 @@ namespace {
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
+        int64_t nTimeRequested;                                  //!< When the block was requested, in microseconds.
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
@@ -117,6 +119,13 @@ namespace {
     /** Number of peers from which we're downloading blocks. */
     int nPeersWithValidatedDownloads = 0;
 
+    /** How far ahead of the last block we have in common with a peer we download, see GetBlockDownloadWindow. */
+    unsigned int nBlockDownloadWindow = BLOCK_DOWNLOAD_WINDOW;
+    /** Moving average of the number of blocks connected per second, sampled while downloading. */
+    double dBlocksConnectedPerSecond = 0;
+    int64_t nConnectRateSampleTime = 0;
+    int nConnectRateSampleHeight = 0;
+
     /** Relay map, protected by cs_main. */
     typedef std::map<uint256, CTransactionRef> MapRelay;
     MapRelay mapRelay;
@@ -175,6 +184,12 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Moving averages, in microseconds, of the time between two blocks arriving from this peer while it had
+    //! requests outstanding, and of the time from requesting a block to receiving it. 0 until measured.
+    int64_t nBlockInterval;
+    int64_t nBlockLatency;
+    //! When this peer last delivered a block we requested from it.
+    int64_t nLastBlockDelivered;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -196,6 +211,10 @@ struct CNodeState {
      * otherwise: whether this peer sends non-witnesses in cmpctblocks/blocktxns.
      */
     bool fSupportsDesiredCmpctVersion;
+    //! Number of tx messages at the front of the process queue whose scripts were already verified
+    unsigned int nTxPreverified;
+    //! Whether to keep preverifying this peer's queued transactions; off once one of them failed
+    bool fPreverifyTx;
 
     CNodeState(CAddress addrIn, std::string addrNameIn) : address(addrIn), name(addrNameIn) {
         fCurrentlyConnected = false;
@@ -211,6 +230,9 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nBlockInterval = 0;
+        nBlockLatency = 0;
+        nLastBlockDelivered = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
@@ -218,6 +240,8 @@ struct CNodeState {
         fHaveWitness = false;
         fWantsCmpctWitness = false;
         fSupportsDesiredCmpctVersion = false;
+        nTxPreverified = 0;
+        fPreverifyTx = true;
     }
 };
 
@@ -347,7 +371,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     MarkBlockAsReceived(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL)});
+            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL), GetTimeMicros()});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -363,6 +387,59 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     return true;
 }
 
+// Requires cs_main.
+// Update the download speed of the peer that delivered a block, if we requested it from that peer.
+void RecordBlockDelivery(NodeId nodeid, const uint256& hash, int64_t nNow) {
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid)
+        return;
+    CNodeState *state = State(nodeid);
+    const QueuedBlock& queuedBlock = *itInFlight->second.second;
+    // Time spent idle, with nothing requested, does not count against the peer
+    int64_t nInterval = std::max<int64_t>(1, nNow - std::max(state->nLastBlockDelivered, queuedBlock.nTimeRequested));
+    int64_t nLatency = std::max<int64_t>(1, nNow - queuedBlock.nTimeRequested);
+    state->nBlockInterval = state->nBlockInterval == 0 ? nInterval : (state->nBlockInterval * 7 + nInterval) / 8;
+    state->nBlockLatency = state->nBlockLatency == 0 ? nLatency : (state->nBlockLatency * 7 + nLatency) / 8;
+    state->nLastBlockDelivered = nNow;
+}
+
+// Requires cs_main.
+// Whether the block holding up the download window, in flight from staller, should be requested from state's
+// peer instead: it has to deliver blocks at least twice as fast, and the block has been in flight for longer
+// than it usually takes that peer to deliver one.
+bool ShouldRequestFromFasterPeer(const CNodeState& state, const CNodeState& staller, const uint256& hash, int64_t nNow) {
+    if (state.nBlockInterval == 0)
+        return false;
+    if (staller.nBlockInterval != 0 && staller.nBlockInterval < 2 * state.nBlockInterval)
+        return false;
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::const_iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end())
+        return false;
+    return nNow - itInFlight->second.second->nTimeRequested > state.nBlockLatency;
+}
+
+// Requires cs_main.
+// Sample how fast the tip advances, and size the block download window accordingly.
+void UpdateBlockDownloadWindow(int64_t nNow) {
+    static const int64_t SAMPLE_INTERVAL = 10 * 1000000;
+    if (nConnectRateSampleTime == 0) {
+        nConnectRateSampleTime = nNow;
+        nConnectRateSampleHeight = chainActive.Height();
+        return;
+    }
+    if (nNow - nConnectRateSampleTime < SAMPLE_INTERVAL)
+        return;
+    double dRate = (chainActive.Height() - nConnectRateSampleHeight) * 1000000.0 / (nNow - nConnectRateSampleTime);
+    dBlocksConnectedPerSecond = (dBlocksConnectedPerSecond * 3 + std::max(0.0, dRate)) / 4;
+    nConnectRateSampleTime = nNow;
+    nConnectRateSampleHeight = chainActive.Height();
+    unsigned int nWindow = GetBlockDownloadWindow(dBlocksConnectedPerSecond, fPruneMode);
+    if (nWindow != nBlockDownloadWindow) {
+        LogPrint("net", "Block download window %u -> %u (%.1f blocks/s connected)\n", nBlockDownloadWindow, nWindow, dBlocksConnectedPerSecond);
+        nBlockDownloadWindow = nWindow;
+    }
+}
+
 /** Check whether the last unknown block a peer advertised is not yet known. */
 void ProcessBlockAvailability(NodeId nodeid) {
     CNodeState *state = State(nodeid);
@@ -467,8 +544,9 @@ const CBlockIndex* LastCommonAncestor(const CBlockIndex* pa, const CBlockIndex*
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const Consensus::Params& consensusParams) {
+ *  at most count entries. If the window prevents fetching anything, nodeStaller and pindexStalled are set
+ *  to the peer and block holding it up. */
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const CBlockIndex*& pindexStalled, const Consensus::Params& consensusParams) {
     if (count == 0)
         return;
 
@@ -498,12 +576,13 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
 
     std::vector<const CBlockIndex*> vToFetch;
     const CBlockIndex *pindexWalk = state->pindexLastCommonBlock;
-    // Never fetch further than the best block we know the peer has, or more than BLOCK_DOWNLOAD_WINDOW + 1 beyond the last
+    // Never fetch further than the best block we know the peer has, or more than nBlockDownloadWindow + 1 beyond the last
     // linked block we have in common with this peer. The +1 is so we can detect stalling, namely if we would be able to
     // download that next block if the window were 1 larger.
-    int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
+    int nWindowEnd = state->pindexLastCommonBlock->nHeight + nBlockDownloadWindow;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    const CBlockIndex* pindexWaitingFor = NULL;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -539,6 +618,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
+                        pindexStalled = pindexWaitingFor;
                     }
                     return;
                 }
@@ -549,13 +629,56 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
 }
 
+/** Add the blocks the background validation of a UTXO snapshot needs next to vBlocks, in height order, up to
+ *  nBlockDownloadWindow beyond its progress and until it has at most count entries. */
+void FindNextSnapshotBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, const Consensus::Params& consensusParams) {
+    if (count == 0 || !pindexSnapshotValidated)
+        return;
+
+    CNodeState *state = State(nodeid);
+    assert(state != NULL);
+    if (state->pindexBestKnownBlock == NULL || state->pindexBestKnownBlock->GetAncestor(pindexSnapshotBase->nHeight) != pindexSnapshotBase)
+        return;
+
+    int nWindowEnd = std::min<int>(pindexSnapshotValidated->nHeight + nBlockDownloadWindow, pindexSnapshotBase->nHeight);
+    std::vector<const CBlockIndex*> vWindow;
+    for (const CBlockIndex* pindex = pindexSnapshotBase->GetAncestor(nWindowEnd); pindex != pindexSnapshotValidated; pindex = pindex->pprev)
+        vWindow.push_back(pindex);
+    for (std::vector<const CBlockIndex*>::reverse_iterator it = vWindow.rbegin(); it != vWindow.rend(); ++it) {
+        const CBlockIndex* pindex = *it;
+        if (pindex->nStatus & BLOCK_HAVE_DATA || mapBlocksInFlight.count(pindex->GetBlockHash()))
+            continue;
+        if (!state->fHaveWitness && IsWitnessEnabled(pindex->pprev, consensusParams))
+            return;
+        vBlocks.push_back(pindex);
+        if (vBlocks.size() == count)
+            return;
+    }
+}
+
 } // anon namespace
 
+int GetBlocksInTransitTarget(int64_t nBlockInterval) {
+    if (nBlockInterval <= 0)
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    int64_t nTarget = BLOCK_DOWNLOAD_BUFFER_TIME * 1000000 / nBlockInterval;
+    return std::max<int64_t>(MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(nTarget, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER));
+}
+
+unsigned int GetBlockDownloadWindow(double dBlocksPerSecond, bool fPruned) {
+    // Blocks ahead of the tip keep their block files from being pruned
+    if (fPruned)
+        return BLOCK_DOWNLOAD_WINDOW;
+    double dWindow = dBlocksPerSecond * BLOCK_DOWNLOAD_WINDOW_TIME;
+    return std::max<unsigned int>(BLOCK_DOWNLOAD_WINDOW, std::min<double>(dWindow, MAX_BLOCK_DOWNLOAD_WINDOW));
+}
+
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
@@ -904,12 +1027,14 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
                 recentRejects->reset();
             }
 
-            // Use pcoinsTip->HaveCoinsInCache as a quick approximation to exclude
-            // requesting or processing some txs which have already been included in a block
+            // Use pcoinsTip->HaveCoinInCache as a quick approximation to exclude
+            // requesting or processing some txs which have already been included in a block.
+            // Best effort: only outputs 0 and 1 are probed.
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
                    mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoinsInCache(inv.hash);
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) ||
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
     case MSG_BLOCK:
     case MSG_WITNESS_BLOCK:
@@ -1030,18 +1155,27 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                     pfrom->fDisconnect = true;
                     send = false;
                 }
+                // Blocks are stored with witness serialization. Send them as
+                // they are when that is what the peer asked for, or when the
+                // block predates segwit and cannot contain witness data.
+                bool fSendRaw = inv.type == MSG_WITNESS_BLOCK ||
+                    (inv.type == MSG_BLOCK && !IsWitnessEnabled(mi->second->pprev, consensusParams));
                 // Pruned nodes may have deleted the block, so check whether
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
                     // Send block from disk
                     CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
+                    if (fSendRaw) {
+                        std::vector<unsigned char> vRawBlock;
+                        if (!ReadRawBlockFromDisk(vRawBlock, (*mi).second, Params().MessageStart()))
+                            assert(!"cannot load block from disk");
+                        connman.PushMessage(pfrom, msgMaker.MakeRaw(NetMsgType::BLOCK, std::move(vRawBlock)));
+                    }
+                    else if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
                         assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
+                    else if (inv.type == MSG_BLOCK)
                         connman.PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block));
-                    else if (inv.type == MSG_WITNESS_BLOCK)
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
                     else if (inv.type == MSG_FILTERED_BLOCK)
                     {
                         bool sendMerkleBlock = false;
@@ -1166,6 +1300,194 @@ inline void static SendBlockTransactions(const CBlock& block, const BlockTransac
     connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCKTXN, resp));
 }
 
+/** Maximum number of compact filters that may be requested with one getcfilters. See BIP 157. */
+static const uint32_t MAX_GETCFILTERS_SIZE = 1000;
+/** Maximum number of cf hashes that may be requested with one getcfheaders. See BIP 157. */
+static const uint32_t MAX_GETCFHEADERS_SIZE = 2000;
+/** Interval between compact filter checkpoints. See BIP 157. */
+static const int CFCHECKPT_INTERVAL = 1000;
+
+/**
+ * Validate a getcfilters, getcfheaders or getcfcheckpt request and find the
+ * stop block. Peers that ask for filters we do not serve, or for an unknown
+ * filter type, are disconnected. Returns false if the request should be
+ * ignored.
+ */
+static bool PrepareBlockFilterRequest(CNode* pfrom, uint8_t nFilterType, int nStartHeight,
+                                      const uint256& stopHash, uint32_t nMaxHeightDiff,
+                                      const CBlockIndex*& pindexStop)
+{
+    if (!(pfrom->GetLocalServices() & NODE_COMPACT_FILTERS) || !g_blockfilterindex ||
+        nFilterType != g_blockfilterindex->GetFilterType()) {
+        LogPrint("net", "peer %d requested unsupported block filter type: %d\n", pfrom->id, nFilterType);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    LOCK(cs_main);
+    BlockMap::const_iterator mi = mapBlockIndex.find(stopHash);
+    // Only serve filters for blocks in the active chain, so that a peer cannot
+    // learn about stale blocks it was never sent
+    if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second)) {
+        LogPrint("net", "peer %d requested invalid block hash: %s\n", pfrom->id, stopHash.ToString());
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    pindexStop = mi->second;
+
+    if (nStartHeight < 0 || nStartHeight > pindexStop->nHeight) {
+        LogPrint("net", "peer %d sent invalid getcfilters/getcfheaders with start height %d and stop height %d\n",
+                 pfrom->id, nStartHeight, pindexStop->nHeight);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    uint32_t nHeightDiff = pindexStop->nHeight - nStartHeight;
+    if (nHeightDiff >= nMaxHeightDiff) {
+        LogPrint("net", "peer %d requested too many cfilters/cfheaders: %d / %d\n", pfrom->id, nHeightDiff + 1, nMaxHeightDiff);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    return true;
+}
+
+static void ProcessGetCFilters(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    uint8_t nFilterType;
+    uint32_t nStartHeight;
+    uint256 stopHash;
+    vRecv >> nFilterType >> nStartHeight >> stopHash;
+
+    const CBlockIndex* pindexStop;
+    if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, stopHash, MAX_GETCFILTERS_SIZE, pindexStop))
+        return;
+
+    std::vector<BlockFilter> filters;
+    if (!g_blockfilterindex->LookupFilterRange(nStartHeight, pindexStop, filters)) {
+        LogPrint("net", "Failed to find block filter in index: filter_type=%s, start_height=%d, stop_hash=%s\n",
+                 BlockFilterTypeName(g_blockfilterindex->GetFilterType()), nStartHeight, stopHash.ToString());
+        return;
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    for (const BlockFilter& filter : filters) {
+        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFILTER, filter));
+    }
+}
+
+static void ProcessGetCFHeaders(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    uint8_t nFilterType;
+    uint32_t nStartHeight;
+    uint256 stopHash;
+    vRecv >> nFilterType >> nStartHeight >> stopHash;
+
+    const CBlockIndex* pindexStop;
+    if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, stopHash, MAX_GETCFHEADERS_SIZE, pindexStop))
+        return;
+
+    uint256 prevHeader;
+    if (nStartHeight > 0) {
+        const CBlockIndex* pindexPrev = pindexStop->GetAncestor(nStartHeight - 1);
+        if (!g_blockfilterindex->LookupFilterHeader(pindexPrev, prevHeader)) {
+            LogPrint("net", "Failed to find block filter header in index: filter_type=%s, block_hash=%s\n",
+                     BlockFilterTypeName(g_blockfilterindex->GetFilterType()), pindexPrev->GetBlockHash().ToString());
+            return;
+        }
+    }
+
+    std::vector<uint256> filterHashes;
+    if (!g_blockfilterindex->LookupFilterHashRange(nStartHeight, pindexStop, filterHashes)) {
+        LogPrint("net", "Failed to find block filter hashes in index: filter_type=%s, start_height=%d, stop_hash=%s\n",
+                 BlockFilterTypeName(g_blockfilterindex->GetFilterType()), nStartHeight, stopHash.ToString());
+        return;
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFHEADERS, nFilterType, pindexStop->GetBlockHash(), prevHeader, filterHashes));
+}
+
+static void ProcessGetCFCheckPt(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    uint8_t nFilterType;
+    uint256 stopHash;
+    vRecv >> nFilterType >> stopHash;
+
+    const CBlockIndex* pindexStop;
+    if (!PrepareBlockFilterRequest(pfrom, nFilterType, 0, stopHash, std::numeric_limits<uint32_t>::max(), pindexStop))
+        return;
+
+    std::vector<uint256> headers(pindexStop->nHeight / CFCHECKPT_INTERVAL);
+    for (int i = headers.size() - 1; i >= 0; i--) {
+        const CBlockIndex* pindex = pindexStop->GetAncestor((i + 1) * CFCHECKPT_INTERVAL);
+        if (!g_blockfilterindex->LookupFilterHeader(pindex, headers[i])) {
+            LogPrint("net", "Failed to find block filter header in index: filter_type=%s, block_hash=%s\n",
+                     BlockFilterTypeName(g_blockfilterindex->GetFilterType()), pindex->GetBlockHash().ToString());
+            return;
+        }
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFCHECKPT, nFilterType, pindexStop->GetBlockHash(), headers));
+}
+
+/**
+ * Verify the scripts of ptx together with those of the transactions that
+ * follow it in pfrom's process queue, in parallel. During a relay burst the
+ * queue holds many tx messages; their AcceptToMemoryPool calls then find the
+ * signatures already checked. Messages are only peeked at, not dequeued.
+ * The scripts of a transaction that fails are checked again by
+ * AcceptToMemoryPool, so a peer that sends one gets no more preverification.
+ */
+static void PreverifyQueuedTransactions(CNode* pfrom, const CTransactionRef& ptx)
+{
+    {
+        LOCK(cs_main);
+        CNodeState* state = State(pfrom->GetId());
+        if (state->nTxPreverified > 0) {
+            // This one was verified along with an earlier transaction
+            state->nTxPreverified--;
+            return;
+        }
+        if (!state->fPreverifyTx)
+            return;
+    }
+    if (!nScriptCheckThreads)
+        return;
+
+    std::vector<CTransactionRef> vtx(1, ptx);
+    {
+        LOCK(pfrom->cs_vProcessMsg);
+        for (const CNetMessage& msg : pfrom->vProcessMsg) {
+            if (vtx.size() >= MAX_PREVERIFY_TX_BATCH || msg.hdr.GetCommand() != NetMsgType::TX)
+                break;
+            try {
+                CDataStream vRecv(msg.vRecv.begin(), msg.vRecv.end(), SER_NETWORK, pfrom->GetRecvVersion());
+                vtx.emplace_back();
+                vRecv >> vtx.back();
+            } catch (const std::exception&) {
+                vtx.pop_back();
+                break;
+            }
+        }
+    }
+    if (vtx.size() == 1)
+        return;
+
+    {
+        LOCK(cs_main);
+        State(pfrom->GetId())->nTxPreverified = vtx.size() - 1;
+        // Leave out what the handler is going to skip anyway
+        vtx.erase(std::remove_if(vtx.begin(), vtx.end(), [](const CTransactionRef& tx) { return AlreadyHave(CInv(MSG_TX, tx->GetHash())); }), vtx.end());
+    }
+    std::vector<uint256> vFailed;
+    size_t nVerified = PreverifyTransactions(mempool, vtx, &vFailed);
+    LogPrint("mempool", "Verified scripts of %u of %u queued transactions from peer=%d, %u failed\n", nVerified, vtx.size(), pfrom->id, vFailed.size());
+    if (!vFailed.empty()) {
+        LOCK(cs_main);
+        State(pfrom->GetId())->fPreverifyTx = false;
+    }
+}
+
 bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -1710,6 +2032,24 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     }
 
 
+    else if (strCommand == NetMsgType::GETCFILTERS)
+    {
+        ProcessGetCFilters(pfrom, vRecv, connman);
+    }
+
+
+    else if (strCommand == NetMsgType::GETCFHEADERS)
+    {
+        ProcessGetCFHeaders(pfrom, vRecv, connman);
+    }
+
+
+    else if (strCommand == NetMsgType::GETCFCHECKPT)
+    {
+        ProcessGetCFCheckPt(pfrom, vRecv, connman);
+    }
+
+
     else if (strCommand == NetMsgType::GETHEADERS)
     {
         CBlockLocator locator;
@@ -1786,6 +2126,8 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
+        PreverifyQueuedTransactions(pfrom, ptx);
+
         LOCK(cs_main);
 
         bool fMissingInputs = false;
@@ -2368,7 +2710,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-        vRecv >> *pblock;
+        UnserializeBlock(vRecv, *pblock);
 
         LogPrint("net", "received block %s peer=%d\n", pblock->GetHash().ToString(), pfrom->id);
 
@@ -2382,6 +2724,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             LOCK(cs_main);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
+            RecordBlockDelivery(pfrom->GetId(), hash, GetTimeMicros());
             forceProcessing |= MarkBlockAsReceived(hash);
             // mapBlockSource is only used for sending reject messages and DoS scores,
             // so the race between here and cs_main in ProcessNewBlock is fine.
@@ -3193,10 +3536,13 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        UpdateBlockDownloadWindow(nNow);
+        int nBlocksInTransitTarget = GetBlocksInTransitTarget(state.nBlockInterval);
+        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < nBlocksInTransitTarget) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            const CBlockIndex* pindexStalled = NULL;
+            FindNextBlocksToDownload(pto->GetId(), nBlocksInTransitTarget - state.nBlocksInFlight, vToDownload, staller, pindexStalled, consensusParams);
             BOOST_FOREACH(const CBlockIndex *pindex, vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto, pindex->pprev, consensusParams);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
@@ -3205,11 +3551,30 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                     pindex->nHeight, pto->id);
             }
             if (state.nBlocksInFlight == 0 && staller != -1) {
-                if (State(staller)->nStallingSince == 0) {
+                if (ShouldRequestFromFasterPeer(state, *State(staller), pindexStalled->GetBlockHash(), nNow)) {
+                    // Rather than waiting for the staller, move the request to this peer. This takes the
+                    // block off the staller's queue (it is tracked as in flight from one peer only), so the
+                    // staller is no longer held responsible for it, but a late delivery from it is still accepted.
+                    uint32_t nFetchFlags = GetFetchFlags(pto, pindexStalled->pprev, consensusParams);
+                    vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindexStalled->GetBlockHash()));
+                    MarkBlockAsInFlight(pto->GetId(), pindexStalled->GetBlockHash(), consensusParams, pindexStalled);
+                    LogPrint("net", "Requesting block %s (%d) peer=%d, stalled on peer=%d\n", pindexStalled->GetBlockHash().ToString(),
+                        pindexStalled->nHeight, pto->id, staller);
+                } else if (State(staller)->nStallingSince == 0) {
                     State(staller)->nStallingSince = nNow;
                     LogPrint("net", "Stall started peer=%d\n", staller);
                 }
             }
+            // Capacity left over goes to the blocks below a UTXO snapshot
+            std::vector<const CBlockIndex*> vSnapshotBlocks;
+            FindNextSnapshotBlocksToDownload(pto->GetId(), std::max(nBlocksInTransitTarget - state.nBlocksInFlight, 0), vSnapshotBlocks, consensusParams);
+            BOOST_FOREACH(const CBlockIndex *pindex, vSnapshotBlocks) {
+                uint32_t nFetchFlags = GetFetchFlags(pto, pindex->pprev, consensusParams);
+                vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
+                MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), consensusParams, pindex);
+                LogPrint("net", "Requesting block %s (%d) below the snapshot base peer=%d\n", pindex->GetBlockHash().ToString(),
+                    pindex->nHeight, pto->id);
+            }
         }
 
         //
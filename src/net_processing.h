@@ -17,6 +17,8 @@ static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
 static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
 /** Default number of orphan+recently-replaced txn to keep around for block reconstruction */
 static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
+/** Maximum number of queued transactions from one peer whose scripts are verified together in parallel */
+static const unsigned int MAX_PREVERIFY_TX_BATCH = 64;
 
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals& nodeSignals);
@@ -43,6 +45,11 @@ struct CNodeStateStats {
     std::vector<int> vHeightInFlight;
 };
 
+/** Number of blocks to keep in flight from a peer that delivers one every nBlockInterval microseconds (0 if unknown) */
+int GetBlocksInTransitTarget(int64_t nBlockInterval);
+/** Size of the block download window when blocks are being connected at dBlocksPerSecond */
+unsigned int GetBlockDownloadWindow(double dBlocksPerSecond, bool fPruned);
+
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 /** Increase a node's misbehavior score. */
@@ -0,0 +1,575 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_OPENHASHMAP_H
+#define BITCOIN_OPENHASHMAP_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Pool of fixed size nodes, carved out of geometrically growing chunks.
+ * Freed nodes are kept on a free list for reuse; the chunks themselves are
+ * only returned by release() and compact(). Nodes only move in compact(),
+ * so pointers to them stay valid until then or until they are deallocated.
+ */
+template <typename T>
+class nodepool
+{
+private:
+    union node {
+        node* next;
+        typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage;
+    };
+
+    static const size_t MIN_CHUNK_NODES = 16;
+    static const size_t MAX_CHUNK_NODES = 16384;
+
+    std::vector<std::pair<void*, size_t> > m_chunks; //!< Allocated chunks and their size in bytes
+    node* m_free;                                    //!< Free list of returned nodes
+    node* m_next;                                    //!< Next never-used node in the last chunk
+    node* m_chunk_end;
+    size_t m_total_nodes;
+
+public:
+    nodepool() : m_free(NULL), m_next(NULL), m_chunk_end(NULL), m_total_nodes(0) {}
+    ~nodepool() { release(); }
+
+    nodepool(const nodepool&) = delete;
+    nodepool& operator=(const nodepool&) = delete;
+
+    /** Get uninitialized storage for one T. */
+    void* allocate()
+    {
+        if (m_free) {
+            node* n = m_free;
+            m_free = n->next;
+            return n;
+        }
+        if (m_next == m_chunk_end) {
+            size_t nodes = std::min(std::max(m_total_nodes, size_t(MIN_CHUNK_NODES)), size_t(MAX_CHUNK_NODES));
+            size_t bytes = nodes * sizeof(node);
+            m_next = static_cast<node*>(::operator new(bytes));
+            m_chunk_end = m_next + nodes;
+            m_chunks.push_back(std::make_pair(static_cast<void*>(m_next), bytes));
+            m_total_nodes += nodes;
+        }
+        return m_next++;
+    }
+
+    /** Return storage obtained from allocate(); the T in it must already be destroyed. */
+    void deallocate(void* p)
+    {
+        node* n = static_cast<node*>(p);
+        n->next = m_free;
+        m_free = n;
+    }
+
+    /** Free all chunks. Every T allocated from the pool must already be destroyed. */
+    void release()
+    {
+        for (size_t i = 0; i < m_chunks.size(); i++)
+            ::operator delete(m_chunks[i].first);
+        std::vector<std::pair<void*, size_t> >().swap(m_chunks);
+        m_free = m_next = m_chunk_end = NULL;
+        m_total_nodes = 0;
+    }
+
+    void swap(nodepool& other)
+    {
+        m_chunks.swap(other.m_chunks);
+        std::swap(m_free, other.m_free);
+        std::swap(m_next, other.m_next);
+        std::swap(m_chunk_end, other.m_chunk_end);
+        std::swap(m_total_nodes, other.m_total_nodes);
+    }
+
+    /**
+     * Free the chunks that the live nodes fit without. The T in each live
+     * node of such a chunk is moved into a free node of a chunk that is
+     * kept, so no memory is allocated and usage never rises. The chunks
+     * with the highest share of live nodes are kept.
+     *
+     * forEachLive(f) must call f(T*&) on a reference to every pointer to a
+     * live node, nLive of them; moved nodes are updated through it.
+     * Returns whether any chunk was freed.
+     */
+    template <typename ForEachLive>
+    bool compact(size_t nLive, ForEachLive forEachLive)
+    {
+        const size_t nChunks = m_chunks.size();
+        if (nChunks < 2)
+            return false;
+        // Not even the smallest chunk could be emptied
+        size_t nMinChunkNodes = ChunkNodes(0);
+        for (size_t i = 1; i < nChunks; i++)
+            nMinChunkNodes = std::min(nMinChunkNodes, ChunkNodes(i));
+        if (m_total_nodes - nLive < nMinChunkNodes)
+            return false;
+
+        // Chunk indices by address, to find the chunk of a node
+        std::vector<size_t> byAddress(nChunks);
+        for (size_t i = 0; i < nChunks; i++)
+            byAddress[i] = i;
+        std::sort(byAddress.begin(), byAddress.end(), [this](size_t a, size_t b) { return m_chunks[a].first < m_chunks[b].first; });
+
+        // Mark the live nodes, one bit per node
+        std::vector<std::vector<bool> > vLive(nChunks);
+        std::vector<size_t> vLiveCount(nChunks, 0);
+        for (size_t i = 0; i < nChunks; i++)
+            vLive[i].resize(ChunkNodes(i));
+        struct Mark {
+            nodepool* pool;
+            const std::vector<size_t>* byAddress;
+            std::vector<std::vector<bool> >* vLive;
+            std::vector<size_t>* vLiveCount;
+            void operator()(T*& p) const
+            {
+                size_t i = pool->FindChunk(*byAddress, p);
+                (*vLive)[i][static_cast<node*>(static_cast<void*>(p)) - static_cast<node*>(pool->m_chunks[i].first)] = true;
+                (*vLiveCount)[i]++;
+            }
+        };
+        forEachLive(Mark{this, &byAddress, &vLive, &vLiveCount});
+
+        // Keep the densest chunks until the live nodes fit
+        std::vector<size_t> byDensity(byAddress);
+        std::sort(byDensity.begin(), byDensity.end(), [&vLiveCount, this](size_t a, size_t b) {
+            return vLiveCount[a] * ChunkNodes(b) > vLiveCount[b] * ChunkNodes(a);
+        });
+        std::vector<bool> vKeep(nChunks, false);
+        size_t nKeptNodes = 0;
+        size_t nKept = 0;
+        while (nKeptNodes < nLive) {
+            vKeep[byDensity[nKept]] = true;
+            nKeptNodes += ChunkNodes(byDensity[nKept]);
+            nKept++;
+        }
+        // Drop kept chunks the others can do without, so that compacting again frees nothing
+        for (size_t k = nKept; k-- > 0;) {
+            size_t i = byDensity[k];
+            if (nKeptNodes - ChunkNodes(i) >= nLive) {
+                vKeep[i] = false;
+                nKeptNodes -= ChunkNodes(i);
+                nKept--;
+            }
+        }
+        if (nKept == nChunks)
+            return false;
+
+        // Rebuild the free list from the kept chunks only, including their never-used nodes
+        m_free = m_next = m_chunk_end = NULL;
+        for (size_t i = 0; i < nChunks; i++) {
+            if (!vKeep[i])
+                continue;
+            node* first = static_cast<node*>(m_chunks[i].first);
+            for (size_t j = ChunkNodes(i); j-- > 0;) {
+                if (!vLive[i][j])
+                    deallocate(first + j);
+            }
+        }
+        std::vector<std::vector<bool> >().swap(vLive);
+
+        struct Relocate {
+            nodepool* pool;
+            const std::vector<size_t>* byAddress;
+            const std::vector<bool>* vKeep;
+            void operator()(T*& p) const
+            {
+                if ((*vKeep)[pool->FindChunk(*byAddress, p)])
+                    return;
+                assert(pool->m_free);
+                T* moved = new (pool->allocate()) T(std::move(*p));
+                p->~T();
+                p = moved;
+            }
+        };
+        forEachLive(Relocate{this, &byAddress, &vKeep});
+
+        size_t j = 0;
+        for (size_t i = 0; i < nChunks; i++) {
+            if (vKeep[i]) {
+                m_chunks[j++] = m_chunks[i];
+            } else {
+                m_total_nodes -= ChunkNodes(i);
+                ::operator delete(m_chunks[i].first);
+            }
+        }
+        m_chunks.resize(j);
+        return true;
+    }
+
+    const std::vector<std::pair<void*, size_t> >& chunks() const { return m_chunks; }
+
+private:
+    size_t ChunkNodes(size_t i) const { return m_chunks[i].second / sizeof(node); }
+
+    /** Index of the chunk p was allocated from, given the chunk indices sorted by address. */
+    size_t FindChunk(const std::vector<size_t>& byAddress, const T* p) const
+    {
+        const char* addr = static_cast<const char*>(static_cast<const void*>(p));
+        size_t lo = 0, hi = byAddress.size();
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            if (static_cast<const char*>(m_chunks[byAddress[mid]].first) <= addr)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        assert(addr >= static_cast<const char*>(m_chunks[byAddress[lo]].first) && addr < static_cast<const char*>(m_chunks[byAddress[lo]].first) + m_chunks[byAddress[lo]].second);
+        return byAddress[lo];
+    }
+};
+
+/**
+ * Hash map with open addressing (linear probing), for maps with many small
+ * entries such as the UTXO cache.
+ *
+ * The table itself is a flat array of (hash, node pointer) slots, so a probe
+ * compares cached hashes in adjacent memory and only follows the pointer of a
+ * slot whose full hash matches. Entries live in nodes from a nodepool instead
+ * of separate heap allocations. Because entries never move, references to
+ * them stay valid across insertions and erasures of other entries, as with
+ * std::unordered_map.
+ *
+ * Iterators are invalidated by insertions that grow the table. Erasing leaves
+ * all other iterators valid, so the map can be drained while iterating with
+ * erase(it++) or it = erase(it). Iteration order is unspecified.
+ *
+ * Memory of erased entries is kept for reuse; only clear() and compact()
+ * return it. The slot array is allocated with malloc, so that compact() can
+ * shrink it in place.
+ */
+template <typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K> >
+class openhashmap
+{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const K, V> value_type;
+    typedef size_t size_type;
+
+    struct slot {
+        value_type* node; //!< NULL for an empty or erased slot
+        size_t hash;      //!< Full hash of the key; TOMBSTONE in an erased slot
+    };
+
+private:
+    //! Marks a slot whose entry was erased, so that probes continue past it
+    static const size_t TOMBSTONE = 1;
+    static const size_t MIN_BUCKETS = 16;
+
+    slot* m_slots;
+    size_t m_buckets; //!< Number of slots, a power of two
+    size_t m_size;
+    size_t m_tombstones;
+    nodepool<value_type> m_pool;
+    Hash m_hasher;
+    KeyEqual m_equal;
+
+    static bool IsEmpty(const slot& s) { return !s.node && s.hash != TOMBSTONE; }
+
+    template <bool IsConst>
+    class iter
+    {
+    private:
+        friend class openhashmap;
+        template <bool> friend class iter;
+        slot* m_pos;
+        slot* m_end;
+
+        iter(slot* pos, slot* end) : m_pos(pos), m_end(end) { skip(); }
+        void skip() { while (m_pos != m_end && !m_pos->node) ++m_pos; }
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename openhashmap::value_type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef typename std::conditional<IsConst, const value_type*, value_type*>::type pointer;
+        typedef typename std::conditional<IsConst, const value_type&, value_type&>::type reference;
+
+        iter() : m_pos(NULL), m_end(NULL) {}
+        //! Allow conversion from iterator to const_iterator
+        iter(const iter<false>& other) : m_pos(other.m_pos), m_end(other.m_end) {}
+
+        reference operator*() const { return *m_pos->node; }
+        pointer operator->() const { return m_pos->node; }
+        iter& operator++() { ++m_pos; skip(); return *this; }
+        iter operator++(int) { iter copy(*this); ++*this; return copy; }
+
+        template <bool OtherConst>
+        bool operator==(const iter<OtherConst>& other) const { return m_pos == other.m_pos; }
+        template <bool OtherConst>
+        bool operator!=(const iter<OtherConst>& other) const { return m_pos != other.m_pos; }
+    };
+
+public:
+    typedef iter<false> iterator;
+    typedef iter<true> const_iterator;
+
+    openhashmap() : m_slots(NULL), m_buckets(0), m_size(0), m_tombstones(0) {}
+    ~openhashmap() { clear(); }
+
+    openhashmap(const openhashmap&) = delete;
+    openhashmap& operator=(const openhashmap&) = delete;
+
+    iterator begin() { return iterator(m_slots, m_slots + m_buckets); }
+    iterator end() { return iterator(m_slots + m_buckets, m_slots + m_buckets); }
+    const_iterator begin() const { return const_iterator(m_slots, m_slots + m_buckets); }
+    const_iterator end() const { return const_iterator(m_slots + m_buckets, m_slots + m_buckets); }
+
+    size_type size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    size_type bucket_count() const { return m_buckets; }
+    const nodepool<value_type>& pool() const { return m_pool; }
+
+    iterator find(const K& key) { return iterator(FindSlot(key), m_slots + m_buckets); }
+    const_iterator find(const K& key) const { return const_iterator(FindSlot(key), m_slots + m_buckets); }
+    size_type count(const K& key) const { return FindSlot(key) != m_slots + m_buckets; }
+
+    /** Construct an entry in place; if the key is already present the new entry is discarded. */
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args)
+    {
+        void* mem = m_pool.allocate();
+        value_type* node;
+        try {
+            node = new (mem) value_type(std::forward<Args>(args)...);
+        } catch (...) {
+            m_pool.deallocate(mem);
+            throw;
+        }
+        size_t hash = m_hasher(node->first);
+
+        ReserveOne();
+        slot* pos = ProbeForInsert(node->first, hash);
+        if (pos->node) {
+            DestroyNode(node);
+            return std::make_pair(iterator(pos, m_slots + m_buckets), false);
+        }
+        if (pos->hash == TOMBSTONE)
+            m_tombstones--;
+        pos->node = node;
+        pos->hash = hash;
+        m_size++;
+        return std::make_pair(iterator(pos, m_slots + m_buckets), true);
+    }
+
+    V& operator[](const K& key)
+    {
+        slot* pos = FindSlot(key);
+        if (pos != m_slots + m_buckets)
+            return pos->node->second;
+        return emplace(std::piecewise_construct, std::forward_as_tuple(key), std::tuple<>()).first->second;
+    }
+
+    /** Erase the entry at it, returning an iterator to the next entry. */
+    iterator erase(const_iterator it)
+    {
+        slot* pos = it.m_pos;
+        assert(pos->node);
+        DestroyNode(pos->node);
+        pos->node = NULL;
+        m_size--;
+        if (m_size == 0) {
+            // Drop all tombstones at once; nothing is left to iterate over
+            for (size_t i = 0; i < m_buckets; i++)
+                m_slots[i].hash = 0;
+            m_tombstones = 0;
+            return end();
+        }
+        // A probe that reaches an empty slot right after this one stops there
+        // anyway, so only leave a tombstone if the chain continues.
+        if (IsEmpty(m_slots[(pos - m_slots + 1) & (m_buckets - 1)])) {
+            pos->hash = 0;
+        } else {
+            pos->hash = TOMBSTONE;
+            m_tombstones++;
+        }
+        return iterator(pos, m_slots + m_buckets);
+    }
+
+    size_type erase(const K& key)
+    {
+        const_iterator it = find(key);
+        if (it == end())
+            return 0;
+        erase(it);
+        return 1;
+    }
+
+    /** Remove all entries and free all memory. */
+    void clear()
+    {
+        for (size_t i = 0; i < m_buckets; i++) {
+            if (m_slots[i].node)
+                DestroyNode(m_slots[i].node);
+        }
+        free(m_slots);
+        m_slots = NULL;
+        m_buckets = m_size = m_tombstones = 0;
+        m_pool.release();
+    }
+
+    /**
+     * Return memory held for erased entries without allocating any: free the
+     * pool chunks the remaining entries fit without, moving the entries out
+     * of them, and shrink the table in place if it is at most half needed.
+     * Memory usage never rises above what it was. Invalidates all iterators
+     * and references to entries.
+     */
+    void compact()
+    {
+        if (m_size == 0) {
+            clear();
+            return;
+        }
+        m_pool.compact(m_size, LiveNodes{m_slots, m_buckets});
+        size_t buckets = MIN_BUCKETS;
+        while (m_size * 4 > buckets * 3)
+            buckets *= 2;
+        if (buckets * 2 <= m_buckets)
+            ShrinkTable(buckets);
+    }
+
+private:
+    /** Calls f on the node pointer of every occupied slot, for nodepool::compact */
+    struct LiveNodes {
+        slot* slots;
+        size_t buckets;
+        template <typename F>
+        void operator()(F f) const
+        {
+            for (size_t i = 0; i < buckets; i++) {
+                if (slots[i].node)
+                    f(slots[i].node);
+            }
+        }
+    };
+
+    void DestroyNode(value_type* node)
+    {
+        node->~value_type();
+        m_pool.deallocate(node);
+    }
+
+    slot* FindSlot(const K& key) const
+    {
+        if (m_size == 0)
+            return m_slots + m_buckets;
+        size_t hash = m_hasher(key);
+        size_t mask = m_buckets - 1;
+        for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+            slot& s = m_slots[i];
+            if (s.node) {
+                if (s.hash == hash && m_equal(s.node->first, key))
+                    return &s;
+            } else if (s.hash != TOMBSTONE) {
+                return m_slots + m_buckets;
+            }
+        }
+    }
+
+    /** Find the slot holding key, or else the first free slot on its probe sequence. */
+    slot* ProbeForInsert(const K& key, size_t hash)
+    {
+        size_t mask = m_buckets - 1;
+        slot* free = NULL;
+        for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+            slot& s = m_slots[i];
+            if (s.node) {
+                if (s.hash == hash && m_equal(s.node->first, key))
+                    return &s;
+            } else if (s.hash == TOMBSTONE) {
+                if (!free)
+                    free = &s;
+            } else {
+                return free ? free : &s;
+            }
+        }
+    }
+
+    /** Make sure one more entry fits while keeping the table (including tombstones) at most 3/4 full. */
+    void ReserveOne()
+    {
+        if ((m_size + m_tombstones + 1) * 4 <= m_buckets * 3)
+            return;
+        size_t buckets = std::max(m_buckets, size_t(MIN_BUCKETS));
+        // Grow only if the live entries need it; otherwise this just purges tombstones
+        while ((m_size + 1) * 8 > buckets * 3)
+            buckets *= 2;
+        Rehash(buckets);
+    }
+
+    static slot* AllocateSlots(size_t buckets)
+    {
+        slot* slots = static_cast<slot*>(calloc(buckets, sizeof(slot)));
+        if (!slots)
+            throw std::bad_alloc();
+        return slots;
+    }
+
+    void Rehash(size_t buckets)
+    {
+        slot* slots = AllocateSlots(buckets);
+        size_t mask = buckets - 1;
+        for (size_t i = 0; i < m_buckets; i++) {
+            if (!m_slots[i].node)
+                continue;
+            size_t j = m_slots[i].hash & mask;
+            while (slots[j].node)
+                j = (j + 1) & mask;
+            slots[j] = m_slots[i];
+        }
+        free(m_slots);
+        m_slots = slots;
+        m_buckets = buckets;
+        m_tombstones = 0;
+    }
+
+    /**
+     * Rehash into the first buckets slots of the table and give the rest
+     * back. The live slots are first packed at the end of the table, which
+     * lies past the new one because buckets is at most half the old size
+     * and holds them with room to spare.
+     */
+    void ShrinkTable(size_t buckets)
+    {
+        assert(buckets * 2 <= m_buckets && m_size < buckets);
+        size_t packed = m_buckets;
+        for (size_t i = m_buckets; i-- > 0;) {
+            if (m_slots[i].node)
+                m_slots[--packed] = m_slots[i];
+        }
+        assert(packed >= buckets);
+        for (size_t i = 0; i < buckets; i++)
+            m_slots[i] = slot();
+        size_t mask = buckets - 1;
+        for (size_t i = packed; i < m_buckets; i++) {
+            size_t j = m_slots[i].hash & mask;
+            while (m_slots[j].node)
+                j = (j + 1) & mask;
+            m_slots[j] = m_slots[i];
+        }
+        // Shrinking a block does not need new memory; if it fails the old block stays valid
+        slot* slots = static_cast<slot*>(realloc(m_slots, buckets * sizeof(slot)));
+        if (slots)
+            m_slots = slots;
+        m_buckets = buckets;
+        m_tombstones = 0;
+    }
+};
+
+#endif // BITCOIN_OPENHASHMAP_H
@@ -324,8 +324,10 @@ public:
 private:
     /** Memory only. */
     const uint256 hash;
+    const uint256 m_witness_hash;
 
     uint256 ComputeHash() const;
+    uint256 ComputeWitnessHash() const;
 
 public:
     /** Construct a CTransaction that qualifies as IsNull() */
@@ -353,8 +355,10 @@ public:
         return hash;
     }
 
-    // Compute a hash that includes both transaction and witness data
-    uint256 GetWitnessHash() const;
+    // Hash that includes both transaction and witness data
+    const uint256& GetWitnessHash() const {
+        return m_witness_hash;
+    }
 
     // Return sum of txouts.
     CAmount GetValueOut() const;
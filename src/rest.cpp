@@ -5,6 +5,7 @@
 
 #include "chain.h"
 #include "chainparams.h"
+#include "index/blockfilterindex.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "validation.h"
@@ -12,6 +13,7 @@
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "utilstrencodings.h"
 #include "version.h"
@@ -40,16 +42,21 @@ static const struct {
 };
 
 struct CCoin {
-    uint32_t nTxVer; // Don't call this nVersion, that name has a special meaning inside IMPLEMENT_SERIALIZE
     uint32_t nHeight;
     CTxOut out;
 
     ADD_SERIALIZE_METHODS;
 
+    CCoin() : nHeight(0) {}
+    explicit CCoin(Coin&& in) : nHeight(in.nHeight), out(std::move(in.out)) {}
+
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action)
     {
-        READWRITE(nTxVer);
+        // The UTXO set no longer tracks transaction versions; keep the BIP64
+        // wire layout by writing a zero placeholder.
+        uint32_t nTxVerDummy = 0;
+        READWRITE(nTxVerDummy);
         READWRITE(nHeight);
         READWRITE(out);
     }
@@ -61,6 +68,9 @@ extern UniValue mempoolInfoToJSON();
 extern UniValue mempoolToJSON(bool fVerbose = false);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
+extern bool ParseAddressOrScript(const std::string& strInput, CScript& script);
+extern UniValue addressUnspentToJSON(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vUnspent);
+extern UniValue addressHistoryToJSON(const std::vector<std::pair<CAddressIndexKey, CAmount> >& vHistory);
 
 static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, std::string message)
 {
@@ -514,22 +524,11 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
             view.SetBackend(viewMempool); // switch cache backend to db+mempool in case user likes to query mempool
 
         for (size_t i = 0; i < vOutPoints.size(); i++) {
-            CCoins coins;
-            uint256 hash = vOutPoints[i].hash;
             bool hit = false;
-            if (view.GetCoins(hash, coins)) {
-                mempool.pruneSpent(hash, coins);
-                if (coins.IsAvailable(vOutPoints[i].n)) {
-                    hit = true;
-                    // Safe to index into vout here because IsAvailable checked if it's off the end of the array, or if
-                    // n is valid but points to an already spent output (IsNull).
-                    CCoin coin;
-                    coin.nTxVer = coins.nVersion;
-                    coin.nHeight = coins.nHeight;
-                    coin.out = coins.vout.at(vOutPoints[i].n);
-                    assert(!coin.out.IsNull());
-                    outs.push_back(coin);
-                }
+            Coin coin;
+            if (view.GetCoin(vOutPoints[i], coin) && !mempool.isSpent(vOutPoints[i])) {
+                hit = true;
+                outs.emplace_back(std::move(coin));
             }
 
             hits.push_back(hit);
@@ -573,7 +572,6 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         UniValue utxos(UniValue::VARR);
         BOOST_FOREACH (const CCoin& coin, outs) {
             UniValue utxo(UniValue::VOBJ);
-            utxo.push_back(Pair("txvers", (int32_t)coin.nTxVer));
             utxo.push_back(Pair("height", (int32_t)coin.nHeight));
             utxo.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
 
@@ -600,6 +598,264 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_address_utxos(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    if (!fAddressIndex)
+        return RESTERR(req, HTTP_NOT_FOUND, "Address index not enabled");
+    std::string strAddress;
+    const RetFormat rf = ParseDataFormat(strAddress, strURIPart);
+
+    CScript script;
+    if (!ParseAddressOrScript(strAddress, script))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid address or script: " + strAddress);
+
+    LOCK(cs_main);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    if (!pblocktree->ReadAddressUnspentIndex(GetScriptHash(script), vUnspent))
+        return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Unable to read address index");
+
+    switch (rf) {
+    case RF_BINARY:
+    case RF_HEX: {
+        // Same layout as getutxos, with each coin preceded by its outpoint
+        std::vector<std::pair<COutPoint, CCoin> > outs;
+        outs.reserve(vUnspent.size());
+        for (const auto& it : vUnspent) {
+            Coin coin(CTxOut(it.second.nValue, it.second.script), it.second.nHeight, it.second.fCoinBase);
+            outs.emplace_back(COutPoint(it.first.txhash, it.first.n), CCoin(std::move(coin)));
+        }
+        CDataStream ssResponse(SER_NETWORK, PROTOCOL_VERSION);
+        ssResponse << chainActive.Height() << chainActive.Tip()->GetBlockHash() << outs;
+
+        if (rf == RF_BINARY) {
+            req->WriteHeader("Content-Type", "application/octet-stream");
+            req->WriteReply(HTTP_OK, ssResponse.str());
+        } else {
+            req->WriteHeader("Content-Type", "text/plain");
+            req->WriteReply(HTTP_OK, HexStr(ssResponse.begin(), ssResponse.end()) + "\n");
+        }
+        return true;
+    }
+
+    case RF_JSON: {
+        UniValue objResponse(UniValue::VOBJ);
+        objResponse.push_back(Pair("chainHeight", chainActive.Height()));
+        objResponse.push_back(Pair("chaintipHash", chainActive.Tip()->GetBlockHash().GetHex()));
+        objResponse.push_back(Pair("utxos", addressUnspentToJSON(vUnspent)));
+
+        std::string strJSON = objResponse.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_address_history(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    if (!fAddressIndex)
+        return RESTERR(req, HTTP_NOT_FOUND, "Address index not enabled");
+    std::string strAddress;
+    const RetFormat rf = ParseDataFormat(strAddress, strURIPart);
+
+    CScript script;
+    if (!ParseAddressOrScript(strAddress, script))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid address or script: " + strAddress);
+
+    switch (rf) {
+    case RF_JSON: {
+        LOCK(cs_main);
+
+        std::vector<std::pair<CAddressIndexKey, CAmount> > vHistory;
+        if (!pblocktree->ReadAddressIndex(GetScriptHash(script), vHistory))
+            return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Unable to read address index");
+
+        std::string strJSON = addressHistoryToJSON(vHistory).write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_block_filter(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/blockfilter/<filtertype>/<blockhash>.<ext>.");
+
+    BlockFilterType filterType;
+    if (!BlockFilterTypeByName(path[0], filterType))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Unknown filtertype " + path[0]);
+    if (!g_blockfilterindex || g_blockfilterindex->GetFilterType() != filterType)
+        return RESTERR(req, HTTP_NOT_FOUND, "Index is not enabled for filtertype " + path[0]);
+
+    uint256 hash;
+    if (!ParseHashStr(path[1], hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + path[1]);
+
+    const CBlockIndex* pblockindex = NULL;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        if (it == mapBlockIndex.end())
+            return RESTERR(req, HTTP_NOT_FOUND, path[1] + " not found");
+        pblockindex = it->second;
+    }
+
+    BlockFilter filter;
+    if (!g_blockfilterindex->LookupFilter(pblockindex, filter))
+        return RESTERR(req, HTTP_NOT_FOUND, "Filter not found. Block filters are still in the process of being indexed.");
+
+    switch (rf) {
+    case RF_BINARY: {
+        CDataStream ssResp(SER_NETWORK, PROTOCOL_VERSION);
+        ssResp << filter;
+        std::string binaryResp = ssResp.str();
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, binaryResp);
+        return true;
+    }
+
+    case RF_HEX: {
+        CDataStream ssResp(SER_NETWORK, PROTOCOL_VERSION);
+        ssResp << filter;
+        std::string strHex = HexStr(ssResp.begin(), ssResp.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+
+    case RF_JSON: {
+        UniValue ret(UniValue::VOBJ);
+        ret.push_back(Pair("filter", HexStr(filter.GetEncodedFilter())));
+        std::string strJSON = ret.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: bin, hex, json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_filter_header(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    if (path.size() != 3)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/blockfilterheaders/<filtertype>/<count>/<blockhash>.<ext>.");
+
+    BlockFilterType filterType;
+    if (!BlockFilterTypeByName(path[0], filterType))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Unknown filtertype " + path[0]);
+    if (!g_blockfilterindex || g_blockfilterindex->GetFilterType() != filterType)
+        return RESTERR(req, HTTP_NOT_FOUND, "Index is not enabled for filtertype " + path[0]);
+
+    long count = strtol(path[1].c_str(), NULL, 10);
+    if (count < 1 || count > 2000)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Header count out of range: " + path[1]);
+
+    uint256 hash;
+    if (!ParseHashStr(path[2], hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + path[2]);
+
+    std::vector<const CBlockIndex *> headers;
+    headers.reserve(count);
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        const CBlockIndex *pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
+        while (pindex != NULL && chainActive.Contains(pindex)) {
+            headers.push_back(pindex);
+            if (headers.size() == (unsigned long)count)
+                break;
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    std::vector<uint256> filterHeaders;
+    filterHeaders.reserve(headers.size());
+    BOOST_FOREACH(const CBlockIndex *pindex, headers) {
+        uint256 filterHeader;
+        if (!g_blockfilterindex->LookupFilterHeader(pindex, filterHeader))
+            break;
+        filterHeaders.push_back(filterHeader);
+    }
+
+    switch (rf) {
+    case RF_BINARY: {
+        CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+        BOOST_FOREACH(const uint256& header, filterHeaders) {
+            ssHeader << header;
+        }
+        std::string binaryHeader = ssHeader.str();
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, binaryHeader);
+        return true;
+    }
+
+    case RF_HEX: {
+        CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+        BOOST_FOREACH(const uint256& header, filterHeaders) {
+            ssHeader << header;
+        }
+        std::string strHex = HexStr(ssHeader.begin(), ssHeader.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+    case RF_JSON: {
+        UniValue jsonHeaders(UniValue::VARR);
+        BOOST_FOREACH(const uint256& header, filterHeaders) {
+            jsonHeaders.push_back(header.GetHex());
+        }
+        std::string strJSON = jsonHeaders.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: bin, hex, json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(HTTPRequest* req, const std::string& strReq);
@@ -611,7 +867,11 @@ static const struct {
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
+      {"/rest/blockfilter/", rest_block_filter},
+      {"/rest/blockfilterheaders/", rest_filter_header},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/address/utxos/", rest_address_utxos},
+      {"/rest/address/history/", rest_address_history},
 };
 
 bool StartREST()
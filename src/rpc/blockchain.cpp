@@ -4,9 +4,12 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "amount.h"
+#include "base58.h"
+#include "blockfilter.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "clientversion.h"
 #include "coins.h"
 #include "consensus/validation.h"
 #include "validation.h"
@@ -15,15 +18,18 @@
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "hash.h"
+#include "index/blockfilterindex.h"
 
 #include <stdint.h>
 
 #include <univalue.h>
 
+#include <boost/filesystem.hpp>
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
 #include <mutex>
@@ -765,57 +771,28 @@ UniValue getblock(const JSONRPCRequest& request)
     return blockToJSON(block, pblockindex);
 }
 
-struct CCoinsStats
-{
-    int nHeight;
-    uint256 hashBlock;
-    uint64_t nTransactions;
-    uint64_t nTransactionOutputs;
-    uint64_t nSerializedSize;
-    uint256 hashSerialized;
-    CAmount nTotalAmount;
-
-    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
-};
-
 //! Calculate statistics about the unspent transaction output set
 static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
 {
     std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
+    CCoinsStatsBuilder builder(stats, pcursor->GetBestBlock());
     {
         LOCK(cs_main);
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
-    ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
-        uint256 key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coins)) {
-            stats.nTransactions++;
-            ss << key;
-            for (unsigned int i=0; i<coins.vout.size(); i++) {
-                const CTxOut &out = coins.vout[i];
-                if (!out.IsNull()) {
-                    stats.nTransactionOutputs++;
-                    ss << VARINT(i+1);
-                    ss << out;
-                    nTotalAmount += out.nValue;
-                }
-            }
-            stats.nSerializedSize += 32 + pcursor->GetValueSize();
-            ss << VARINT(0);
+        COutPoint key;
+        Coin coin;
+        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+            builder.Add(key, std::move(coin), pcursor->GetValueSize());
         } else {
             return error("%s: unable to read value", __func__);
         }
         pcursor->Next();
     }
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
+    builder.Finalize();
     return true;
 }
 
@@ -908,6 +885,253 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
     return ret;
 }
 
+UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite the unspent transaction output set to a snapshot file, which another node can start from with -loadsnapshot.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"       (string, required) Path to write the snapshot to, relative to the data directory if not absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,          (numeric) The number of coins written\n"
+            "  \"base_hash\": \"hash\",         (string) The block the snapshot was taken at\n"
+            "  \"base_height\": n,            (numeric) The height of that block\n"
+            "  \"hash_serialized\": \"hash\",   (string) The snapshot's commitment, as reported by gettxoutsetinfo\n"
+            "  \"path\": \"path\"               (string) The absolute path of the snapshot\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = boost::filesystem::absolute(request.params[0].get_str(), GetDataDir());
+    boost::filesystem::path pathTmp = path.string() + ".incomplete";
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    FlushStateToDisk();
+
+    CUTXOSnapshotMetadata metadata;
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    const CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        pcursor.reset(pcoinsTip->Cursor());
+        pindex = mapBlockIndex.find(pcursor->GetBestBlock())->second;
+    }
+    memcpy(metadata.pchMessageStart, Params().MessageStart(), sizeof(metadata.pchMessageStart));
+    metadata.hashBlock = pindex->GetBlockHash();
+    metadata.nChainTx = pindex->nChainTx;
+
+    CAutoFile afile(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (afile.IsNull())
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to open " + pathTmp.string() + " for writing");
+
+    // Don't leave a partial snapshot behind on errors or interruption
+    CCoinsStats stats;
+    try {
+        try {
+            // Written again below, once the coin count and hash are known
+            afile << metadata;
+
+            afile << (uint32_t)pindex->nHeight;
+            for (int nHeight = 1; nHeight <= pindex->nHeight; nHeight++) {
+                afile << pindex->GetAncestor(nHeight)->GetBlockHeader();
+            }
+
+            CCoinsStatsBuilder builder(stats, metadata.hashBlock);
+            while (pcursor->Valid()) {
+                boost::this_thread::interruption_point();
+                COutPoint key;
+                Coin coin;
+                if (!pcursor->GetKey(key) || !pcursor->GetValue(coin))
+                    throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+                afile << key << coin;
+                builder.Add(key, std::move(coin), pcursor->GetValueSize());
+                pcursor->Next();
+            }
+            builder.Finalize();
+
+            metadata.nCoins = stats.nTransactionOutputs;
+            metadata.hashSerialized = stats.hashSerialized;
+            if (fseek(afile.Get(), 0, SEEK_SET))
+                throw JSONRPCError(RPC_MISC_ERROR, "Unable to rewind " + pathTmp.string());
+            afile << metadata;
+            FileCommit(afile.Get());
+            afile.fclose();
+        } catch (const std::ios_base::failure& e) {
+            throw JSONRPCError(RPC_MISC_ERROR, strprintf("Unable to write %s: %s", pathTmp.string(), e.what()));
+        }
+        if (!RenameOver(pathTmp, path))
+            throw JSONRPCError(RPC_MISC_ERROR, "Unable to rename " + pathTmp.string() + " to " + path.string());
+    } catch (...) {
+        afile.fclose();
+        boost::system::error_code ec;
+        boost::filesystem::remove(pathTmp, ec);
+        throw;
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_written", (int64_t)metadata.nCoins));
+    ret.push_back(Pair("base_hash", metadata.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", (int64_t)pindex->nHeight));
+    ret.push_back(Pair("hash_serialized", metadata.hashSerialized.GetHex()));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
+/** Accept either an address or a hex-encoded scriptPubKey, for scripts that have no address form */
+bool ParseAddressOrScript(const std::string& strInput, CScript& script)
+{
+    CBitcoinAddress address(strInput);
+    if (address.IsValid()) {
+        script = GetScriptForDestination(address.Get());
+        return true;
+    }
+    if (!strInput.empty() && IsHex(strInput)) {
+        std::vector<unsigned char> data(ParseHex(strInput));
+        script = CScript(data.begin(), data.end());
+        return true;
+    }
+    return false;
+}
+
+static CScript AddressIndexScriptFromParam(const UniValue& param)
+{
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled. Use -addressindex and restart with -reindex-chainstate");
+    CScript script;
+    if (!ParseAddressOrScript(param.get_str(), script))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address or script");
+    return script;
+}
+
+UniValue addressUnspentToJSON(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vUnspent)
+{
+    AssertLockHeld(cs_main);
+    UniValue ret(UniValue::VARR);
+    for (const auto& it : vUnspent) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("txid", it.first.txhash.GetHex()));
+        entry.push_back(Pair("vout", (int)it.first.n));
+        entry.push_back(Pair("amount", ValueFromAmount(it.second.nValue)));
+        entry.push_back(Pair("scriptPubKey", HexStr(it.second.script.begin(), it.second.script.end())));
+        entry.push_back(Pair("height", it.second.nHeight));
+        entry.push_back(Pair("confirmations", chainActive.Height() - it.second.nHeight + 1));
+        entry.push_back(Pair("coinbase", it.second.fCoinBase));
+        ret.push_back(entry);
+    }
+    return ret;
+}
+
+UniValue addressHistoryToJSON(const std::vector<std::pair<CAddressIndexKey, CAmount> >& vHistory)
+{
+    AssertLockHeld(cs_main);
+    UniValue ret(UniValue::VARR);
+    for (const auto& it : vHistory) {
+        // Skip entries from blocks connected after the last chainstate flush before an unclean shutdown
+        if (it.first.nHeight > chainActive.Height())
+            continue;
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("txid", it.first.txhash.GetHex()));
+        entry.push_back(Pair("index", (int)it.first.nIndex));
+        entry.push_back(Pair("spending", it.first.fSpending));
+        entry.push_back(Pair("amount", ValueFromAmount(it.second)));
+        entry.push_back(Pair("height", it.first.nHeight));
+        entry.push_back(Pair("blockhash", chainActive[it.first.nHeight]->GetBlockHash().GetHex()));
+        ret.push_back(entry);
+    }
+    return ret;
+}
+
+UniValue getaddressutxos(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "getaddressutxos \"address\"\n"
+            "\nReturns the confirmed unspent outputs paying to an address or script.\n"
+            "Requires -addressindex.\n"
+            "\nArguments:\n"
+            "1. \"address\"    (string, required) A bitcoin address, or a hex-encoded scriptPubKey\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\" : \"hash\",         (string) The transaction id\n"
+            "    \"vout\" : n,              (numeric) The output number\n"
+            "    \"amount\" : x.xxx,        (numeric) The output value in " + CURRENCY_UNIT + "\n"
+            "    \"scriptPubKey\" : \"hex\",  (string) The script\n"
+            "    \"height\" : n,            (numeric) The height of the block containing the output\n"
+            "    \"confirmations\" : n,     (numeric) The number of confirmations\n"
+            "    \"coinbase\" : true|false  (boolean) Coinbase or not\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressutxos", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+            + HelpExampleRpc("getaddressutxos", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+        );
+
+    CScript script = AddressIndexScriptFromParam(request.params[0]);
+
+    LOCK(cs_main);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    if (!pblocktree->ReadAddressUnspentIndex(GetScriptHash(script), vUnspent))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read address index");
+
+    return addressUnspentToJSON(vUnspent);
+}
+
+UniValue getaddresshistory(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
+        throw std::runtime_error(
+            "getaddresshistory \"address\" ( start end )\n"
+            "\nReturns the confirmed outputs paying to an address or script, and the inputs spending them, ordered by height.\n"
+            "Requires -addressindex.\n"
+            "\nArguments:\n"
+            "1. \"address\"    (string, required) A bitcoin address, or a hex-encoded scriptPubKey\n"
+            "2. start        (numeric, optional) The first block height to include\n"
+            "3. end          (numeric, optional) The last block height to include\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\" : \"hash\",         (string) The transaction id\n"
+            "    \"index\" : n,             (numeric) The output number, or for spends the input number\n"
+            "    \"spending\" : true|false, (boolean) Whether this entry spends an earlier output\n"
+            "    \"amount\" : x.xxx,        (numeric) The change in balance in " + CURRENCY_UNIT + ", negative for spends\n"
+            "    \"height\" : n,            (numeric) The block height\n"
+            "    \"blockhash\" : \"hash\"     (string) The block hash\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresshistory", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\" 400000 450000")
+            + HelpExampleRpc("getaddresshistory", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\", 400000, 450000")
+        );
+
+    CScript script = AddressIndexScriptFromParam(request.params[0]);
+    int nStart = 0;
+    int nEnd = 0;
+    if (request.params.size() > 1)
+        nStart = request.params[1].get_int();
+    if (request.params.size() > 2)
+        nEnd = request.params[2].get_int();
+    if (nStart < 0 || nEnd < 0 || (nEnd > 0 && nEnd < nStart))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid height range");
+
+    LOCK(cs_main);
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vHistory;
+    if (!pblocktree->ReadAddressIndex(GetScriptHash(script), vHistory, nStart, nEnd))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read address index");
+
+    return addressHistoryToJSON(vHistory);
+}
+
 UniValue gettxout(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
@@ -933,7 +1157,6 @@ UniValue gettxout(const JSONRPCRequest& request)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,            (numeric) The version\n"
             "  \"coinbase\" : true|false   (boolean) Coinbase or not\n"
             "}\n"
 
@@ -957,33 +1180,33 @@ UniValue gettxout(const JSONRPCRequest& request)
     if (request.params.size() > 2)
         fMempool = request.params[2].get_bool();
 
-    CCoins coins;
+    COutPoint out(hash, n);
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) { // TODO: filtering spent coins should be done by the CCoinsViewMemPool
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
+        }
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin)) {
             return NullUniValue;
+        }
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex *pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT) {
         ret.push_back(Pair("confirmations", 0));
-    else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+    } else {
+        ret.push_back(Pair("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1)));
+    }
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("coinbase", (bool)coin.fCoinBase));
 
     return ret;
 }
@@ -1422,14 +1645,79 @@ UniValue reconsiderblock(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+UniValue getblockfilter(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            "getblockfilter \"blockhash\" ( \"filtertype\" )\n"
+            "\nRetrieve a BIP 157 content filter for a particular block. Requires -blockfilterindex.\n"
+            "\nArguments:\n"
+            "1. \"blockhash\"       (string, required) The hash of the block\n"
+            "2. \"filtertype\"      (string, optional, default=\"basic\") The type name of the filter\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\" : \"hex\",   (string) the hex-encoded filter data\n"
+            "  \"header\" : \"hash\",  (string) the hex-encoded filter header\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\" \"basic\"")
+            + HelpExampleRpc("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\", \"basic\"")
+        );
+
+    uint256 hash(ParseHashV(request.params[0], "blockhash"));
+
+    std::string strFilterType = "basic";
+    if (request.params.size() > 1)
+        strFilterType = request.params[1].get_str();
+
+    BlockFilterType filterType;
+    if (!BlockFilterTypeByName(strFilterType, filterType))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown filtertype");
+    if (!g_blockfilterindex || g_blockfilterindex->GetFilterType() != filterType)
+        throw JSONRPCError(RPC_MISC_ERROR, "Index is not enabled for filtertype " + strFilterType);
+
+    const CBlockIndex* pblockindex;
+    bool fBlockOnActiveChain;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        if (it == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pblockindex = it->second;
+        fBlockOnActiveChain = chainActive.Contains(pblockindex);
+    }
+
+    // Wait for a block that was just connected to reach the index
+    if (fBlockOnActiveChain)
+        g_blockfilterindex->BlockUntilSyncedToCurrentChain();
+
+    BlockFilter filter;
+    uint256 filterHeader;
+    if (!g_blockfilterindex->LookupFilter(pblockindex, filter) ||
+        !g_blockfilterindex->LookupFilterHeader(pblockindex, filterHeader)) {
+        if (!fBlockOnActiveChain)
+            throw JSONRPCError(RPC_MISC_ERROR, "Block is not in the active chain and was never indexed");
+        throw JSONRPCError(RPC_MISC_ERROR, "Filter not found. Block filters are still in the process of being indexed.");
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("filter", HexStr(filter.GetEncodedFilter())));
+    ret.push_back(Pair("header", filterHeader.GetHex()));
+    return ret;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafe argNames
   //  --------------------- ------------------------  -----------------------  ------ ----------
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true,  {"path"} },
+    { "blockchain",         "getaddresshistory",      &getaddresshistory,      true,  {"address","start","end"} },
+    { "blockchain",         "getaddressutxos",        &getaddressutxos,        true,  {"address"} },
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,  {} },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,  {} },
     { "blockchain",         "getblockcount",          &getblockcount,          true,  {} },
     { "blockchain",         "getblock",               &getblock,               true,  {"blockhash","verbose"} },
     { "blockchain",         "getblockhash",           &getblockhash,           true,  {"height"} },
+    { "blockchain",         "getblockfilter",         &getblockfilter,         true,  {"blockhash","filtertype"} },
     { "blockchain",         "getblockheader",         &getblockheader,         true,  {"blockhash","verbose"} },
     { "blockchain",         "getchaintips",           &getchaintips,           true,  {} },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true,  {} },
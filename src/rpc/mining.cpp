@@ -531,7 +531,8 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
     // a segwit-block to a non-segwit caller.
     static bool fLastTemplateSupportsSegwit = true;
     if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5) ||
+        // Mempool changes are followed right away when the block candidate can be updated incrementally
+        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && (GetTime() - nStart > 5 || CanUpdateBlockCandidate())) ||
         fLastTemplateSupportsSegwit != fSupportsSegwit)
     {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
@@ -5,6 +5,7 @@
 
 #include "base58.h"
 #include "clientversion.h"
+#include "dbwrapper.h"
 #include "init.h"
 #include "validation.h"
 #include "net.h"
@@ -554,6 +555,84 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
     }
 }
 
+UniValue getdbstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getdbstats\n"
+            "Returns I/O, cache and compaction statistics of the open LevelDB databases.\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"name\": \"xxxx\",             (string) Name of the database, e.g. \"chainstate\" or \"index\"\n"
+            "    \"reads\": xxxxx,               (numeric) Number of point lookups\n"
+            "    \"reads_found\": xxxxx,         (numeric) Number of lookups that found their key\n"
+            "    \"read_bytes\": xxxxx,          (numeric) Bytes returned by lookups\n"
+            "    \"read_time\": x.xxx,           (numeric) Seconds spent in lookups\n"
+            "    \"batches\": xxxxx,             (numeric) Number of batches written\n"
+            "    \"batch_bytes\": xxxxx,         (numeric) Bytes written in batches\n"
+            "    \"batch_time\": x.xxx,          (numeric) Seconds spent writing batches\n"
+            "    \"batch_time_max\": x.xxx,      (numeric) Slowest batch write, in seconds\n"
+            "    \"slow_batches\": xxxxx,        (numeric) Batch writes slower than " + strprintf("%dms", DBWRAPPER_SLOW_WRITE_MICROS / 1000) + ", typically delayed by compaction\n"
+            "    \"block_cache_hits\": xxxxx,    (numeric) Block cache lookups that hit\n"
+            "    \"block_cache_misses\": xxxxx,  (numeric) Block cache lookups that missed\n"
+            "    \"block_cache_usage\": xxxxx,   (numeric) Bytes held in the block cache\n"
+            "    \"memory_usage\": xxxxx,        (numeric) Approximate bytes used by the block cache and memtables\n"
+            "    \"compaction_time\": x.xxx,     (numeric) Seconds spent compacting\n"
+            "    \"read_amplification\": xx,     (numeric) Files a lookup of a missing key may have to check\n"
+            "    \"levels\": [                   (json array) Levels that hold files or have been compacted\n"
+            "      {\n"
+            "        \"level\": x,               (numeric) Level number\n"
+            "        \"files\": xx,              (numeric) Number of table files\n"
+            "        \"size_mib\": xx,           (numeric) Size of the level in MiB\n"
+            "        \"compaction_time\": xx,    (numeric) Seconds spent compacting into the level\n"
+            "        \"compaction_read_mib\": xx,    (numeric) MiB read by those compactions\n"
+            "        \"compaction_written_mib\": xx  (numeric) MiB written by those compactions\n"
+            "      }, ...\n"
+            "    ]\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleRpc("getdbstats", "")
+        );
+
+    UniValue ret(UniValue::VARR);
+    for (const CDBWrapperStats& stats : GetAllDBWrapperStats()) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("name", stats.name));
+        obj.push_back(Pair("reads", stats.nReads));
+        obj.push_back(Pair("reads_found", stats.nReadsFound));
+        obj.push_back(Pair("read_bytes", stats.nReadBytes));
+        obj.push_back(Pair("read_time", stats.nReadMicros / 1000000.0));
+        obj.push_back(Pair("batches", stats.nBatches));
+        obj.push_back(Pair("batch_bytes", stats.nBatchBytes));
+        obj.push_back(Pair("batch_time", stats.nBatchMicros / 1000000.0));
+        obj.push_back(Pair("batch_time_max", stats.nMaxBatchMicros / 1000000.0));
+        obj.push_back(Pair("slow_batches", stats.nSlowBatches));
+        obj.push_back(Pair("block_cache_hits", stats.nBlockCacheHits));
+        obj.push_back(Pair("block_cache_misses", stats.nBlockCacheMisses));
+        obj.push_back(Pair("block_cache_usage", (uint64_t)stats.nBlockCacheUsage));
+        obj.push_back(Pair("memory_usage", (uint64_t)stats.nMemoryUsage));
+        obj.push_back(Pair("compaction_time", stats.dCompactionSeconds));
+        obj.push_back(Pair("read_amplification", stats.nReadAmplification));
+        UniValue levels(UniValue::VARR);
+        for (const CDBWrapperStats::Level& level : stats.levels) {
+            UniValue entry(UniValue::VOBJ);
+            entry.push_back(Pair("level", level.nLevel));
+            entry.push_back(Pair("files", level.nFiles));
+            entry.push_back(Pair("size_mib", level.dSizeMiB));
+            entry.push_back(Pair("compaction_time", level.dCompactionSeconds));
+            entry.push_back(Pair("compaction_read_mib", level.dCompactionReadMiB));
+            entry.push_back(Pair("compaction_written_mib", level.dCompactionWrittenMiB));
+            levels.push_back(entry);
+        }
+        obj.push_back(Pair("levels", levels));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
 UniValue echo(const JSONRPCRequest& request)
 {
     if (request.fHelp)
@@ -570,9 +649,10 @@ UniValue echo(const JSONRPCRequest& request)
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
-    { "control",            "getinfo",                &getinfo,                true,  {} }, /* uses wallet if enabled */
+    { "control",            "getinfo",                &getinfo,                true,  {}, true }, /* uses wallet if enabled */
     { "control",            "getmemoryinfo",          &getmemoryinfo,          true,  {"mode"} },
-    { "util",               "validateaddress",        &validateaddress,        true,  {"address"} }, /* uses wallet if enabled */
+    { "control",            "getdbstats",             &getdbstats,             true,  {} },
+    { "util",               "validateaddress",        &validateaddress,        true,  {"address"}, true }, /* uses wallet if enabled */
     { "util",               "createmultisig",         &createmultisig,         true,  {"nrequired","keys"} },
     { "util",               "verifymessage",          &verifymessage,          true,  {"address","signature","message"} },
     { "util",               "signmessagewithprivkey", &signmessagewithprivkey, true,  {"privkey","message"} },
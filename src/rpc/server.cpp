@@ -7,11 +7,13 @@
 
 #include "base58.h"
 #include "init.h"
+#include "metrics.h"
 #include "random.h"
 #include "sync.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "validationinterface.h"
 
 #include <univalue.h>
 
@@ -472,19 +474,34 @@ UniValue CRPCTable::execute(const JSONRPCRequest &request) const
 
     g_rpcSignals.PreCommand(*pcmd);
 
+    // Wallet notifications are delivered in the background, wait for them so
+    // that wallet calls see every change to the chain and mempool made so far
+    if (pcmd->syncValidationInterface)
+        SyncWithValidationInterfaceQueue();
+
+    int64_t nTimeStart = GetTimeMicros();
     try
     {
         // Execute, convert arguments to array if necessary
+        UniValue result;
         if (request.params.isObject()) {
-            return pcmd->actor(transformNamedArguments(request, pcmd->argNames));
+            result = pcmd->actor(transformNamedArguments(request, pcmd->argNames));
         } else {
-            return pcmd->actor(request);
+            result = pcmd->actor(request);
         }
+        RecordRPCCall(request.strMethod, GetTimeMicros() - nTimeStart, false);
+        return result;
     }
     catch (const std::exception& e)
     {
+        RecordRPCCall(request.strMethod, GetTimeMicros() - nTimeStart, true);
         throw JSONRPCError(RPC_MISC_ERROR, e.what());
     }
+    catch (...)
+    {
+        RecordRPCCall(request.strMethod, GetTimeMicros() - nTimeStart, true);
+        throw;
+    }
 }
 
 std::vector<std::string> CRPCTable::listCommands() const
@@ -141,6 +141,8 @@ public:
     rpcfn_type actor;
     bool okSafeMode;
     std::vector<std::string> argNames;
+    //! Wait for the queued validation interface callbacks before running, so the wallet is up to date
+    bool syncValidationInterface;
 };
 
 /**
@@ -6,11 +6,12 @@
 
 #include "reverselock.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <boost/bind.hpp>
 #include <utility>
 
-CScheduler::CScheduler() : nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
+CScheduler::CScheduler() : nLastTaskId(0), nThreadsServicingQueue(0), nThreadsRunningLow(0), stopRequested(false), stopWhenEmpty(false)
 {
 }
 
@@ -27,6 +28,48 @@ static boost::system_time toPosixTime(const boost::chrono::system_clock::time_po
 }
 #endif
 
+static int64_t MicrosBetween(boost::chrono::system_clock::time_point from, boost::chrono::system_clock::time_point to)
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(to - from).count();
+}
+
+bool CScheduler::empty() const
+{
+    if (!taskQueue.empty())
+        return false;
+    for (const std::deque<TaskId>& ready : readyQueue) {
+        if (!ready.empty())
+            return false;
+    }
+    return true;
+}
+
+void CScheduler::promoteDueTasks(boost::chrono::system_clock::time_point now)
+{
+    while (!taskQueue.empty() && taskQueue.begin()->first <= now) {
+        Task& task = mapTasks.at(taskQueue.begin()->second);
+        readyQueue[task.priority].push_back(taskQueue.begin()->second);
+        task.fQueued = false;
+        taskQueue.erase(taskQueue.begin());
+    }
+}
+
+CScheduler::TaskId CScheduler::popReadyTask()
+{
+    for (int priority = PRIORITY_HIGH; priority < PRIORITY_COUNT; priority++) {
+        std::deque<TaskId>& ready = readyQueue[priority];
+        // Leave one thread for everything else, if there is more than one
+        if (priority == PRIORITY_LOW && nThreadsServicingQueue > 1 && nThreadsRunningLow + 1 >= nThreadsServicingQueue)
+            break;
+        if (!ready.empty()) {
+            TaskId id = ready.front();
+            ready.pop_front();
+            return id;
+        }
+    }
+    return 0;
+}
+
 void CScheduler::serviceQueue()
 {
     boost::unique_lock<boost::mutex> lock(newTaskMutex);
@@ -37,42 +80,72 @@ void CScheduler::serviceQueue()
     // is called.
     while (!shouldStop()) {
         try {
-            while (!shouldStop() && taskQueue.empty()) {
-                // Wait until there is something to do.
-                newTaskScheduled.wait(lock);
-            }
-
-            // Wait until either there is a new task, or until
-            // the time of the first item on the queue:
-
+            promoteDueTasks(boost::chrono::system_clock::now());
+            TaskId id = popReadyTask();
+            if (id == 0) {
+                // Wait until either there is a new task, a low priority task
+                // finished, or until the time of the first item on the queue:
+                if (taskQueue.empty()) {
+                    newTaskScheduled.wait(lock);
+                } else {
 // wait_until needs boost 1.50 or later; older versions have timed_wait:
 #if BOOST_VERSION < 105000
-            while (!shouldStop() && !taskQueue.empty() &&
-                   newTaskScheduled.timed_wait(lock, toPosixTime(taskQueue.begin()->first))) {
-                // Keep waiting until timeout
-            }
+                    newTaskScheduled.timed_wait(lock, toPosixTime(taskQueue.begin()->first));
 #else
-            // Some boost versions have a conflicting overload of wait_until that returns void.
-            // Explicitly use a template here to avoid hitting that overload.
-            while (!shouldStop() && !taskQueue.empty()) {
-                boost::chrono::system_clock::time_point timeToWaitFor = taskQueue.begin()->first;
-                if (newTaskScheduled.wait_until<>(lock, timeToWaitFor) == boost::cv_status::timeout)
-                    break; // Exit loop after timeout, it means we reached the time of the event
-            }
+                    // Some boost versions have a conflicting overload of wait_until that returns void.
+                    // Explicitly use a template here to avoid hitting that overload.
+                    boost::chrono::system_clock::time_point timeToWaitFor = taskQueue.begin()->first;
+                    newTaskScheduled.wait_until<>(lock, timeToWaitFor);
 #endif
-            // If there are multiple threads, the queue can empty while we're waiting (another
-            // thread may service the task we were waiting on).
-            if (shouldStop() || taskQueue.empty())
+                }
                 continue;
+            }
 
-            Function f = taskQueue.begin()->second;
-            taskQueue.erase(taskQueue.begin());
+            std::map<TaskId, Task>::iterator it = mapTasks.find(id);
+            Function f = it->second.f;
+            const Priority priority = it->second.priority;
+            const int64_t nRepeatMillis = it->second.nRepeatMillis;
+            const boost::chrono::system_clock::time_point timeStart = boost::chrono::system_clock::now();
+            const int64_t nDelayMicros = std::max<int64_t>(MicrosBetween(it->second.time, timeStart), 0);
+            // Repeating tasks stay known while they run, so that they can be cancelled
+            if (nRepeatMillis == 0)
+                mapTasks.erase(it);
+            else
+                it->second.fRunning = true;
+            if (priority == PRIORITY_LOW)
+                nThreadsRunningLow++;
 
-            {
+            try {
                 // Unlock before calling f, so it can reschedule itself or another task
                 // without deadlocking:
                 reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
                 f();
+            } catch (...) {
+                if (priority == PRIORITY_LOW)
+                    nThreadsRunningLow--;
+                mapTasks.erase(id);
+                throw;
+            }
+            const boost::chrono::system_clock::time_point timeEnd = boost::chrono::system_clock::now();
+
+            if (priority == PRIORITY_LOW) {
+                nThreadsRunningLow--;
+                // A thread may have left a low priority task for us
+                newTaskScheduled.notify_one();
+            }
+            Stats& s = stats[priority];
+            s.nTasks++;
+            s.nDelayMicros += nDelayMicros;
+            s.nMaxDelayMicros = std::max(s.nMaxDelayMicros, nDelayMicros);
+            s.nRunMicros += MicrosBetween(timeStart, timeEnd);
+
+            if (nRepeatMillis != 0) {
+                it = mapTasks.find(id);
+                if (it != mapTasks.end()) {
+                    it->second.time = timeEnd + boost::chrono::milliseconds(nRepeatMillis);
+                    it->second.fRunning = false;
+                    enqueue(id, it->second);
+                }
             }
         } catch (...) {
             --nThreadsServicingQueue;
@@ -95,39 +168,162 @@ void CScheduler::stop(bool drain)
     newTaskScheduled.notify_all();
 }
 
-void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t)
+bool CScheduler::AreThreadsServicingQueue() const
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    return nThreadsServicingQueue > 0 && !stopRequested;
+}
+
+void CScheduler::enqueue(TaskId id, Task& task)
+{
+    // Called with newTaskMutex held
+    task.itQueue = taskQueue.insert(std::make_pair(task.time, id));
+    task.fQueued = true;
+}
+
+CScheduler::TaskId CScheduler::scheduleTask(Function f, boost::chrono::system_clock::time_point t, Priority priority, int64_t nRepeatMillis)
 {
+    assert(priority >= PRIORITY_HIGH && priority < PRIORITY_COUNT);
+    TaskId id;
     {
         boost::unique_lock<boost::mutex> lock(newTaskMutex);
-        taskQueue.insert(std::make_pair(t, f));
+        id = ++nLastTaskId;
+        Task& task = mapTasks[id];
+        task.f = std::move(f);
+        task.priority = priority;
+        task.nRepeatMillis = nRepeatMillis;
+        task.time = t;
+        task.fRunning = false;
+        enqueue(id, task);
     }
     newTaskScheduled.notify_one();
+    return id;
 }
 
-void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaMilliSeconds)
+CScheduler::TaskId CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t, Priority priority)
 {
-    schedule(f, boost::chrono::system_clock::now() + boost::chrono::milliseconds(deltaMilliSeconds));
+    return scheduleTask(std::move(f), t, priority, 0);
 }
 
-static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaMilliSeconds)
+CScheduler::TaskId CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaMilliSeconds, Priority priority)
 {
-    f();
-    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaMilliSeconds), deltaMilliSeconds);
+    return schedule(std::move(f), boost::chrono::system_clock::now() + boost::chrono::milliseconds(deltaMilliSeconds), priority);
 }
 
-void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaMilliSeconds)
+CScheduler::TaskId CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaMilliSeconds, Priority priority)
 {
-    scheduleFromNow(boost::bind(&Repeat, this, f, deltaMilliSeconds), deltaMilliSeconds);
+    assert(deltaMilliSeconds > 0);
+    return scheduleTask(std::move(f), boost::chrono::system_clock::now() + boost::chrono::milliseconds(deltaMilliSeconds), priority, deltaMilliSeconds);
+}
+
+bool CScheduler::cancel(TaskId id)
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    std::map<TaskId, Task>::iterator it = mapTasks.find(id);
+    if (it == mapTasks.end())
+        return false;
+    if (it->second.fQueued) {
+        taskQueue.erase(it->second.itQueue);
+    } else if (!it->second.fRunning) {
+        // Already due. A cancelled task must not linger in its ready queue,
+        // or stop(true) would wait for it.
+        std::deque<TaskId>& ready = readyQueue[it->second.priority];
+        ready.erase(std::find(ready.begin(), ready.end(), id));
+    }
+    mapTasks.erase(it);
+    return true;
 }
 
 size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
                              boost::chrono::system_clock::time_point &last) const
 {
     boost::unique_lock<boost::mutex> lock(newTaskMutex);
-    size_t result = taskQueue.size();
-    if (!taskQueue.empty()) {
-        first = taskQueue.begin()->first;
-        last = taskQueue.rbegin()->first;
+    size_t result = 0;
+    for (const auto& entry : mapTasks) {
+        const Task& task = entry.second;
+        // Repeating tasks that are running are not waiting to be serviced
+        if (task.fRunning)
+            continue;
+        if (result == 0 || task.time < first)
+            first = task.time;
+        if (result == 0 || task.time > last)
+            last = task.time;
+        result++;
     }
     return result;
 }
+
+CScheduler::Stats CScheduler::getStats(Priority priority) const
+{
+    assert(priority >= PRIORITY_HIGH && priority < PRIORITY_COUNT);
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    return stats[priority];
+}
+
+void SingleThreadedSchedulerClient::MaybeScheduleProcessQueue()
+{
+    // Called with m_mutex held
+    if (m_scheduled || m_pending.empty())
+        return;
+    m_scheduled = true;
+    m_pscheduler->schedule(std::bind(&SingleThreadedSchedulerClient::ProcessQueue, shared_from_this()), boost::chrono::system_clock::now(), CScheduler::PRIORITY_HIGH);
+}
+
+void SingleThreadedSchedulerClient::RunFront(std::unique_lock<std::mutex>& lock)
+{
+    CScheduler::Function f = std::move(m_pending.front());
+    m_pending.pop_front();
+    m_running = true;
+    try {
+        reverse_lock<std::unique_lock<std::mutex> > rlock(lock);
+        f();
+    } catch (...) {
+        m_running = false;
+        m_cv_done.notify_all();
+        throw;
+    }
+    m_running = false;
+    m_cv_done.notify_all();
+}
+
+void SingleThreadedSchedulerClient::ProcessQueue()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_scheduled = false;
+    if (m_running || m_pending.empty()) {
+        // EmptyQueue is draining the queue on another thread
+        return;
+    }
+    RunFront(lock);
+    MaybeScheduleProcessQueue();
+}
+
+void SingleThreadedSchedulerClient::AddToProcessQueue(CScheduler::Function func)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.push_back(std::move(func));
+        if (m_pscheduler) {
+            MaybeScheduleProcessQueue();
+            return;
+        }
+    }
+    EmptyQueue();
+}
+
+void SingleThreadedSchedulerClient::EmptyQueue()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_cv_done.wait(lock, [this]{ return !m_running; });
+        if (m_pending.empty())
+            break;
+        RunFront(lock);
+    }
+}
+
+size_t SingleThreadedSchedulerClient::CallbacksPending()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pending.size() + m_running;
+}
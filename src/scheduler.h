@@ -12,7 +12,12 @@
 //
 #include <boost/chrono/chrono.hpp>
 #include <boost/thread.hpp>
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
 
 //
 // Simple class for background tasks that should be run
@@ -31,6 +36,18 @@
 // delete t;
 // delete s; // Must be done after thread is interrupted/joined.
 //
+// Several threads may run serviceQueue. Tasks that are due run in order of
+// priority, and when more than one thread services the queue, one of them is
+// always kept free of low priority tasks, so that long maintenance work never
+// holds up latency-sensitive callbacks. The node's periodic maintenance tasks
+// are all low priority, so with the default of two threads they still run one
+// at a time.
+//
+
+static const int DEFAULT_SCHEDULER_THREADS = 2;
+static const int MAX_SCHEDULER_THREADS = 16;
+//! Interval in seconds at which scheduler latency statistics are logged with -debug=bench
+static const int64_t SCHEDULER_STATS_LOG_INTERVAL = 5 * 60;
 
 class CScheduler
 {
@@ -39,21 +56,33 @@ public:
     ~CScheduler();
 
     typedef std::function<void(void)> Function;
+    //! Identifies a scheduled task for cancel(); never 0
+    typedef uint64_t TaskId;
+
+    enum Priority {
+        PRIORITY_HIGH,      //!< latency-sensitive callbacks, e.g. validation notifications
+        PRIORITY_NORMAL,
+        PRIORITY_LOW,       //!< periodic maintenance, e.g. writing peers.dat
+        PRIORITY_COUNT
+    };
 
     // Call func at/after time t
-    void schedule(Function f, boost::chrono::system_clock::time_point t);
+    TaskId schedule(Function f, boost::chrono::system_clock::time_point t, Priority priority = PRIORITY_NORMAL);
 
     // Convenience method: call f once deltaSeconds from now
-    void scheduleFromNow(Function f, int64_t deltaMilliSeconds);
+    TaskId scheduleFromNow(Function f, int64_t deltaMilliSeconds, Priority priority = PRIORITY_NORMAL);
 
     // Another convenience method: call f approximately
     // every deltaSeconds forever, starting deltaSeconds from now.
     // To be more precise: every time f is finished, it
     // is rescheduled to run deltaSeconds later. If you
     // need more accurate scheduling, don't use this method.
-    void scheduleEvery(Function f, int64_t deltaMilliSeconds);
+    TaskId scheduleEvery(Function f, int64_t deltaMilliSeconds, Priority priority = PRIORITY_NORMAL);
 
-    // To keep things as simple as possible, there is no unschedule.
+    // Remove a task that has not started yet, or stop a repeating task from
+    // being rescheduled. Returns false if the task is unknown or has already
+    // run. A task that is running when it is cancelled runs to completion.
+    bool cancel(TaskId id);
 
     // Services the queue 'forever'. Should be run in a thread,
     // and interrupted using boost::interrupt_thread
@@ -64,19 +93,99 @@ public:
     // or when there is no work left to be done (drain=true)
     void stop(bool drain=false);
 
+    // Whether a thread is servicing the queue and has not been told to stop
+    bool AreThreadsServicingQueue() const;
+
     // Returns number of tasks waiting to be serviced,
     // and first and last task times
     size_t getQueueInfo(boost::chrono::system_clock::time_point &first,
                         boost::chrono::system_clock::time_point &last) const;
 
+    /** Latency of the tasks of one priority that have run so far */
+    struct Stats
+    {
+        uint64_t nTasks;            //!< tasks run
+        int64_t nDelayMicros;       //!< total time tasks waited past their scheduled time
+        int64_t nMaxDelayMicros;    //!< ... and the longest such wait
+        int64_t nRunMicros;         //!< total time spent running tasks
+
+        Stats() : nTasks(0), nDelayMicros(0), nMaxDelayMicros(0), nRunMicros(0) {}
+    };
+
+    Stats getStats(Priority priority) const;
+
 private:
-    std::multimap<boost::chrono::system_clock::time_point, Function> taskQueue;
+    typedef std::multimap<boost::chrono::system_clock::time_point, TaskId> TimeQueue;
+
+    struct Task
+    {
+        Function f;
+        Priority priority;
+        int64_t nRepeatMillis;      //!< 0 for tasks that run once
+        boost::chrono::system_clock::time_point time;
+        TimeQueue::iterator itQueue; //!< position in taskQueue, if not yet due
+        bool fQueued;               //!< whether itQueue is valid
+        bool fRunning;              //!< a repeating task that is running right now
+    };
+
+    std::map<TaskId, Task> mapTasks;    //!< tasks that are waiting, and repeating tasks that are running
+    TimeQueue taskQueue;                //!< tasks that are not due yet
+    std::deque<TaskId> readyQueue[PRIORITY_COUNT]; //!< due tasks by priority
+    Stats stats[PRIORITY_COUNT];
+    TaskId nLastTaskId;
     boost::condition_variable newTaskScheduled;
     mutable boost::mutex newTaskMutex;
     int nThreadsServicingQueue;
+    int nThreadsRunningLow;
     bool stopRequested;
     bool stopWhenEmpty;
-    bool shouldStop() { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+    bool empty() const;
+    bool shouldStop() const { return stopRequested || (stopWhenEmpty && empty()); }
+
+    TaskId scheduleTask(Function f, boost::chrono::system_clock::time_point t, Priority priority, int64_t nRepeatMillis);
+    void enqueue(TaskId id, Task& task);
+    //! Moves tasks that are due to their ready queue
+    void promoteDueTasks(boost::chrono::system_clock::time_point now);
+    //! Takes the next task this thread may run off the ready queues, or returns 0
+    TaskId popReadyTask();
+};
+
+/**
+ * Runs the functions added to it on a CScheduler, one at a time and in the
+ * order they were added, even if several threads service the scheduler.
+ * Clients use it to hand work to the background while keeping it ordered.
+ *
+ * Must be owned by a std::shared_ptr, as the tasks it schedules keep it alive.
+ * Without a scheduler, functions run right away on the thread adding them.
+ */
+class SingleThreadedSchedulerClient : public std::enable_shared_from_this<SingleThreadedSchedulerClient>
+{
+private:
+    CScheduler* m_pscheduler;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv_done;
+    std::deque<CScheduler::Function> m_pending;
+    //! a task to process the queue is on the scheduler
+    bool m_scheduled;
+    //! one of the pending functions is being run
+    bool m_running;
+
+    void MaybeScheduleProcessQueue();
+    void ProcessQueue();
+    //! Runs the oldest pending function, with m_mutex released meanwhile
+    void RunFront(std::unique_lock<std::mutex>& lock);
+
+public:
+    explicit SingleThreadedSchedulerClient(CScheduler* pschedulerIn) : m_pscheduler(pschedulerIn), m_scheduled(false), m_running(false) {}
+
+    void AddToProcessQueue(CScheduler::Function func);
+
+    // Runs all pending functions on the calling thread, after waiting for
+    // one that is running on the scheduler, if any
+    void EmptyQueue();
+
+    size_t CallbacksPending();
 };
 
 #endif
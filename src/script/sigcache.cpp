@@ -8,10 +8,13 @@
 #include "memusage.h"
 #include "pubkey.h"
 #include "random.h"
+#include "streams.h"
 #include "uint256.h"
 #include "util.h"
+#include "utiltime.h"
 
 #include "cuckoocache.h"
+#include "clientversion.h"
 #include <boost/thread.hpp>
 
 namespace {
@@ -79,6 +82,22 @@ public:
     {
         return setValid.setup_bytes(n);
     }
+
+    void Dump(uint256& nonceOut, std::vector<uint256>& entries)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        nonceOut = nonce;
+        setValid.get_live(entries);
+    }
+
+    //! Replaces the nonce, so only valid before the cache is used
+    void Load(const uint256& nonceIn, const std::vector<uint256>& entries)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        nonce = nonceIn;
+        for (const uint256& entry : entries)
+            setValid.insert(entry);
+    }
 };
 
 /* In previous versions of this code, signatureCache was a local static variable
@@ -88,20 +107,100 @@ public:
  * signatureCache could be made local to VerifySignature.
 */
 static CSignatureCache signatureCache;
+
+/** The configured -maxsigcachesize in bytes */
+size_t GetMaxSigCacheBytes()
+{
+    // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
+    // setup_bytes creates the minimum possible cache (2 elements).
+    return std::min(std::max((int64_t)0, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE)), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+}
 }
 
 // To be called once in AppInitMain/BasicTestingSetup to initialize the
 // signatureCache.
 void InitSignatureCache()
 {
-    // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
-    // setup_bytes creates the minimum possible cache (2 elements).
-    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE)), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nMaxCacheSize = GetMaxSigCacheBytes();
     size_t nElems = signatureCache.setup_bytes(nMaxCacheSize);
     LogPrintf("Using %zu MiB out of %zu requested for signature cache, able to store %zu elements\n",
             (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>20, nElems);
 }
 
+static const uint64_t SIGCACHE_DUMP_VERSION = 1;
+
+bool LoadSignatureCache()
+{
+    FILE* filestr = fopen((GetDataDir() / "sigcache.dat").string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open signature cache file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    uint256 nonce;
+    std::vector<uint256> entries;
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != SIGCACHE_DUMP_VERSION) {
+            return false;
+        }
+        file >> nonce;
+        uint64_t num;
+        file >> num;
+        // The cache drops whatever does not fit anyway, so don't trust num
+        // for more than the configured cache can hold
+        entries.reserve(std::min(num, (uint64_t)(GetMaxSigCacheBytes() / sizeof(uint256))));
+        while (num--) {
+            entries.emplace_back();
+            file >> entries.back();
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize signature cache data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    signatureCache.Load(nonce, entries);
+    LogPrintf("Imported signature cache from disk: %u entries\n", entries.size());
+    return true;
+}
+
+void DumpSignatureCache()
+{
+    int64_t start = GetTimeMicros();
+
+    uint256 nonce;
+    std::vector<uint256> entries;
+    signatureCache.Dump(nonce, entries);
+
+    int64_t mid = GetTimeMicros();
+
+    try {
+        FILE* filestr = fopen((GetDataDir() / "sigcache.dat.new").string().c_str(), "wb");
+        if (!filestr) {
+            return;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t version = SIGCACHE_DUMP_VERSION;
+        file << version;
+        file << nonce;
+        file << (uint64_t)entries.size();
+        for (const uint256& entry : entries)
+            file << entry;
+
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(GetDataDir() / "sigcache.dat.new", GetDataDir() / "sigcache.dat");
+        int64_t last = GetTimeMicros();
+        LogPrintf("Dumped signature cache: %u entries, %gs to copy, %gs to dump\n", entries.size(), (mid-start)*0.000001, (last-mid)*0.000001);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump signature cache: %s. Continuing anyway.\n", e.what());
+    }
+}
+
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
     uint256 entry;
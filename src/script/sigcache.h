@@ -32,4 +32,10 @@ public:
 
 void InitSignatureCache();
 
+/** Dump the signature cache, along with the nonce its entries are salted with, to disk. */
+void DumpSignatureCache();
+
+/** Load the signature cache from disk. Must be called before any signature is verified. */
+bool LoadSignatureCache();
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
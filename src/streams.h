@@ -138,6 +138,80 @@ private:
     size_t nPos;
 };
 
+/** Reads bit-packed values, most significant bit first, from an underlying byte stream */
+template <typename IStream>
+class BitStreamReader
+{
+private:
+    IStream& m_istream;
+    //! Buffered byte read from the stream; the next bit to read is at m_offset from the top
+    uint8_t m_buffer;
+    //! Number of bits of m_buffer already consumed; 8 means a new byte must be read
+    int m_offset;
+
+public:
+    explicit BitStreamReader(IStream& istream) : m_istream(istream), m_buffer(0), m_offset(8) {}
+
+    /** Read the next nbits (at most 64) as a big-endian integer */
+    uint64_t Read(int nbits)
+    {
+        assert(nbits >= 0 && nbits <= 64);
+        uint64_t data = 0;
+        while (nbits > 0) {
+            if (m_offset == 8) {
+                m_istream >> m_buffer;
+                m_offset = 0;
+            }
+            int bits = std::min(8 - m_offset, nbits);
+            data <<= bits;
+            data |= static_cast<uint8_t>(m_buffer << m_offset) >> (8 - bits);
+            m_offset += bits;
+            nbits -= bits;
+        }
+        return data;
+    }
+};
+
+/** Writes bit-packed values, most significant bit first, to an underlying byte stream */
+template <typename OStream>
+class BitStreamWriter
+{
+private:
+    OStream& m_ostream;
+    //! Partially filled byte, written out once full or on Flush
+    uint8_t m_buffer;
+    //! Number of bits of m_buffer already filled
+    int m_offset;
+
+public:
+    explicit BitStreamWriter(OStream& ostream) : m_ostream(ostream), m_buffer(0), m_offset(0) {}
+    ~BitStreamWriter() { Flush(); }
+
+    /** Write the low nbits (at most 64) of data, most significant first */
+    void Write(uint64_t data, int nbits)
+    {
+        assert(nbits >= 0 && nbits <= 64);
+        while (nbits > 0) {
+            int bits = std::min(8 - m_offset, nbits);
+            m_buffer |= (data << (64 - nbits)) >> (64 - 8 + m_offset);
+            m_offset += bits;
+            nbits -= bits;
+            if (m_offset == 8)
+                Flush();
+        }
+    }
+
+    /** Write out a partially filled byte, padding it with zero bits */
+    void Flush()
+    {
+        if (m_offset == 0)
+            return;
+        m_ostream << m_buffer;
+        m_buffer = 0;
+        m_offset = 0;
+    }
+};
+
 /** Double ended buffer combining vector and stream-like interfaces.
  *
  * >> and << read and write unformatted data using the above serialization templates.
@@ -0,0 +1,156 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "txdb.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > GetUnspent(const CScript& script)
+{
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    BOOST_CHECK(pblocktree->ReadAddressUnspentIndex(GetScriptHash(script), vUnspent));
+    return vUnspent;
+}
+
+std::vector<std::pair<CAddressIndexKey, CAmount> > GetHistory(const CScript& script)
+{
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vHistory;
+    BOOST_CHECK(pblocktree->ReadAddressIndex(GetScriptHash(script), vHistory));
+    return vHistory;
+}
+
+bool IndexAtTip()
+{
+    LOCK(cs_main);
+    uint256 hashBest;
+    return pblocktree->ReadAddressIndexBestBlock(hashBest) && hashBest == chainActive.Tip()->GetBlockHash();
+}
+
+void Invalidate(CBlockIndex* pindex)
+{
+    CValidationState state;
+    BOOST_CHECK(InvalidateBlock(state, Params(), pindex));
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+}
+
+void Reconsider(CBlockIndex* pindex)
+{
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(ResetBlockFailureFlags(pindex));
+    }
+    CValidationState state;
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(addressindex_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(addressindex_connect_disconnect_replay)
+{
+    CScript scriptCoinbase = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptDest = GetScriptForDestination(key.GetPubKey().GetID());
+
+    // Spend the first coinbase to a new script in a block connected with the index on
+    fAddressIndex = true;
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = coinbaseTxns[0].vout[0].nValue - 10000;
+    spend.vout[0].scriptPubKey = scriptDest;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptCoinbase, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, spend), scriptCoinbase);
+    BOOST_REQUIRE(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    CBlockIndex* pindexSpend = chainActive.Tip();
+    const uint256 txid = spend.GetHash();
+    BOOST_CHECK(IndexAtTip());
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent = GetUnspent(scriptDest);
+    BOOST_REQUIRE_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].first.txhash == txid);
+    BOOST_CHECK_EQUAL(vUnspent[0].second.nValue, spend.vout[0].nValue);
+    BOOST_CHECK_EQUAL(vUnspent[0].second.nHeight, pindexSpend->nHeight);
+    BOOST_CHECK(!vUnspent[0].second.fCoinBase);
+
+    // The new coinbase is indexed, the spend shows in the history of the coinbase script
+    vUnspent = GetUnspent(scriptCoinbase);
+    BOOST_REQUIRE_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].second.fCoinBase);
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vHistory = GetHistory(scriptCoinbase);
+    BOOST_REQUIRE_EQUAL(vHistory.size(), 2U);
+    for (const auto& entry : vHistory) {
+        BOOST_CHECK_EQUAL(entry.first.nHeight, pindexSpend->nHeight);
+        if (entry.first.fSpending) {
+            BOOST_CHECK(entry.first.txhash == txid);
+            BOOST_CHECK_EQUAL(entry.second, -coinbaseTxns[0].vout[0].nValue);
+        }
+    }
+
+    // The changes are held until the block index is written, and read the same afterwards
+    BOOST_CHECK(pblocktree->AddressIndexPendingUsage() > 0);
+    FlushStateToDisk();
+    BOOST_CHECK_EQUAL(pblocktree->AddressIndexPendingUsage(), 0U);
+    BOOST_CHECK(IndexAtTip());
+    BOOST_CHECK_EQUAL(GetUnspent(scriptDest).size(), 1U);
+    BOOST_CHECK_EQUAL(GetHistory(scriptCoinbase).size(), 2U);
+
+    // Disconnecting the block rolls the index back, reconnecting restores it
+    Invalidate(pindexSpend);
+    BOOST_CHECK(GetUnspent(scriptDest).empty());
+    BOOST_CHECK(GetHistory(scriptCoinbase).empty());
+    BOOST_CHECK(IndexAtTip());
+    Reconsider(pindexSpend);
+    BOOST_CHECK_EQUAL(GetUnspent(scriptDest).size(), 1U);
+    BOOST_CHECK(IndexAtTip());
+
+    // Simulate a crash after indexing a block the chainstate was not flushed
+    // with: the chainstate moves back without the index following it
+    fAddressIndex = false;
+    Invalidate(pindexSpend);
+    fAddressIndex = true;
+    BOOST_CHECK_EQUAL(GetUnspent(scriptDest).size(), 1U);
+    BOOST_CHECK(!IndexAtTip());
+    BOOST_CHECK(ReplayAddressIndex(Params()));
+    BOOST_CHECK(IndexAtTip());
+    BOOST_CHECK(GetUnspent(scriptDest).empty());
+    BOOST_CHECK(GetHistory(scriptCoinbase).empty());
+
+    // And the other way around, the index missing a block of the chainstate
+    fAddressIndex = false;
+    Reconsider(pindexSpend);
+    fAddressIndex = true;
+    BOOST_CHECK(chainActive.Tip() == pindexSpend);
+    BOOST_CHECK(GetUnspent(scriptDest).empty());
+    BOOST_CHECK(ReplayAddressIndex(Params()));
+    BOOST_CHECK(IndexAtTip());
+    vUnspent = GetUnspent(scriptDest);
+    BOOST_REQUIRE_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].first.txhash == txid);
+    BOOST_CHECK_EQUAL(GetHistory(scriptCoinbase).size(), 2U);
+
+    // Replaying an index that is in step changes nothing
+    BOOST_CHECK(ReplayAddressIndex(Params()));
+    BOOST_CHECK_EQUAL(GetUnspent(scriptDest).size(), 1U);
+
+    fAddressIndex = false;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,183 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "net_processing.h"
+
+#include "chainparams.h"
+#include "consensus/merkle.h"
+#include "hash.h"
+#include "netmessagemaker.h"
+#include "pow.h"
+#include "validation.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+struct RegtestingSetup : public TestingSetup {
+    RegtestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+};
+
+/** A chain of coinbase-only blocks on top of the genesis block */
+std::vector<CBlock> MakeChain(int nBlocks)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    std::vector<CBlock> vBlocks;
+    uint256 hashPrev = genesis.GetHash();
+    for (int i = 1; i <= nBlocks; i++) {
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].scriptSig = CScript() << i << OP_0;
+        coinbase.vout.resize(1);
+        coinbase.vout[0].nValue = 0;
+        coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        CBlock block;
+        block.nVersion = 4;
+        block.hashPrevBlock = hashPrev;
+        block.nTime = genesis.nTime + i;
+        block.nBits = genesis.nBits;
+        block.vtx.push_back(MakeTransactionRef(coinbase));
+        block.hashMerkleRoot = BlockMerkleRoot(block);
+        while (!CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus()))
+            block.nNonce++;
+        hashPrev = block.GetHash();
+        vBlocks.push_back(block);
+    }
+    return vBlocks;
+}
+
+/** Hand a message to ProcessMessages as if node had sent it */
+void ReceiveMessage(CNode& node, CConnman& connman, const CSerializedNetMsg& msg)
+{
+    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), msg.data.size());
+    uint256 hash = Hash(msg.data.begin(), msg.data.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    std::vector<unsigned char> vHeader;
+    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, vHeader, 0, hdr};
+
+    CNetMessage netmsg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    BOOST_REQUIRE_EQUAL(netmsg.readHeader((const char*)vHeader.data(), vHeader.size()), (int)vHeader.size());
+    if (!msg.data.empty())
+        BOOST_REQUIRE_EQUAL(netmsg.readData((const char*)msg.data.data(), msg.data.size()), (int)msg.data.size());
+    BOOST_REQUIRE(netmsg.complete());
+    {
+        LOCK(node.cs_vProcessMsg);
+        node.nProcessQueueSize += netmsg.vRecv.size() + CMessageHeader::HEADER_SIZE;
+        node.vProcessMsg.push_back(std::move(netmsg));
+    }
+    std::atomic<bool> interruptDummy(false);
+    while (ProcessMessages(&node, connman, interruptDummy)) {}
+}
+
+/** Let SendMessages run for node, dropping what it queues as there is no socket to send it on */
+void SendMessagesTo(CNode& node, CConnman& connman)
+{
+    std::atomic<bool> interruptDummy(false);
+    SendMessages(&node, connman, interruptDummy);
+    LOCK(node.cs_vSend);
+    node.vSendMsg.clear();
+    node.nSendSize = 0;
+    node.nSendOffset = 0;
+    node.fPauseSend = false;
+}
+
+std::vector<int> HeightsInFlight(const CNode& node)
+{
+    CNodeStateStats stats;
+    BOOST_CHECK(GetNodeStateStats(node.GetId(), stats));
+    std::sort(stats.vHeightInFlight.begin(), stats.vHeightInFlight.end());
+    return stats.vHeightInFlight;
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(blockdownload_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(blocks_in_transit_target)
+{
+    // Peers that have not delivered anything yet get the fixed default
+    BOOST_CHECK_EQUAL(GetBlocksInTransitTarget(0), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // Enough blocks to keep the peer busy for BLOCK_DOWNLOAD_BUFFER_TIME
+    BOOST_CHECK_EQUAL(GetBlocksInTransitTarget(BLOCK_DOWNLOAD_BUFFER_TIME * 1000000 / 10), 10);
+    BOOST_CHECK_EQUAL(GetBlocksInTransitTarget(BLOCK_DOWNLOAD_BUFFER_TIME * 1000000 / 40), 40);
+
+    // Within bounds for very slow and very fast peers
+    BOOST_CHECK_EQUAL(GetBlocksInTransitTarget(3600 * 1000000LL), MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlocksInTransitTarget(1), MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+}
+
+BOOST_AUTO_TEST_CASE(block_download_window)
+{
+    // Never smaller than the fixed window
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(0, false), BLOCK_DOWNLOAD_WINDOW);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(10, false), BLOCK_DOWNLOAD_WINDOW);
+
+    // Covers BLOCK_DOWNLOAD_WINDOW_TIME of validation when that is more
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(300, false), 300 * BLOCK_DOWNLOAD_WINDOW_TIME);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(1e6, false), MAX_BLOCK_DOWNLOAD_WINDOW);
+
+    // Fixed when pruning
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(1e6, true), BLOCK_DOWNLOAD_WINDOW);
+}
+
+BOOST_FIXTURE_TEST_CASE(stalled_block_moves_to_faster_peer, RegtestingSetup)
+{
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    // Enough blocks to run past the download window
+    const std::vector<CBlock> vBlocks = MakeChain(BLOCK_DOWNLOAD_WINDOW + 6);
+    std::vector<CBlock> vHeaders;
+    for (const CBlock& block : vBlocks)
+        vHeaders.push_back(CBlock(block.GetBlockHeader()));
+
+    CAddress addr(CService(), NODE_NONE);
+    CNode slow(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", true);
+    CNode fast(1, NODE_NETWORK, 0, INVALID_SOCKET, addr, 1, 1, "", true);
+    for (CNode* pnode : {&slow, &fast}) {
+        pnode->SetSendVersion(PROTOCOL_VERSION);
+        GetNodeSignals().InitializeNode(pnode, *connman);
+        pnode->nVersion = PROTOCOL_VERSION;
+        pnode->fSuccessfullyConnected = true;
+        ReceiveMessage(*pnode, *connman, msgMaker.Make(NetMsgType::HEADERS, vHeaders));
+    }
+
+    // Each peer is asked for the default number of blocks, the fast one delivers them
+    SendMessagesTo(slow, *connman);
+    SendMessagesTo(fast, *connman);
+    std::vector<int> vSlowInFlight = HeightsInFlight(slow);
+    std::vector<int> vFastInFlight = HeightsInFlight(fast);
+    BOOST_REQUIRE_EQUAL(vSlowInFlight.size(), (size_t)MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_REQUIRE_EQUAL(vFastInFlight.size(), (size_t)MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(vSlowInFlight.front(), 1);
+    for (int nHeight : vFastInFlight)
+        ReceiveMessage(fast, *connman, msgMaker.Make(NetMsgType::BLOCK, vBlocks[nHeight - 1]));
+    BOOST_CHECK(HeightsInFlight(fast).empty());
+
+    // The rest of the window arrives, only the slow peer's blocks are missing
+    for (int nHeight = vFastInFlight.back() + 1; nHeight <= (int)BLOCK_DOWNLOAD_WINDOW; nHeight++)
+        BOOST_CHECK(ProcessNewBlock(Params(), std::make_shared<CBlock>(vBlocks[nHeight - 1]), true, NULL));
+    BOOST_CHECK_EQUAL(chainActive.Height(), 0);
+
+    // The fast peer can't get anything past the window, so it takes over the
+    // request for the block holding the window up from the slow peer
+    SendMessagesTo(fast, *connman);
+    BOOST_CHECK(HeightsInFlight(fast) == std::vector<int>(1, 1));
+    vSlowInFlight = HeightsInFlight(slow);
+    BOOST_CHECK_EQUAL(vSlowInFlight.size(), (size_t)MAX_BLOCKS_IN_TRANSIT_PER_PEER - 1);
+    BOOST_CHECK(std::find(vSlowInFlight.begin(), vSlowInFlight.end(), 1) == vSlowInFlight.end());
+
+    // The request was moved, not duplicated: the slow peer delivering the
+    // block after all is still accepted, and clears the fast peer's request
+    ReceiveMessage(slow, *connman, msgMaker.Make(NetMsgType::BLOCK, vBlocks[0]));
+    BOOST_CHECK_EQUAL(chainActive.Height(), 1);
+    BOOST_CHECK(HeightsInFlight(fast).empty());
+
+    bool fUpdateConnectionTime = false;
+    GetNodeSignals().FinalizeNode(slow.GetId(), fUpdateConnectionTime);
+    GetNodeSignals().FinalizeNode(fast.GetId(), fUpdateConnectionTime);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
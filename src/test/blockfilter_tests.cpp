@@ -0,0 +1,198 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "serialize.h"
+#include "streams.h"
+#include "undo.h"
+#include "utilstrencodings.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(bitstream_reader_writer)
+{
+    CDataStream stream(SER_NETWORK, 0);
+
+    {
+        BitStreamWriter<CDataStream> bitwriter(stream);
+        bitwriter.Write(0, 1);
+        bitwriter.Write(2, 2);
+        bitwriter.Write(6, 3);
+        bitwriter.Write(11, 4);
+        bitwriter.Write(1, 5);
+        bitwriter.Write(32, 6);
+        bitwriter.Write(7, 7);
+        bitwriter.Write(30497, 16);
+        bitwriter.Flush();
+    }
+
+    // 0 10 110 1011 00001 100000 0000111 0111011100100001, padded with zeros
+    BOOST_CHECK_EQUAL(HexStr(stream.begin(), stream.end()), "5ac300777210");
+
+    BitStreamReader<CDataStream> bitreader(stream);
+    BOOST_CHECK_EQUAL(bitreader.Read(1), 0U);
+    BOOST_CHECK_EQUAL(bitreader.Read(2), 2U);
+    BOOST_CHECK_EQUAL(bitreader.Read(3), 6U);
+    BOOST_CHECK_EQUAL(bitreader.Read(4), 11U);
+    BOOST_CHECK_EQUAL(bitreader.Read(5), 1U);
+    BOOST_CHECK_EQUAL(bitreader.Read(6), 32U);
+    BOOST_CHECK_EQUAL(bitreader.Read(7), 7U);
+    BOOST_CHECK_EQUAL(bitreader.Read(16), 30497U);
+    BOOST_CHECK_THROW(bitreader.Read(8), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    GCSFilter::ElementSet included_elements, excluded_elements;
+    for (int i = 0; i < 100; ++i) {
+        GCSFilter::Element element1(32);
+        element1[0] = i;
+        included_elements.insert(std::move(element1));
+
+        GCSFilter::Element element2(32);
+        element2[1] = i;
+        excluded_elements.insert(std::move(element2));
+    }
+
+    GCSFilter filter(GCSFilter::Params(0, 0, 10, 1 << 10), included_elements);
+    BOOST_CHECK_EQUAL(filter.GetN(), 100U);
+    for (const GCSFilter::Element& element : included_elements) {
+        BOOST_CHECK(filter.Match(element));
+
+        GCSFilter::ElementSet query = excluded_elements;
+        query.insert(element);
+        BOOST_CHECK(filter.MatchAny(query));
+    }
+
+    // The filter round-trips through its encoding
+    GCSFilter filter2(filter.GetParams(), filter.GetEncoded());
+    BOOST_CHECK_EQUAL(filter2.GetN(), filter.GetN());
+    for (const GCSFilter::Element& element : included_elements) {
+        BOOST_CHECK(filter2.Match(element));
+    }
+
+    // Malformed encodings are rejected
+    std::vector<unsigned char> truncated(filter.GetEncoded().begin(), filter.GetEncoded().end() - 1);
+    BOOST_CHECK_THROW(GCSFilter(filter.GetParams(), truncated), std::ios_base::failure);
+    std::vector<unsigned char> padded = filter.GetEncoded();
+    padded.push_back(0);
+    BOOST_CHECK_THROW(GCSFilter(filter.GetParams(), padded), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_default_constructor)
+{
+    GCSFilter filter;
+    BOOST_CHECK_EQUAL(filter.GetN(), 0U);
+    BOOST_CHECK_EQUAL(filter.GetEncoded().size(), 1U);
+
+    const GCSFilter::Params& params = filter.GetParams();
+    BOOST_CHECK_EQUAL(params.m_siphash_k0, 0U);
+    BOOST_CHECK_EQUAL(params.m_siphash_k1, 0U);
+    BOOST_CHECK_EQUAL(params.m_P, 0);
+    BOOST_CHECK_EQUAL(params.m_M, 1U);
+
+    BOOST_CHECK(!filter.Match(GCSFilter::Element(1, 0x42)));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
+{
+    CScript included_scripts[5], excluded_scripts[3];
+
+    // First two are outputs on a single transaction.
+    included_scripts[0] << std::vector<unsigned char>(0, 65) << OP_CHECKSIG;
+    included_scripts[1] << OP_DUP << OP_HASH160 << std::vector<unsigned char>(1, 20) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    // Third is an output on in a second transaction.
+    included_scripts[2] << OP_1 << std::vector<unsigned char>(2, 33) << OP_1 << OP_CHECKMULTISIG;
+
+    // Last two are spent by a single transaction.
+    included_scripts[3] << OP_0 << std::vector<unsigned char>(3, 32);
+    included_scripts[4] << OP_4 << OP_ADD << OP_8 << OP_EQUAL;
+
+    // OP_RETURN output and an empty script are not included.
+    excluded_scripts[0] << OP_RETURN << std::vector<unsigned char>(4, 40);
+    excluded_scripts[1] = CScript();
+
+    // Script that is spent by a transaction but not in the undo data is not included.
+    excluded_scripts[2] << OP_3 << OP_ADD << OP_7 << OP_EQUAL;
+
+    CMutableTransaction tx_1;
+    tx_1.vout.emplace_back(100, included_scripts[0]);
+    tx_1.vout.emplace_back(200, included_scripts[1]);
+    tx_1.vout.emplace_back(0, excluded_scripts[0]);
+
+    CMutableTransaction tx_2;
+    tx_2.vout.emplace_back(300, included_scripts[2]);
+    tx_2.vout.emplace_back(0, excluded_scripts[1]);
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(tx_1));
+    block.vtx.push_back(MakeTransactionRef(tx_2));
+
+    CBlockUndo block_undo;
+    block_undo.vtxundo.emplace_back();
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(400, included_scripts[3]), 1000, true);
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(500, included_scripts[4]), 10000, false);
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(500, excluded_scripts[1]), 10000, false);
+
+    BlockFilter block_filter(BLOCK_FILTER_BASIC, block, block_undo);
+    const GCSFilter& filter = block_filter.GetFilter();
+
+    for (const CScript& script : included_scripts) {
+        BOOST_CHECK(filter.Match(GCSFilter::Element(script.begin(), script.end())));
+    }
+    for (const CScript& script : excluded_scripts) {
+        BOOST_CHECK(!filter.Match(GCSFilter::Element(script.begin(), script.end())));
+    }
+
+    // Test serialization/unserialization.
+    BlockFilter block_filter2;
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block_filter;
+    stream >> block_filter2;
+
+    BOOST_CHECK(block_filter.GetFilterType() == block_filter2.GetFilterType());
+    BOOST_CHECK(block_filter.GetBlockHash() == block_filter2.GetBlockHash());
+    BOOST_CHECK(block_filter.GetEncodedFilter() == block_filter2.GetEncodedFilter());
+    BOOST_CHECK(block_filter.GetHash() == block_filter2.GetHash());
+
+    BlockFilter default_ctor_block_filter_1;
+    BOOST_CHECK(default_ctor_block_filter_1.GetFilterType() == BLOCK_FILTER_INVALID);
+
+    // Unknown filter types cannot be constructed
+    BOOST_CHECK_THROW(BlockFilter(BLOCK_FILTER_INVALID, block.GetHash(), block_filter.GetEncodedFilter()), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_genesis_vector)
+{
+    // BIP 158 test vector for the testnet genesis block
+    const CBlock& genesis = Params(CBaseChainParams::TESTNET).GenesisBlock();
+    BOOST_CHECK_EQUAL(genesis.GetHash().GetHex(), "000000000933ea01ad0ee984209779baaec3ced90fa3f408719526f8d77f4943");
+
+    BlockFilter filter(BLOCK_FILTER_BASIC, genesis, CBlockUndo());
+    BOOST_CHECK_EQUAL(HexStr(filter.GetEncodedFilter()), "019dfca8");
+    BOOST_CHECK_EQUAL(filter.ComputeHeader(uint256()).GetHex(), "21584579b7eb08997773e5aeff3a7f932700042d0ed2a6129012b7d7ae81b750");
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_type_names)
+{
+    BOOST_CHECK_EQUAL(BlockFilterTypeName(BLOCK_FILTER_BASIC), "basic");
+    BOOST_CHECK_EQUAL(BlockFilterTypeName(BLOCK_FILTER_INVALID), "");
+
+    BlockFilterType filter_type;
+    BOOST_CHECK(BlockFilterTypeByName("basic", filter_type));
+    BOOST_CHECK(filter_type == BLOCK_FILTER_BASIC);
+    BOOST_CHECK(!BlockFilterTypeByName("unknown", filter_type));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
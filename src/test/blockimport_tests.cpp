@@ -0,0 +1,142 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "consensus/merkle.h"
+#include "consensus/validation.h"
+#include "pow.h"
+#include "streams.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <set>
+#include <stdio.h>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+/** A chain of coinbase-only blocks on top of the genesis block */
+std::vector<CBlock> MakeChain(int nBlocks)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    std::vector<CBlock> vBlocks;
+    uint256 hashPrev = genesis.GetHash();
+    for (int i = 1; i <= nBlocks; i++) {
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].scriptSig = CScript() << i << OP_0;
+        coinbase.vout.resize(1);
+        coinbase.vout[0].nValue = 0;
+        coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        CBlock block;
+        block.nVersion = 4;
+        block.hashPrevBlock = hashPrev;
+        block.nTime = genesis.nTime + i;
+        block.nBits = genesis.nBits;
+        block.vtx.push_back(MakeTransactionRef(coinbase));
+        block.hashMerkleRoot = BlockMerkleRoot(block);
+        while (!CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus()))
+            block.nNonce++;
+        hashPrev = block.GetHash();
+        vBlocks.push_back(block);
+    }
+    return vBlocks;
+}
+
+/** Append a block the way it is stored in blk?????.dat, announcing nExtra bytes more than it takes */
+void WriteBlock(CDataStream& file, const CBlock& block, unsigned int nExtra = 0)
+{
+    unsigned int nSize = GetSerializeSize(block, SER_DISK, CLIENT_VERSION) + nExtra;
+    file << FLATDATA(Params().MessageStart()) << nSize << block;
+}
+
+/**
+ * A block file with everything the loader has to recover from: junk between
+ * blocks, a block announcing more bytes than it uses, and an unreadable block.
+ */
+CDataStream MakeBlockFile(const std::vector<CBlock>& vBlocks)
+{
+    CDataStream file(SER_DISK, CLIENT_VERSION);
+    file << std::string("junk");
+    WriteBlock(file, Params().GenesisBlock());
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        if (i == vBlocks.size() / 3) {
+            // Fails to deserialize: the transaction count is out of range
+            std::vector<unsigned char> vGarbage(200, 0xff);
+            file << FLATDATA(Params().MessageStart()) << (unsigned int)vGarbage.size();
+            file.write((const char*)vGarbage.data(), vGarbage.size());
+        }
+        if (i == vBlocks.size() / 2) {
+            WriteBlock(file, vBlocks[i], 10);
+            file.write(std::string(10, '\0').data(), 10);
+            continue;
+        }
+        WriteBlock(file, vBlocks[i]);
+        if (i % 7 == 0)
+            file << (unsigned char)Params().MessageStart()[0];
+    }
+    return file;
+}
+
+struct ImportResult
+{
+    bool fLoaded;
+    int nHeight;
+    uint256 hashTip;
+    std::set<uint256> setHaveData;
+};
+
+/** Import the block file into a fresh regtest node whose pipeline runs nWorkers decoding threads */
+ImportResult Import(int nBlocks, int nWorkers)
+{
+    TestingSetup setup(CBaseChainParams::REGTEST);
+    CDataStream file = MakeBlockFile(MakeChain(nBlocks));
+    FILE* fileIn = tmpfile();
+    BOOST_REQUIRE(fileIn);
+    BOOST_REQUIRE_EQUAL(fwrite(file.data(), 1, file.size(), fileIn), file.size());
+    rewind(fileIn);
+
+    ImportResult result;
+    int nScriptCheckThreadsSaved = nScriptCheckThreads;
+    nScriptCheckThreads = nWorkers;
+    result.fLoaded = LoadExternalBlockFile(Params(), fileIn);
+    nScriptCheckThreads = nScriptCheckThreadsSaved;
+
+    CValidationState state;
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    LOCK(cs_main);
+    result.nHeight = chainActive.Height();
+    result.hashTip = chainActive.Tip()->GetBlockHash();
+    for (const auto& entry : mapBlockIndex) {
+        if (entry.second->nStatus & BLOCK_HAVE_DATA)
+            result.setHaveData.insert(entry.first);
+    }
+    return result;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(blockimport_tests)
+
+BOOST_AUTO_TEST_CASE(parallel_import_matches_serial)
+{
+    const int nBlocks = 60;
+    // Without workers the importing thread decodes every block itself
+    ImportResult serial = Import(nBlocks, 0);
+    BOOST_CHECK(serial.fLoaded);
+    BOOST_CHECK_EQUAL(serial.nHeight, nBlocks);
+    BOOST_CHECK_EQUAL(serial.setHaveData.size(), (size_t)nBlocks + 1);
+
+    for (int nWorkers : {1, 4}) {
+        ImportResult parallel = Import(nBlocks, nWorkers);
+        BOOST_CHECK(parallel.fLoaded);
+        BOOST_CHECK_EQUAL(parallel.nHeight, serial.nHeight);
+        BOOST_CHECK(parallel.hashTip == serial.hashTip);
+        BOOST_CHECK(parallel.setHaveData == serial.setHaveData);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
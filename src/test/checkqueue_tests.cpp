@@ -438,5 +438,94 @@ BOOST_AUTO_TEST_CASE(test_CheckQueueControl_Locks)
         tg.join_all();
     }
 }
+
+/** Test that a CCheckQueueControl that only tries to take the queue backs off while it is in use */
+BOOST_AUTO_TEST_CASE(test_CheckQueueControl_Try)
+{
+    auto queue = std::unique_ptr<Standard_Queue>(new Standard_Queue{QUEUE_BATCH_SIZE});
+    {
+        CCheckQueueControl<FakeCheck> control(queue.get());
+        BOOST_CHECK(control.HasQueue());
+        CCheckQueueControl<FakeCheck> tryControl(queue.get(), true);
+        BOOST_CHECK(!tryControl.HasQueue());
+        // As with a NULL queue, the caller has to run the checks itself
+        std::vector<FakeCheck> vChecks(1);
+        tryControl.Add(vChecks);
+        BOOST_CHECK(tryControl.Wait());
+    }
+    CCheckQueueControl<FakeCheck> tryControl(queue.get(), true);
+    BOOST_CHECK(tryControl.HasQueue());
+}
+
+/** Test that every item pushed onto a CWorkStealingDeque is taken exactly
+ * once, either by the owner or by one of the concurrent thieves.
+ */
+BOOST_AUTO_TEST_CASE(test_WorkStealingDeque)
+{
+    static const size_t N_ITEMS = 100000;
+    std::vector<size_t> items(N_ITEMS);
+    std::vector<std::atomic<int>> taken(N_ITEMS);
+    for (size_t i = 0; i < N_ITEMS; ++i) {
+        items[i] = i;
+        taken[i] = 0;
+    }
+    CWorkStealingDeque<size_t> deque(2); // start small to exercise growing
+    std::atomic<bool> done {false};
+    std::vector<std::thread> thieves;
+    for (int t = 0; t < 3; ++t) {
+        thieves.emplace_back([&]{
+            while (true) {
+                bool fDone = done;
+                size_t* x = nullptr;
+                if (deque.Steal(x) == CWorkStealingDeque<size_t>::STEAL_OK) {
+                    ++taken[*x];
+                } else if (fDone && deque.Size() == 0) {
+                    break;
+                }
+            }
+        });
+    }
+    for (size_t i = 0; i < N_ITEMS; ++i) {
+        deque.Push(&items[i]);
+        if (i % 3 == 0) {
+            size_t* x = deque.Pop();
+            if (x) ++taken[*x];
+        }
+    }
+    while (size_t* x = deque.Pop()) {
+        ++taken[*x];
+    }
+    done = true;
+    for (auto& t : thieves) t.join();
+    size_t nWrong = 0;
+    for (size_t i = 0; i < N_ITEMS; ++i) {
+        nWrong += taken[i] != 1;
+    }
+    BOOST_REQUIRE_EQUAL(nWrong, 0);
+}
+
+/** Test that CCheckQueueControl drives the single-lock baseline queue too */
+BOOST_AUTO_TEST_CASE(test_SingleLockCheckQueue)
+{
+    typedef CSingleLockCheckQueue<FailingCheck> Queue;
+    auto queue = std::unique_ptr<Queue>(new Queue {QUEUE_BATCH_SIZE});
+    boost::thread_group tg;
+    for (auto x = 0; x < nScriptCheckThreads; ++x) {
+       tg.create_thread([&]{queue->Thread();});
+    }
+    // The last round has no failing check.
+    for (size_t i = 0; i <= 100; ++i) {
+        CCheckQueueControl<FailingCheck, Queue> control(queue.get());
+        std::vector<FailingCheck> vChecks;
+        for (size_t k = 0; k < 100; ++k) {
+            vChecks.emplace_back(k == i);
+        }
+        control.Add(vChecks);
+        BOOST_REQUIRE_EQUAL(control.Wait(), i == 100);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
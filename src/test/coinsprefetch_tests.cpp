@@ -0,0 +1,127 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinsprefetch.h"
+
+#include "coins.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <atomic>
+#include <map>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+/** Plain map-backed view; const lookups are safe to run concurrently */
+class CCoinsViewMap : public CCoinsView
+{
+public:
+    std::map<COutPoint, Coin> map;
+    mutable std::atomic<int> reads;
+
+    CCoinsViewMap() : reads(0) {}
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
+    {
+        reads++;
+        std::map<COutPoint, Coin>::const_iterator it = map.find(outpoint);
+        if (it == map.end())
+            return false;
+        coin = it->second;
+        return true;
+    }
+
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase)
+    {
+        for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
+            if (!(it->second.flags & CCoinsCacheEntry::DIRTY))
+                continue;
+            if (it->second.coin.IsSpent())
+                map.erase(it->first);
+            else
+                map[it->first] = it->second.coin;
+        }
+        if (fErase)
+            mapCoins.clear();
+        return true;
+    }
+};
+
+}
+
+BOOST_FIXTURE_TEST_SUITE(coinsprefetch_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(coinsprefetch_stage_and_serve)
+{
+    CCoinsViewMap base;
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 1000; i++) {
+        COutPoint outpoint(GetRandHash(), i);
+        Coin coin;
+        coin.out.nValue = i + 1;
+        coin.nHeight = 1;
+        if (i < 900)
+            base.map.emplace(outpoint, coin);
+        outpoints.push_back(outpoint);
+    }
+
+    CCoinsViewPrefetch prefetch(&base, 4);
+    prefetch.Prefetch(outpoints);
+    prefetch.WaitForIdle();
+    // Coins that the base does not have are not staged
+    BOOST_CHECK_EQUAL(prefetch.GetStagedCount(), 900U);
+    BOOST_CHECK_EQUAL(base.reads, 1000);
+
+    // Staged coins are served without touching the base, and only once
+    CCoinsViewCache cache(&prefetch);
+    for (int i = 0; i < 900; i++) {
+        BOOST_CHECK_EQUAL(cache.AccessCoin(outpoints[i]).out.nValue, i + 1);
+    }
+    BOOST_CHECK_EQUAL(base.reads, 1000);
+    BOOST_CHECK_EQUAL(prefetch.GetStagedCount(), 0U);
+    BOOST_CHECK(!cache.HaveCoin(outpoints[950]));
+    BOOST_CHECK_EQUAL(base.reads, 1001);
+}
+
+BOOST_AUTO_TEST_CASE(coinsprefetch_write_discards_staged)
+{
+    CCoinsViewMap base;
+    COutPoint outpoint(GetRandHash(), 0);
+    Coin coin;
+    coin.out.nValue = 1;
+    coin.nHeight = 1;
+    base.map.emplace(outpoint, coin);
+
+    CCoinsViewPrefetch prefetch(&base, 2);
+    prefetch.Prefetch(std::vector<COutPoint>(1, outpoint));
+    prefetch.WaitForIdle();
+    BOOST_CHECK_EQUAL(prefetch.GetStagedCount(), 1U);
+
+    // Write a spend of the coin through the prefetch layer: the staged copy
+    // must not resurface.
+    {
+        CCoinsMap map;
+        map[outpoint].flags = CCoinsCacheEntry::DIRTY;
+        BOOST_CHECK(prefetch.BatchWrite(map, uint256(), true));
+    }
+    BOOST_CHECK_EQUAL(prefetch.GetStagedCount(), 0U);
+    Coin result;
+    BOOST_CHECK(!prefetch.GetCoin(outpoint, result));
+    BOOST_CHECK(!prefetch.HaveCoin(outpoint));
+}
+
+BOOST_AUTO_TEST_CASE(coinsprefetch_disabled)
+{
+    CCoinsViewMap base;
+    COutPoint outpoint(GetRandHash(), 0);
+    CCoinsViewPrefetch prefetch(&base, 0);
+    prefetch.Prefetch(std::vector<COutPoint>(1, outpoint));
+    prefetch.WaitForIdle();
+    BOOST_CHECK_EQUAL(prefetch.GetStagedCount(), 0U);
+    BOOST_CHECK_EQUAL(base.reads, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "hash.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 #include "test/test_random.h"
@@ -255,6 +256,50 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256_implementations) {
+    // Every accelerated backend usable on this machine must agree with the portable one.
+    const sha256_implementation::UseImplementation uses[] = {
+        sha256_implementation::STANDARD,
+        sha256_implementation::USE_SSE4,
+        sha256_implementation::USE_AVX2,
+        sha256_implementation::USE_SHANI,
+    };
+    for (const auto use : uses) {
+        std::string name = SHA256AutoDetect(use);
+        BOOST_TEST_MESSAGE("Testing SHA256 implementation " << name);
+        BOOST_CHECK(name.find("self-test") == std::string::npos);
+        TestSHA256("", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+        TestSHA256("This is exactly 64 bytes long, not counting the terminating byte",
+                   "ab64eff7e88e2e46165e29f2bce41826bd4c7b3552f6b382a9e7d3af47c245f8");
+        TestSHA256("As Bitcoin relies on 80 byte header hashes, we want to have an example for that.",
+                   "7406e8de7d6e4fffc573daef05aefb8806e7790f55eab5576f31349743cca743");
+        TestSHA256(std::string(1000000, 'a'),
+                   "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+        TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
+    }
+    SHA256AutoDetect();
+}
+
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Compare against CHash256 for every batch size around the 4-way and 8-way boundaries.
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; ++j) {
+            in[j] = insecure_rand() & 0xff;
+        }
+        for (int j = 0; j < i; ++j) {
+            CHash256().Write(in + 64 * j, 64).Finalize(out1 + 32 * j);
+        }
+        SHA256D64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+        // Hashing in place must give the same result.
+        SHA256D64(in, in, i);
+        BOOST_CHECK(memcmp(out1, in, 32 * i) == 0);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
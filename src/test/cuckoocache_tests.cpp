@@ -391,4 +391,31 @@ BOOST_AUTO_TEST_CASE(cuckoocache_generations)
     test_cache_generations<CuckooCache::cache<uint256, uint256Hasher>>();
 }
 
+BOOST_AUTO_TEST_CASE(cuckoocache_get_live)
+{
+    insecure_rand = FastRandomContext(true);
+    CuckooCache::cache<uint256, uint256Hasher> cc{};
+    cc.setup(1 << 12);
+    std::vector<uint256> hashes(1000);
+    for (uint256& h : hashes) {
+        insecure_GetRandHash(h);
+        cc.insert(h);
+    }
+    // Erased elements are left out
+    for (size_t i = 0; i < hashes.size(); i += 2)
+        cc.contains(hashes[i], true);
+
+    std::vector<uint256> live;
+    cc.get_live(live);
+    BOOST_CHECK_EQUAL(live.size(), hashes.size() / 2);
+
+    // Replaying them into a fresh cache gives the same contents
+    CuckooCache::cache<uint256, uint256Hasher> copy{};
+    copy.setup(1 << 12);
+    for (const uint256& h : live)
+        copy.insert(h);
+    for (size_t i = 0; i < hashes.size(); ++i)
+        BOOST_CHECK_EQUAL(copy.contains(hashes[i], false), i % 2 == 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -320,6 +320,49 @@ BOOST_AUTO_TEST_CASE(iterator_string_ordering)
     }
 }
 
-
+BOOST_AUTO_TEST_CASE(dbwrapper_stats)
+{
+    boost::filesystem::path ph = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    CDBWrapper dbw(ph, (1 << 20), true, false, false);
+    BOOST_CHECK_EQUAL(dbw.GetName(), ph.filename().string());
+    CDBWrapperStats before = dbw.GetStats();
+
+    CDBBatch batch(dbw);
+    for (uint32_t i = 0; i < 1000; i++)
+        batch.Write(i, GetRandHash());
+    dbw.WriteBatch(batch);
+
+    // Move everything out of the memtable into table files, so that reads
+    // go through the block cache
+    dbw.CompactRange(uint32_t(0), uint32_t(1000));
+
+    uint256 value;
+    for (uint32_t i = 0; i < 1000; i++)
+        BOOST_CHECK(dbw.Read(i, value));
+    BOOST_CHECK(!dbw.Exists(uint32_t(1000)));
+
+    CDBWrapperStats stats = dbw.GetStats();
+    BOOST_CHECK_EQUAL(stats.name, dbw.GetName());
+    BOOST_CHECK_EQUAL(stats.nReads - before.nReads, 1001U);
+    BOOST_CHECK_EQUAL(stats.nReadsFound - before.nReadsFound, 1000U);
+    BOOST_CHECK_EQUAL(stats.nReadBytes - before.nReadBytes, 1000U * 32);
+    BOOST_CHECK_EQUAL(stats.nBatches - before.nBatches, 1U);
+    BOOST_CHECK(stats.nBatchBytes - before.nBatchBytes >= 1000U * (4 + 32));
+    BOOST_CHECK(stats.nBlockCacheHits > 0);
+    BOOST_CHECK(stats.nBlockCacheMisses > 0);
+    BOOST_CHECK(stats.nBlockCacheUsage > 0);
+
+    // The compaction left the data in one level
+    int nFiles = 0;
+    for (const CDBWrapperStats::Level& level : stats.levels)
+        nFiles += level.nFiles;
+    BOOST_CHECK(nFiles > 0);
+    BOOST_CHECK(stats.nReadAmplification > 0);
+
+    bool fFound = false;
+    for (const CDBWrapperStats& entry : GetAllDBWrapperStats())
+        fFound |= entry.name == stats.name;
+    BOOST_CHECK(fFound);
+}
 
 BOOST_AUTO_TEST_SUITE_END()
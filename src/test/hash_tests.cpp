@@ -105,6 +105,14 @@ BOOST_AUTO_TEST_CASE(siphash)
 
     BOOST_CHECK_EQUAL(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, uint256S("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100")), 0x7127512f72f27cceull);
 
+    // The outpoint variant must match hashing the 36 bytes directly
+    uint256 val = uint256S("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100");
+    const unsigned char extra[4] = {0x20, 0x21, 0x22, 0x23};
+    CSipHasher hasherExtra(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL);
+    hasherExtra.Write(val.begin(), 32);
+    hasherExtra.Write(extra, 4);
+    BOOST_CHECK_EQUAL(SipHashUint256Extra(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, val, 0x23222120), hasherExtra.Finalize());
+
     // Check test vectors from spec, one byte at a time
     CSipHasher hasher2(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL);
     for (uint8_t x=0; x<ARRAYLEN(siphash_4_2_testvec); ++x)
@@ -0,0 +1,171 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "index/base.h"
+
+#include "chain.h"
+#include "primitives/block.h"
+#include "script/standard.h"
+#include "utiltime.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+/** What a TestIndex has written; outlives the index to simulate a restart */
+struct TestIndexStore
+{
+    std::mutex mutex;
+    std::vector<uint256> vWritten;
+    CBlockLocator locator;
+    bool fBadBlock = false;
+};
+
+/** An index that records which blocks it was given */
+class TestIndex : public BaseIndex
+{
+private:
+    TestIndexStore& store;
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+    {
+        if (nWriteDelayMillis)
+            MilliSleep(nWriteDelayMillis);
+        std::lock_guard<std::mutex> lock(store.mutex);
+        if (block.GetHash() != pindex->GetBlockHash())
+            store.fBadBlock = true;
+        store.vWritten.push_back(pindex->GetBlockHash());
+        return true;
+    }
+
+    bool ReadBestBlock(CBlockLocator& locator)
+    {
+        std::lock_guard<std::mutex> lock(store.mutex);
+        locator = store.locator;
+        return !locator.IsNull();
+    }
+
+    bool WriteBestBlock(const CBlockLocator& locator)
+    {
+        std::lock_guard<std::mutex> lock(store.mutex);
+        store.locator = locator;
+        return true;
+    }
+
+    const char* GetName() const { return "testindex"; }
+
+public:
+    int64_t nWriteDelayMillis;
+
+    TestIndex(TestIndexStore& storeIn) : store(storeIn), nWriteDelayMillis(0) {}
+
+    virtual ~TestIndex()
+    {
+        Interrupt();
+        Stop();
+    }
+};
+
+bool WaitForSync(BaseIndex& index)
+{
+    for (int i = 0; i < 1000; i++) {
+        if (index.BlockUntilSyncedToCurrentChain())
+            return true;
+        MilliSleep(10);
+    }
+    return false;
+}
+
+/** Check that the store holds the active chain up to pindexTip, each block written once and in order */
+void CheckWritten(TestIndexStore& store, const CBlockIndex* pindexTip)
+{
+    LOCK(cs_main);
+    std::lock_guard<std::mutex> lock(store.mutex);
+    BOOST_CHECK(!store.fBadBlock);
+    BOOST_REQUIRE_EQUAL(store.vWritten.size(), (size_t)pindexTip->nHeight + 1);
+    for (size_t i = 0; i < store.vWritten.size(); i++)
+        BOOST_CHECK(store.vWritten[i] == chainActive[i]->GetBlockHash());
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(index_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(index_sync_and_resume)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    TestIndexStore store;
+    {
+        TestIndex index(store);
+        // Nothing to wait for before the initial sync is done
+        BOOST_CHECK(!index.BlockUntilSyncedToCurrentChain());
+        BOOST_CHECK(!index.IsSynced());
+        BOOST_CHECK(index.Start());
+        BOOST_CHECK(WaitForSync(index));
+        BOOST_CHECK(index.IsSynced());
+        CheckWritten(store, chainActive.Tip());
+
+        // Once in sync, new blocks are followed
+        CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+        BOOST_CHECK(index.BlockUntilSyncedToCurrentChain());
+        CheckWritten(store, chainActive.Tip());
+
+        index.Stop();
+        BOOST_CHECK(store.locator.vHave[0] == chainActive.Tip()->GetBlockHash());
+    }
+
+    // Restarted, the index only writes the blocks connected in the meantime
+    for (int i = 0; i < 2; i++)
+        CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    TestIndex index(store);
+    BOOST_CHECK(index.Start());
+    BOOST_CHECK(WaitForSync(index));
+    CheckWritten(store, chainActive.Tip());
+}
+
+BOOST_AUTO_TEST_CASE(index_interrupt)
+{
+    TestIndexStore store;
+    {
+        TestIndex index(store);
+        index.nWriteDelayMillis = 10;
+        BOOST_CHECK(index.Start());
+        MilliSleep(50);
+        index.Interrupt();
+        BOOST_CHECK(!index.BlockUntilSyncedToCurrentChain());
+        index.Stop();
+    }
+    size_t nWritten;
+    {
+        std::lock_guard<std::mutex> lock(store.mutex);
+        nWritten = store.vWritten.size();
+        BOOST_CHECK(nWritten < (size_t)chainActive.Height() + 1);
+        // Stopping persists how far the index got
+        if (nWritten > 0)
+            BOOST_CHECK(store.locator.vHave[0] == store.vWritten.back());
+    }
+
+    // Stopping twice, or an index that was never started, is harmless
+    {
+        TestIndex index(store);
+        index.Interrupt();
+        index.Stop();
+        index.Stop();
+    }
+
+    // Resumes where it was interrupted, without writing anything twice
+    TestIndex index(store);
+    BOOST_CHECK(index.Start());
+    BOOST_CHECK(WaitForSync(index));
+    CheckWritten(store, chainActive.Tip());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,8 +3,12 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chainparams.h"
+#include "clientversion.h"
+#include "consensus/merkle.h"
+#include "random.h"
 #include "validation.h"
 #include "net.h"
+#include "streams.h"
 
 #include "test/test_bitcoin.h"
 
@@ -73,4 +77,73 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+BOOST_FIXTURE_TEST_CASE(read_raw_block, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        pindex = chainActive.Tip();
+    }
+
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()));
+    std::vector<unsigned char> vRawBlock;
+    BOOST_CHECK(ReadRawBlockFromDisk(vRawBlock, pindex, chainparams.MessageStart()));
+
+    // The raw bytes are exactly what the block serializes to on the network
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    BOOST_CHECK(vRawBlock == std::vector<unsigned char>(ss.begin(), ss.end()));
+
+    BOOST_CHECK(ReadRawBlockFromDisk(vRawBlock, pindex->pprev->GetBlockPos(), chainparams.MessageStart()));
+    BOOST_CHECK(Hash(vRawBlock.begin(), vRawBlock.begin() + 80) == pindex->pprev->GetBlockHash());
+
+    // Blocks of other networks and positions without an index header are rejected
+    BOOST_CHECK(!ReadRawBlockFromDisk(vRawBlock, pindex, Params(CBaseChainParams::MAIN).MessageStart()));
+    BOOST_CHECK(!ReadRawBlockFromDisk(vRawBlock, CDiskBlockPos(pindex->GetBlockPos().nFile, 4), chainparams.MessageStart()));
+}
+
+BOOST_AUTO_TEST_CASE(unserialize_block_parallel)
+{
+    CBlock block;
+    block.nVersion = 4;
+    block.hashPrevBlock = GetRandHash();
+    block.nTime = 1234567;
+    for (int i = 0; i < 300; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1 + i % 3);
+        for (CTxIn& txin : mtx.vin) {
+            txin.prevout = COutPoint(GetRandHash(), i);
+            // Every other transaction has a witness
+            if (i % 2)
+                txin.scriptWitness.stack.push_back(std::vector<unsigned char>(i, i & 0xff));
+        }
+        mtx.vout.resize(1);
+        mtx.vout[0].nValue = i;
+        block.vtx.push_back(MakeTransactionRef(std::move(mtx)));
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    CDataStream ssCopy(ss);
+
+    CBlock expected;
+    ss >> expected;
+    CBlock parallel;
+    UnserializeBlock(ssCopy, parallel);
+    BOOST_CHECK(ssCopy.empty());
+
+    BOOST_CHECK(parallel.GetHash() == block.GetHash());
+    BOOST_REQUIRE_EQUAL(parallel.vtx.size(), block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        BOOST_CHECK(parallel.vtx[i]->GetHash() == expected.vtx[i]->GetHash());
+        BOOST_CHECK(parallel.vtx[i]->GetWitnessHash() == expected.vtx[i]->GetWitnessHash());
+        BOOST_CHECK(parallel.vtx[i]->HasWitness() == (i % 2 == 1));
+    }
+    BOOST_CHECK(BlockMerkleRoot(parallel) == block.hashMerkleRoot);
+    BOOST_CHECK(BlockWitnessMerkleRoot(parallel) == BlockWitnessMerkleRoot(expected));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -581,4 +581,60 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolLinksTest)
+{
+    TestMemPoolEntryHelper entry;
+    CTxMemPool pool;
+
+    // Parent with three children, the last of which also spends the first
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(3);
+    for (int i = 0; i < 3; i++) {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 33000LL;
+    }
+    pool.addUnchecked(txParent.GetHash(), entry.FromTx(txParent));
+    const size_t nParentUsage = pool.DynamicMemoryUsage();
+
+    CMutableTransaction txChild[3];
+    for (int i = 0; i < 3; i++) {
+        txChild[i].vin.resize(1);
+        txChild[i].vin[0].scriptSig = CScript() << OP_11;
+        txChild[i].vin[0].prevout = COutPoint(txParent.GetHash(), i);
+        txChild[i].vout.resize(1);
+        txChild[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChild[i].vout[0].nValue = 11000LL;
+    }
+    txChild[2].vin.resize(2);
+    txChild[2].vin[1].prevout = COutPoint(txChild[0].GetHash(), 0);
+    for (int i = 0; i < 3; i++) {
+        pool.addUnchecked(txChild[i].GetHash(), entry.FromTx(txChild[i]));
+    }
+
+    CTxMemPool::txiter parentIt = pool.mapTx.find(txParent.GetHash());
+    CTxMemPool::txiter child0It = pool.mapTx.find(txChild[0].GetHash());
+    CTxMemPool::txiter child2It = pool.mapTx.find(txChild[2].GetHash());
+    BOOST_CHECK_EQUAL(pool.GetMemPoolParents(parentIt).size(), 0U);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(parentIt).size(), 3U);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(child0It).size(), 1U);
+    BOOST_CHECK(pool.GetMemPoolChildren(child0It)[0] == &*child2It);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolParents(child2It).size(), 2U);
+    BOOST_CHECK_EQUAL(child2It->GetCountWithAncestors(), 3U);
+    BOOST_CHECK_EQUAL(parentIt->GetCountWithDescendants(), 4U);
+
+    // Removing a child unlinks it from both of its parents
+    pool.removeRecursive(txChild[2]);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(parentIt).size(), 2U);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(child0It).size(), 0U);
+    BOOST_CHECK_EQUAL(parentIt->GetCountWithDescendants(), 3U);
+
+    // ... and the memory the links used is all accounted for
+    pool.removeRecursive(txChild[0]);
+    pool.removeRecursive(txChild[1]);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(parentIt).size(), 0U);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), nParentUsage);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,58 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "metrics.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(metrics_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(metrics_histogram)
+{
+    CMetricHistogram histogram;
+    histogram.Observe(50);
+    histogram.Observe(100);
+    histogram.Observe(3000);
+    histogram.Observe(60000000);
+
+    std::string out;
+    histogram.Render(out, "test_seconds", "phase=\"x\"");
+    // Buckets are cumulative; bounds are inclusive
+    BOOST_CHECK(out.find("test_seconds_bucket{phase=\"x\",le=\"0.0001\"} 2\n") != std::string::npos);
+    BOOST_CHECK(out.find("test_seconds_bucket{phase=\"x\",le=\"0.0025\"} 2\n") != std::string::npos);
+    BOOST_CHECK(out.find("test_seconds_bucket{phase=\"x\",le=\"0.005\"} 3\n") != std::string::npos);
+    BOOST_CHECK(out.find("test_seconds_bucket{phase=\"x\",le=\"10\"} 3\n") != std::string::npos);
+    BOOST_CHECK(out.find("test_seconds_bucket{phase=\"x\",le=\"+Inf\"} 4\n") != std::string::npos);
+    BOOST_CHECK(out.find("test_seconds_sum{phase=\"x\"} 60.003150\n") != std::string::npos);
+    BOOST_CHECK(out.find("test_seconds_count{phase=\"x\"} 4\n") != std::string::npos);
+
+    out.clear();
+    CMetricHistogram().Render(out, "empty", "");
+    BOOST_CHECK(out.find("empty_bucket{le=\"+Inf\"} 0\n") != std::string::npos);
+    BOOST_CHECK(out.find("empty_count 0\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(metrics_render)
+{
+    RecordMessageBytes(true, "inv", 61);
+    RecordMessageBytes(false, "not-a-command", 30);
+    RecordRPCCall("metricstest", 2000, false);
+    RecordRPCCall("metricstest", 2000, true);
+    RecordBlockConnectPhase(BLOCK_PHASE_FLUSH, 1);
+
+    std::string out = RenderMetrics();
+    BOOST_CHECK(out.find("# TYPE bitcoin_block_connect_seconds histogram\n") != std::string::npos);
+    BOOST_CHECK(out.find("bitcoin_block_connect_seconds_bucket{phase=\"flush\",le=\"0.0001\"} ") != std::string::npos);
+    BOOST_CHECK(out.find("bitcoin_mempool_transactions 0\n") != std::string::npos);
+    BOOST_CHECK(out.find("bitcoin_net_message_bytes_total{command=\"inv\",direction=\"sent\"} ") != std::string::npos);
+    // Unknown commands do not get a series of their own
+    BOOST_CHECK(out.find("not-a-command") == std::string::npos);
+    BOOST_CHECK(out.find("bitcoin_net_message_bytes_total{command=\"*other*\",direction=\"recv\"} ") != std::string::npos);
+    BOOST_CHECK(out.find("bitcoin_rpc_duration_seconds_count{method=\"metricstest\"} 2\n") != std::string::npos);
+    BOOST_CHECK(out.find("bitcoin_rpc_errors_total{method=\"metricstest\"} 1\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
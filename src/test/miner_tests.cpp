@@ -20,6 +20,7 @@
 #include "test/test_bitcoin.h"
 
 #include <memory>
+#include <set>
 
 #include <boost/test/unit_test.hpp>
 
@@ -190,6 +191,109 @@ void TestPackageSelection(const CChainParams& chainparams, CScript scriptPubKey,
     BOOST_CHECK(pblocktemplate->block.vtx[8]->GetHash() == hashLowFeeTx2);
 }
 
+static void CheckSameSelection(const CBlockTemplate& a, const CBlockTemplate& b)
+{
+    std::set<uint256> txidsA, txidsB;
+    for (size_t i = 1; i < a.block.vtx.size(); i++)
+        txidsA.insert(a.block.vtx[i]->GetHash());
+    for (size_t i = 1; i < b.block.vtx.size(); i++)
+        txidsB.insert(b.block.vtx[i]->GetHash());
+    BOOST_CHECK(txidsA == txidsB);
+    BOOST_CHECK_EQUAL(a.vTxFees[0], b.vTxFees[0]);
+}
+
+// Test that templates built by updating the block candidate select the same
+// transactions as templates assembled from scratch.
+void TestIncrementalSelection(const CChainParams& chainparams, CScript scriptPubKey, std::vector<CTransactionRef>& txFirst)
+{
+    TestMemPoolEntryHelper entry;
+    mempool.clear();
+
+    // A parent with ten outputs
+    CMutableTransaction parent;
+    parent.vin.resize(1);
+    parent.vin[0].scriptSig = CScript() << OP_1;
+    parent.vin[0].prevout = COutPoint(txFirst[3]->GetHash(), 0);
+    parent.vout.resize(10);
+    for (int i = 0; i < 10; i++)
+        parent.vout[i].nValue = 490000000LL;
+    mempool.addUnchecked(parent.GetHash(), entry.Fee(COIN).SpendsCoinbase(true).FromTx(parent));
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BOOST_CHECK(CanUpdateBlockCandidate());
+
+    // Children of a selected transaction are appended to the candidate
+    std::vector<CMutableTransaction> children(5);
+    for (int i = 0; i < 5; i++) {
+        children[i].vin.resize(1);
+        children[i].vin[0].scriptSig = CScript() << OP_1;
+        children[i].vin[0].prevout = COutPoint(parent.GetHash(), i);
+        children[i].vout.resize(1);
+        children[i].vout[0].nValue = 490000000LL - 10000 * (i + 1);
+        mempool.addUnchecked(children[i].GetHash(), entry.Fee(10000 * (i + 1)).SpendsCoinbase(false).FromTx(children[i]));
+    }
+    BOOST_CHECK(CanUpdateBlockCandidate());
+    pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 7);
+    // in the order they arrived, rather than by fee rate
+    for (int i = 0; i < 5; i++)
+        BOOST_CHECK(pblocktemplate->block.vtx[2 + i]->GetHash() == children[i].GetHash());
+    InvalidateBlockCandidate();
+    std::unique_ptr<CBlockTemplate> pblocktemplateFull = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    CheckSameSelection(*pblocktemplate, *pblocktemplateFull);
+    BOOST_CHECK(pblocktemplateFull->block.vtx[2]->GetHash() == children[4].GetHash());
+
+    // Removing a selected transaction drops the candidate
+    mempool.removeRecursive(children[2]);
+    BOOST_CHECK(!CanUpdateBlockCandidate());
+    pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 6);
+    for (const CTransactionRef& tx : pblocktemplate->block.vtx)
+        BOOST_CHECK(tx->GetHash() != children[2].GetHash());
+
+    // A transaction below the minimum fee rate is left out, until a child
+    // pays for it, which requires assembling from scratch
+    CMutableTransaction freeTx;
+    freeTx.vin.resize(1);
+    freeTx.vin[0].scriptSig = CScript() << OP_1;
+    freeTx.vin[0].prevout = COutPoint(parent.GetHash(), 9);
+    freeTx.vout.resize(1);
+    freeTx.vout[0].nValue = 490000000LL;
+    mempool.addUnchecked(freeTx.GetHash(), entry.Fee(0).FromTx(freeTx));
+    CMutableTransaction grandchild;
+    grandchild.vin.resize(1);
+    grandchild.vin[0].scriptSig = CScript() << OP_1;
+    grandchild.vin[0].prevout = COutPoint(children[0].GetHash(), 0);
+    grandchild.vout.resize(1);
+    grandchild.vout[0].nValue = children[0].vout[0].nValue - 20000;
+    mempool.addUnchecked(grandchild.GetHash(), entry.Fee(20000).FromTx(grandchild));
+    pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 7);
+    InvalidateBlockCandidate();
+    pblocktemplateFull = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    CheckSameSelection(*pblocktemplate, *pblocktemplateFull);
+
+    CMutableTransaction cpfpTx;
+    cpfpTx.vin.resize(1);
+    cpfpTx.vin[0].scriptSig = CScript() << OP_1;
+    cpfpTx.vin[0].prevout = COutPoint(freeTx.GetHash(), 0);
+    cpfpTx.vout.resize(1);
+    cpfpTx.vout[0].nValue = 490000000LL - 100000;
+    mempool.addUnchecked(cpfpTx.GetHash(), entry.Fee(100000).FromTx(cpfpTx));
+    pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 9);
+    InvalidateBlockCandidate();
+    pblocktemplateFull = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey);
+    CheckSameSelection(*pblocktemplate, *pblocktemplateFull);
+
+    // Prioritisation is not followed incrementally
+    BOOST_CHECK(CanUpdateBlockCandidate());
+    mempool.PrioritiseTransaction(grandchild.GetHash(), 1000);
+    BOOST_CHECK(!CanUpdateBlockCandidate());
+    mempool.clear();
+}
+
 // NOTE: These tests rely on CreateNewBlock doing its own self-validation!
 BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 {
@@ -496,6 +600,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     mempool.clear();
 
     TestPackageSelection(chainparams, scriptPubKey, txFirst);
+    TestIncrementalSelection(chainparams, scriptPubKey, txFirst);
 
     fCheckpointsEnabled = true;
 }
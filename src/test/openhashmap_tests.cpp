@@ -0,0 +1,171 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "openhashmap.h"
+
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+#include "memusage.h"
+
+#include <map>
+#include <set>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(openhashmap_tests, BasicTestingSetup)
+
+// Hasher with few distinct values, so that probe sequences collide often
+struct CollidingHasher
+{
+    size_t operator()(uint32_t x) const { return x % 7; }
+};
+
+typedef openhashmap<uint32_t, std::string, CollidingHasher> TestMap;
+
+static void CheckEqual(const TestMap& map, const std::map<uint32_t, std::string>& expected)
+{
+    BOOST_CHECK_EQUAL(map.size(), expected.size());
+    size_t count = 0;
+    for (TestMap::const_iterator it = map.begin(); it != map.end(); ++it) {
+        std::map<uint32_t, std::string>::const_iterator exp = expected.find(it->first);
+        BOOST_CHECK(exp != expected.end() && exp->second == it->second);
+        count++;
+    }
+    BOOST_CHECK_EQUAL(count, expected.size());
+    for (const auto& entry : expected) {
+        TestMap::const_iterator it = map.find(entry.first);
+        BOOST_CHECK(it != map.end() && it->second == entry.second);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(openhashmap_random_ops)
+{
+    TestMap map;
+    std::map<uint32_t, std::string> expected;
+
+    for (int i = 0; i < 20000; i++) {
+        uint32_t key = insecure_rand() % 500;
+        switch (insecure_rand() % 4) {
+        case 0:
+        case 1: {
+            std::string value = std::to_string(insecure_rand());
+            bool inserted = map.emplace(key, value).second;
+            BOOST_CHECK_EQUAL(inserted, expected.emplace(key, value).second);
+            break;
+        }
+        case 2:
+            BOOST_CHECK_EQUAL(map.erase(key), expected.erase(key));
+            break;
+        case 3:
+            map[key] = "x";
+            expected[key] = "x";
+            break;
+        }
+        BOOST_CHECK_EQUAL(map.count(key), expected.count(key));
+    }
+    CheckEqual(map, expected);
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(openhashmap_erase_while_iterating)
+{
+    TestMap map;
+    std::map<uint32_t, std::string> expected;
+    for (uint32_t i = 0; i < 1000; i++) {
+        map.emplace(i, std::to_string(i));
+        if (i % 3) expected.emplace(i, std::to_string(i));
+    }
+
+    // Every entry is visited exactly once while erasing some of them
+    size_t visited = 0;
+    for (TestMap::iterator it = map.begin(); it != map.end(); ) {
+        visited++;
+        if (it->first % 3 == 0) {
+            map.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    BOOST_CHECK_EQUAL(visited, 1000U);
+    CheckEqual(map, expected);
+
+    // Drain the rest
+    for (TestMap::iterator it = map.begin(); it != map.end(); ) {
+        it = map.erase(it);
+    }
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.find(1) == map.end());
+}
+
+BOOST_AUTO_TEST_CASE(openhashmap_stable_references)
+{
+    TestMap map;
+    std::string& first = map[12345];
+    first = "first";
+    const std::string* ptr = &first;
+
+    // Growing the table and erasing other entries does not move entries
+    for (uint32_t i = 0; i < 10000; i++)
+        map.emplace(i, "other");
+    for (uint32_t i = 0; i < 10000; i += 2)
+        map.erase(i);
+    BOOST_CHECK(&map.find(12345)->second == ptr);
+    BOOST_CHECK_EQUAL(*ptr, "first");
+
+    // Memory usage accounts for the table and every pool chunk
+    BOOST_CHECK(memusage::DynamicUsage(map) >= map.bucket_count() * sizeof(TestMap::slot) + 5001 * sizeof(TestMap::value_type));
+}
+
+BOOST_AUTO_TEST_CASE(openhashmap_compact)
+{
+    TestMap map;
+    std::map<uint32_t, std::string> expected;
+    for (uint32_t i = 0; i < 10000; i++) {
+        map.emplace(i, std::to_string(i));
+        if (i % 10 == 0) expected.emplace(i, std::to_string(i));
+    }
+    for (uint32_t i = 0; i < 10000; i++) {
+        if (i % 10) map.erase(i);
+    }
+
+    // Erasing alone keeps the memory; compacting gives it back
+    size_t usage = memusage::DynamicUsage(map);
+    size_t buckets = map.bucket_count();
+    std::set<void*> chunks;
+    for (const auto& chunk : map.pool().chunks())
+        chunks.insert(chunk.first);
+    map.compact();
+    CheckEqual(map, expected);
+    BOOST_CHECK(memusage::DynamicUsage(map) * 4 < usage);
+    BOOST_CHECK(map.bucket_count() * 3 >= map.size() * 4);
+    // ...without allocating: the entries moved into chunks it already had
+    BOOST_CHECK(map.bucket_count() < buckets);
+    for (const auto& chunk : map.pool().chunks())
+        BOOST_CHECK(chunks.count(chunk.first));
+
+    // Nothing to give back: the map stays as it is
+    usage = memusage::DynamicUsage(map);
+    map.compact();
+    CheckEqual(map, expected);
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), usage);
+
+    // The compacted map is fully usable
+    map.emplace(123456, "new");
+    expected.emplace(123456, "new");
+    map.erase(0);
+    expected.erase(0);
+    CheckEqual(map, expected);
+
+    while (!map.empty())
+        map.erase(map.begin());
+    map.compact();
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
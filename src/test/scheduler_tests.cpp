@@ -7,6 +7,9 @@
 
 #include "test/test_bitcoin.h"
 
+#include <atomic>
+#include <future>
+
 #include <boost/bind.hpp>
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_int_distribution.hpp>
@@ -114,4 +117,167 @@ BOOST_AUTO_TEST_CASE(manythreads)
     BOOST_CHECK_EQUAL(counterSum, 200);
 }
 
+BOOST_AUTO_TEST_CASE(singlethreadedclient_ordered)
+{
+    // Two clients on a scheduler with several threads: each client's
+    // functions run in order and never concurrently with each other.
+    CScheduler scheduler;
+    std::shared_ptr<SingleThreadedSchedulerClient> clients[2];
+    std::vector<int> results[2];
+    std::atomic<int> running[2];
+    bool fConcurrent = false;
+    for (int i = 0; i < 2; i++) {
+        clients[i] = std::make_shared<SingleThreadedSchedulerClient>(&scheduler);
+        running[i] = 0;
+    }
+
+    boost::thread_group threads;
+    for (int i = 0; i < 4; i++)
+        threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+
+    for (int n = 0; n < 1000; n++) {
+        for (int i = 0; i < 2; i++) {
+            clients[i]->AddToProcessQueue([&, i, n] {
+                if (++running[i] != 1)
+                    fConcurrent = true;
+                results[i].push_back(n);
+                running[i]--;
+            });
+        }
+    }
+
+    // Whatever has not run yet is run right here
+    clients[0]->EmptyQueue();
+    BOOST_CHECK_EQUAL(clients[0]->CallbacksPending(), 0U);
+
+    scheduler.stop(true);
+    threads.join_all();
+    clients[1]->EmptyQueue();
+
+    BOOST_CHECK(!fConcurrent);
+    for (int i = 0; i < 2; i++) {
+        BOOST_CHECK_EQUAL(results[i].size(), 1000U);
+        for (int n = 0; n < (int)results[i].size(); n++)
+            BOOST_CHECK_EQUAL(results[i][n], n);
+    }
+
+    // Without a scheduler functions run on the calling thread
+    SingleThreadedSchedulerClient direct(NULL);
+    bool fRan = false;
+    direct.AddToProcessQueue([&fRan] { fRan = true; });
+    BOOST_CHECK(fRan);
+}
+
+BOOST_AUTO_TEST_CASE(priority_and_cancel)
+{
+    // Everything is due by the time the thread starts: tasks run by
+    // priority, then in the order they were due, minus the cancelled ones.
+    CScheduler scheduler;
+    std::vector<int> order;
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+    scheduler.schedule([&order] { order.push_back(3); }, now - boost::chrono::seconds(2), CScheduler::PRIORITY_LOW);
+    scheduler.schedule([&order] { order.push_back(2); }, now - boost::chrono::seconds(1), CScheduler::PRIORITY_NORMAL);
+    CScheduler::TaskId cancelled = scheduler.schedule([&order] { order.push_back(-1); }, now, CScheduler::PRIORITY_HIGH);
+    scheduler.schedule([&order] { order.push_back(1); }, now, CScheduler::PRIORITY_HIGH);
+    scheduler.schedule([&order] { order.push_back(0); }, now - boost::chrono::seconds(1), CScheduler::PRIORITY_HIGH);
+    CScheduler::TaskId repeating = scheduler.scheduleEvery([&order] { order.push_back(-2); }, 1000000);
+    boost::chrono::system_clock::time_point first, last;
+    BOOST_CHECK_EQUAL(scheduler.getQueueInfo(first, last), 6U);
+
+    BOOST_CHECK(scheduler.cancel(cancelled));
+    BOOST_CHECK(!scheduler.cancel(cancelled));
+    BOOST_CHECK(scheduler.cancel(repeating));
+    BOOST_CHECK_EQUAL(scheduler.getQueueInfo(first, last), 4U);
+
+    boost::thread thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    scheduler.stop(true);
+    thread.join();
+
+    BOOST_CHECK_EQUAL(order.size(), 4U);
+    for (int i = 0; i < (int)order.size(); i++)
+        BOOST_CHECK_EQUAL(order[i], i);
+    BOOST_CHECK_EQUAL(scheduler.getStats(CScheduler::PRIORITY_HIGH).nTasks, 2U);
+    BOOST_CHECK_EQUAL(scheduler.getStats(CScheduler::PRIORITY_LOW).nTasks, 1U);
+    BOOST_CHECK(scheduler.getStats(CScheduler::PRIORITY_LOW).nMaxDelayMicros >= 2000000);
+}
+
+BOOST_AUTO_TEST_CASE(low_priority_reserve)
+{
+    // With two threads, a long low priority task does not keep a high
+    // priority one waiting, and a second low priority task waits for the
+    // first instead of taking the other thread.
+    CScheduler scheduler;
+    boost::thread_group threads;
+    for (int i = 0; i < 2; i++)
+        threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+
+    std::promise<void> started, release, high;
+    std::shared_future<void> released = release.get_future().share();
+    std::atomic<bool> fSecondLowRan(false);
+    scheduler.scheduleFromNow([&started, released] { started.set_value(); released.wait(); }, 0, CScheduler::PRIORITY_LOW);
+    started.get_future().wait();
+    scheduler.scheduleFromNow([&fSecondLowRan] { fSecondLowRan = true; }, 0, CScheduler::PRIORITY_LOW);
+    scheduler.scheduleFromNow([&high] { high.set_value(); }, 0, CScheduler::PRIORITY_HIGH);
+    high.get_future().wait();
+    MicroSleep(10000);
+    BOOST_CHECK(!fSecondLowRan);
+
+    release.set_value();
+    scheduler.stop(true);
+    threads.join_all();
+    BOOST_CHECK(fSecondLowRan);
+}
+
+BOOST_AUTO_TEST_CASE(cancel_due_task)
+{
+    // A low priority task that became due while the other thread runs one is
+    // held back; once it is cancelled, stop(true) lets the idle thread exit
+    // without waiting for the running task.
+    CScheduler scheduler;
+    boost::thread threads[2];
+    for (int i = 0; i < 2; i++)
+        threads[i] = boost::thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+
+    std::promise<void> started, release;
+    std::shared_future<void> released = release.get_future().share();
+    scheduler.scheduleFromNow([&started, released] { started.set_value(); released.wait(); }, 0, CScheduler::PRIORITY_LOW);
+    started.get_future().wait();
+    std::atomic<bool> fCancelledRan(false);
+    CScheduler::TaskId id = scheduler.scheduleFromNow([&fCancelledRan] { fCancelledRan = true; }, 0, CScheduler::PRIORITY_LOW);
+    MicroSleep(10000);
+    BOOST_CHECK(scheduler.cancel(id));
+
+    scheduler.stop(true);
+    bool fIdleExited = false;
+    for (int n = 0; n < 1000 && !fIdleExited; n++) {
+        for (int i = 0; i < 2; i++)
+            fIdleExited |= threads[i].try_join_for(boost::chrono::milliseconds(5));
+    }
+    BOOST_CHECK(fIdleExited);
+    release.set_value();
+    for (int i = 0; i < 2; i++) {
+        if (threads[i].joinable())
+            threads[i].join();
+    }
+    BOOST_CHECK(!fCancelledRan);
+}
+
+BOOST_AUTO_TEST_CASE(repeating_cancel)
+{
+    CScheduler scheduler;
+    std::atomic<int> nRuns(0);
+    CScheduler::TaskId id = scheduler.scheduleEvery([&nRuns] { nRuns++; }, 1);
+    boost::thread thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    while (nRuns < 3)
+        MicroSleep(1000);
+    BOOST_CHECK(scheduler.cancel(id));
+    // At most a run that had already started completes
+    int nRunsCancelled = nRuns;
+    MicroSleep(20000);
+    BOOST_CHECK(nRuns <= nRunsCancelled + 1);
+    BOOST_CHECK(!scheduler.cancel(id));
+    scheduler.stop(true);
+    thread.join();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,73 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "script/sigcache.h"
+
+#include "clientversion.h"
+#include "crypto/sha256.h"
+#include "key.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+#include "util.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sigcache_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(sigcache_dump_load)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    uint256 sighash = GetRandHash();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(GetRandHash(), vchSig));
+
+    CTransaction tx;
+    PrecomputedTransactionData txdata(tx);
+    CachingTransactionSignatureChecker checker(&tx, 0, 0, true, txdata);
+    // Signed a different hash
+    BOOST_CHECK(!checker.VerifySignature(vchSig, pubkey, sighash));
+
+    // Write a cache file that claims the signature is valid; entries are
+    // only meaningful together with the nonce they were computed with.
+    uint256 nonce = GetRandHash();
+    uint256 entry;
+    CSHA256().Write(nonce.begin(), 32).Write(sighash.begin(), 32).Write(&pubkey[0], pubkey.size()).Write(&vchSig[0], vchSig.size()).Finalize(entry.begin());
+    {
+        CAutoFile file(fopen((GetDataDir() / "sigcache.dat").string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        file << (uint64_t)1 << nonce << (uint64_t)1 << entry;
+    }
+    BOOST_CHECK(LoadSignatureCache());
+    BOOST_CHECK(checker.VerifySignature(vchSig, pubkey, sighash));
+
+    // Dumping writes back the nonce and the entry
+    DumpSignatureCache();
+    {
+        CAutoFile file(fopen((GetDataDir() / "sigcache.dat").string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        uint64_t version, num;
+        uint256 nonceRead;
+        file >> version >> nonceRead >> num;
+        BOOST_CHECK_EQUAL(version, 1U);
+        BOOST_CHECK(nonceRead == nonce);
+        bool found = false;
+        while (num--) {
+            uint256 entryRead;
+            file >> entryRead;
+            found |= entryRead == entry;
+        }
+        BOOST_CHECK(found);
+    }
+
+    // A truncated file is rejected
+    {
+        CAutoFile file(fopen((GetDataDir() / "sigcache.dat").string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        file << (uint64_t)1 << nonce << (uint64_t)5 << entry;
+    }
+    BOOST_CHECK(!LoadSignatureCache());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -11,9 +11,14 @@
 #include "txdb.h"
 #include "txmempool.h"
 
+#include <atomic>
+
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
+/** Set by StartShutdown(), e.g. through AbortNode(); cleared for every test */
+extern std::atomic<bool> fRequestShutdown;
+
 /** Basic testing setup.
  * This just configures logging and chain parameters.
  */
@@ -6,6 +6,8 @@
 
 #include "net.h"
 
+#include <atomic>
+
 #include <boost/test/unit_test.hpp>
 
 std::unique_ptr<CConnman> g_connman;
@@ -15,12 +17,14 @@ void Shutdown(void* parg)
   exit(EXIT_SUCCESS);
 }
 
+std::atomic<bool> fRequestShutdown(false);
+
 void StartShutdown()
 {
-  exit(EXIT_SUCCESS);
+  fRequestShutdown = true;
 }
 
 bool ShutdownRequested()
 {
-  return false;
+  return fRequestShutdown;
 }
@@ -84,4 +84,84 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+BOOST_FIXTURE_TEST_CASE(tx_preverify_batch, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // Only the first coinbase is mature; split it so that there is something
+    // to spend from the mempool.
+    CMutableTransaction parent;
+    parent.nVersion = 1;
+    parent.vin.resize(1);
+    parent.vin[0].prevout.hash = coinbaseTxns[0].GetHash();
+    parent.vin[0].prevout.n = 0;
+    parent.vout.resize(4);
+    for (int i = 0; i < 4; i++) {
+        parent.vout[i].nValue = 10*COIN;
+        parent.vout[i].scriptPubKey = scriptPubKey;
+    }
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, parent, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    parent.vin[0].scriptSig << vchSig;
+    BOOST_CHECK(ToMemPool(parent));
+
+    std::vector<CMutableTransaction> children(4);
+    for (int i = 0; i < 4; i++) {
+        children[i].nVersion = 1;
+        children[i].vin.resize(1);
+        children[i].vin[0].prevout.hash = parent.GetHash();
+        children[i].vin[0].prevout.n = i;
+        children[i].vout.resize(1);
+        children[i].vout[0].nValue = 9*COIN;
+        children[i].vout[0].scriptPubKey = scriptPubKey;
+        // The third one pays no fee
+        if (i == 2)
+            children[i].vout[0].nValue = 10*COIN;
+
+        hash = SignatureHash(scriptPubKey, children[i], 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        // The last one carries a signature for a different output
+        if (i == 3)
+            vchSig[10] ^= 1;
+        children[i].vin[0].scriptSig << vchSig;
+    }
+
+    CMutableTransaction orphan = children[0];
+    orphan.vin[0].prevout.hash = GetRandHash();
+    // Non-standard, so it is skipped although it could be verified
+    CMutableTransaction nonstandard = children[0];
+    nonstandard.nVersion = 3;
+
+    std::vector<CTransactionRef> batch;
+    batch.push_back(MakeTransactionRef(parent));
+    for (const CMutableTransaction& child : children)
+        batch.push_back(MakeTransactionRef(child));
+    batch.push_back(MakeTransactionRef(orphan));
+    batch.push_back(MakeTransactionRef(nonstandard));
+
+    // The transaction already in the pool, the one with missing inputs and
+    // the ones AcceptToMemoryPool would reject on policy are skipped; a bad
+    // signature only shows up once the scripts are run.
+    std::vector<uint256> vFailed;
+    BOOST_CHECK_EQUAL(PreverifyTransactions(mempool, batch, &vFailed), 3U);
+    BOOST_CHECK_EQUAL(vFailed.size(), 1U);
+    BOOST_CHECK(vFailed[0] == children[3].GetHash());
+    BOOST_CHECK_EQUAL(mempool.size(), 1U);
+
+    BOOST_CHECK(ToMemPool(children[0]));
+    BOOST_CHECK(ToMemPool(children[1]));
+    BOOST_CHECK(!ToMemPool(children[3]));
+    BOOST_CHECK_EQUAL(mempool.size(), 3U);
+
+    // A transaction spending an output already spent in the pool is a
+    // replacement, which is left to AcceptToMemoryPool.
+    CMutableTransaction replacement = children[1];
+    replacement.vout[0].nValue = 8*COIN;
+    batch.assign(1, MakeTransactionRef(replacement));
+    BOOST_CHECK_EQUAL(PreverifyTransactions(mempool, batch), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
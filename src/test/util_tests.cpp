@@ -11,10 +11,13 @@
 #include "utilmoneystr.h"
 #include "test/test_bitcoin.h"
 #include "test/test_random.h"
+#include "test/testutil.h"
 
 #include <stdint.h>
 #include <vector>
 
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem/fstream.hpp>
 #include <boost/test/unit_test.hpp>
 
 extern std::map<std::string, std::string> mapArgs;
@@ -566,4 +569,69 @@ BOOST_AUTO_TEST_CASE(test_ParseFixedPoint)
     BOOST_CHECK(!ParseFixedPoint("1.", 8, &amount));
 }
 
+
+static std::string ReadDebugLog()
+{
+    boost::filesystem::ifstream file(GetDataDir() / "debug.log");
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+BOOST_AUTO_TEST_CASE(util_DebugLogWriter)
+{
+    boost::filesystem::path pathTemp = GetTempPath() / strprintf("test_bitcoin_log_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+    boost::filesystem::create_directories(pathTemp);
+    ForceSetArg("-datadir", pathTemp.string());
+    ClearDatadirCache();
+    fPrintToDebugLog = true;
+    fLogTimestamps = false;
+    OpenDebugLog();
+    // Anything logged before the log was opened comes first
+    const std::string strBefore = ReadDebugLog();
+
+    // Written directly until the writer is started
+    BOOST_CHECK_EQUAL(LogPrintStr("direct 1\n"), 9);
+    BOOST_CHECK_EQUAL(ReadDebugLog(), strBefore + "direct 1\n");
+
+    StartDebugLogWriter(64);
+    BOOST_CHECK_EQUAL(LogPrintStr("queued 1\n"), 9);
+    // More than the queue can hold is dropped, and reported
+    BOOST_CHECK_EQUAL(LogPrintStr(std::string(64, 'x') + "\n"), 0);
+    BOOST_CHECK_EQUAL(LogPrintStr("queued 2\n"), 9);
+    // Flushing writes out everything queued so far from the calling thread
+    FlushDebugLog();
+    std::string strLog = ReadDebugLog();
+    BOOST_CHECK_EQUAL(strLog.find("direct 1\nqueued 1\n"), strBefore.size());
+    BOOST_CHECK(strLog.find("queued 1\n") < strLog.find("queued 2\n"));
+    BOOST_CHECK(strLog.find("queued 2\n") != std::string::npos);
+    BOOST_CHECK(strLog.find("1 log messages dropped") != std::string::npos);
+    BOOST_CHECK(strLog.find('x') == std::string::npos);
+
+    // The queue is empty after a flush, so a message of exactly its size fits
+    BOOST_CHECK_EQUAL(LogPrintStr(std::string(63, 'y') + "\n"), 64);
+    FlushDebugLog();
+
+    // Stopping writes out what is queued ahead of anything logged afterwards
+    BOOST_CHECK_EQUAL(LogPrintStr("queued 3\n"), 9);
+    StopDebugLogWriter();
+    BOOST_CHECK_EQUAL(LogPrintStr("direct 2\n"), 9);
+    strLog = ReadDebugLog();
+    BOOST_CHECK(boost::algorithm::ends_with(strLog, std::string(63, 'y') + "\nqueued 3\ndirect 2\n"));
+
+    // A writer can be started again, but not with an empty queue
+    StopDebugLogWriter();
+    StartDebugLogWriter(0);
+    BOOST_CHECK_EQUAL(LogPrintStr("direct 3\n"), 9);
+    BOOST_CHECK(boost::algorithm::ends_with(ReadDebugLog(), "direct 2\ndirect 3\n"));
+    StartDebugLogWriter(64);
+    BOOST_CHECK_EQUAL(LogPrintStr("queued 4\n"), 9);
+    StopDebugLogWriter();
+    BOOST_CHECK(boost::algorithm::ends_with(ReadDebugLog(), "direct 3\nqueued 4\n"));
+
+    fPrintToDebugLog = false;
+    fLogTimestamps = DEFAULT_LOGTIMESTAMPS;
+    mapArgs.erase("-datadir");
+    ClearDatadirCache();
+    boost::filesystem::remove_all(pathTemp);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
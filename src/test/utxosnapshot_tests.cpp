@@ -0,0 +1,326 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "consensus/merkle.h"
+#include "init.h"
+#include "pow.h"
+#include "random.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+/** A chain of coinbase-only blocks on top of the genesis block, not processed yet */
+std::vector<std::shared_ptr<const CBlock> > MakeChain(int nBlocks)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    std::vector<std::shared_ptr<const CBlock> > vBlocks;
+    uint256 hashPrev = genesis.GetHash();
+    for (int i = 1; i <= nBlocks; i++) {
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].scriptSig = CScript() << i << OP_0;
+        coinbase.vout.resize(1);
+        coinbase.vout[0].nValue = GetBlockSubsidy(i, Params().GetConsensus());
+        coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        pblock->nVersion = 4;
+        pblock->hashPrevBlock = hashPrev;
+        pblock->nTime = genesis.nTime + i;
+        pblock->nBits = genesis.nBits;
+        pblock->vtx.push_back(MakeTransactionRef(coinbase));
+        pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+        while (!CheckProofOfWork(pblock->GetHash(), pblock->nBits, Params().GetConsensus()))
+            pblock->nNonce++;
+        hashPrev = pblock->GetHash();
+        vBlocks.push_back(pblock);
+    }
+    return vBlocks;
+}
+
+/** What dumptxoutset would write for the tip of a chain */
+struct Snapshot
+{
+    CUTXOSnapshotMetadata metadata;
+    std::vector<CBlockHeader> vHeaders;
+    std::vector<std::pair<COutPoint, Coin> > vCoins;
+
+    /** hash_serialized of vCoins, as the loader computes it */
+    uint256 HashCoins() const
+    {
+        CCoinsStats stats;
+        CCoinsStatsBuilder builder(stats, metadata.hashBlock);
+        for (const auto& entry : vCoins) {
+            Coin coin(entry.second);
+            size_t nSize = ::GetSerializeSize(coin, SER_DISK, CLIENT_VERSION);
+            builder.Add(entry.first, std::move(coin), nSize);
+        }
+        builder.Finalize();
+        return stats.hashSerialized;
+    }
+
+    void Write(const boost::filesystem::path& path) const
+    {
+        CAutoFile afile(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!afile.IsNull());
+        afile << metadata << (uint32_t)vHeaders.size();
+        for (const CBlockHeader& header : vHeaders)
+            afile << header;
+        for (const auto& entry : vCoins)
+            afile << entry.first << entry.second;
+    }
+};
+
+/** The snapshot of the UTXO set vBlocks produce, taken in database order like dumptxoutset does */
+Snapshot MakeSnapshot(const std::vector<std::shared_ptr<const CBlock> >& vBlocks)
+{
+    Snapshot snapshot;
+    CCoinsViewDB db(1 << 20, true, true, "chainstate_test");
+    {
+        CCoinsViewCache view(&db);
+        for (size_t i = 0; i < vBlocks.size(); i++) {
+            for (const CTransactionRef& tx : vBlocks[i]->vtx)
+                UpdateCoins(*tx, view, i + 1);
+            snapshot.vHeaders.push_back(vBlocks[i]->GetBlockHeader());
+        }
+        view.SetBestBlock(vBlocks.back()->GetHash());
+        BOOST_REQUIRE(view.Flush());
+    }
+    std::unique_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint key;
+        Coin coin;
+        BOOST_REQUIRE(pcursor->GetKey(key) && pcursor->GetValue(coin));
+        snapshot.vCoins.emplace_back(key, std::move(coin));
+    }
+
+    memcpy(snapshot.metadata.pchMessageStart, Params().MessageStart(), sizeof(snapshot.metadata.pchMessageStart));
+    snapshot.metadata.hashBlock = vBlocks.back()->GetHash();
+    snapshot.metadata.nChainTx = vBlocks.size() + 1;
+    snapshot.metadata.nCoins = snapshot.vCoins.size();
+    snapshot.metadata.hashSerialized = snapshot.HashCoins();
+    return snapshot;
+}
+
+/** Write snapshot and try to load it, trusting its own hash unless hashTrusted is given */
+bool Load(const Snapshot& snapshot, std::string& strError, const uint256* phashTrusted = NULL)
+{
+    boost::filesystem::path path = GetDataDir() / "utxo.dat";
+    snapshot.Write(path);
+    return LoadUTXOSnapshot(Params(), path, phashTrusted ? *phashTrusted : snapshot.metadata.hashSerialized, strError);
+}
+
+/** Whether strError says the load failed for the reason in strExpected */
+bool HasReason(const std::string& strError, const std::string& strExpected)
+{
+    return strError.find(strExpected) != std::string::npos;
+}
+
+/** A rejected snapshot must leave the empty chainstate alone */
+void CheckUntouched()
+{
+    LOCK(cs_main);
+    BOOST_CHECK_EQUAL(chainActive.Height(), 0);
+    BOOST_CHECK(pindexSnapshotBase == NULL);
+}
+
+/** Feed the blocks below the snapshot base to the background validation and wait until it is done */
+void ValidateInBackground(const std::vector<std::shared_ptr<const CBlock> >& vBlocks)
+{
+    StartSnapshotValidation(1 << 20, 1 << 20);
+    for (const auto& pblock : vBlocks)
+        BOOST_CHECK(ProcessNewBlock(Params(), pblock, true, NULL));
+    for (int i = 0; i < 3000 && !ShutdownRequested(); i++) {
+        {
+            LOCK(cs_main);
+            if (fSnapshotValidated)
+                break;
+        }
+        MilliSleep(10);
+    }
+    StopSnapshotValidation();
+}
+
+} // anon namespace
+
+BOOST_FIXTURE_TEST_SUITE(utxosnapshot_tests, TestChainSetup)
+
+BOOST_AUTO_TEST_CASE(snapshot_load)
+{
+    std::vector<std::shared_ptr<const CBlock> > vBlocks = MakeChain(20);
+    Snapshot snapshot = MakeSnapshot(vBlocks);
+    BOOST_CHECK_EQUAL(snapshot.vCoins.size(), 20);
+
+    std::string strError;
+    BOOST_CHECK_MESSAGE(Load(snapshot, strError), strError);
+    LOCK(cs_main);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == snapshot.metadata.hashBlock);
+    BOOST_CHECK_EQUAL(chainActive.Height(), 20);
+    BOOST_CHECK(pindexSnapshotBase == chainActive.Tip());
+    BOOST_CHECK_EQUAL(chainActive.Tip()->nChainTx, 21);
+    BOOST_CHECK(!fSnapshotValidated);
+    for (const auto& entry : snapshot.vCoins) {
+        const Coin& coin = pcoinsTip->AccessCoin(entry.first);
+        BOOST_CHECK(coin.out == entry.second.out);
+        BOOST_CHECK_EQUAL(coin.nHeight, entry.second.nHeight);
+        BOOST_CHECK(coin.IsCoinBase());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_untrusted_hash)
+{
+    Snapshot snapshot = MakeSnapshot(MakeChain(10));
+    std::string strError;
+
+    // The commitment in the file is consistent, but not the one we trust
+    uint256 hashOther = GetRandHash();
+    BOOST_CHECK(!Load(snapshot, strError, &hashOther));
+    BOOST_CHECK_MESSAGE(HasReason(strError, "commits to"), strError);
+    CheckUntouched();
+
+    // Without a hash of our own, regtest has nothing to trust
+    uint256 hashNull;
+    BOOST_CHECK(!Load(snapshot, strError, &hashNull));
+    BOOST_CHECK_MESSAGE(HasReason(strError, "No trusted UTXO set hash"), strError);
+    CheckUntouched();
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_corrupt)
+{
+    const Snapshot snapshot = MakeSnapshot(MakeChain(10));
+    boost::filesystem::path path = GetDataDir() / "utxo.dat";
+    std::string strError;
+
+    // Cut off in the middle of the coins
+    snapshot.Write(path);
+    boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 10);
+    BOOST_CHECK(!LoadUTXOSnapshot(Params(), path, snapshot.metadata.hashSerialized, strError));
+    BOOST_CHECK_MESSAGE(HasReason(strError, "Error reading UTXO snapshot"), strError);
+    CheckUntouched();
+
+    // Not a snapshot at all
+    {
+        CAutoFile afile(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        afile << std::string("not a snapshot");
+    }
+    BOOST_CHECK(!LoadUTXOSnapshot(Params(), path, snapshot.metadata.hashSerialized, strError));
+    BOOST_CHECK_MESSAGE(HasReason(strError, "Error reading UTXO snapshot"), strError);
+    CheckUntouched();
+
+    // A coin changed after the commitment was made
+    Snapshot corrupt(snapshot);
+    corrupt.vCoins[3].second.out.nValue += 1;
+    BOOST_CHECK(!Load(corrupt, strError));
+    BOOST_CHECK_MESSAGE(HasReason(strError, "contents hash to"), strError);
+    CheckUntouched();
+
+    // A header that does not lead to the base
+    corrupt = snapshot;
+    corrupt.vHeaders.pop_back();
+    BOOST_CHECK(!Load(corrupt, strError));
+    BOOST_CHECK_MESSAGE(HasReason(strError, "do not lead to its base block"), strError);
+    CheckUntouched();
+
+    // Another network's snapshot
+    corrupt = snapshot;
+    corrupt.metadata.pchMessageStart[0] ^= 1;
+    BOOST_CHECK(!Load(corrupt, strError));
+    BOOST_CHECK_MESSAGE(HasReason(strError, "different network"), strError);
+    CheckUntouched();
+
+    corrupt = snapshot;
+    corrupt.metadata.nVersion = CUTXOSnapshotMetadata::CURRENT_VERSION + 1;
+    BOOST_CHECK(!Load(corrupt, strError));
+    BOOST_CHECK_MESSAGE(HasReason(strError, "Unsupported UTXO snapshot version"), strError);
+    CheckUntouched();
+
+    // Coins out of database order
+    corrupt = snapshot;
+    std::swap(corrupt.vCoins[0], corrupt.vCoins[1]);
+    corrupt.metadata.hashSerialized = corrupt.HashCoins();
+    BOOST_CHECK(!Load(corrupt, strError));
+    BOOST_CHECK_MESSAGE(HasReason(strError, "unordered or spent"), strError);
+    CheckUntouched();
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_coin_count)
+{
+    const Snapshot snapshot = MakeSnapshot(MakeChain(10));
+    std::string strError;
+
+    // Claims more coins than the file has
+    Snapshot corrupt(snapshot);
+    corrupt.metadata.nCoins++;
+    BOOST_CHECK(!Load(corrupt, strError));
+    BOOST_CHECK_MESSAGE(HasReason(strError, "Error reading UTXO snapshot"), strError);
+    CheckUntouched();
+
+    // Claims fewer: the coins read don't match the commitment
+    corrupt = snapshot;
+    corrupt.metadata.nCoins--;
+    BOOST_CHECK(!Load(corrupt, strError));
+    BOOST_CHECK_MESSAGE(HasReason(strError, "contents hash to"), strError);
+    CheckUntouched();
+
+    // A coin left out, with the count and commitment to match
+    corrupt = snapshot;
+    corrupt.vCoins.pop_back();
+    corrupt.metadata.nCoins--;
+    corrupt.metadata.hashSerialized = corrupt.HashCoins();
+    BOOST_CHECK(!Load(corrupt, strError, &snapshot.metadata.hashSerialized));
+    BOOST_CHECK_MESSAGE(HasReason(strError, "commits to"), strError);
+    CheckUntouched();
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_background_validation)
+{
+    std::vector<std::shared_ptr<const CBlock> > vBlocks = MakeChain(20);
+    std::string strError;
+    BOOST_REQUIRE_MESSAGE(Load(MakeSnapshot(vBlocks), strError), strError);
+
+    ValidateInBackground(vBlocks);
+    BOOST_CHECK(!ShutdownRequested());
+    bool fFlag = false;
+    BOOST_CHECK(pblocktree->ReadFlag("snapshotvalidated", fFlag) && fFlag);
+    LOCK(cs_main);
+    BOOST_CHECK(fSnapshotValidated);
+    // The blocks below the base are linked into the chain
+    for (int nHeight = 1; nHeight <= 20; nHeight++)
+        BOOST_CHECK_EQUAL(chainActive[nHeight]->nChainTx, nHeight + 1);
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_background_mismatch)
+{
+    std::vector<std::shared_ptr<const CBlock> > vBlocks = MakeChain(20);
+    // A consistent snapshot with a coin the blocks never created
+    Snapshot snapshot = MakeSnapshot(vBlocks);
+    Coin coin(CTxOut(COIN, CScript() << OP_TRUE), 5, false);
+    snapshot.vCoins.emplace_back(COutPoint(uint256S("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"), 0), coin);
+    snapshot.metadata.nCoins++;
+    snapshot.metadata.hashSerialized = snapshot.HashCoins();
+    std::string strError;
+    BOOST_REQUIRE_MESSAGE(Load(snapshot, strError), strError);
+
+    ValidateInBackground(vBlocks);
+    BOOST_CHECK(ShutdownRequested());
+    bool fFlag = false;
+    BOOST_CHECK(pblocktree->ReadFlag("snapshotinvalid", fFlag) && fFlag);
+    BOOST_CHECK(!pblocktree->ReadFlag("snapshotvalidated", fFlag) || !fFlag);
+    LOCK(cs_main);
+    BOOST_CHECK(!fSnapshotValidated);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
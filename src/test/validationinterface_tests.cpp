@@ -0,0 +1,123 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "validationinterface.h"
+
+#include "primitives/transaction.h"
+#include "scheduler.h"
+#include "test/test_bitcoin.h"
+#include "utiltime.h"
+
+#include <future>
+#include <thread>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+/** Records the callbacks it receives and the threads they run on */
+class CRecordingListener : public CValidationInterface
+{
+public:
+    std::vector<int> vPositions;
+    std::vector<std::thread::id> vThreads;
+    std::shared_future<void> release;
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload)
+    {
+        if (release.valid())
+            release.wait();
+        vPositions.push_back(-2);
+        vThreads.push_back(std::this_thread::get_id());
+    }
+
+    void SyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, int posInBlock)
+    {
+        vPositions.push_back(posInBlock);
+        vThreads.push_back(std::this_thread::get_id());
+    }
+};
+
+}
+
+BOOST_FIXTURE_TEST_SUITE(validationinterface_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(validationinterface_queued)
+{
+    CScheduler scheduler;
+    boost::thread schedulerThread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    RegisterBackgroundSignalScheduler(scheduler);
+
+    CRecordingListener queued, direct;
+    std::promise<void> release;
+    queued.release = release.get_future().share();
+    RegisterValidationInterface(&queued, true);
+    RegisterValidationInterface(&direct);
+
+    // The queued listener is stuck in its first callback, which does not
+    // hold up the notifying thread.
+    CMutableTransaction mtx;
+    GetMainSignals().UpdatedBlockTip(NULL, NULL, false);
+    for (int i = 0; i < 10; i++) {
+        mtx.nLockTime = i;
+        GetMainSignals().SyncTransaction(MakeTransactionRef(mtx), NULL, i);
+    }
+    BOOST_CHECK(queued.vPositions.empty());
+    BOOST_CHECK_EQUAL(direct.vPositions.size(), 11U);
+
+    release.set_value();
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK(queued.vPositions == direct.vPositions);
+    BOOST_CHECK_EQUAL(queued.vPositions.front(), -2);
+    for (int i = 0; i < 10; i++)
+        BOOST_CHECK_EQUAL(queued.vPositions[i + 1], i);
+    for (size_t i = 0; i < queued.vThreads.size(); i++) {
+        BOOST_CHECK(queued.vThreads[i] != std::this_thread::get_id());
+        BOOST_CHECK(direct.vThreads[i] == std::this_thread::get_id());
+    }
+
+    // Unregistering delivers what is still queued
+    GetMainSignals().SyncTransaction(MakeTransactionRef(mtx), NULL, 10);
+    UnregisterValidationInterface(&queued);
+    BOOST_CHECK_EQUAL(queued.vPositions.size(), 12U);
+    UnregisterValidationInterface(&direct);
+    GetMainSignals().SyncTransaction(MakeTransactionRef(mtx), NULL, 11);
+    BOOST_CHECK_EQUAL(queued.vPositions.size(), 12U);
+    BOOST_CHECK_EQUAL(direct.vPositions.size(), 12U);
+
+    UnregisterBackgroundSignalScheduler();
+    scheduler.stop(true);
+    schedulerThread.join();
+}
+
+BOOST_AUTO_TEST_CASE(validationinterface_sync_after_stop)
+{
+    CScheduler scheduler;
+    boost::thread schedulerThread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    RegisterBackgroundSignalScheduler(scheduler);
+    while (!scheduler.AreThreadsServicingQueue())
+        MilliSleep(1);
+
+    // Shutdown interrupts the scheduler thread while callbacks are still queued
+    CRecordingListener queued;
+    RegisterValidationInterface(&queued, true);
+    schedulerThread.interrupt();
+    schedulerThread.join();
+    BOOST_CHECK(!scheduler.AreThreadsServicingQueue());
+    CMutableTransaction mtx;
+    GetMainSignals().SyncTransaction(MakeTransactionRef(mtx), NULL, 0);
+
+    // Syncing runs them here instead of waiting for the scheduler
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK_EQUAL(queued.vPositions.size(), 1U);
+    BOOST_CHECK(queued.vThreads[0] == std::this_thread::get_id());
+
+    UnregisterValidationInterface(&queued);
+    UnregisterBackgroundSignalScheduler();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
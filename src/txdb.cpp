@@ -7,34 +7,136 @@
 
 #include "chainparams.h"
 #include "hash.h"
+#include "init.h"
+#include "memusage.h"
 #include "pow.h"
 #include "uint256.h"
+#include "ui_interface.h"
+#include "util.h"
 
 #include <stdint.h>
 
 #include <boost/thread.hpp>
 
+static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
+static const char DB_TXINDEX_BEST_BLOCK = 'T';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_SNAPSHOT_BASE = 'S';
+static const char DB_ADDRESSINDEX = 'a';
+static const char DB_ADDRESSUNSPENT = 'u';
+static const char DB_ADDRESSINDEX_BEST_BLOCK = 'A';
+
+namespace {
+
+/** Database key of a single unspent output: DB_COIN, txid, VARINT(output index). */
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key(DB_COIN)  {}
+
+    template<typename Stream>
+    void Serialize(Stream &s) const {
+        s << key;
+        s << outpoint->hash;
+        s << VARINT(outpoint->n);
+    }
 
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        s >> key;
+        s >> outpoint->hash;
+        s >> VARINT(outpoint->n);
+    }
+};
+
+/**
+ * Legacy per-transaction UTXO record, as stored under DB_COINS before the
+ * per-output layout. Only used to read old chainstates during Upgrade().
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nCode)
+ * - unspentness bitvector, for vout[2] and further; least significant byte first
+ * - the non-spent CTxOuts (via CTxOutCompressor)
+ * - VARINT(nHeight)
+ *
+ * The nCode value consists of:
+ * - bit 0: IsCoinBase()
+ * - bit 1: vout[0] is not spent
+ * - bit 2: vout[1] is not spent
+ * - The higher bits encode N, the number of non-zero bytes in the following bitvector.
+ *   - In case both bit 1 and bit 2 are unset, they encode N-1, as there must be at
+ *     least one non-spent output).
+ */
+class CCoins
+{
+public:
+    //! whether transaction is a coinbase
+    bool fCoinBase;
+
+    //! unspent transaction outputs; spent outputs are .IsNull()
+    std::vector<CTxOut> vout;
+
+    //! at which height this transaction was included in the active block chain
+    int nHeight;
+
+    CCoins() : fCoinBase(false), vout(0), nHeight(0) { }
+
+    template<typename Stream>
+    void Unserialize(Stream &s) {
+        unsigned int nCode = 0;
+        // version
+        int nVersionDummy;
+        ::Unserialize(s, VARINT(nVersionDummy));
+        // header code
+        ::Unserialize(s, VARINT(nCode));
+        fCoinBase = nCode & 1;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 2) != 0;
+        vAvail[1] = (nCode & 4) != 0;
+        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])));
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight));
+    }
+};
+
+}
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, const std::string& strDir) : db(GetDataDir() / strDir, nCacheSize, fMemory, fWipe, true) 
 {
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(std::make_pair(DB_COINS, txid), coins);
+bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    return db.Read(CoinEntry(&outpoint), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(std::make_pair(DB_COINS, txid));
+bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -44,26 +146,31 @@ uint256 CCoinsViewDB::GetBestBlock() const {
     return hashBestChain;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(std::make_pair(DB_COINS, it->first));
+            CoinEntry entry(&it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
             else
-                batch.Write(std::make_pair(DB_COINS, it->first), it->second.coins);
+                batch.Write(entry, it->second.coin);
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            ++it;
+        }
     }
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
@@ -96,25 +203,31 @@ CCoinsViewCursor *CCoinsViewDB::Cursor() const
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COINS);
+    i->pcursor->Seek(DB_COIN);
     // Cache key of first record
-    i->pcursor->GetKey(i->keyTmp);
+    if (i->pcursor->Valid()) {
+        CoinEntry entry(&i->keyTmp.second);
+        i->pcursor->GetKey(entry);
+        i->keyTmp.first = entry.key;
+    } else {
+        i->keyTmp.first = 0; // Make sure Valid() and GetKey() return false
+    }
     return i;
 }
 
-bool CCoinsViewDBCursor::GetKey(uint256 &key) const
+bool CCoinsViewDBCursor::GetKey(COutPoint &key) const
 {
     // Return cached key
-    if (keyTmp.first == DB_COINS) {
+    if (keyTmp.first == DB_COIN) {
         key = keyTmp.second;
         return true;
     }
     return false;
 }
 
-bool CCoinsViewDBCursor::GetValue(CCoins &coins) const
+bool CCoinsViewDBCursor::GetValue(Coin &coin) const
 {
-    return pcursor->GetValue(coins);
+    return pcursor->GetValue(coin);
 }
 
 unsigned int CCoinsViewDBCursor::GetValueSize() const
@@ -124,14 +237,18 @@ unsigned int CCoinsViewDBCursor::GetValueSize() const
 
 bool CCoinsViewDBCursor::Valid() const
 {
-    return keyTmp.first == DB_COINS;
+    return keyTmp.first == DB_COIN;
 }
 
 void CCoinsViewDBCursor::Next()
 {
     pcursor->Next();
-    if (!pcursor->Valid() || !pcursor->GetKey(keyTmp))
+    CoinEntry entry(&keyTmp.second);
+    if (!pcursor->Valid() || !pcursor->GetKey(entry)) {
         keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
+    } else {
+        keyTmp.first = entry.key;
+    }
 }
 
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
@@ -143,7 +260,27 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
     }
-    return WriteBatch(batch, true);
+    LOCK(cs_addressindex);
+    for (std::map<CAddressIndexKey, std::pair<CAmount, bool> >::const_iterator it=mapAddressIndexPending.begin(); it != mapAddressIndexPending.end(); it++) {
+        if (it->second.second)
+            batch.Erase(std::make_pair(DB_ADDRESSINDEX, it->first));
+        else
+            batch.Write(std::make_pair(DB_ADDRESSINDEX, it->first), it->second.first);
+    }
+    for (std::map<CAddressUnspentKey, CAddressUnspentValue>::const_iterator it=mapAddressUnspentPending.begin(); it != mapAddressUnspentPending.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(std::make_pair(DB_ADDRESSUNSPENT, it->first));
+        else
+            batch.Write(std::make_pair(DB_ADDRESSUNSPENT, it->first), it->second);
+    }
+    if (!hashAddressIndexPending.IsNull())
+        batch.Write(DB_ADDRESSINDEX_BEST_BLOCK, hashAddressIndexPending);
+    if (!WriteBatch(batch, true))
+        return false;
+    mapAddressIndexPending.clear();
+    mapAddressUnspentPending.clear();
+    hashAddressIndexPending.SetNull();
+    return true;
 }
 
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
@@ -157,6 +294,108 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadTxIndexBestBlock(CBlockLocator &locator) {
+    return Read(DB_TXINDEX_BEST_BLOCK, locator);
+}
+
+bool CBlockTreeDB::WriteTxIndexBestBlock(const CBlockLocator &locator) {
+    return Write(DB_TXINDEX_BEST_BLOCK, locator);
+}
+
+bool CBlockTreeDB::WriteAddressIndexBlock(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vHistory, bool fErase,
+                                          const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vUnspent,
+                                          const uint256 &hashBestBlock) {
+    LOCK(cs_addressindex);
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vHistory.begin(); it!=vHistory.end(); it++)
+        mapAddressIndexPending[it->first] = std::make_pair(it->second, fErase);
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=vUnspent.begin(); it!=vUnspent.end(); it++)
+        mapAddressUnspentPending[it->first] = it->second;
+    hashAddressIndexPending = hashBestBlock;
+    return true;
+}
+
+bool CBlockTreeDB::ReadAddressIndexBestBlock(uint256 &hashBestBlock) {
+    {
+        LOCK(cs_addressindex);
+        if (!hashAddressIndexPending.IsNull()) {
+            hashBestBlock = hashAddressIndexPending;
+            return true;
+        }
+    }
+    return Read(DB_ADDRESSINDEX_BEST_BLOCK, hashBestBlock);
+}
+
+size_t CBlockTreeDB::AddressIndexPendingUsage() {
+    LOCK(cs_addressindex);
+    return memusage::DynamicUsage(mapAddressIndexPending) + memusage::DynamicUsage(mapAddressUnspentPending);
+}
+
+bool CBlockTreeDB::ReadAddressIndex(const uint256 &scriptHash, std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, int nStartHeight, int nEndHeight) {
+    std::map<CAddressIndexKey, CAmount> mapHistory;
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexKey(scriptHash, nStartHeight, uint256(), 0, false)));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESSINDEX || key.second.scriptHash != scriptHash)
+            break;
+        if (nEndHeight > 0 && key.second.nHeight > nEndHeight)
+            break;
+        CAmount nValue;
+        if (!pcursor->GetValue(nValue))
+            return error("%s: failed to read value", __func__);
+        mapHistory.insert(std::make_pair(key.second, nValue));
+        pcursor->Next();
+    }
+
+    // Apply the changes that are not on disk yet
+    LOCK(cs_addressindex);
+    std::map<CAddressIndexKey, std::pair<CAmount, bool> >::const_iterator it = mapAddressIndexPending.lower_bound(CAddressIndexKey(scriptHash, nStartHeight, uint256(), 0, false));
+    for (; it != mapAddressIndexPending.end() && it->first.scriptHash == scriptHash; it++) {
+        if (nEndHeight > 0 && it->first.nHeight > nEndHeight)
+            break;
+        if (it->second.second)
+            mapHistory.erase(it->first);
+        else
+            mapHistory[it->first] = it->second.first;
+    }
+    vect.insert(vect.end(), mapHistory.begin(), mapHistory.end());
+    return true;
+}
+
+bool CBlockTreeDB::ReadAddressUnspentIndex(const uint256 &scriptHash, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect) {
+    std::map<CAddressUnspentKey, CAddressUnspentValue> mapUnspent;
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(std::make_pair(DB_ADDRESSUNSPENT, CAddressUnspentKey(scriptHash, uint256(), 0)));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressUnspentKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESSUNSPENT || key.second.scriptHash != scriptHash)
+            break;
+        CAddressUnspentValue value;
+        if (!pcursor->GetValue(value))
+            return error("%s: failed to read value", __func__);
+        mapUnspent.insert(std::make_pair(key.second, value));
+        pcursor->Next();
+    }
+
+    // Apply the changes that are not on disk yet
+    LOCK(cs_addressindex);
+    std::map<CAddressUnspentKey, CAddressUnspentValue>::const_iterator it = mapAddressUnspentPending.lower_bound(CAddressUnspentKey(scriptHash, uint256(), 0));
+    for (; it != mapAddressUnspentPending.end() && it->first.scriptHash == scriptHash; it++) {
+        if (it->second.IsNull())
+            mapUnspent.erase(it->first);
+        else
+            mapUnspent[it->first] = it->second;
+    }
+    vect.insert(vect.end(), mapUnspent.begin(), mapUnspent.end());
+    return true;
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -169,6 +408,20 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+bool CBlockTreeDB::WriteSnapshotBase(const uint256 &hash, uint64_t nChainTx, const uint256 &hashSerialized) {
+    return Write(DB_SNAPSHOT_BASE, std::make_pair(hash, std::make_pair(nChainTx, hashSerialized)));
+}
+
+bool CBlockTreeDB::ReadSnapshotBase(uint256 &hash, uint64_t &nChainTx, uint256 &hashSerialized) {
+    std::pair<uint256, std::pair<uint64_t, uint256> > base;
+    if (!Read(DB_SNAPSHOT_BASE, base))
+        return false;
+    hash = base.first;
+    nChainTx = base.second.first;
+    hashSerialized = base.second.second;
+    return true;
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex)
 {
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
@@ -211,3 +464,77 @@ bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256
 
     return true;
 }
+
+/** Upgrade the database from older formats.
+ *
+ * Currently implemented: from the per-tx utxo model (0.8..0.14.x) to per-txout.
+ * Each legacy record is replaced by one record per unspent, spendable output
+ * in the same batch, so an interrupted upgrade resumes where it stopped.
+ */
+bool CCoinsViewDB::Upgrade() {
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(std::make_pair(DB_COINS, uint256()));
+    if (!pcursor->Valid()) {
+        return true;
+    }
+
+    int64_t count = 0;
+    LogPrintf("Upgrading utxo-set database...\n");
+    LogPrintf("[0%%]...");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    size_t batch_size = 1 << 24;
+    CDBBatch batch(db);
+    int reportDone = 0;
+    std::pair<unsigned char, uint256> key;
+    std::pair<unsigned char, uint256> prev_key = std::make_pair(DB_COINS, uint256());
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            break;
+        }
+        if (pcursor->GetKey(key) && key.first == DB_COINS) {
+            if (count++ % 256 == 0) {
+                uint32_t high = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
+                int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
+                uiInterface.ShowProgress(_("Upgrading UTXO database"), percentageDone);
+                if (reportDone < percentageDone/10) {
+                    // report max. every 10% step
+                    LogPrintf("[%d%%]...", percentageDone);
+                    reportDone = percentageDone/10;
+                }
+            }
+            CCoins old_coins;
+            if (!pcursor->GetValue(old_coins)) {
+                return error("%s: cannot parse CCoins record", __func__);
+            }
+            COutPoint outpoint(key.second, 0);
+            for (size_t i = 0; i < old_coins.vout.size(); ++i) {
+                if (!old_coins.vout[i].IsNull() && !old_coins.vout[i].scriptPubKey.IsUnspendable()) {
+                    Coin newcoin(std::move(old_coins.vout[i]), old_coins.nHeight, old_coins.fCoinBase);
+                    outpoint.n = i;
+                    CoinEntry entry(&outpoint);
+                    batch.Write(entry, newcoin);
+                }
+            }
+            batch.Erase(key);
+            if (batch.SizeEstimate() > batch_size) {
+                if (!db.WriteBatch(batch)) {
+                    return error("%s: failed to write upgraded records", __func__);
+                }
+                batch.Clear();
+                db.CompactRange(prev_key, key);
+                prev_key = key;
+            }
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+    if (!db.WriteBatch(batch)) {
+        return error("%s: failed to write upgraded records", __func__);
+    }
+    db.CompactRange(std::make_pair((unsigned char)DB_COINS, uint256()), key);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
+    return !ShutdownRequested();
+}
@@ -6,9 +6,11 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "addressindex.h"
 #include "coins.h"
 #include "dbwrapper.h"
 #include "chain.h"
+#include "sync.h"
 
 #include <map>
 #include <string>
@@ -33,6 +35,8 @@ static const int64_t nMaxBlockDBCache = 2;
 // Unlike for the UTXO database, for the txindex scenario the leveldb cache make
 // a meaningful difference: https://github.com/bitcoin/bitcoin/pull/8273#issuecomment-229601991
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
+//! Max memory allocated to the block filter index DB cache, if -blockfilterindex (MiB)
+static const int64_t nMaxFilterIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
 
@@ -67,13 +71,17 @@ class CCoinsViewDB : public CCoinsView
 protected:
     CDBWrapper db;
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    //! strDir is the directory below the data directory that holds the database
+    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const std::string& strDir = "chainstate");
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase);
     CCoinsViewCursor *Cursor() const;
+
+    //! Convert a chainstate in the older per-transaction format. Returns false on failure or interruption.
+    bool Upgrade();
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -82,8 +90,8 @@ class CCoinsViewDBCursor: public CCoinsViewCursor
 public:
     ~CCoinsViewDBCursor() {}
 
-    bool GetKey(uint256 &key) const;
-    bool GetValue(CCoins &coins) const;
+    bool GetKey(COutPoint &key) const;
+    bool GetValue(Coin &coin) const;
     unsigned int GetValueSize() const;
 
     bool Valid() const;
@@ -93,7 +101,7 @@ private:
     CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
         CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
     std::unique_ptr<CDBIterator> pcursor;
-    std::pair<char, uint256> keyTmp;
+    std::pair<char, COutPoint> keyTmp;
 
     friend class CCoinsViewDB;
 };
@@ -106,6 +114,16 @@ public:
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
+
+    /**
+     * Address index changes not written yet. They go to disk in the same batch
+     * as the block index (see WriteBatchSync), so that the blocks they refer to
+     * are always known after a restart, and the reads below see through them.
+     */
+    CCriticalSection cs_addressindex;
+    std::map<CAddressIndexKey, std::pair<CAmount, bool> > mapAddressIndexPending; //!< value, and whether the entry is erased
+    std::map<CAddressUnspentKey, CAddressUnspentValue> mapAddressUnspentPending; //!< a null value erases the entry
+    uint256 hashAddressIndexPending;
 public:
     bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
@@ -114,8 +132,23 @@ public:
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    bool ReadTxIndexBestBlock(CBlockLocator &locator);
+    bool WriteTxIndexBestBlock(const CBlockLocator &locator);
+    //! Apply one block's address index changes (erasing the history entries when fErase, and the unspent entries whose value is null) and record hashBestBlock as the block the index is in step with; written by the next WriteBatchSync
+    bool WriteAddressIndexBlock(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vHistory, bool fErase,
+                                const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vUnspent,
+                                const uint256 &hashBestBlock);
+    bool ReadAddressIndexBestBlock(uint256 &hashBestBlock);
+    //! Memory used by the address index changes waiting for WriteBatchSync
+    size_t AddressIndexPendingUsage();
+    //! Read the history of a script, optionally limited to a range of heights (an end height of 0 means no limit)
+    bool ReadAddressIndex(const uint256 &scriptHash, std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, int nStartHeight = 0, int nEndHeight = 0);
+    bool ReadAddressUnspentIndex(const uint256 &scriptHash, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    //! The base block of the UTXO snapshot the chainstate was loaded from, with its nChainTx and hash_serialized
+    bool WriteSnapshotBase(const uint256 &hash, uint64_t nChainTx, const uint256 &hashSerialized);
+    bool ReadSnapshotBase(uint256 &hash, uint64_t &nChainTx, uint256 &hashSerialized);
     bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
 };
 
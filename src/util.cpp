@@ -72,6 +72,8 @@
 #include <sys/prctl.h>
 #endif
 
+#include <exception>
+
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/predicate.hpp> // for startswith() and endswith()
@@ -193,6 +195,27 @@ static FILE* fileout = NULL;
 static boost::mutex* mutexDebugLog = NULL;
 static std::list<std::string>* vMsgsBeforeOpenLog;
 
+/**
+ * Messages waiting for the log writer thread. Logging threads only hold the
+ * mutex to append a message, the writer takes the whole batch at once and
+ * writes it to debug.log with a single fwrite.
+ */
+struct CDebugLogQueue
+{
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::vector<std::string> vMessages;
+    size_t nBytes;
+    size_t nMaxBytes;
+    uint64_t nDropped;      //!< Messages dropped since the last notice in the log
+    bool fRunning;          //!< Whether messages are queued rather than written directly
+    bool fStop;
+    boost::thread thread;
+
+    CDebugLogQueue() : nBytes(0), nMaxBytes(0), nDropped(0), fRunning(false), fStop(false) {}
+};
+static CDebugLogQueue* debugLogQueue = NULL;
+
 static int FileWriteStr(const std::string &str, FILE *fp)
 {
     return fwrite(str.data(), 1, str.size(), fp);
@@ -203,6 +226,153 @@ static void DebugPrintInit()
     assert(mutexDebugLog == NULL);
     mutexDebugLog = new boost::mutex();
     vMsgsBeforeOpenLog = new std::list<std::string>;
+    debugLogQueue = new CDebugLogQueue();
+}
+
+/** Write to debug.log, reopening it first if requested. Requires mutexDebugLog. */
+static int DebugLogWriteStr(const std::string &str)
+{
+    // reopen the log file, if requested
+    if (fReopenDebugLog) {
+        fReopenDebugLog = false;
+        boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+        if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
+            setbuf(fileout, NULL); // unbuffered
+    }
+
+    return FileWriteStr(str, fileout);
+}
+
+/** Queue a message for the log writer thread. Returns false if it is not running. */
+static bool QueueDebugLogStr(std::string &str, int &ret)
+{
+    boost::unique_lock<boost::mutex> lock(debugLogQueue->mutex);
+    if (!debugLogQueue->fRunning)
+        return false;
+
+    if (debugLogQueue->nBytes + str.size() > debugLogQueue->nMaxBytes) {
+        // The writer can't keep up: rather than growing without bound or
+        // stalling the caller, drop the message and say so in the log.
+        debugLogQueue->nDropped++;
+        ret = 0;
+        return true;
+    }
+    ret = str.size();
+    debugLogQueue->nBytes += str.size();
+    debugLogQueue->vMessages.push_back(std::move(str));
+    if (debugLogQueue->vMessages.size() == 1) {
+        lock.unlock();
+        debugLogQueue->cond.notify_one();
+    }
+    return true;
+}
+
+/**
+ * Write out everything queued, and the number of messages dropped. Requires
+ * mutexDebugLog, which is held from taking the batch to writing it so that
+ * batches can't overtake each other.
+ */
+static void WriteDebugLogQueue()
+{
+    std::vector<std::string> vBatch;
+    uint64_t nDropped;
+    {
+        boost::unique_lock<boost::mutex> lock(debugLogQueue->mutex);
+        vBatch.swap(debugLogQueue->vMessages);
+        debugLogQueue->nBytes = 0;
+        nDropped = debugLogQueue->nDropped;
+        debugLogQueue->nDropped = 0;
+    }
+    if (vBatch.empty() && nDropped == 0)
+        return;
+
+    std::string strBatch;
+    for (const std::string& str : vBatch)
+        strBatch += str;
+    if (nDropped) {
+        if (fLogTimestamps)
+            strBatch += DateTimeStrFormat("%Y-%m-%d %H:%M:%S ", GetTime());
+        strBatch += strprintf("%u log messages dropped, the log writer could not keep up\n", nDropped);
+    }
+    DebugLogWriteStr(strBatch);
+}
+
+static void ThreadDebugLogWriter()
+{
+    RenameThread("bitcoin-logwriter");
+
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(debugLogQueue->mutex);
+            while (!debugLogQueue->fStop && debugLogQueue->vMessages.empty() && debugLogQueue->nDropped == 0)
+                debugLogQueue->cond.wait(lock);
+            if (debugLogQueue->vMessages.empty() && debugLogQueue->nDropped == 0) {
+                // Anything logged from here on is written directly, after
+                // everything that was queued.
+                debugLogQueue->fRunning = false;
+                return;
+            }
+        }
+
+        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+        WriteDebugLogQueue();
+    }
+}
+
+static std::terminate_handler prevTerminateHandler = NULL;
+
+/** Don't let the messages leading up to a std::terminate go with the process */
+static void DebugLogTerminateHandler()
+{
+    // The terminating thread may hold the lock itself
+    if (mutexDebugLog->try_lock()) {
+        if (fileout != NULL)
+            WriteDebugLogQueue();
+        mutexDebugLog->unlock();
+    }
+    if (prevTerminateHandler)
+        prevTerminateHandler();
+    std::abort();
+}
+
+void StartDebugLogWriter(size_t nMaxBytes)
+{
+    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+    {
+        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+        if (fileout == NULL)
+            return;
+    }
+    boost::unique_lock<boost::mutex> lock(debugLogQueue->mutex);
+    if (debugLogQueue->thread.joinable() || nMaxBytes == 0)
+        return;
+    if (prevTerminateHandler == NULL)
+        prevTerminateHandler = std::set_terminate(DebugLogTerminateHandler);
+    debugLogQueue->nMaxBytes = nMaxBytes;
+    debugLogQueue->fStop = false;
+    debugLogQueue->fRunning = true;
+    debugLogQueue->thread = boost::thread(&ThreadDebugLogWriter);
+}
+
+void FlushDebugLog()
+{
+    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+    boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+    if (fileout != NULL)
+        WriteDebugLogQueue();
+}
+
+void StopDebugLogWriter()
+{
+    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+    {
+        boost::unique_lock<boost::mutex> lock(debugLogQueue->mutex);
+        if (!debugLogQueue->thread.joinable())
+            return;
+        debugLogQueue->fStop = true;
+    }
+    debugLogQueue->cond.notify_one();
+    debugLogQueue->thread.join();
 }
 
 void OpenDebugLog()
@@ -304,6 +474,9 @@ int LogPrintStr(const std::string &str)
     else if (fPrintToDebugLog)
     {
         boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+        if (QueueDebugLogStr(strTimestamped, ret))
+            return ret;
+
         boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
 
         // buffer if we haven't opened the log yet
@@ -314,15 +487,7 @@ int LogPrintStr(const std::string &str)
         }
         else
         {
-            // reopen the log file, if requested
-            if (fReopenDebugLog) {
-                fReopenDebugLog = false;
-                boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-                if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
-                    setbuf(fileout, NULL); // unbuffered
-            }
-
-            ret = FileWriteStr(strTimestamped, fileout);
+            ret = DebugLogWriteStr(strTimestamped);
         }
     }
     return ret;
@@ -472,6 +637,7 @@ void PrintExceptionContinue(const std::exception* pex, const char* pszThread)
 {
     std::string message = FormatException(pex, pszThread);
     LogPrintf("\n\n************************\n%s\n", message);
+    FlushDebugLog();
     fprintf(stderr, "\n\n************************\n%s\n", message.c_str());
 }
 
@@ -32,6 +32,8 @@
 static const bool DEFAULT_LOGTIMEMICROS = false;
 static const bool DEFAULT_LOGIPS        = false;
 static const bool DEFAULT_LOGTIMESTAMPS = true;
+/** Default for -logqueuesize, in KiB */
+static const unsigned int DEFAULT_LOG_QUEUE_SIZE = 4096;
 
 /** Signals for translation. */
 class CTranslationInterface
@@ -121,6 +123,20 @@ void ReadConfigFile(const std::string& confPath);
 boost::filesystem::path GetSpecialFolderPath(int nFolder, bool fCreate = true);
 #endif
 void OpenDebugLog();
+/**
+ * Hand debug.log writes off to a background thread, which writes what was
+ * logged in batches. Up to nMaxBytes of messages are queued; messages beyond
+ * that are dropped and counted. Until it is started and after it is stopped,
+ * messages are written directly.
+ */
+void StartDebugLogWriter(size_t nMaxBytes);
+/** Write out everything still queued and stop the log writer thread */
+void StopDebugLogWriter();
+/**
+ * Write out everything queued from the calling thread, for error paths that
+ * may not get as far as a clean shutdown. A std::terminate does this too.
+ */
+void FlushDebugLog();
 void ShrinkDebugFile();
 void runCommand(const std::string& strCommand);
 
@@ -9,11 +9,13 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinsprefetch.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
 #include "hash.h"
 #include "init.h"
+#include "metrics.h"
 #include "policy/fees.h"
 #include "policy/policy.h"
 #include "pow.h"
@@ -37,7 +39,10 @@
 #include "warnings.h"
 
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -59,12 +64,16 @@ CCriticalSection cs_main;
 BlockMap mapBlockIndex;
 CChain chainActive;
 CBlockIndex *pindexBestHeader = NULL;
+CBlockIndex *pindexSnapshotBase = NULL;
+bool fSnapshotValidated = false;
+CBlockIndex *pindexSnapshotValidated = NULL;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
 std::atomic_bool fImporting(false);
 bool fReindex = false;
 bool fTxIndex = false;
+bool fAddressIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
@@ -182,7 +191,7 @@ public:
     ~MemPoolConflictRemovalTracker() {
         pool.NotifyEntryRemoved.disconnect(boost::bind(&MemPoolConflictRemovalTracker::NotifyEntryRemoved, this, _1, _2));
         for (const auto& tx : conflictedTxs) {
-            GetMainSignals().SyncTransaction(*tx, NULL, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+            GetMainSignals().SyncTransaction(tx, NULL, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
         }
         conflictedTxs.clear();
     }
@@ -207,6 +216,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewPrefetch *pcoinsPrefetch = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 enum FlushStateMode {
@@ -395,15 +405,15 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
-            CCoins coins;
-            if (!viewMemPool.GetCoins(txin.prevout.hash, coins)) {
+            Coin coin;
+            if (!viewMemPool.GetCoin(txin.prevout, coin)) {
                 return error("%s: Missing input", __func__);
             }
-            if (coins.nHeight == MEMPOOL_HEIGHT) {
+            if (coin.nHeight == MEMPOOL_HEIGHT) {
                 // Assume all mempool transaction confirm in the next block
                 prevheights[txinIndex] = tip->nHeight + 1;
             } else {
-                prevheights[txinIndex] = coins.nHeight;
+                prevheights[txinIndex] = coin.nHeight;
             }
         }
         lockPair = CalculateSequenceLocks(tx, flags, &prevheights, index);
@@ -459,7 +469,9 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& in
     unsigned int nSigOps = 0;
     for (unsigned int i = 0; i < tx.vin.size(); i++)
     {
-        const CTxOut &prevout = inputs.GetOutputFor(tx.vin[i]);
+        const Coin& coin = inputs.AccessCoin(tx.vin[i].prevout);
+        assert(!coin.IsSpent());
+        const CTxOut &prevout = coin.out;
         if (prevout.scriptPubKey.IsPayToScriptHash())
             nSigOps += prevout.scriptPubKey.GetSigOpCount(tx.vin[i].scriptSig);
     }
@@ -479,7 +491,9 @@ int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& i
 
     for (unsigned int i = 0; i < tx.vin.size(); i++)
     {
-        const CTxOut &prevout = inputs.GetOutputFor(tx.vin[i]);
+        const Coin& coin = inputs.AccessCoin(tx.vin[i].prevout);
+        assert(!coin.IsSpent());
+        const CTxOut &prevout = coin.out;
         nSigOps += CountWitnessSigOps(tx.vin[i].scriptSig, prevout.scriptPubKey, &tx.vin[i].scriptWitness, flags);
     }
     return nSigOps;
@@ -543,9 +557,9 @@ void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
     if (expired != 0)
         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
 
-    std::vector<uint256> vNoSpendsRemaining;
+    std::vector<COutPoint> vNoSpendsRemaining;
     pool.TrimToSize(limit, &vNoSpendsRemaining);
-    BOOST_FOREACH(const uint256& removed, vNoSpendsRemaining)
+    BOOST_FOREACH(const COutPoint& removed, vNoSpendsRemaining)
         pcoinsTip->Uncache(removed);
 }
 
@@ -570,16 +584,13 @@ static bool IsCurrentForFeeEstimation()
     return true;
 }
 
-bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, bool fLimitFree,
-                              bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<uint256>& vHashTxnToUncache)
+/**
+ * The checks AcceptToMemoryPool runs on a transaction before looking at the
+ * mempool or its inputs. Requires cs_main.
+ */
+static bool CheckTxPolicy(const CTransaction& tx, CValidationState& state)
 {
-    const CTransaction& tx = *ptx;
-    const uint256 hash = tx.GetHash();
     AssertLockHeld(cs_main);
-    if (pfMissingInputs)
-        *pfMissingInputs = false;
-
     if (!CheckTransaction(tx, state))
         return false; // state filled in by CheckTransaction
 
@@ -604,6 +615,83 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
     if (!CheckFinalTx(tx, STANDARD_LOCKTIME_VERIFY_FLAGS))
         return state.DoS(0, false, REJECT_NONSTANDARD, "non-final");
 
+    return true;
+}
+
+/**
+ * The policy checks AcceptToMemoryPool runs on a transaction whose inputs are
+ * all in view, short of the replacement rules and the scripts: standard
+ * inputs and witness, sigops, fees and the in-mempool ancestor limits.
+ * setAncestors is filled with the in-mempool ancestors of entry. Requires
+ * cs_main.
+ */
+static bool CheckTxInputsPolicy(CTxMemPool& pool, CValidationState& state, const CTxMemPoolEntry& entry, const CCoinsViewCache& view,
+                                const CAmount& nModifiedFees, bool fLimitFree, const CAmount& nAbsurdFee, CTxMemPool::setEntries& setAncestors)
+{
+    AssertLockHeld(cs_main);
+    const CTransaction& tx = entry.GetTx();
+    const CAmount& nFees = entry.GetFee();
+    const int64_t nSigOpsCost = entry.GetSigOpCost();
+    const unsigned int nSize = entry.GetTxSize();
+
+    // Check for non-standard pay-to-script-hash in inputs
+    if (fRequireStandard && !AreInputsStandard(tx, view))
+        return state.Invalid(false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
+
+    // Check for non-standard witness in P2WSH
+    if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
+        return state.DoS(0, false, REJECT_NONSTANDARD, "bad-witness-nonstandard", true);
+
+    // Check that the transaction doesn't have an excessive number of
+    // sigops, making it impossible to mine. Since the coinbase transaction
+    // itself can contain sigops MAX_STANDARD_TX_SIGOPS is less than
+    // MAX_BLOCK_SIGOPS; we still consider this an invalid rather than
+    // merely non-standard transaction.
+    if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
+        return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
+            strprintf("%d", nSigOpsCost));
+
+    CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+    if (mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
+    }
+
+    // No transactions are allowed below minRelayTxFee except from disconnected blocks
+    if (fLimitFree && nModifiedFees < ::minRelayTxFee.GetFee(nSize)) {
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "min relay fee not met");
+    }
+
+    if (nAbsurdFee && nFees > nAbsurdFee)
+        return state.Invalid(false,
+            REJECT_HIGHFEE, "absurdly-high-fee",
+            strprintf("%d > %d", nFees, nAbsurdFee));
+
+    // Calculate in-mempool ancestors, up to a limit.
+    size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+    size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+    size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+    size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
+    std::string errString;
+    if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+        return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
+    }
+
+    return true;
+}
+
+bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, bool fLimitFree,
+                              bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
+                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
+{
+    const CTransaction& tx = *ptx;
+    const uint256 hash = tx.GetHash();
+    AssertLockHeld(cs_main);
+    if (pfMissingInputs)
+        *pfMissingInputs = false;
+
+    if (!CheckTxPolicy(tx, state))
+        return false;
+
     // is it already in the memory pool?
     if (pool.exists(hash))
         return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-in-mempool");
@@ -665,22 +753,34 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         view.SetBackend(viewMemPool);
 
         // do we already have it?
-        bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
-        if (view.HaveCoins(hash)) {
-            if (!fHadTxInCache)
-                vHashTxnToUncache.push_back(hash);
-            return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+        for (size_t out = 0; out < tx.vout.size(); out++) {
+            COutPoint outpoint(hash, out);
+            bool had_coin_in_cache = pcoinsTip->HaveCoinInCache(outpoint);
+            if (view.HaveCoin(outpoint)) {
+                if (!had_coin_in_cache) {
+                    coins_to_uncache.push_back(outpoint);
+                }
+                return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+            }
         }
 
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
-                vHashTxnToUncache.push_back(txin.prevout.hash);
-            if (!view.HaveCoins(txin.prevout.hash)) {
-                if (pfMissingInputs)
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
+                coins_to_uncache.push_back(txin.prevout);
+            }
+            if (!view.HaveCoin(txin.prevout)) {
+                // Are inputs missing because we already have the tx?
+                for (size_t out = 0; out < tx.vout.size(); out++) {
+                    // Optimistically just do efficient check of cache for outputs
+                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
+                        return state.Invalid(false, REJECT_DUPLICATE, "txn-already-known");
+                    }
+                }
+                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
+                if (pfMissingInputs) {
                     *pfMissingInputs = true;
+                }
                 return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
             }
         }
@@ -706,14 +806,6 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             return state.DoS(0, false, REJECT_NONSTANDARD, "non-BIP68-final");
         }
 
-        // Check for non-standard pay-to-script-hash in inputs
-        if (fRequireStandard && !AreInputsStandard(tx, view))
-            return state.Invalid(false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
-
-        // Check for non-standard witness in P2WSH
-        if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
-            return state.DoS(0, false, REJECT_NONSTANDARD, "bad-witness-nonstandard", true);
-
         int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
 
         CAmount nValueOut = tx.GetValueOut();
@@ -726,8 +818,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase()) {
                 fSpendsCoinbase = true;
                 break;
             }
@@ -737,40 +829,9 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
                               fSpendsCoinbase, nSigOpsCost, lp);
         unsigned int nSize = entry.GetTxSize();
 
-        // Check that the transaction doesn't have an excessive number of
-        // sigops, making it impossible to mine. Since the coinbase transaction
-        // itself can contain sigops MAX_STANDARD_TX_SIGOPS is less than
-        // MAX_BLOCK_SIGOPS; we still consider this an invalid rather than
-        // merely non-standard transaction.
-        if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
-            return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
-                strprintf("%d", nSigOpsCost));
-
-        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
-        if (mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
-        }
-
-        // No transactions are allowed below minRelayTxFee except from disconnected blocks
-        if (fLimitFree && nModifiedFees < ::minRelayTxFee.GetFee(nSize)) {
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "min relay fee not met");
-        }
-
-        if (nAbsurdFee && nFees > nAbsurdFee)
-            return state.Invalid(false,
-                REJECT_HIGHFEE, "absurdly-high-fee",
-                strprintf("%d > %d", nFees, nAbsurdFee));
-
-        // Calculate in-mempool ancestors, up to a limit.
         CTxMemPool::setEntries setAncestors;
-        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
-        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
-        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
-        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
-        std::string errString;
-        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
-            return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
-        }
+        if (!CheckTxInputsPolicy(pool, state, entry, view, nModifiedFees, fLimitFree, nAbsurdFee, setAncestors))
+            return false;
 
         // A transaction that spends outputs that would be replaced by it is invalid. Now
         // that we have the set of all ancestors we can detect this
@@ -982,7 +1043,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         }
     }
 
-    GetMainSignals().SyncTransaction(tx, NULL, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+    GetMainSignals().SyncTransaction(ptx, NULL, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
 
     return true;
 }
@@ -991,10 +1052,10 @@ bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
                         bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
 {
-    std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    std::vector<COutPoint> coins_to_uncache;
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, coins_to_uncache);
     if (!res) {
-        BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
+        BOOST_FOREACH(const COutPoint& hashTx, coins_to_uncache)
             pcoinsTip->Uncache(hashTx);
     }
     // After we've (potentially) uncached entries, ensure our coins cache is still within its size limits
@@ -1048,10 +1109,8 @@ bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
         int nHeight = -1;
         {
-            const CCoinsViewCache& view = *pcoinsTip;
-            const CCoins* coins = view.AccessCoins(hash);
-            if (coins)
-                nHeight = coins->nHeight;
+            const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+            if (!coin.IsSpent()) nHeight = coin.nHeight;
         }
         if (nHeight > 0)
             pindexSlow = chainActive[nHeight];
@@ -1138,6 +1197,45 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    // The index header written by WriteBlockToDisk precedes the block
+    if (pos.nPos < CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("%s: invalid position %s", __func__, pos.ToString());
+    CDiskBlockPos hpos(pos.nFile, pos.nPos - CMessageHeader::MESSAGE_START_SIZE - sizeof(unsigned int));
+
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars blkStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blkStart) >> nSize;
+        if (memcmp(blkStart, messageStart, CMessageHeader::MESSAGE_START_SIZE))
+            return error("%s: block magic mismatch at %s", __func__, pos.ToString());
+        if (nSize > MAX_SIZE)
+            return error("%s: block size %u too large at %s", __func__, nSize, pos.ToString());
+        block.resize(nSize);
+        filein.read((char*)block.data(), nSize);
+    }
+    catch (const std::exception& e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    if (!ReadRawBlockFromDisk(block, pindex->GetBlockPos(), messageStart))
+        return false;
+    // Hashing the header is cheap and catches reading the wrong block
+    if (block.size() < 80 || Hash(block.begin(), block.begin() + 80) != pindex->GetBlockHash())
+        return error("ReadRawBlockFromDisk(CBlockIndex*): header doesn't match index for %s at %s",
+                pindex->ToString(), pindex->GetBlockPos().ToString());
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1301,24 +1399,13 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
-            // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            txundo.vprevout.emplace_back();
+            bool is_spent = inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            assert(is_spent);
         }
     }
     // add outputs
-    inputs.ModifyNewCoins(tx.GetHash(), tx.IsCoinBase())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
@@ -1356,20 +1443,20 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY)
+            if (coin.IsCoinBase()) {
+                if (nSpendHeight - coin.nHeight < COINBASE_MATURITY)
                     return state.Invalid(false,
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase",
-                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight));
+                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coin.nHeight));
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
         }
@@ -1389,11 +1476,13 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks, int nSpendHeight)
 {
     if (!tx.IsCoinBase())
     {
-        if (!Consensus::CheckTxInputs(tx, state, inputs, GetSpendHeight(inputs)))
+        if (nSpendHeight < 0)
+            nSpendHeight = GetSpendHeight(inputs);
+        if (!Consensus::CheckTxInputs(tx, state, inputs, nSpendHeight))
             return false;
 
         if (pvChecks)
@@ -1411,11 +1500,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1427,7 +1516,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
+                        CScriptCheck check2(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -1477,6 +1566,8 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
+} // anon namespace
+
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
     // Open history file to read
@@ -1504,11 +1595,14 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
+namespace {
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
     SetMiscWarning(strMessage);
     LogPrintf("*** %s\n", strMessage);
+    FlushDebugLog();
     uiInterface.ThreadSafeMessageBox(
         userMessage.empty() ? _("Error: A fatal internal error occurred, see debug.log for details") : userMessage,
         "", CClientUIInterface::MSG_ERROR);
@@ -1525,34 +1619,29 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
 } // anon namespace
 
 /**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
+ * Restore the UTXO in a Coin at a given COutPoint.
+ * @param undo The Coin to be restored.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
- * @return True on success.
+ * @return True on success, false if the undo data was inconsistent with the view.
  */
-bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+bool ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 {
     bool fClean = true;
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
-    }
-    if (coins->IsAvailable(out.n))
+    if (view.HaveCoin(out))
         fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height and coinbase). Older versions included this
+        // information only in undo records for the last spend of a transactions'
+        // outputs. This implies that it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (alternate.IsSpent())
+            return error("%s: undo data adding output to missing transaction", __func__);
+        undo.nHeight = alternate.nHeight;
+        undo.fCoinBase = alternate.fCoinBase;
+    }
+    view.AddCoin(out, std::move(undo), !fClean);
 
     return fClean;
 }
@@ -1583,34 +1672,28 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                bool is_spent = view.SpendCoin(out, &coin);
+                if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != coin.nHeight || tx.IsCoinBase() != coin.fCoinBase) {
+                    fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+                }
+            }
         }
 
         // restore inputs
         if (i > 0) { // not coinbases
-            const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+            CTxUndo &txundo = blockUndo.vtxundo[i-1];
             if (txundo.vprevout.size() != tx.vin.size())
                 return error("DisconnectBlock(): transaction and undo data inconsistent");
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
-                const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
+                if (!ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out))
                     fClean = false;
             }
+            // At this point, all of txundo.vprevout should have been moved out.
         }
     }
 
@@ -1625,6 +1708,66 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
     return fClean;
 }
 
+/**
+ * Apply the -addressindex changes for connecting a block, or for
+ * disconnecting it when fConnect is false. The spent outputs come from the
+ * block's undo data.
+ *
+ * The changes are held by pblocktree and written together with the block
+ * index in FlushStateToDisk, which does so before flushing the chainstate. A
+ * crash in between leaves the index ahead of the chainstate, at a block the
+ * block index knows; ReplayAddressIndex brings it back in line on startup.
+ */
+static bool UpdateAddressIndex(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect)
+{
+    const int nHeight = pindex->nHeight;
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vHistory;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+
+    // Walk the block in the order its changes were made, or in reverse when
+    // undoing them, so that outputs created and spent within the block end up
+    // with the right final state in the unspent index.
+    for (size_t k = 0; k < block.vtx.size(); k++) {
+        const size_t i = fConnect ? k : block.vtx.size() - 1 - k;
+        const CTransaction& tx = *block.vtx[i];
+        const uint256& txhash = tx.GetHash();
+
+        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vSpent;
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i-1];
+            if (txundo.vprevout.size() != tx.vin.size())
+                return error("%s: transaction and undo data inconsistent", __func__);
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const Coin& coin = txundo.vprevout[j];
+                const uint256 scriptHash = GetScriptHash(coin.out.scriptPubKey);
+                vHistory.push_back(std::make_pair(CAddressIndexKey(scriptHash, nHeight, txhash, j, true), -coin.out.nValue));
+                CAddressUnspentKey key(scriptHash, tx.vin[j].prevout.hash, tx.vin[j].prevout.n);
+                vSpent.push_back(std::make_pair(key, fConnect ? CAddressUnspentValue() :
+                                                CAddressUnspentValue(coin.out.nValue, coin.out.scriptPubKey, coin.nHeight, coin.fCoinBase)));
+            }
+        }
+
+        if (fConnect)
+            vUnspent.insert(vUnspent.end(), vSpent.begin(), vSpent.end());
+
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            const CTxOut& out = tx.vout[o];
+            if (out.scriptPubKey.IsUnspendable())
+                continue;
+            const uint256 scriptHash = GetScriptHash(out.scriptPubKey);
+            vHistory.push_back(std::make_pair(CAddressIndexKey(scriptHash, nHeight, txhash, o, false), out.nValue));
+            vUnspent.push_back(std::make_pair(CAddressUnspentKey(scriptHash, txhash, o), fConnect ?
+                                              CAddressUnspentValue(out.nValue, out.scriptPubKey, nHeight, tx.IsCoinBase()) : CAddressUnspentValue()));
+        }
+
+        if (!fConnect)
+            vUnspent.insert(vUnspent.end(), vSpent.begin(), vSpent.end());
+    }
+
+    return pblocktree->WriteAddressIndexBlock(vHistory, !fConnect, vUnspent,
+                                              fConnect ? pindex->GetBlockHash() : pindex->pprev->GetBlockHash());
+}
+
 void static FlushBlockFile(bool fFinalize = false)
 {
     LOCK(cs_LastBlockFile);
@@ -1657,6 +1800,166 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/** Turns a parsed transaction of a block into the final one, which computes its hashes */
+class CTxHashCheck
+{
+private:
+    CMutableTransaction* ptx;
+    CTransactionRef* ptxOut;
+
+public:
+    CTxHashCheck() : ptx(NULL), ptxOut(NULL) {}
+    CTxHashCheck(CMutableTransaction* ptxIn, CTransactionRef* ptxOutIn) : ptx(ptxIn), ptxOut(ptxOutIn) {}
+
+    bool operator()() {
+        *ptxOut = MakeTransactionRef(std::move(*ptx));
+        return true;
+    }
+
+    void swap(CTxHashCheck& check) {
+        std::swap(ptx, check.ptx);
+        std::swap(ptxOut, check.ptxOut);
+    }
+};
+
+static CCheckQueue<CTxHashCheck> txhashqueue(32);
+
+void ThreadTxHash() {
+    RenameThread("bitcoin-txhash");
+    txhashqueue.Thread();
+}
+
+void BuildBlockTransactions(std::vector<CMutableTransaction>& vtx, std::vector<CTransactionRef>& vtxOut)
+{
+    vtxOut.resize(vtx.size());
+    if (!nScriptCheckThreads || vtx.size() < MIN_PARALLEL_TX_HASH) {
+        for (size_t i = 0; i < vtx.size(); i++)
+            vtxOut[i] = MakeTransactionRef(std::move(vtx[i]));
+        return;
+    }
+
+    // Rather than wait for another block, hash this one serially
+    CCheckQueueControl<CTxHashCheck> control(&txhashqueue, true);
+    if (!control.HasQueue()) {
+        for (size_t i = 0; i < vtx.size(); i++)
+            vtxOut[i] = MakeTransactionRef(std::move(vtx[i]));
+        return;
+    }
+
+    std::vector<CTxHashCheck> vChecks;
+    vChecks.reserve(vtx.size());
+    for (size_t i = 0; i < vtx.size(); i++)
+        vChecks.emplace_back(&vtx[i], &vtxOut[i]);
+    control.Add(vChecks);
+    control.Wait();
+}
+
+size_t PreverifyTransactions(CTxMemPool& pool, const std::vector<CTransactionRef>& txs, std::vector<uint256>* pvFailed)
+{
+    if (!nScriptCheckThreads)
+        return 0;
+
+    unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    if (!Params().RequireStandard()) {
+        scriptVerifyFlags = GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
+    }
+
+    // The script checks point into these, so they must not be reallocated
+    std::vector<PrecomputedTransactionData> vTxData;
+    vTxData.reserve(txs.size());
+    std::vector<const CTransaction*> vVerified;
+    std::vector<std::vector<CScriptCheck> > vTxChecks;
+    {
+        LOCK2(cs_main, pool.cs);
+        CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+        std::vector<COutPoint> coins_to_uncache;
+        for (const CTransactionRef& ptx : txs) {
+            // Scripts are the expensive part of acceptance: only verify them
+            // for transactions that pass the cheaper checks AcceptToMemoryPool
+            // runs first, so that a batch of junk costs no more than it would
+            // serially. Replacements are left to AcceptToMemoryPool alone.
+            const CTransaction& tx = *ptx;
+            const uint256& hash = tx.GetHash();
+            CValidationState state;
+            if (!CheckTxPolicy(tx, state) || pool.exists(hash))
+                continue;
+
+            CCoinsViewCache view(&viewMemPool);
+            bool fUsable = true;
+            for (const CTxIn& txin : tx.vin) {
+                if (pool.mapNextTx.count(txin.prevout)) {
+                    fUsable = false;
+                    break;
+                }
+                if (!pcoinsTip->HaveCoinInCache(txin.prevout))
+                    coins_to_uncache.push_back(txin.prevout);
+                if (!view.HaveCoin(txin.prevout)) {
+                    fUsable = false;
+                    break;
+                }
+            }
+            if (!fUsable || !view.HaveInputs(tx))
+                continue;
+
+            LockPoints lp;
+            if (!CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp))
+                continue;
+
+            int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+            CAmount nFees = view.GetValueIn(tx) - tx.GetValueOut();
+            CAmount nModifiedFees = nFees;
+            pool.ApplyDelta(hash, nModifiedFees);
+            CTxMemPoolEntry entry(ptx, nFees, 0, chainActive.Height(), false, nSigOpsCost, lp);
+            CTxMemPool::setEntries setAncestors;
+            if (!CheckTxInputsPolicy(pool, state, entry, view, nModifiedFees, true, 0, setAncestors))
+                continue;
+
+            // Only collects the script checks; CheckTxInputs runs right away
+            std::vector<CScriptCheck> vChecks;
+            vTxData.emplace_back(tx);
+            if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, vTxData.back(), &vChecks)) {
+                vTxData.pop_back();
+                continue;
+            }
+            vVerified.push_back(&tx);
+            vTxChecks.push_back(std::move(vChecks));
+        }
+        // The coins were only needed to build the checks; leave the cache as
+        // AcceptToMemoryPool would for a transaction it rejects.
+        for (const COutPoint& outpoint : coins_to_uncache)
+            pcoinsTip->Uncache(outpoint);
+    }
+
+    // The script check queue is shared with block validation, which comes
+    // first: if it is busy, leave the scripts to AcceptToMemoryPool. It is
+    // only taken after cs_main is released, as ConnectBlock takes it while
+    // holding cs_main.
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue, true);
+    if (!control.HasQueue())
+        return 0;
+
+    // Valid signatures are added to the signature cache as they are checked.
+    // The queue takes its checks by swapping, so it gets copies.
+    for (const std::vector<CScriptCheck>& vChecks : vTxChecks) {
+        std::vector<CScriptCheck> vCopies(vChecks);
+        control.Add(vCopies);
+    }
+    if (!control.Wait() && pvFailed) {
+        // The queue only tells that something failed, and stops checking
+        // once it does. Find out what: the signatures already found valid
+        // come from the cache, so this mostly checks what was skipped.
+        for (size_t i = 0; i < vVerified.size(); i++) {
+            for (CScriptCheck& check : vTxChecks[i]) {
+                if (!check()) {
+                    pvFailed->push_back(vVerified[i]->GetHash());
+                    break;
+                }
+            }
+        }
+    }
+    return vVerified.size();
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1724,34 +2027,23 @@ unsigned int MaxBlockSigopsCost(const CBlockIndex* pindexPrev,const Consensus::P
         return MAX_BLOCK1_SIGOPS_COST;
 }
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+/** The rules a block is connected under that depend on the chain below it */
+struct BlockConnectRules
 {
-    AssertLockHeld(cs_main);
-    assert(pindex);
-    // pindex->phashBlock can be null if called by CreateNewBlock/TestBlockValidity
-    assert((pindex->phashBlock == NULL) ||
-           (*pindex->phashBlock == block.GetHash()));
-    int64_t nTimeStart = GetTimeMicros();
-
-    // Check it again in case a previous version let a bad block in
-    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck))
-        return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
+    bool fScriptChecks;
+    bool fEnforceBIP30;
+    unsigned int flags;
+    int nLockTimeFlags;
+    int64_t nMaxSigOpsCost;
+};
 
-    // verify that the view's current state corresponds to the previous block
-    uint256 hashPrevBlock = pindex->pprev == NULL ? uint256() : pindex->pprev->GetBlockHash();
-    assert(hashPrevBlock == view.GetBestBlock());
+/** Work out the rules pindex is connected under. Requires cs_main, for the versionbits cache and the assumed valid block. */
+static BlockConnectRules GetBlockConnectRules(const CBlockIndex* pindex, const CChainParams& chainparams)
+{
+    AssertLockHeld(cs_main);
+    BlockConnectRules rules;
 
-    // Special case for the genesis block, skipping connection of its transactions
-    // (its coinbase is unspendable)
-    if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
-        if (!fJustCheck)
-            view.SetBestBlock(pindex->GetBlockHash());
-        return true;
-    }
-    
-	 
-    bool fScriptChecks = true;
+    rules.fScriptChecks = true;
     if (!hashAssumeValid.IsNull()) {
         // We've been configured with the hash of a block which has been externally verified to have a valid history.
         // A suitable default value is included with the software and updated from time to time.  Because validity
@@ -1772,14 +2064,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 //  artificially set the default assumed verified block further back.
                 // The test against nMinimumChainWork prevents the skipping when denied access to any chain at
                 //  least as good as the expected chain.
-                fScriptChecks = (GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, chainparams.GetConsensus()) <= 60 * 60 * 24 * 7 * 2);
+                rules.fScriptChecks = (GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, chainparams.GetConsensus()) <= 60 * 60 * 24 * 7 * 2);
             }
         }
     }
 
-    int64_t nTime1 = GetTimeMicros(); nTimeCheck += nTime1 - nTimeStart;
-    LogPrint("bench", "    - Sanity checks: %.2fms [%.2fs]\n", 0.001 * (nTime1 - nTimeStart), nTimeCheck * 0.000001);
-
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
     // If such overwrites are allowed, coinbases and transactions depending upon those
@@ -1792,7 +2081,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // Now that the whole chain is irreversibly beyond that time it is applied to all blocks except the
     // two in the chain that violate it. This prevents exploiting the issue against nodes during their
     // initial block download.
-    bool fEnforceBIP30 = (!pindex->phashBlock) || // Enforce on CreateNewBlock invocations which don't have a hash.
+    rules.fEnforceBIP30 = (!pindex->phashBlock) || // Enforce on CreateNewBlock invocations which don't have a hash.
                           !((pindex->nHeight==91842 && pindex->GetBlockHash() == uint256S("0x00000000000a4d0a398161ffc163c503763b1f4360639393e0e4c8e300e0caec")) ||
                            (pindex->nHeight==91880 && pindex->GetBlockHash() == uint256S("0x00000000000743f190a18c5577a3c2d2a1f610ae9601ac046a38084ccb7cd721")));
 
@@ -1804,60 +2093,67 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // If we're on the known chain at height greater than where BIP34 activated, we can save the db accesses needed for the BIP30 check.
     CBlockIndex *pindexBIP34height = pindex->pprev->GetAncestor(chainparams.GetConsensus().BIP34Height);
     //Only continue to enforce if we're below BIP34 activation height or the block hash at that height doesn't correspond.
-    fEnforceBIP30 = fEnforceBIP30 && (!pindexBIP34height || !(pindexBIP34height->GetBlockHash() == chainparams.GetConsensus().BIP34Hash));
-
-    if (fEnforceBIP30) {
-        for (const auto& tx : block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx->GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                                 REJECT_INVALID, "bad-txns-BIP30");
-        }
-    }
+    rules.fEnforceBIP30 = rules.fEnforceBIP30 && (!pindexBIP34height || !(pindexBIP34height->GetBlockHash() == chainparams.GetConsensus().BIP34Hash));
 
     // BIP16 didn't become active until Apr 1 2012
     int64_t nBIP16SwitchTime = 1333238400;
     bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
 
-    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+    rules.flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
 
     // Start enforcing the DERSIG (BIP66) rule
     if (pindex->nHeight >= chainparams.GetConsensus().BIP66Height) {
-        flags |= SCRIPT_VERIFY_DERSIG;
+        rules.flags |= SCRIPT_VERIFY_DERSIG;
     }
 
     // Start enforcing CHECKLOCKTIMEVERIFY (BIP65) rule
     if (pindex->nHeight >= chainparams.GetConsensus().BIP65Height) {
-        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+        rules.flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
     }
 
     // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
-    int nLockTimeFlags = 0;
+    rules.nLockTimeFlags = 0;
     if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
-        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
-        nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
+        rules.flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+        rules.nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
     }
 
     // Start enforcing WITNESS rules using versionbits logic.
     if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_WITNESS;
-        flags |= SCRIPT_VERIFY_NULLDUMMY;
+        rules.flags |= SCRIPT_VERIFY_WITNESS;
+        rules.flags |= SCRIPT_VERIFY_NULLDUMMY;
     }
 
-    int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
-    LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
-
-    CBlockUndo blockundo;
+    rules.nMaxSigOpsCost = MaxBlockSigopsCost(pindex->pprev, chainparams.GetConsensus());
+    return rules;
+}
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+/**
+ * Check the transactions of a block against view and apply them to it, filling blockundo.
+ * This does not take cs_main: what it needs from the chain comes in through rules, and
+ * pindex and its ancestors do not change once they are in mapBlockIndex. Script checks
+ * go to control if it has a queue and are performed inline otherwise; the caller waits
+ * for them.
+ */
+static bool ConnectBlockTransactions(const CBlock& block, CValidationState& state, const CBlockIndex* pindex,
+                                     CCoinsViewCache& view, const CChainParams& chainparams, const BlockConnectRules& rules,
+                                     bool fCacheResults, CCheckQueueControl<CScriptCheck>& control, CBlockUndo& blockundo, int& nInputs)
+{
+    if (rules.fEnforceBIP30) {
+        for (const auto& tx : block.vtx) {
+            for (size_t o = 0; o < tx->vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx->GetHash(), o))) {
+                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+                }
+            }
+        }
+    }
 
     std::vector<int> prevheights;
     CAmount nFees = 0;
-    int nInputs = 0;
+    nInputs = 0;
     int64_t nSigOpsCost = 0;
-    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
-    vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     std::vector<PrecomputedTransactionData> txdata;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
@@ -1878,10 +2174,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             // be in ConnectBlock because they require the UTXO set
             prevheights.resize(tx.vin.size());
             for (size_t j = 0; j < tx.vin.size(); j++) {
-                prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+                prevheights[j] = view.AccessCoin(tx.vin[j].prevout).nHeight;
             }
 
-            if (!SequenceLocks(tx, nLockTimeFlags, &prevheights, *pindex)) {
+            if (!SequenceLocks(tx, rules.nLockTimeFlags, &prevheights, *pindex)) {
                 return state.DoS(100, error("%s: contains a non-BIP68-final transaction", __func__),
                                  REJECT_INVALID, "bad-txns-nonfinal");
             }
@@ -1891,8 +2187,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         // * legacy (always)
         // * p2sh (when P2SH enabled in flags and excludes coinbase)
         // * witness (when witness enabled in flags and excludes coinbase)
-        nSigOpsCost += GetTransactionSigOpCost(tx, view, flags);
-        if (nSigOpsCost > MaxBlockSigopsCost(pindex->pprev,chainparams.GetConsensus()))
+        nSigOpsCost += GetTransactionSigOpCost(tx, view, rules.flags);
+        if (nSigOpsCost > rules.nMaxSigOpsCost)
             return state.DoS(100, error("ConnectBlock(): too many sigops"),
                              REJECT_INVALID, "bad-blk-sigops");
 
@@ -1902,8 +2198,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             nFees += view.GetValueIn(tx)-tx.GetValueOut();
 
             std::vector<CScriptCheck> vChecks;
-            bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
+            if (!CheckInputs(tx, state, view, rules.fScriptChecks, rules.flags, fCacheResults, txdata[i], control.HasQueue() ? &vChecks : NULL, pindex->nHeight))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
             control.Add(vChecks);
@@ -1914,12 +2209,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             blockundo.vtxundo.push_back(CTxUndo());
         }
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
-
-        vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
-    int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
-    LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2), 0.001 * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * 0.000001);
 
     CAmount blockReward = nFees + GetBlockSubsidy(pindex->nHeight, chainparams.GetConsensus());
     if (block.vtx[0]->GetValueOut() > blockReward)
@@ -1927,6 +2217,53 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                          error("ConnectBlock(): coinbase pays too much (actual=%d vs limit=%d)",
                                block.vtx[0]->GetValueOut(), blockReward),
                                REJECT_INVALID, "bad-cb-amount");
+    return true;
+}
+
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, bool fCacheResults)
+{
+    AssertLockHeld(cs_main);
+    assert(pindex);
+    // pindex->phashBlock can be null if called by CreateNewBlock/TestBlockValidity
+    assert((pindex->phashBlock == NULL) ||
+           (*pindex->phashBlock == block.GetHash()));
+    int64_t nTimeStart = GetTimeMicros();
+
+    // Check it again in case a previous version let a bad block in
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck))
+        return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
+
+    // verify that the view's current state corresponds to the previous block
+    uint256 hashPrevBlock = pindex->pprev == NULL ? uint256() : pindex->pprev->GetBlockHash();
+    assert(hashPrevBlock == view.GetBestBlock());
+
+    // Special case for the genesis block, skipping connection of its transactions
+    // (its coinbase is unspendable)
+    if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
+        if (!fJustCheck)
+            view.SetBestBlock(pindex->GetBlockHash());
+        return true;
+    }
+
+    int64_t nTime1 = GetTimeMicros(); nTimeCheck += nTime1 - nTimeStart;
+    LogPrint("bench", "    - Sanity checks: %.2fms [%.2fs]\n", 0.001 * (nTime1 - nTimeStart), nTimeCheck * 0.000001);
+
+    BlockConnectRules rules = GetBlockConnectRules(pindex, chainparams);
+
+    int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
+    LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
+
+    CBlockUndo blockundo;
+
+    CCheckQueueControl<CScriptCheck> control(rules.fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+
+    int nInputs = 0;
+    /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
+    if (!ConnectBlockTransactions(block, state, pindex, view, chainparams, rules, fJustCheck && fCacheResults, control, blockundo, nInputs))
+        return false;
+    int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
+    LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2), 0.001 * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * 0.000001);
 
     if (!control.Wait())
         return state.DoS(100, false);
@@ -1936,6 +2273,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     if (fJustCheck)
         return true;
 
+    // Block template checks are left out of the metrics
+    RecordBlockConnectPhase(BLOCK_PHASE_CHECK, nTime1 - nTimeStart);
+    RecordBlockConnectPhase(BLOCK_PHASE_FORKS, nTime2 - nTime1);
+    RecordBlockConnectPhase(BLOCK_PHASE_CONNECT_TXS, nTime3 - nTime2);
+    RecordBlockConnectPhase(BLOCK_PHASE_VERIFY, nTime4 - nTime2);
+
     // Write undo information to disk
     if (pindex->GetUndoPos().IsNull() || !pindex->IsValid(BLOCK_VALID_SCRIPTS))
     {
@@ -1955,14 +2298,15 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
-            return AbortNode(state, "Failed to write transaction index");
+    if (fAddressIndex)
+        if (!UpdateAddressIndex(block, blockundo, pindex, true))
+            return AbortNode(state, "Failed to write address index");
 
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
     int64_t nTime5 = GetTimeMicros(); nTimeIndex += nTime5 - nTime4;
+    RecordBlockConnectPhase(BLOCK_PHASE_INDEX, nTime5 - nTime4);
     LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime5 - nTime4), nTimeIndex * 0.000001);
 
     // Watch for changes to the previous coinbase transaction.
@@ -1972,13 +2316,43 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
 
     int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
+    RecordBlockConnectPhase(BLOCK_PHASE_CALLBACKS, nTime6 - nTime5);
     LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime6 - nTime5), nTimeCallbacks * 0.000001);
 
     return true;
 }
 
-/**
- * Update the on-disk chain state.
+/** Write the block and undo files and the dirty block index entries to disk. Requires cs_main and cs_LastBlockFile. */
+static bool WriteBlockIndex(CValidationState& state)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_LastBlockFile);
+    // Depend on nMinDiskSpace to ensure we can write block index
+    if (!CheckDiskSpace(0))
+        return state.Error("out of disk space");
+    // First make sure all block and undo data is flushed to disk.
+    FlushBlockFile();
+    // Then update all block file information (which may refer to block and undo files).
+    std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
+    vFiles.reserve(setDirtyFileInfo.size());
+    for (std::set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); ) {
+        vFiles.push_back(std::make_pair(*it, &vinfoBlockFile[*it]));
+        setDirtyFileInfo.erase(it++);
+    }
+    std::vector<const CBlockIndex*> vBlocks;
+    vBlocks.reserve(setDirtyBlockIndex.size());
+    for (std::set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
+        vBlocks.push_back(*it);
+        setDirtyBlockIndex.erase(it++);
+    }
+    if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
+        return AbortNode(state, "Failed to write to block index database");
+    }
+    return true;
+}
+
+/**
+ * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
  * if they're too large, if it's been a while since the last write,
  * or always and in all cases if we're in prune mode and are deleting files.
@@ -2020,7 +2394,7 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode, int n
         nLastSetChain = nNow;
     }
     int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
-    int64_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+    int64_t cacheSize = pcoinsTip->DynamicMemoryUsage() + pblocktree->AddressIndexPendingUsage();
     int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
     // The cache is large and we're within 10% and 100 MiB of the limit, but we have time now (not in the middle of a block processing).
     bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - 100 * 1024 * 1024);
@@ -2034,29 +2408,8 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode, int n
     bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
     // Write blocks and block index to disk.
     if (fDoFullFlush || fPeriodicWrite) {
-        // Depend on nMinDiskSpace to ensure we can write block index
-        if (!CheckDiskSpace(0))
-            return state.Error("out of disk space");
-        // First make sure all block and undo data is flushed to disk.
-        FlushBlockFile();
-        // Then update all block file information (which may refer to block and undo files).
-        {
-            std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
-            vFiles.reserve(setDirtyFileInfo.size());
-            for (std::set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); ) {
-                vFiles.push_back(std::make_pair(*it, &vinfoBlockFile[*it]));
-                setDirtyFileInfo.erase(it++);
-            }
-            std::vector<const CBlockIndex*> vBlocks;
-            vBlocks.reserve(setDirtyBlockIndex.size());
-            for (std::set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
-                vBlocks.push_back(*it);
-                setDirtyBlockIndex.erase(it++);
-            }
-            if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
-                return AbortNode(state, "Failed to write to block index database");
-            }
-        }
+        if (!WriteBlockIndex(state))
+            return false;
         // Finally remove any pruned files
         if (fFlushForPrune)
             UnlinkPrunedFiles(setFilesToPrune);
@@ -2064,16 +2417,24 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode, int n
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
-        // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // Write the chainstate (which may refer to block index entries), but
+        // keep the unspent coins cached so validation does not start cold.
+        if (!pcoinsTip->Sync())
             return AbortNode(state, "Failed to write to coin database");
+        // Everything left is clean. If it still takes more than half of the
+        // space, evict some of it so that new coins have room to accumulate
+        // before the next write.
+        if (pcoinsTip->DynamicMemoryUsage() > (size_t)nTotalSpace / 2) {
+            pcoinsTip->Trim(nTotalSpace / 2);
+            LogPrint("coindb", "Trimmed coins cache to %.1fMiB (%u txo)\n", pcoinsTip->DynamicMemoryUsage() * (1.0 / (1<<20)), (unsigned int)pcoinsTip->GetCacheSize());
+        }
         nLastFlush = nNow;
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
@@ -2150,6 +2511,7 @@ void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
             }
         }
     }
+    SetChainStateMetrics(chainActive.Height(), pcoinsTip->DynamicMemoryUsage(), pcoinsTip->GetCacheSize());
     LogPrintf("%s: new best=%s height=%d version=0x%08x log2_work=%.8g tx=%lu date='%s' progress=%f cache=%.1fMiB(%utx)", __func__,
       chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), chainActive.Tip()->nVersion,
       log(chainActive.Tip()->nChainWork.getdouble())/log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
@@ -2179,6 +2541,15 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
         bool flushed = view.Flush();
         assert(flushed);
     }
+    // DisconnectBlock is also used by VerifyDB on a scratch view, so the
+    // address index is only rolled back here, for real chain changes.
+    if (fAddressIndex) {
+        CBlockUndo blockUndo;
+        if (!UndoReadFromDisk(blockUndo, pindexDelete->GetUndoPos(), pindexDelete->pprev->GetBlockHash()))
+            return AbortNode(state, "Failed to read undo data");
+        if (!UpdateAddressIndex(block, blockUndo, pindexDelete, false))
+            return AbortNode(state, "Failed to write address index");
+    }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
@@ -2210,7 +2581,7 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
     for (const auto& tx : block.vtx) {
-        GetMainSignals().SyncTransaction(*tx, pindexDelete->pprev, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+        GetMainSignals().SyncTransaction(tx, pindexDelete->pprev, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
     }
     return true;
 }
@@ -2253,6 +2624,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     const CBlock& blockConnecting = *connectTrace.blocksConnected.back().second;
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
+    RecordBlockConnectPhase(BLOCK_PHASE_READ_FROM_DISK, nTime2 - nTime1);
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
@@ -2270,11 +2642,13 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         assert(flushed);
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
+    RecordBlockConnectPhase(BLOCK_PHASE_FLUSH, nTime4 - nTime3);
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
     int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
+    RecordBlockConnectPhase(BLOCK_PHASE_CHAINSTATE, nTime5 - nTime4);
     LogPrint("bench", "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
     // Remove conflicting transactions from the mempool.;
     mempool.removeForBlock(blockConnecting.vtx, pindexNew->nHeight);
@@ -2282,6 +2656,8 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     UpdateTip(pindexNew, chainparams);
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
+    RecordBlockConnectPhase(BLOCK_PHASE_POST_CONNECT, nTime6 - nTime5);
+    RecordBlockConnectPhase(BLOCK_PHASE_TOTAL, nTime6 - nTime1);
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
     return true;
@@ -2518,7 +2894,8 @@ bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams,
                 assert(pair.second);
                 const CBlock& block = *(pair.second);
                 for (unsigned int i = 0; i < block.vtx.size(); i++)
-                    GetMainSignals().SyncTransaction(*block.vtx[i], pair.first, i);
+                    GetMainSignals().SyncTransaction(block.vtx[i], pair.first, i);
+                GetMainSignals().BlockConnected(pair.second, pair.first);
             }
         }
         // When we reach this point, we switched to a new tip (stored in pindexNewTip).
@@ -2682,10 +3059,34 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
 }
 
 /** Mark a block as having its data received and checked (up to BLOCK_VALID_TRANSACTIONS). */
+namespace {
+
+/** Chainstate built from genesis by the background validation of a UTXO snapshot */
+std::unique_ptr<CCoinsViewDB> pcoinsSnapshotValidationDB;
+std::unique_ptr<CCoinsViewCache> pcoinsSnapshotValidation;
+size_t nSnapshotValidationCacheUsage = 0;
+std::thread threadSnapshotValidation;
+std::mutex mutexSnapshotValidation;
+std::condition_variable condSnapshotValidation;
+bool fInterruptSnapshotValidation = false;
+/** Counts the blocks received below the snapshot base, so the validation thread never misses one */
+uint64_t nSnapshotBlocksReceived = 0;
+
+/** Whether pindex is at or below a UTXO snapshot base that was not validated yet. Requires cs_main. */
+bool IsAssumedBySnapshot(const CBlockIndex* pindex)
+{
+    return pindexSnapshotBase && !fSnapshotValidated && pindex->pprev && pindexSnapshotBase->GetAncestor(pindex->nHeight) == pindex;
+}
+
+} // anon namespace
+
 bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBlockIndex *pindexNew, const CDiskBlockPos& pos)
 {
+    bool fAssumed = IsAssumedBySnapshot(pindexNew);
     pindexNew->nTx = block.vtx.size();
-    pindexNew->nChainTx = 0;
+    // The snapshot base keeps the nChainTx the snapshot came with
+    if (!fAssumed)
+        pindexNew->nChainTx = 0;
     pindexNew->nFile = pos.nFile;
     pindexNew->nDataPos = pos.nPos;
     pindexNew->nUndoPos = 0;
@@ -2696,6 +3097,17 @@ bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBl
     pindexNew->RaiseValidity(BLOCK_VALID_TRANSACTIONS);
     setDirtyBlockIndex.insert(pindexNew);
 
+    if (fAssumed) {
+        // Blocks below the snapshot base are already part of the active chain; they
+        // only feed the background validation, which links them once it is done.
+        {
+            std::lock_guard<std::mutex> lock(mutexSnapshotValidation);
+            nSnapshotBlocksReceived++;
+        }
+        condSnapshotValidation.notify_all();
+        return true;
+    }
+
     if (pindexNew->pprev == NULL || pindexNew->pprev->nChainTx) {
         // If pindexNew is the genesis block or all parents are BLOCK_VALID_TRANSACTIONS.
         std::deque<CBlockIndex*> queue;
@@ -3278,6 +3690,28 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
     return true;
 }
 
+/**
+ * Start loading the coins spent by a block that is about to be connected, so
+ * that ConnectBlock finds them in memory. Coins that are already cached or
+ * that are created within the block itself are skipped.
+ */
+static void PrefetchBlockInputs(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    std::set<uint256> setTxids;
+    std::vector<COutPoint> vOutpoints;
+    for (const CTransactionRef& tx : block.vtx) {
+        setTxids.insert(tx->GetHash());
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (!setTxids.count(txin.prevout.hash) && !pcoinsTip->HaveCoinInCache(txin.prevout))
+                vOutpoints.push_back(txin.prevout);
+        }
+    }
+    pcoinsPrefetch->Prefetch(vOutpoints);
+}
+
 bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<const CBlock> pblock, bool fForceProcessing, bool *fNewBlock)
 {
     {
@@ -3294,6 +3728,9 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
             // Store to disk
             ret = AcceptBlock(pblock, state, chainparams, &pindex, fForceProcessing, NULL, fNewBlock);
         }
+        // Blocks that may extend the active chain get connected soon
+        if (ret && pcoinsPrefetch && pindex && chainActive.Tip() && pindex->nChainWork > chainActive.Tip()->nChainWork)
+            PrefetchBlockInputs(*pblock);
         CheckBlockIndex(chainparams.GetConsensus());
         if (!ret) {
             GetMainSignals().BlockChecked(*pblock, state);
@@ -3393,6 +3830,15 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
     }
 }
 
+/* Whether the background validation of a UTXO snapshot still has to read blocks from this file */
+static bool IsBlockFileNeededBySnapshotValidation(int fileNumber)
+{
+    if (!pindexSnapshotBase || fSnapshotValidated)
+        return false;
+    int nHeightValidated = pindexSnapshotValidated ? pindexSnapshotValidated->nHeight : 0;
+    return vinfoBlockFile[fileNumber].nHeightFirst <= (unsigned)pindexSnapshotBase->nHeight && vinfoBlockFile[fileNumber].nHeightLast > (unsigned)nHeightValidated;
+}
+
 /* Calculate the block/rev files to delete based on height specified by user with RPC command pruneblockchain */
 void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeight)
 {
@@ -3406,7 +3852,7 @@ void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeig
     unsigned int nLastBlockWeCanPrune = std::min((unsigned)nManualPruneHeight, chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP);
     int count=0;
     for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
-        if (vinfoBlockFile[fileNumber].nSize == 0 || vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
+        if (vinfoBlockFile[fileNumber].nSize == 0 || vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune || IsBlockFileNeededBySnapshotValidation(fileNumber))
             continue;
         PruneOneBlockFile(fileNumber);
         setFilesToPrune.insert(fileNumber);
@@ -3456,6 +3902,9 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight
             if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
                 continue;
 
+            if (IsBlockFileNeededBySnapshotValidation(fileNumber))
+                continue;
+
             PruneOneBlockFile(fileNumber);
             // Queue up the files for removal
             setFilesToPrune.insert(fileNumber);
@@ -3544,6 +3993,11 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
 
     boost::this_thread::interruption_point();
 
+    uint256 hashSnapshotBase, hashSnapshotSerialized;
+    uint64_t nSnapshotChainTx = 0;
+    pblocktree->ReadSnapshotBase(hashSnapshotBase, nSnapshotChainTx, hashSnapshotSerialized);
+    pblocktree->ReadFlag("snapshotvalidated", fSnapshotValidated);
+
     // Calculate nChainWork
     std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
@@ -3572,6 +4026,11 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
                 pindex->nChainTx = pindex->nTx;
             }
         }
+        if (!hashSnapshotBase.IsNull() && pindex->GetBlockHash() == hashSnapshotBase) {
+            // The snapshot base has no block data to count transactions from
+            pindex->nChainTx = nSnapshotChainTx;
+            pindexSnapshotBase = pindex;
+        }
         if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL))
             setBlockIndexCandidates.insert(pindex);
         if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
@@ -3581,6 +4040,23 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    // Blocks below an unvalidated snapshot base that were downloaded for its
+    // background validation stay unlinked until it completes
+    for (CBlockIndex* pindex = fSnapshotValidated ? NULL : pindexSnapshotBase; pindex && pindex->pprev; pindex = pindex->pprev) {
+        if (pindex->nTx == 0)
+            continue;
+        if (pindex != pindexSnapshotBase) {
+            pindex->nChainTx = 0;
+            setBlockIndexCandidates.erase(pindex);
+        }
+        std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex->pprev);
+        while (range.first != range.second) {
+            if (range.first->second == pindex)
+                range.first = mapBlocksUnlinked.erase(range.first);
+            else
+                range.first++;
+        }
+    }
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -3627,9 +4103,9 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     pblocktree->ReadReindexing(fReindexing);
     fReindex |= fReindexing;
 
-    // Check whether we have a transaction index
-    pblocktree->ReadFlag("txindex", fTxIndex);
-    LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
+    // Check whether we have an address index
+    pblocktree->ReadFlag("addressindex", fAddressIndex);
+    LogPrintf("%s: address index %s\n", __func__, fAddressIndex ? "enabled" : "disabled");
 
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
@@ -3691,7 +4167,12 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
             break;
         if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
             // If pruning, only go back as far as we have data.
-            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
+            LogPrintf("VerifyDB(): block verification stopping at height %d (no data)\n", pindex->nHeight);
+            break;
+        }
+        if (pindexSnapshotBase && pindex->nHeight <= pindexSnapshotBase->nHeight) {
+            // Blocks up to a UTXO snapshot base were never connected to this chainstate and have no undo data
+            LogPrintf("VerifyDB(): block verification stopping at height %d (UTXO snapshot base)\n", pindex->nHeight);
             break;
         }
         CBlock block;
@@ -3750,13 +4231,69 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
     return true;
 }
 
+bool ReplayAddressIndex(const CChainParams& params)
+{
+    LOCK(cs_main);
+
+    if (!fAddressIndex || chainActive.Tip() == NULL)
+        return true;
+
+    uint256 hashBest;
+    if (!pblocktree->ReadAddressIndexBestBlock(hashBest)) {
+        // Nothing has been indexed since the chainstate was (re)built
+        if (chainActive.Height() > 0)
+            return error("%s: address index has no best block", __func__);
+        return true;
+    }
+    BlockMap::iterator mi = mapBlockIndex.find(hashBest);
+    if (mi == mapBlockIndex.end())
+        return error("%s: address index best block %s not found", __func__, hashBest.ToString());
+    CBlockIndex* pindex = mi->second;
+    if (pindex == chainActive.Tip())
+        return true;
+
+    LogPrintf("Replaying address index from %s (height %d) to %s (height %d)\n", pindex->GetBlockHash().ToString(), pindex->nHeight,
+        chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height());
+
+    // Roll back the blocks that were indexed after the last chainstate flush
+    // (or on a branch the chainstate is not on), down to the active chain.
+    while (!chainActive.Contains(pindex)) {
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!ReadBlockFromDisk(block, pindex, params.GetConsensus()))
+            return error("%s: failed to read block %s", __func__, pindex->GetBlockHash().ToString());
+        if (!UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()))
+            return error("%s: failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+        if (!UpdateAddressIndex(block, blockundo, pindex, false))
+            return error("%s: failed to roll back block %s", __func__, pindex->GetBlockHash().ToString());
+        pindex = pindex->pprev;
+    }
+
+    // Index the active chain blocks the index has not seen yet
+    while (pindex != chainActive.Tip()) {
+        pindex = chainActive.Next(pindex);
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!ReadBlockFromDisk(block, pindex, params.GetConsensus()))
+            return error("%s: failed to read block %s", __func__, pindex->GetBlockHash().ToString());
+        if (!UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()))
+            return error("%s: failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+        if (!UpdateAddressIndex(block, blockundo, pindex, true))
+            return error("%s: failed to index block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    return true;
+}
+
 bool RewindBlockIndex(const CChainParams& params)
 {
     LOCK(cs_main);
 
     int nHeight = 1;
     while (nHeight <= chainActive.Height()) {
-        if (IsWitnessEnabled(chainActive[nHeight - 1], params.GetConsensus()) && !(chainActive[nHeight]->nStatus & BLOCK_OPT_WITNESS)) {
+        // Blocks covered by a UTXO snapshot were never downloaded; their validity is assumed
+        bool fSnapshot = pindexSnapshotBase && nHeight <= pindexSnapshotBase->nHeight;
+        if (!fSnapshot && IsWitnessEnabled(chainActive[nHeight - 1], params.GetConsensus()) && !(chainActive[nHeight]->nStatus & BLOCK_OPT_WITNESS)) {
             break;
         }
         nHeight++;
@@ -3844,6 +4381,9 @@ void UnloadBlockIndex()
     chainActive.SetTip(NULL);
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
+    pindexSnapshotBase = NULL;
+    fSnapshotValidated = false;
+    pindexSnapshotValidated = NULL;
     mempool.clear();
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
@@ -3879,9 +4419,9 @@ bool InitBlockIndex(const CChainParams& chainparams)
     if (chainActive.Genesis() != NULL)
         return true;
 
-    // Use the provided setting for -txindex in the new database
-    fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
-    pblocktree->WriteFlag("txindex", fTxIndex);
+    // Use the provided setting for -addressindex in the new database
+    fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
+    pblocktree->WriteFlag("addressindex", fAddressIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -3909,20 +4449,191 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
-bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+namespace {
+
+/**
+ * Pipeline behind LoadExternalBlockFile. A reader thread scans the file for
+ * serialized blocks. Worker threads deserialize them (which hashes every
+ * transaction) and run the context-free CheckBlock (which computes the merkle
+ * root). The caller receives the results in file order and adds them to the
+ * block index one at a time, so the whole sequential part happens under
+ * cs_main just like before.
+ *
+ * A block that fails to deserialize makes the caller restart the scan one
+ * byte after that block's message start. This is the same recovery the
+ * single-threaded loader used.
+ */
+class CBlockImportPipeline
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+public:
+    struct Item
+    {
+        uint64_t nPos;      //!< file position of the serialized block
+        uint64_t nRewind;   //!< where to resume scanning if the block is unreadable
+        unsigned int nSize; //!< size announced in the header
+        unsigned int nConsumed; //!< bytes actually used by the block
+        CDataStream data;
+        std::shared_ptr<CBlock> pblock; //!< NULL if deserialization failed
+        uint256 hash;
+        std::string strError;
+        bool fDone;
+
+        Item() : nPos(0), nRewind(0), nSize(0), nConsumed(0), data(SER_DISK, CLIENT_VERSION), fDone(false) {}
+    };
 
-    int nLoaded = 0;
-    try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
+    /** Takes ownership of fileIn, which is closed on destruction. */
+    CBlockImportPipeline(FILE* fileIn, const CChainParams& chainparamsIn, int nWorkers) :
+        chainparams(chainparamsIn),
+        blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION),
+        nQueuedBytes(0), nGeneration(0), nRestartPos(0), fEOF(false), fStop(false)
+    {
+        // The destructor does not run if this throws, so join whatever was
+        // started here rather than leave a joinable std::thread behind
+        try {
+            vThreadWorkers.reserve(nWorkers);
+            threadReader = std::thread(&CBlockImportPipeline::ThreadRead, this);
+            for (int i = 0; i < nWorkers; i++)
+                vThreadWorkers.emplace_back(&CBlockImportPipeline::ThreadDecode, this);
+        } catch (...) {
+            StopThreads();
+            throw;
+        }
+    }
+
+    ~CBlockImportPipeline()
+    {
+        StopThreads();
+    }
+
+    /**
+     * Wait for the next block in file order. If no worker has picked it up yet,
+     * it is decoded on the calling thread. Returns NULL once the file is exhausted.
+     */
+    std::shared_ptr<Item> Next()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            if (!queueOrdered.empty()) {
+                std::shared_ptr<Item> item = queueOrdered.front();
+                if (item->fDone) {
+                    queueOrdered.pop_front();
+                    nQueuedBytes -= item->nSize;
+                    condReader.notify_one();
+                    return item;
+                }
+                if (!queueDecode.empty() && queueDecode.front() == item) {
+                    queueDecode.pop_front();
+                    lock.unlock();
+                    Decode(*item);
+                    lock.lock();
+                    item->fDone = true;
+                    continue;
+                }
+            } else if (fEOF) {
+                return nullptr;
+            }
+            condConsumer.wait(lock);
+        }
+    }
+
+    /** Drop everything read ahead and resume scanning the file at nPos. */
+    void Restart(uint64_t nPos)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            nGeneration++;
+            nRestartPos = nPos;
+            queueOrdered.clear();
+            queueDecode.clear();
+            nQueuedBytes = 0;
+            fEOF = false;
+        }
+        condReader.notify_all();
+    }
+
+private:
+    /** Upper bound on the serialized size of blocks read ahead of the caller */
+    static const size_t MAX_QUEUED_BYTES = 16 * MAX_BLOCK_SERIALIZED_SIZE;
+    /** Upper bound on the number of blocks read ahead of the caller */
+    static const size_t MAX_QUEUED_BLOCKS = 1024;
+
+    const CChainParams& chainparams;
+    CBufferedFile blkdat;
+
+    std::mutex mutex;
+    std::condition_variable condReader;
+    std::condition_variable condWorker;
+    std::condition_variable condConsumer;
+
+    //! All blocks read but not yet handed out, in file order
+    std::deque<std::shared_ptr<Item>> queueOrdered;
+    //! Blocks not yet picked up by a worker
+    std::deque<std::shared_ptr<Item>> queueDecode;
+    size_t nQueuedBytes;
+    uint64_t nGeneration;
+    uint64_t nRestartPos;
+    bool fEOF;
+    bool fStop;
+
+    std::thread threadReader;
+    std::vector<std::thread> vThreadWorkers;
+
+    void StopThreads()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            fStop = true;
+        }
+        condReader.notify_all();
+        condWorker.notify_all();
+        if (threadReader.joinable())
+            threadReader.join();
+        for (std::thread& thread : vThreadWorkers)
+            thread.join();
+    }
+
+    void Decode(Item& item) const
+    {
+        try {
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            item.data >> *pblock;
+            item.nConsumed = item.nSize - item.data.size();
+            item.hash = pblock->GetHash();
+            // Caches a positive result in CBlock::fChecked, so AcceptBlock does not
+            // repeat the work. Failures are detected again and handled there.
+            CValidationState state;
+            CheckBlock(*pblock, state, chainparams.GetConsensus());
+            item.pblock = pblock;
+        } catch (const std::exception& e) {
+            item.strError = e.what();
+        }
+        item.data = CDataStream(SER_DISK, CLIENT_VERSION);
+    }
 
+    /** Queue a block read by the given generation of the reader. Returns false if it is stale. */
+    bool Push(const std::shared_ptr<Item>& item, uint64_t nGenerationRead)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!fStop && nGeneration == nGenerationRead && !queueOrdered.empty() &&
+                   (nQueuedBytes + item->nSize > MAX_QUEUED_BYTES || queueOrdered.size() >= MAX_QUEUED_BLOCKS)) {
+                condReader.wait(lock);
+            }
+            if (fStop || nGeneration != nGenerationRead)
+                return false;
+            queueOrdered.push_back(item);
+            queueDecode.push_back(item);
+            nQueuedBytes += item->nSize;
+        }
+        condWorker.notify_one();
+        condConsumer.notify_one();
+        return true;
+    }
+
+    /** Scan the file from nRewind on, until the end or until the scan is restarted. */
+    void ReadFile(uint64_t nRewind, uint64_t nGenerationRead)
+    {
+        while (!blkdat.eof()) {
             blkdat.SetPos(nRewind);
             nRewind++; // start one byte further next time, in case of failure
             blkdat.SetLimit(); // remove former limit
@@ -3945,18 +4656,105 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
             }
             try {
                 // read block
-                uint64_t nBlockPos = blkdat.GetPos();
+                std::shared_ptr<Item> item = std::make_shared<Item>();
+                item->nPos = blkdat.GetPos();
+                item->nRewind = nRewind;
+                item->nSize = nSize;
+                blkdat.SetLimit(item->nPos + nSize);
+                item->data.resize(nSize);
+                blkdat.read(&item->data[0], nSize);
+                nRewind = blkdat.GetPos();
+                if (!Push(item, nGenerationRead))
+                    return;
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+    }
+
+    void ThreadRead()
+    {
+        RenameThread("bitcoin-loadrd");
+        uint64_t nGenerationRead = 0;
+        uint64_t nStartPos = blkdat.GetPos();
+        while (true) {
+            ReadFile(nStartPos, nGenerationRead);
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (nGeneration == nGenerationRead) {
+                    fEOF = true;
+                    condConsumer.notify_all();
+                }
+                while (!fStop && nGeneration == nGenerationRead)
+                    condReader.wait(lock);
+                if (fStop)
+                    return;
+                nGenerationRead = nGeneration;
+                nStartPos = nRestartPos;
+            }
+            blkdat.Seek(nStartPos);
+        }
+    }
+
+    void ThreadDecode()
+    {
+        RenameThread("bitcoin-loaddec");
+        while (true) {
+            std::shared_ptr<Item> item;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!fStop && queueDecode.empty())
+                    condWorker.wait(lock);
+                if (fStop)
+                    return;
+                item = queueDecode.front();
+                queueDecode.pop_front();
+            }
+            Decode(*item);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                item->fDone = true;
+            }
+            condConsumer.notify_one();
+        }
+    }
+};
+
+} // anon namespace
+
+bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+{
+    // Map of disk positions for blocks with unknown parent (only used for reindex)
+    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    try {
+        // This takes over fileIn and calls fclose() on it when done
+        CBlockImportPipeline pipeline(fileIn, chainparams, nScriptCheckThreads);
+        while (true) {
+            boost::this_thread::interruption_point();
+
+            std::shared_ptr<CBlockImportPipeline::Item> item = pipeline.Next();
+            if (!item)
+                break;
+            if (!item->pblock) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, item->strError);
+                pipeline.Restart(item->nRewind);
+                continue;
+            }
+            if (item->nConsumed < item->nSize) {
+                // keep scanning right after the block, not after the announced size
+                pipeline.Restart(item->nPos + item->nConsumed);
+            }
+            try {
                 if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+                    dbp->nPos = item->nPos;
+                std::shared_ptr<CBlock> pblock = item->pblock;
                 CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
 
                 // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
+                uint256 hash = item->hash;
                 if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
                     LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
                             block.hashPrevBlock.ToString());
@@ -4026,6 +4824,392 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     return nLoaded > 0;
 }
 
+bool LoadUTXOSnapshot(const CChainParams& chainparams, const boost::filesystem::path& path, const uint256& hashExpected, std::string& strError)
+{
+    FILE* file = fopen(path.string().c_str(), "rb");
+    CAutoFile afile(file, SER_DISK, CLIENT_VERSION);
+    if (afile.IsNull()) {
+        strError = strprintf(_("Unable to open UTXO snapshot %s"), path.string());
+        return false;
+    }
+
+    try {
+        CUTXOSnapshotMetadata metadata;
+        afile >> metadata;
+        if (metadata.nVersion != CUTXOSnapshotMetadata::CURRENT_VERSION) {
+            strError = strprintf(_("Unsupported UTXO snapshot version %d"), metadata.nVersion);
+            return false;
+        }
+        if (memcmp(metadata.pchMessageStart, chainparams.MessageStart(), sizeof(metadata.pchMessageStart))) {
+            strError = _("The UTXO snapshot is for a different network");
+            return false;
+        }
+        // The snapshot's own commitment only protects against corruption; the
+        // hash it is checked against has to come from somewhere trusted.
+        uint256 hashTrusted = hashExpected;
+        if (hashTrusted.IsNull()) {
+            MapAssumeUTXO::const_iterator it = chainparams.AssumeUTXO().find(metadata.hashBlock);
+            if (it == chainparams.AssumeUTXO().end()) {
+                strError = strprintf(_("No trusted UTXO set hash is known for snapshot base %s; use -assumeutxo"), metadata.hashBlock.ToString());
+                return false;
+            }
+            hashTrusted = it->second;
+        }
+        if (metadata.hashSerialized != hashTrusted) {
+            strError = strprintf(_("The UTXO snapshot commits to %s, expected %s"), metadata.hashSerialized.ToString(), hashTrusted.ToString());
+            return false;
+        }
+        {
+            // On a fresh datadir the genesis block has not been connected yet
+            CValidationState state;
+            if (chainActive.Tip() == NULL && !ActivateBestChain(state, chainparams)) {
+                strError = strprintf(_("Failed to connect the genesis block: %s"), FormatStateMessage(state));
+                return false;
+            }
+        }
+        {
+            LOCK(cs_main);
+            if (pindexSnapshotBase && pindexSnapshotBase->GetBlockHash() == metadata.hashBlock) {
+                LogPrintf("%s: chainstate was already loaded from this snapshot\n", __func__);
+                return true;
+            }
+            if (chainActive.Height() != 0) {
+                strError = _("A UTXO snapshot can only be loaded into an empty chainstate");
+                return false;
+            }
+            if (fTxIndex || fAddressIndex) {
+                strError = _("A UTXO snapshot cannot be loaded with -txindex or -addressindex");
+                return false;
+            }
+        }
+        // Connect the header chain up to the snapshot base
+        uint32_t nHeaders;
+        afile >> nHeaders;
+        const CBlockIndex* pindexLast = NULL;
+        std::vector<CBlockHeader> vHeaders;
+        for (uint32_t i = 0; i < nHeaders; i++) {
+            boost::this_thread::interruption_point();
+            CBlockHeader header;
+            afile >> header;
+            vHeaders.push_back(header);
+            if (vHeaders.size() == MAX_HEADERS_RESULTS || i + 1 == nHeaders) {
+                CValidationState state;
+                if (!ProcessNewBlockHeaders(vHeaders, state, chainparams, &pindexLast)) {
+                    strError = strprintf(_("Invalid block header in UTXO snapshot: %s"), FormatStateMessage(state));
+                    return false;
+                }
+                vHeaders.clear();
+            }
+        }
+        if (!pindexLast || pindexLast->GetBlockHash() != metadata.hashBlock || pindexLast->nHeight != (int)nHeaders) {
+            strError = _("The UTXO snapshot headers do not lead to its base block");
+            return false;
+        }
+        LogPrintf("%s: snapshot base %s at height %d, %u coins\n", __func__, metadata.hashBlock.ToString(), pindexLast->nHeight, metadata.nCoins);
+
+        // First pass: check the coins against the commitment before touching the chainstate
+        long nCoinsPos = ftell(afile.Get());
+        CCoinsStats stats;
+        CCoinsStatsBuilder builder(stats, metadata.hashBlock);
+        COutPoint prevout;
+        for (uint64_t i = 0; i < metadata.nCoins; i++) {
+            boost::this_thread::interruption_point();
+            COutPoint outpoint;
+            Coin coin;
+            afile >> outpoint >> coin;
+            if ((i > 0 && !(prevout < outpoint)) || coin.IsSpent()) {
+                strError = _("The UTXO snapshot contains unordered or spent coins");
+                return false;
+            }
+            prevout = outpoint;
+            size_t nSize = ::GetSerializeSize(coin, SER_DISK, CLIENT_VERSION);
+            builder.Add(outpoint, std::move(coin), nSize);
+        }
+        builder.Finalize();
+        if (stats.hashSerialized != metadata.hashSerialized) {
+            strError = strprintf(_("The UTXO snapshot contents hash to %s, but it commits to %s"), stats.hashSerialized.ToString(), metadata.hashSerialized.ToString());
+            return false;
+        }
+
+        // Second pass: write the coins. A crash from here on leaves a partially
+        // loaded chainstate behind, which init detects through this flag.
+        if (fseek(afile.Get(), nCoinsPos, SEEK_SET)) {
+            strError = _("Unable to rewind the UTXO snapshot file");
+            return false;
+        }
+        pblocktree->WriteFlag("snapshotloading", true);
+        LOCK(cs_main);
+        for (uint64_t i = 0; i < metadata.nCoins; i++) {
+            boost::this_thread::interruption_point();
+            COutPoint outpoint;
+            Coin coin;
+            afile >> outpoint >> coin;
+            pcoinsTip->AddCoin(outpoint, std::move(coin), false);
+            if (pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) {
+                if (!pcoinsTip->Flush()) {
+                    strError = _("Failed to write to coin database");
+                    return false;
+                }
+            }
+        }
+        pcoinsTip->SetBestBlock(metadata.hashBlock);
+
+        // Everything up to the base is assumed valid; none of it has block data.
+        CBlockIndex* pindex = mapBlockIndex[metadata.hashBlock];
+        for (CBlockIndex* pindexWalk = pindex; pindexWalk && pindexWalk->pprev; pindexWalk = pindexWalk->pprev) {
+            if (pindexWalk->RaiseValidity(BLOCK_VALID_SCRIPTS))
+                setDirtyBlockIndex.insert(pindexWalk);
+        }
+        pindex->nChainTx = metadata.nChainTx;
+        pindexSnapshotBase = pindex;
+        chainActive.SetTip(pindex);
+        setBlockIndexCandidates.insert(pindex);
+        PruneBlockIndexCandidates();
+
+        CValidationState state;
+        if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+            strError = strprintf(_("Failed to write UTXO snapshot to disk: %s"), FormatStateMessage(state));
+            return false;
+        }
+        if (!pblocktree->WriteSnapshotBase(metadata.hashBlock, metadata.nChainTx, metadata.hashSerialized) || !pblocktree->WriteFlag("snapshotloading", false)) {
+            strError = _("Failed to write to block index database");
+            return false;
+        }
+        LogPrintf("%s: loaded %u coins, new tip %s height=%d\n", __func__, stats.nTransactionOutputs, pindex->GetBlockHash().ToString(), pindex->nHeight);
+    } catch (const std::exception& e) {
+        strError = strprintf(_("Error reading UTXO snapshot: %s"), e.what());
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+/**
+ * Write the background chainstate. The block index goes first, so that it always has the data
+ * of the blocks the chainstate includes; the active chainstate and its cache are left alone.
+ */
+bool FlushSnapshotValidation()
+{
+    {
+        LOCK2(cs_main, cs_LastBlockFile);
+        CValidationState state;
+        if (!WriteBlockIndex(state))
+            return false;
+    }
+    if (!pcoinsSnapshotValidation->Flush())
+        return AbortNode("Failed to write to the snapshot validation coin database");
+    return true;
+}
+
+/** The snapshot does not match the chain: keep the node from starting on it again */
+void InvalidSnapshot(const std::string& strReason)
+{
+    pblocktree->WriteFlag("snapshotinvalid", true);
+    AbortNode(strprintf("UTXO snapshot validation failed: %s", strReason),
+              _("The UTXO snapshot this node was started from is invalid. Restart with -reindex to download and validate the full block chain."));
+}
+
+/** Compare the background chainstate, now at the snapshot base, with the snapshot and link up the blocks below it */
+void CompleteSnapshotValidation()
+{
+    if (!FlushSnapshotValidation())
+        return;
+
+    uint256 hashBase, hashExpected;
+    uint64_t nChainTxExpected;
+    if (!pblocktree->ReadSnapshotBase(hashBase, nChainTxExpected, hashExpected)) {
+        AbortNode("Failed to read the UTXO snapshot base from the block index database");
+        return;
+    }
+    CCoinsStats stats;
+    std::unique_ptr<CCoinsViewCursor> pcursor(pcoinsSnapshotValidationDB->Cursor());
+    CCoinsStatsBuilder builder(stats, pcursor->GetBestBlock());
+    for (; pcursor->Valid(); pcursor->Next()) {
+        {
+            std::lock_guard<std::mutex> lock(mutexSnapshotValidation);
+            // Resumes from the flushed chainstate on the next start
+            if (fInterruptSnapshotValidation)
+                return;
+        }
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+            AbortNode("Failed to read the snapshot validation coin database");
+            return;
+        }
+        builder.Add(key, std::move(coin), pcursor->GetValueSize());
+    }
+    builder.Finalize();
+    pcursor.reset();
+    if (stats.hashSerialized != hashExpected) {
+        InvalidSnapshot(strprintf("the blocks up to %s produce a UTXO set hashing to %s, the snapshot's is %s", hashBase.ToString(), stats.hashSerialized.ToString(), hashExpected.ToString()));
+        return;
+    }
+
+    LOCK(cs_main);
+    std::vector<CBlockIndex*> vLink;
+    for (CBlockIndex* pindex = pindexSnapshotBase; pindex->pprev; pindex = pindex->pprev)
+        vLink.push_back(pindex);
+    uint64_t nChainTx = chainActive.Genesis()->nChainTx;
+    for (std::vector<CBlockIndex*>::reverse_iterator it = vLink.rbegin(); it != vLink.rend(); ++it) {
+        assert((*it)->nTx > 0);
+        nChainTx += (*it)->nTx;
+        if (*it != pindexSnapshotBase)
+            (*it)->nChainTx = nChainTx;
+    }
+    if (nChainTx != nChainTxExpected) {
+        InvalidSnapshot(strprintf("the blocks up to %s contain %u transactions, the snapshot claims %u", hashBase.ToString(), nChainTx, nChainTxExpected));
+        return;
+    }
+    fSnapshotValidated = true;
+    pindexSnapshotValidated = NULL;
+    if (!pblocktree->WriteFlag("snapshotvalidated", true)) {
+        AbortNode("Failed to write to block index database");
+        return;
+    }
+    LogPrintf("%s: UTXO snapshot at %s validated (%u transactions)\n", __func__, hashBase.ToString(), nChainTx);
+
+    pcoinsSnapshotValidation.reset();
+    pcoinsSnapshotValidationDB.reset();
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(GetDataDir() / "chainstate_snapshot", ec);
+}
+
+void ThreadSnapshotValidation()
+{
+    const CChainParams& chainparams = Params();
+    try {
+        while (true) {
+            uint64_t nReceived;
+            {
+                std::lock_guard<std::mutex> lock(mutexSnapshotValidation);
+                if (fInterruptSnapshotValidation)
+                    break;
+                nReceived = nSnapshotBlocksReceived;
+            }
+            CBlockIndex* pindexNext = NULL;
+            bool fHaveData = false;
+            BlockConnectRules rules;
+            {
+                LOCK(cs_main);
+                if (pindexSnapshotValidated != pindexSnapshotBase) {
+                    pindexNext = pindexSnapshotBase->GetAncestor(pindexSnapshotValidated->nHeight + 1);
+                    if (pindexNext->nStatus & BLOCK_FAILED_MASK) {
+                        InvalidSnapshot(strprintf("block %s below the snapshot base is invalid", pindexNext->GetBlockHash().ToString()));
+                        return;
+                    }
+                    fHaveData = pindexNext->nStatus & BLOCK_HAVE_DATA;
+                    if (fHaveData)
+                        rules = GetBlockConnectRules(pindexNext, chainparams);
+                }
+            }
+            if (!pindexNext) {
+                CompleteSnapshotValidation();
+                return;
+            }
+            if (!fHaveData) {
+                // Downloaded by net_processing from the peers' spare capacity
+                std::unique_lock<std::mutex> lock(mutexSnapshotValidation);
+                condSnapshotValidation.wait(lock, [nReceived] { return fInterruptSnapshotValidation || nSnapshotBlocksReceived != nReceived; });
+                continue;
+            }
+
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindexNext, chainparams.GetConsensus())) {
+                AbortNode(strprintf("Failed to read block %s for the snapshot validation", pindexNext->GetBlockHash().ToString()));
+                return;
+            }
+            // The background chainstate is private to this thread, so the block is
+            // connected without cs_main. Script checks use the shared queue only when
+            // the active chainstate isn't, and are performed inline otherwise.
+            CValidationState state;
+            bool fValid = CheckBlock(block, state, chainparams.GetConsensus(), false, false);
+            if (fValid) {
+                assert(pcoinsSnapshotValidation->GetBestBlock() == pindexNext->pprev->GetBlockHash());
+                CBlockUndo blockundo;
+                int nInputs;
+                CCheckQueueControl<CScriptCheck> control(rules.fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL, true);
+                // Historical signatures would only push the mempool's out of the caches
+                fValid = ConnectBlockTransactions(block, state, pindexNext, *pcoinsSnapshotValidation, chainparams, rules, false, control, blockundo, nInputs);
+                if (!control.Wait() && fValid)
+                    fValid = state.DoS(100, false);
+            }
+            if (!fValid) {
+                if (state.IsError())
+                    AbortNode(strprintf("Snapshot validation failed to connect block %s", pindexNext->GetBlockHash().ToString()));
+                else
+                    InvalidSnapshot(strprintf("block %s at height %d is invalid: %s", pindexNext->GetBlockHash().ToString(), pindexNext->nHeight, FormatStateMessage(state)));
+                return;
+            }
+            pcoinsSnapshotValidation->SetBestBlock(pindexNext->GetBlockHash());
+            {
+                LOCK(cs_main);
+                pindexSnapshotValidated = pindexNext;
+            }
+            if (pindexNext->nHeight % 10000 == 0)
+                LogPrintf("%s: validated up to height %d of %d\n", __func__, pindexNext->nHeight, pindexSnapshotBase->nHeight);
+            if (pcoinsSnapshotValidation->DynamicMemoryUsage() > nSnapshotValidationCacheUsage && !FlushSnapshotValidation())
+                return;
+        }
+        FlushSnapshotValidation();
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
+}
+
+} // anon namespace
+
+void StartSnapshotValidation(size_t nCoinDBCache, size_t nCoinCacheUsage)
+{
+    LOCK(cs_main);
+    if (!pindexSnapshotBase || fSnapshotValidated)
+        return;
+
+    pcoinsSnapshotValidationDB.reset(new CCoinsViewDB(nCoinDBCache, false, false, "chainstate_snapshot"));
+    uint256 hashBest = pcoinsSnapshotValidationDB->GetBestBlock();
+    BlockMap::iterator it = mapBlockIndex.find(hashBest);
+    if (it != mapBlockIndex.end() && pindexSnapshotBase->GetAncestor(it->second->nHeight) == it->second) {
+        pindexSnapshotValidated = it->second;
+    } else {
+        if (!hashBest.IsNull()) {
+            LogPrintf("%s: snapshot validation chainstate at unknown block %s, starting over\n", __func__, hashBest.ToString());
+            pcoinsSnapshotValidationDB.reset();
+            pcoinsSnapshotValidationDB.reset(new CCoinsViewDB(nCoinDBCache, false, true, "chainstate_snapshot"));
+        }
+        pindexSnapshotValidated = chainActive.Genesis();
+    }
+    pcoinsSnapshotValidation.reset(new CCoinsViewCache(pcoinsSnapshotValidationDB.get()));
+    pcoinsSnapshotValidation->SetBestBlock(pindexSnapshotValidated->GetBlockHash());
+    nSnapshotValidationCacheUsage = nCoinCacheUsage;
+    fInterruptSnapshotValidation = false;
+    LogPrintf("Validating the blocks below the UTXO snapshot base in the background, from height %d to %d\n", pindexSnapshotValidated->nHeight, pindexSnapshotBase->nHeight);
+    threadSnapshotValidation = std::thread(&TraceThread<std::function<void()> >, "snapshotval", std::function<void()>(&ThreadSnapshotValidation));
+}
+
+void InterruptSnapshotValidation()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutexSnapshotValidation);
+        fInterruptSnapshotValidation = true;
+    }
+    condSnapshotValidation.notify_all();
+}
+
+void StopSnapshotValidation()
+{
+    InterruptSnapshotValidation();
+    if (threadSnapshotValidation.joinable())
+        threadSnapshotValidation.join();
+
+    {
+        LOCK(cs_main);
+        pindexSnapshotValidated = NULL;
+    }
+    pcoinsSnapshotValidation.reset();
+    pcoinsSnapshotValidationDB.reset();
+}
+
 void static CheckBlockIndex(const Consensus::Params& consensusParams)
 {
     if (!fCheckBlockIndex) {
@@ -4069,9 +5253,11 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
     CBlockIndex* pindexFirstNotScriptsValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
     while (pindex != NULL) {
         nNodes++;
+        // Blocks up to the base of a UTXO snapshot are valid without having had data, until the background validation links them.
+        bool fAssumed = IsAssumedBySnapshot(pindex);
         if (pindexFirstInvalid == NULL && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
-        if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
-        if (pindexFirstNeverProcessed == NULL && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
+        if (pindexFirstMissing == NULL && !fAssumed && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
+        if (pindexFirstNeverProcessed == NULL && !fAssumed && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
         if (pindex->pprev != NULL && pindexFirstNotTreeValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotTransactionsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexFirstNotTransactionsValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
@@ -4095,10 +5281,15 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
             if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
         }
         if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
-        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
-        // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
-        assert((pindexFirstNeverProcessed != NULL) == (pindex->nChainTx == 0)); // nChainTx != 0 is used to signal that all parent blocks have been processed (but may have been pruned).
-        assert((pindexFirstNotTransactionsValid != NULL) == (pindex->nChainTx == 0));
+        if (!fAssumed) {
+            assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
+            // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
+            assert((pindexFirstNeverProcessed != NULL) == (pindex->nChainTx == 0)); // nChainTx != 0 is used to signal that all parent blocks have been processed (but may have been pruned).
+            assert((pindexFirstNotTransactionsValid != NULL) == (pindex->nChainTx == 0));
+        } else {
+            // Only the snapshot base knows how many transactions lead up to it.
+            assert((pindex == pindexSnapshotBase) == (pindex->nChainTx != 0));
+        }
         assert(pindex->nHeight == nHeight); // nHeight must be consistent.
         assert(pindex->pprev == NULL || pindex->nChainWork >= pindex->pprev->nChainWork); // For every block except the genesis block, the chainwork must be larger than the parent's.
         assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight))); // The pskip pointer must point back for all but the first 2 blocks.
@@ -34,8 +34,10 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CBloomFilter;
 class CChainParams;
+class CCoinsViewPrefetch;
 class CInv;
 class CConnman;
 class CScriptCheck;
@@ -80,8 +82,14 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Number of blocks that can be requested at any given time from a single peer. During block download
+ *  this is only the starting point, see MIN/MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds for the number of blocks in flight from a peer, scaled to how fast it delivers them. */
+static const int MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 128;
+/** Time in seconds it should take a peer to deliver the blocks we have in flight from it. */
+static const int64_t BLOCK_DOWNLOAD_BUFFER_TIME = 4;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -97,6 +105,10 @@ static const int MAX_BLOCKTXN_DEPTH = 10;
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
  *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Upper bound of the block download window, which grows beyond BLOCK_DOWNLOAD_WINDOW when blocks are
+ *  validated faster than BLOCK_DOWNLOAD_WINDOW per BLOCK_DOWNLOAD_WINDOW_TIME seconds. */
+static const unsigned int MAX_BLOCK_DOWNLOAD_WINDOW = 8192;
+static const unsigned int BLOCK_DOWNLOAD_WINDOW_TIME = 10;
 /** Time to wait (in seconds) between writing blocks/block index to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
@@ -130,6 +142,8 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+static const bool DEFAULT_ADDRESSINDEX = false;
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 /** Default for -mempoolreplacement */
@@ -144,6 +158,7 @@ static const unsigned int MAX_BLOCKS_TO_ANNOUNCE = 8;
 static const int MAX_UNCONNECTING_HEADERS = 10;
 
 static const bool DEFAULT_PEERBLOOMFILTERS = true;
+static const bool DEFAULT_PEERBLOCKFILTERS = false;
 
 struct BlockHasher
 {
@@ -165,6 +180,7 @@ extern std::atomic_bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fAddressIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
@@ -184,6 +200,13 @@ extern uint256 hashAssumeValid;
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex *pindexBestHeader;
 
+/** Base block of the UTXO snapshot the chainstate was started from, if any. */
+extern CBlockIndex *pindexSnapshotBase;
+/** Whether the blocks up to pindexSnapshotBase were validated and found to produce the snapshot's UTXO set. */
+extern bool fSnapshotValidated;
+/** Last block below the snapshot base connected by the background validation, while it runs. */
+extern CBlockIndex *pindexSnapshotValidated;
+
 /** Minimum disk space required - used in CheckDiskSpace() */
 static const uint64_t nMinDiskSpace = 52428800;
 
@@ -245,6 +268,52 @@ bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, CValidationS
 
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
+/** Magic bytes at the start of a UTXO snapshot file */
+static const char SNAPSHOT_MAGIC[5] = {'u', 't', 'x', 'o', '\xff'};
+
+/**
+ * Header of a UTXO snapshot file. It is followed by the block headers from height 1
+ * up to hashBlock (preceded by their count), and then by nCoins (COutPoint, Coin)
+ * pairs in database order.
+ */
+class CUTXOSnapshotMetadata
+{
+public:
+    static const uint16_t CURRENT_VERSION = 1;
+
+    uint16_t nVersion;
+    CMessageHeader::MessageStartChars pchMessageStart;
+    //! Block at which the snapshot was taken
+    uint256 hashBlock;
+    //! Number of transactions in the chain up to and including hashBlock
+    uint64_t nChainTx;
+    uint64_t nCoins;
+    //! gettxoutsetinfo's hash_serialized for the coins in the snapshot
+    uint256 hashSerialized;
+
+    CUTXOSnapshotMetadata() : nVersion(CURRENT_VERSION), nChainTx(0), nCoins(0)
+    {
+        memset(pchMessageStart, 0, sizeof(pchMessageStart));
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        s.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        s << nVersion << FLATDATA(pchMessageStart) << hashBlock << nChainTx << nCoins << hashSerialized;
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        char magic[sizeof(SNAPSHOT_MAGIC)];
+        s.read(magic, sizeof(magic));
+        if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)))
+            throw std::ios_base::failure("Not a UTXO snapshot file");
+        s >> nVersion >> FLATDATA(pchMessageStart) >> hashBlock >> nChainTx >> nCoins >> hashSerialized;
+    }
+};
+
 /** Open a block file (blk?????.dat) */
 FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Open an undo file (rev?????.dat) */
@@ -253,6 +322,26 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = NULL);
+/**
+ * Load a UTXO snapshot written by dumptxoutset into an empty chainstate and make
+ * its base block the tip. The coins must match the snapshot's hash_serialized
+ * commitment, which must equal hashExpected or, if that is null, the hash
+ * chainparams trusts for the snapshot's base block. Blocks below the base are
+ * assumed valid until the background validation has checked them.
+ */
+bool LoadUTXOSnapshot(const CChainParams& chainparams, const boost::filesystem::path& path, const uint256& hashExpected, std::string& strError);
+/**
+ * Validate the blocks up to the UTXO snapshot base in a background thread, on a
+ * separate chainstate built from genesis, as they are downloaded. Once it reaches
+ * the base its UTXO set must hash to the snapshot's hash_serialized; if it does
+ * not, or a block turns out invalid, the node shuts down and requires -reindex.
+ * Does nothing without an unvalidated snapshot. Must be called after the block
+ * index is loaded.
+ */
+void StartSnapshotValidation(size_t nCoinDBCache, size_t nCoinCacheUsage);
+void InterruptSnapshotValidation();
+/** Stop the background validation and persist its progress. */
+void StopSnapshotValidation();
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk */
@@ -261,6 +350,34 @@ bool LoadBlockIndex(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the transaction hashing thread */
+void ThreadTxHash();
+
+/** Minimum number of transactions in a block for their hashes to be computed in parallel */
+static const size_t MIN_PARALLEL_TX_HASH = 64;
+
+/**
+ * Turn the parsed transactions of a block into vtxOut. Creating a transaction
+ * computes its txid and witness hash, which is spread over the transaction
+ * hashing threads when there are enough transactions and no other block is
+ * using them. vtx is left in a moved-from state.
+ */
+void BuildBlockTransactions(std::vector<CMutableTransaction>& vtx, std::vector<CTransactionRef>& vtxOut);
+
+/**
+ * Deserialize a block, equivalent to s >> block but with the transaction
+ * hashes computed in parallel. Meant for blocks received from peers, which
+ * are on the critical path of validation; other readers, such as
+ * ReadBlockFromDisk, deserialize plainly rather than share the threads.
+ */
+template <typename Stream>
+void UnserializeBlock(Stream& s, CBlock& block)
+{
+    s >> static_cast<CBlockHeader&>(block);
+    std::vector<CMutableTransaction> vtx;
+    s >> vtx;
+    BuildBlockTransactions(vtx, block.vtx);
+}
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -327,6 +444,20 @@ bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced = NULL,
                         bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
 
+/**
+ * Verify the scripts of a batch of loose transactions in parallel, so that the
+ * AcceptToMemoryPool calls that follow find their signatures in the signature
+ * cache. This does not accept anything and has no effect on the outcome of
+ * AcceptToMemoryPool. Only transactions that pass the policy checks
+ * AcceptToMemoryPool runs before script verification are verified; others,
+ * replacements and those whose inputs are unavailable are skipped. The scripts
+ * are checked on the script verification threads; while those are busy with a
+ * block nothing is verified. The hashes of transactions whose scripts failed
+ * are appended to pvFailed. Must be called without holding cs_main. Returns
+ * the number of transactions verified.
+ */
+size_t PreverifyTransactions(CTxMemPool& pool, const std::vector<CTransactionRef>& txs, std::vector<uint256>* pvFailed = NULL);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -364,10 +495,12 @@ int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& i
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
- * instead of being performed inline.
+ * instead of being performed inline. nSpendHeight is the height of the spending block; if it is
+ * -1 it is looked up from the view's best block, which takes cs_main.
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                 unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = NULL);
+                 unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = NULL,
+                 int nSpendHeight = -1);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
@@ -445,8 +578,8 @@ private:
 
 public:
     CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
+        scriptPubKey(outIn.scriptPubKey), amount(outIn.nValue),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
@@ -470,6 +603,10 @@ public:
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read a block as stored on disk (witness serialization), without deserializing it */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -485,9 +622,10 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const Co
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons).
+ *  With fJustCheck, script results are stored in the caches unless fCacheResults is false. */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins,
-                  const CChainParams& chainparams, bool fJustCheck = false);
+                  const CChainParams& chainparams, bool fJustCheck = false, bool fCacheResults = true);
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
@@ -504,6 +642,9 @@ bool IsWitnessEnabled(const CBlockIndex* pindexPrev, const Consensus::Params& pa
 /** Check whether 2Mb blocks are enabled for block. */
 bool Is2MbBlocksEnabled(const CBlockIndex* pindexPrev, const Consensus::Params& params);
 
+/** Bring the -addressindex back in step with the active chain after an unclean shutdown, using the block and undo data */
+bool ReplayAddressIndex(const CChainParams& params);
+
 /** When there are blocks in the active chain with missing data, rewind the chainstate and remove them from the block index */
 bool RewindBlockIndex(const CChainParams& params);
 
@@ -542,6 +683,9 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** The coins prefetching layer below pcoinsTip, NULL if -prefetchthreads=0 (protected by cs_main) */
+extern CCoinsViewPrefetch *pcoinsPrefetch;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
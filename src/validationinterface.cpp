@@ -5,6 +5,16 @@
 
 #include "validationinterface.h"
 
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "scheduler.h"
+
+#include <chrono>
+#include <future>
+#include <map>
+#include <mutex>
+#include <vector>
+
 static CMainSignals g_signals;
 
 CMainSignals& GetMainSignals()
@@ -12,41 +22,144 @@ CMainSignals& GetMainSignals()
     return g_signals;
 }
 
-void RegisterValidationInterface(CValidationInterface* pwalletIn) {
-    g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2, _3));
-    g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
-    g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
-    g_signals.SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
-    g_signals.Inventory.connect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
-    g_signals.Broadcast.connect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1, _2));
-    g_signals.BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
-    g_signals.ScriptForMining.connect(boost::bind(&CValidationInterface::GetScriptForMining, pwalletIn, _1));
-    g_signals.BlockFound.connect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
-    g_signals.NewPoWValidBlock.connect(boost::bind(&CValidationInterface::NewPoWValidBlock, pwalletIn, _1, _2));
+namespace {
+
+/** Signal connections of one listener, and the queue its callbacks go through if it is queued */
+struct CListenerConnections
+{
+    std::vector<boost::signals2::connection> connections;
+    std::shared_ptr<SingleThreadedSchedulerClient> queue;
+};
+
+}
+
+static std::mutex cs_listeners;
+static std::map<CValidationInterface*, CListenerConnections> mapListeners;
+static CScheduler* pBackgroundScheduler = NULL;
+
+static void DisconnectListener(CListenerConnections& listener)
+{
+    for (boost::signals2::connection& connection : listener.connections)
+        connection.disconnect();
+    if (listener.queue)
+        listener.queue->EmptyQueue();
+}
+
+void RegisterValidationInterface(CValidationInterface* pwalletIn, bool fQueued) {
+    std::lock_guard<std::mutex> lock(cs_listeners);
+    CListenerConnections& listener = mapListeners[pwalletIn];
+    if (fQueued)
+        listener.queue = std::make_shared<SingleThreadedSchedulerClient>(pBackgroundScheduler);
+
+    std::shared_ptr<SingleThreadedSchedulerClient> queue = listener.queue;
+    auto dispatch = [queue](CScheduler::Function f) {
+        if (queue) {
+            queue->AddToProcessQueue(std::move(f));
+        } else {
+            f();
+        }
+    };
+    std::vector<boost::signals2::connection>& c = listener.connections;
+    c.push_back(g_signals.UpdatedBlockTip.connect([=](const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload) {
+        dispatch([=] { pwalletIn->UpdatedBlockTip(pindexNew, pindexFork, fInitialDownload); });
+    }));
+    c.push_back(g_signals.SyncTransaction.connect([=](const CTransactionRef& ptx, const CBlockIndex* pindex, int posInBlock) {
+        dispatch([=] { pwalletIn->SyncTransaction(*ptx, pindex, posInBlock); });
+    }));
+    c.push_back(g_signals.BlockConnected.connect([=](const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex) {
+        dispatch([=] { pwalletIn->BlockConnected(block, pindex); });
+    }));
+    c.push_back(g_signals.UpdatedTransaction.connect([=](const uint256& hash) {
+        dispatch([=] { pwalletIn->UpdatedTransaction(hash); });
+    }));
+    c.push_back(g_signals.SetBestChain.connect([=](const CBlockLocator& locator) {
+        dispatch([=] { pwalletIn->SetBestChain(locator); });
+    }));
+    c.push_back(g_signals.Inventory.connect([=](const uint256& hash) {
+        dispatch([=] { pwalletIn->Inventory(hash); });
+    }));
+    c.push_back(g_signals.Broadcast.connect([=](int64_t nBestBlockTime, CConnman* connman) {
+        dispatch([=] { pwalletIn->ResendWalletTransactions(nBestBlockTime, connman); });
+    }));
+    c.push_back(g_signals.BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2)));
+    c.push_back(g_signals.ScriptForMining.connect(boost::bind(&CValidationInterface::GetScriptForMining, pwalletIn, _1)));
+    c.push_back(g_signals.BlockFound.connect([=](const uint256& hash) {
+        dispatch([=] { pwalletIn->ResetRequestCount(hash); });
+    }));
+    c.push_back(g_signals.NewPoWValidBlock.connect([=](const CBlockIndex* pindex, const std::shared_ptr<const CBlock>& block) {
+        dispatch([=] { pwalletIn->NewPoWValidBlock(pindex, block); });
+    }));
 }
 
 void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
-    g_signals.BlockFound.disconnect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
-    g_signals.ScriptForMining.disconnect(boost::bind(&CValidationInterface::GetScriptForMining, pwalletIn, _1));
-    g_signals.BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
-    g_signals.Broadcast.disconnect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1, _2));
-    g_signals.Inventory.disconnect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
-    g_signals.SetBestChain.disconnect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
-    g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
-    g_signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
-    g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2, _3));
-    g_signals.NewPoWValidBlock.disconnect(boost::bind(&CValidationInterface::NewPoWValidBlock, pwalletIn, _1, _2));
+    CListenerConnections listener;
+    {
+        std::lock_guard<std::mutex> lock(cs_listeners);
+        std::map<CValidationInterface*, CListenerConnections>::iterator it = mapListeners.find(pwalletIn);
+        if (it == mapListeners.end())
+            return;
+        listener = std::move(it->second);
+        mapListeners.erase(it);
+    }
+    DisconnectListener(listener);
 }
 
 void UnregisterAllValidationInterfaces() {
-    g_signals.BlockFound.disconnect_all_slots();
-    g_signals.ScriptForMining.disconnect_all_slots();
-    g_signals.BlockChecked.disconnect_all_slots();
-    g_signals.Broadcast.disconnect_all_slots();
-    g_signals.Inventory.disconnect_all_slots();
-    g_signals.SetBestChain.disconnect_all_slots();
-    g_signals.UpdatedTransaction.disconnect_all_slots();
-    g_signals.SyncTransaction.disconnect_all_slots();
-    g_signals.UpdatedBlockTip.disconnect_all_slots();
-    g_signals.NewPoWValidBlock.disconnect_all_slots();
+    std::map<CValidationInterface*, CListenerConnections> listeners;
+    {
+        std::lock_guard<std::mutex> lock(cs_listeners);
+        listeners.swap(mapListeners);
+    }
+    for (auto& entry : listeners)
+        DisconnectListener(entry.second);
+}
+
+void RegisterBackgroundSignalScheduler(CScheduler& scheduler) {
+    std::lock_guard<std::mutex> lock(cs_listeners);
+    pBackgroundScheduler = &scheduler;
+}
+
+void UnregisterBackgroundSignalScheduler() {
+    std::lock_guard<std::mutex> lock(cs_listeners);
+    pBackgroundScheduler = NULL;
+}
+
+static std::vector<std::shared_ptr<SingleThreadedSchedulerClient> > GetListenerQueues()
+{
+    std::vector<std::shared_ptr<SingleThreadedSchedulerClient> > queues;
+    std::lock_guard<std::mutex> lock(cs_listeners);
+    for (const auto& entry : mapListeners) {
+        if (entry.second.queue)
+            queues.push_back(entry.second.queue);
+    }
+    return queues;
+}
+
+/** Whether the background scheduler still runs the callbacks queued for listeners */
+static bool IsBackgroundSchedulerRunning()
+{
+    std::lock_guard<std::mutex> lock(cs_listeners);
+    return pBackgroundScheduler && pBackgroundScheduler->AreThreadsServicingQueue();
+}
+
+void FlushBackgroundCallbacks() {
+    for (const auto& queue : GetListenerQueues())
+        queue->EmptyQueue();
+}
+
+void SyncWithValidationInterfaceQueue() {
+    std::vector<std::future<void> > done;
+    for (const auto& queue : GetListenerQueues()) {
+        std::shared_ptr<std::promise<void> > promise = std::make_shared<std::promise<void> >();
+        done.push_back(promise->get_future());
+        queue->AddToProcessQueue([promise] { promise->set_value(); });
+    }
+    for (std::future<void>& future : done) {
+        // The scheduler stops at shutdown, before the RPC server does; run what
+        // it left behind on this thread instead of waiting for it forever
+        while (future.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+            if (!IsBackgroundSchedulerRunning())
+                FlushBackgroundCallbacks();
+        }
+    }
 }
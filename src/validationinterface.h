@@ -16,6 +16,7 @@ struct CBlockLocator;
 class CBlockIndex;
 class CConnman;
 class CReserveScript;
+class CScheduler;
 class CTransaction;
 class CValidationInterface;
 class CValidationState;
@@ -23,17 +24,39 @@ class uint256;
 
 // These functions dispatch to one or all registered wallets
 
-/** Register a wallet to receive updates from core */
-void RegisterValidationInterface(CValidationInterface* pwalletIn);
-/** Unregister a wallet from core */
+/**
+ * Register a wallet to receive updates from core.
+ *
+ * Queued listeners receive their callbacks in order on the background
+ * scheduler instead of on the notifying thread, which is typically holding
+ * cs_main. GetScriptForMining and BlockChecked are always called directly,
+ * as they return a result or borrow the block. Without a background
+ * scheduler, queued listeners are called directly as well.
+ */
+void RegisterValidationInterface(CValidationInterface* pwalletIn, bool fQueued = false);
+/** Unregister a wallet from core, delivering its queued callbacks first */
 void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister all wallets from core */
 void UnregisterAllValidationInterfaces();
+/** Use a scheduler for the callbacks of queued listeners registered from now on */
+void RegisterBackgroundSignalScheduler(CScheduler& scheduler);
+/** Stop using the background scheduler for listeners registered from now on */
+void UnregisterBackgroundSignalScheduler();
+/** Run all queued callbacks on the calling thread, for when the scheduler is no longer serviced */
+void FlushBackgroundCallbacks();
+/**
+ * Wait until every callback queued so far has run, so that listeners
+ * reflect all validation changes made before the call. Once the background
+ * scheduler has stopped, the callbacks run on the calling thread. Must not be
+ * called with cs_main held, as the callbacks may need it.
+ */
+void SyncWithValidationInterfaceQueue();
 
 class CValidationInterface {
 protected:
     virtual void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlockIndex *pindex, int posInBlock) {}
+    virtual void BlockConnected(const std::shared_ptr<const CBlock> &block, const CBlockIndex *pindex) {}
     virtual void SetBestChain(const CBlockLocator &locator) {}
     virtual void UpdatedTransaction(const uint256 &hash) {}
     virtual void Inventory(const uint256 &hash) {}
@@ -42,7 +65,7 @@ protected:
     virtual void GetScriptForMining(boost::shared_ptr<CReserveScript>&) {};
     virtual void ResetRequestCount(const uint256 &hash) {};
     virtual void NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& block) {};
-    friend void ::RegisterValidationInterface(CValidationInterface*);
+    friend void ::RegisterValidationInterface(CValidationInterface*, bool);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
 };
@@ -60,7 +83,9 @@ struct CMainSignals {
      * transaction was accepted to mempool, removed from mempool (only when
      * removal was due to conflict from connected block), or appeared in a
      * disconnected block.*/
-    boost::signals2::signal<void (const CTransaction &, const CBlockIndex *pindex, int posInBlock)> SyncTransaction;
+    boost::signals2::signal<void (const std::shared_ptr<const CTransaction> &, const CBlockIndex *pindex, int posInBlock)> SyncTransaction;
+    /** Notifies listeners of a block connected to the active chain, after its transactions were notified. */
+    boost::signals2::signal<void (const std::shared_ptr<const CBlock> &, const CBlockIndex *pindex)> BlockConnected;
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
     boost::signals2::signal<void (const uint256 &)> UpdatedTransaction;
     /** Notifies listeners of a new active block chain. */
@@ -3103,54 +3103,54 @@ extern UniValue importmulti(const JSONRPCRequest& request);
 static const CRPCCommand commands[] =
 { //  category              name                        actor (function)           okSafeMode
     //  --------------------- ------------------------    -----------------------    ----------
-    { "rawtransactions",    "fundrawtransaction",       &fundrawtransaction,       false,  {"hexstring","options"} },
-    { "hidden",             "resendwallettransactions", &resendwallettransactions, true,   {} },
-    { "wallet",             "abandontransaction",       &abandontransaction,       false,  {"txid"} },
-    { "wallet",             "addmultisigaddress",       &addmultisigaddress,       true,   {"nrequired","keys","account"} },
-    { "wallet",             "addwitnessaddress",        &addwitnessaddress,        true,   {"address"} },
-    { "wallet",             "backupwallet",             &backupwallet,             true,   {"destination"} },
-    { "wallet",             "bumpfee",                  &bumpfee,                  true,   {"txid", "options"} },
-    { "wallet",             "dumpprivkey",              &dumpprivkey,              true,   {"address"}  },
-    { "wallet",             "dumpwallet",               &dumpwallet,               true,   {"filename"} },
-    { "wallet",             "encryptwallet",            &encryptwallet,            true,   {"passphrase"} },
-    { "wallet",             "getaccountaddress",        &getaccountaddress,        true,   {"account"} },
-    { "wallet",             "getaccount",               &getaccount,               true,   {"address"} },
-    { "wallet",             "getaddressesbyaccount",    &getaddressesbyaccount,    true,   {"account"} },
-    { "wallet",             "getbalance",               &getbalance,               false,  {"account","minconf","include_watchonly"} },
-    { "wallet",             "getnewaddress",            &getnewaddress,            true,   {"account"} },
-    { "wallet",             "getrawchangeaddress",      &getrawchangeaddress,      true,   {} },
-    { "wallet",             "getreceivedbyaccount",     &getreceivedbyaccount,     false,  {"account","minconf"} },
-    { "wallet",             "getreceivedbyaddress",     &getreceivedbyaddress,     false,  {"address","minconf"} },
-    { "wallet",             "gettransaction",           &gettransaction,           false,  {"txid","include_watchonly"} },
-    { "wallet",             "getunconfirmedbalance",    &getunconfirmedbalance,    false,  {} },
-    { "wallet",             "getwalletinfo",            &getwalletinfo,            false,  {} },
-    { "wallet",             "importmulti",              &importmulti,              true,   {"requests","options"} },
-    { "wallet",             "importprivkey",            &importprivkey,            true,   {"privkey","label","rescan"} },
-    { "wallet",             "importwallet",             &importwallet,             true,   {"filename"} },
-    { "wallet",             "importaddress",            &importaddress,            true,   {"address","label","rescan","p2sh"} },
-    { "wallet",             "importprunedfunds",        &importprunedfunds,        true,   {"rawtransaction","txoutproof"} },
-    { "wallet",             "importpubkey",             &importpubkey,             true,   {"pubkey","label","rescan"} },
-    { "wallet",             "keypoolrefill",            &keypoolrefill,            true,   {"newsize"} },
-    { "wallet",             "listaccounts",             &listaccounts,             false,  {"minconf","include_watchonly"} },
-    { "wallet",             "listaddressgroupings",     &listaddressgroupings,     false,  {} },
-    { "wallet",             "listlockunspent",          &listlockunspent,          false,  {} },
-    { "wallet",             "listreceivedbyaccount",    &listreceivedbyaccount,    false,  {"minconf","include_empty","include_watchonly"} },
-    { "wallet",             "listreceivedbyaddress",    &listreceivedbyaddress,    false,  {"minconf","include_empty","include_watchonly"} },
-    { "wallet",             "listsinceblock",           &listsinceblock,           false,  {"blockhash","target_confirmations","include_watchonly"} },
-    { "wallet",             "listtransactions",         &listtransactions,         false,  {"account","count","skip","include_watchonly"} },
-    { "wallet",             "listunspent",              &listunspent,              false,  {"minconf","maxconf","addresses","include_unsafe"} },
-    { "wallet",             "lockunspent",              &lockunspent,              true,   {"unlock","transactions"} },
-    { "wallet",             "move",                     &movecmd,                  false,  {"fromaccount","toaccount","amount","minconf","comment"} },
-    { "wallet",             "sendfrom",                 &sendfrom,                 false,  {"fromaccount","toaddress","amount","minconf","comment","comment_to"} },
-    { "wallet",             "sendmany",                 &sendmany,                 false,  {"fromaccount","amounts","minconf","comment","subtractfeefrom"} },
-    { "wallet",             "sendtoaddress",            &sendtoaddress,            false,  {"address","amount","comment","comment_to","subtractfeefromamount"} },
-    { "wallet",             "setaccount",               &setaccount,               true,   {"address","account"} },
-    { "wallet",             "settxfee",                 &settxfee,                 true,   {"amount"} },
-    { "wallet",             "signmessage",              &signmessage,              true,   {"address","message"} },
-    { "wallet",             "walletlock",               &walletlock,               true,   {} },
-    { "wallet",             "walletpassphrasechange",   &walletpassphrasechange,   true,   {"oldpassphrase","newpassphrase"} },
-    { "wallet",             "walletpassphrase",         &walletpassphrase,         true,   {"passphrase","timeout"} },
-    { "wallet",             "removeprunedfunds",        &removeprunedfunds,        true,   {"txid"} },
+    { "rawtransactions",    "fundrawtransaction",       &fundrawtransaction,       false,  {"hexstring","options"}, true },
+    { "hidden",             "resendwallettransactions", &resendwallettransactions, true,   {}, true },
+    { "wallet",             "abandontransaction",       &abandontransaction,       false,  {"txid"}, true },
+    { "wallet",             "addmultisigaddress",       &addmultisigaddress,       true,   {"nrequired","keys","account"}, true },
+    { "wallet",             "addwitnessaddress",        &addwitnessaddress,        true,   {"address"}, true },
+    { "wallet",             "backupwallet",             &backupwallet,             true,   {"destination"}, true },
+    { "wallet",             "bumpfee",                  &bumpfee,                  true,   {"txid", "options"}, true },
+    { "wallet",             "dumpprivkey",              &dumpprivkey,              true,   {"address"}, true },
+    { "wallet",             "dumpwallet",               &dumpwallet,               true,   {"filename"}, true },
+    { "wallet",             "encryptwallet",            &encryptwallet,            true,   {"passphrase"}, true },
+    { "wallet",             "getaccountaddress",        &getaccountaddress,        true,   {"account"}, true },
+    { "wallet",             "getaccount",               &getaccount,               true,   {"address"}, true },
+    { "wallet",             "getaddressesbyaccount",    &getaddressesbyaccount,    true,   {"account"}, true },
+    { "wallet",             "getbalance",               &getbalance,               false,  {"account","minconf","include_watchonly"}, true },
+    { "wallet",             "getnewaddress",            &getnewaddress,            true,   {"account"}, true },
+    { "wallet",             "getrawchangeaddress",      &getrawchangeaddress,      true,   {}, true },
+    { "wallet",             "getreceivedbyaccount",     &getreceivedbyaccount,     false,  {"account","minconf"}, true },
+    { "wallet",             "getreceivedbyaddress",     &getreceivedbyaddress,     false,  {"address","minconf"}, true },
+    { "wallet",             "gettransaction",           &gettransaction,           false,  {"txid","include_watchonly"}, true },
+    { "wallet",             "getunconfirmedbalance",    &getunconfirmedbalance,    false,  {}, true },
+    { "wallet",             "getwalletinfo",            &getwalletinfo,            false,  {}, true },
+    { "wallet",             "importmulti",              &importmulti,              true,   {"requests","options"}, true },
+    { "wallet",             "importprivkey",            &importprivkey,            true,   {"privkey","label","rescan"}, true },
+    { "wallet",             "importwallet",             &importwallet,             true,   {"filename"}, true },
+    { "wallet",             "importaddress",            &importaddress,            true,   {"address","label","rescan","p2sh"}, true },
+    { "wallet",             "importprunedfunds",        &importprunedfunds,        true,   {"rawtransaction","txoutproof"}, true },
+    { "wallet",             "importpubkey",             &importpubkey,             true,   {"pubkey","label","rescan"}, true },
+    { "wallet",             "keypoolrefill",            &keypoolrefill,            true,   {"newsize"}, true },
+    { "wallet",             "listaccounts",             &listaccounts,             false,  {"minconf","include_watchonly"}, true },
+    { "wallet",             "listaddressgroupings",     &listaddressgroupings,     false,  {}, true },
+    { "wallet",             "listlockunspent",          &listlockunspent,          false,  {}, true },
+    { "wallet",             "listreceivedbyaccount",    &listreceivedbyaccount,    false,  {"minconf","include_empty","include_watchonly"}, true },
+    { "wallet",             "listreceivedbyaddress",    &listreceivedbyaddress,    false,  {"minconf","include_empty","include_watchonly"}, true },
+    { "wallet",             "listsinceblock",           &listsinceblock,           false,  {"blockhash","target_confirmations","include_watchonly"}, true },
+    { "wallet",             "listtransactions",         &listtransactions,         false,  {"account","count","skip","include_watchonly"}, true },
+    { "wallet",             "listunspent",              &listunspent,              false,  {"minconf","maxconf","addresses","include_unsafe"}, true },
+    { "wallet",             "lockunspent",              &lockunspent,              true,   {"unlock","transactions"}, true },
+    { "wallet",             "move",                     &movecmd,                  false,  {"fromaccount","toaccount","amount","minconf","comment"}, true },
+    { "wallet",             "sendfrom",                 &sendfrom,                 false,  {"fromaccount","toaddress","amount","minconf","comment","comment_to"}, true },
+    { "wallet",             "sendmany",                 &sendmany,                 false,  {"fromaccount","amounts","minconf","comment","subtractfeefrom"}, true },
+    { "wallet",             "sendtoaddress",            &sendtoaddress,            false,  {"address","amount","comment","comment_to","subtractfeefromamount"}, true },
+    { "wallet",             "setaccount",               &setaccount,               true,   {"address","account"}, true },
+    { "wallet",             "settxfee",                 &settxfee,                 true,   {"amount"}, true },
+    { "wallet",             "signmessage",              &signmessage,              true,   {"address","message"}, true },
+    { "wallet",             "walletlock",               &walletlock,               true,   {}, true },
+    { "wallet",             "walletpassphrasechange",   &walletpassphrasechange,   true,   {"oldpassphrase","newpassphrase"}, true },
+    { "wallet",             "walletpassphrase",         &walletpassphrase,         true,   {"passphrase","timeout"}, true },
+    { "wallet",             "removeprunedfunds",        &removeprunedfunds,        true,   {"txid"}, true },
 };
 
 void RegisterWalletRPCCommands(CRPCTable &t)
@@ -3653,7 +3653,7 @@ CWallet* CWallet::CreateWalletFromFile(const std::string walletFile)
 
     LogPrintf(" wallet      %15dms\n", GetTimeMillis() - nStart);
 
-    RegisterValidationInterface(walletInstance);
+    RegisterValidationInterface(walletInstance, true);
 
     CBlockIndex *pindexRescan = chainActive.Genesis();
     if (!GetBoolArg("-rescan", false))
@@ -3760,7 +3760,7 @@ void CWallet::postInitProcess(CScheduler& scheduler)
 
     // Run a thread to flush wallet periodically
     if (!CWallet::fFlushScheduled.exchange(true)) {
-        scheduler.scheduleEvery(MaybeCompactWalletDB, 500);
+        scheduler.scheduleEvery(MaybeCompactWalletDB, 500, CScheduler::PRIORITY_LOW);
     }
 }
 